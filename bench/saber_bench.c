@@ -0,0 +1,736 @@
+/*
+ * saber_bench: wall-clock timings of every kernel across band counts, pixel
+ * counts, batch layouts and thread counts, written as JSON.
+ *
+ *   saber_bench [--quick] [--accuracy exact|fast|both] [--threads 1,2,4]
+ *               [--min-time S] [--max-elems N] [--out FILE]
+ *               [--compare BASELINE] [--tolerance F]
+ *
+ * Single pixels go through the one-spectrum API; larger scenes through
+ * saber_scene_run() in both layouts, once per thread count. Each result is
+ * the best of three trials, a trial repeating the call until it has run
+ * for --min-time seconds. ns_per_band is per band and pixel (per band and
+ * library class for build_cache); gb_per_s counts the spectra each kernel
+ * reads and writes, not the cached tables.
+ *
+ * --compare matches results against a baseline written by an earlier run
+ * (by kernel, accuracy, bands, pixels, classes, layout and threads) and
+ * exits 1 when, for some kernel, the geometric mean of the new / baseline
+ * ns_per_band ratios exceeds 1 + tolerance (default 0.15). Cases the
+ * baseline lacks are listed, not failed; a baseline recorded on a
+ * single-thread machine ("hardware_threads": 1) therefore gates only
+ * the 1-thread cases. Baselines name the machine they come from.
+ */
+#include "saber.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+
+#define N_SRC       701         /* 300-1000 nm at 1 nm, as shipped libraries */
+#define N_PARAM     6
+#define N_MIX       3
+#define MAX_THREADS 16
+#define MAX_RESULTS 4096
+
+static const size_t bench_bands[]   = {10, 60, 250, 450};
+static const size_t bench_pixels[]  = {1, 100, 10000, 1000000};
+static const size_t bench_classes[] = {10, 100, 1000};
+
+static const char* param_names[N_PARAM] = {
+    "chl", "a_g_440", "bb_p_550", "a_nap_440", "a_g_s", "bb_p_gamma"
+};
+
+typedef struct bench_result {
+    char   kernel[24];
+    char   accuracy[8];
+    char   layout[8];
+    size_t bands, pixels, classes, threads;
+    double seconds;             /* best time per call */
+    double ns_per_band;
+    double gb_per_s;
+    double speedup;             /* vs one thread, same case */
+} bench_result;
+
+typedef struct bench_opts {
+    int    quick;
+    int    acc_lo, acc_hi;
+    size_t threads[MAX_THREADS];
+    size_t n_threads;
+    double min_time;
+    size_t max_elems;
+    const char* out;
+    const char* compare;
+    double tolerance;
+} bench_opts;
+
+static bench_result results[MAX_RESULTS];
+static size_t n_results;
+
+/*-------------------------------------------------------------*
+ *  Timing                                                     *
+ *-------------------------------------------------------------*/
+typedef int (*bench_fn)(void* arg);
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* Best of three trials of the mean time per call; -1 if a call fails */
+static double time_call(bench_fn fn, void* arg, double min_time)
+{
+    int rc = fn(arg);                               /* warm-up */
+    if (rc != 0 && rc != 4) return -1.0;
+
+    double best = INFINITY;
+    for (int trial = 0; trial < 3; trial++) {
+        size_t reps = 0;
+        double t0 = now_s(), t;
+        do {
+            fn(arg);
+            reps++;
+            t = now_s() - t0;
+        } while (t < min_time);
+        if (t / reps < best) best = t / reps;
+    }
+    return best;
+}
+
+static void record(const char* kernel, saber_accuracy acc, const char* layout,
+                   size_t bands, size_t pixels, size_t classes, size_t threads,
+                   double seconds, double bytes)
+{
+    if (n_results == MAX_RESULTS) return;
+    bench_result* r = &results[n_results++];
+    snprintf(r->kernel, sizeof(r->kernel), "%s", kernel);
+    snprintf(r->accuracy, sizeof(r->accuracy), "%s", acc == SABER_ACCURACY_FAST ? "fast" : "exact");
+    snprintf(r->layout, sizeof(r->layout), "%s", layout);
+    r->bands   = bands;
+    r->pixels  = pixels;
+    r->classes = classes;
+    r->threads = threads;
+    r->seconds = seconds;
+
+    double units = (double)bands * (pixels ? pixels : classes);
+    r->ns_per_band = 1e9 * seconds / units;
+    r->gb_per_s    = bytes / seconds * 1e-9;
+    r->speedup     = 1.0;
+    for (size_t k = n_results - 1; k-- > 0;) {
+        const bench_result* s = &results[k];
+        if (s->threads == 1 && s->bands == bands && s->pixels == pixels &&
+            strcmp(s->kernel, r->kernel) == 0 && strcmp(s->layout, r->layout) == 0 &&
+            strcmp(s->accuracy, r->accuracy) == 0) {
+            r->speedup = s->seconds / seconds;
+            break;
+        }
+    }
+
+    fprintf(stderr, "  %-16s %-5s %4zu bands %8zu px %-5s %2zu thr  %10.3f ns/band %8.3f GB/s  x%.2f\n",
+            r->kernel, r->accuracy, bands, pixels ? pixels : classes,
+            layout, threads, r->ns_per_band, r->gb_per_s, r->speedup);
+}
+
+/*-------------------------------------------------------------*
+ *  Synthetic tables and scenes                                *
+ *-------------------------------------------------------------*/
+static double frand(void)
+{
+    return (double)rand() / RAND_MAX;
+}
+
+static int load_library(saber_ctx* ctx, size_t n_class)
+{
+    double* wl = malloc(sizeof(double) * N_SRC * (4 + n_class));
+    const char** names = malloc(sizeof(char*) * n_class);
+    char* text = malloc(24 * n_class);
+    if (!wl || !names || !text) {
+        free(wl); free(names); free(text);
+        return 3;
+    }
+
+    double *aw = wl + N_SRC, *a0 = aw + N_SRC, *a1 = a0 + N_SRC, *rb = a1 + N_SRC;
+    for (size_t i = 0; i < N_SRC; i++) {
+        double x = (double)i / (N_SRC - 1);
+        wl[i] = 300.0 + i;
+        aw[i] = 0.005 + 2.5 * x * x * x * x;
+        a0[i] = 0.7 + 0.3 * sin(12.0 * x);
+        a1[i] = 0.05 + 0.02 * cos(9.0 * x);
+    }
+    for (size_t c = 0; c < n_class; c++) {
+        snprintf(text + 24 * c, 24, "class_%zu", c);
+        names[c] = text + 24 * c;
+        double level = 0.01 + 0.05 * frand(), slope = 0.05 * frand();
+        for (size_t i = 0; i < N_SRC; i++)
+            rb[c * N_SRC + i] = level + slope * i / N_SRC + 0.005 * sin(0.02 * i + c);
+    }
+
+    int rc = saber_ctx_load_pure_water(ctx, wl, aw, N_SRC);
+    if (!rc) rc = saber_ctx_load_a0_a1(ctx, wl, a0, a1, N_SRC);
+    if (!rc) rc = saber_ctx_load_r_rs_b(ctx, wl, names, rb, N_SRC, n_class);
+    free(wl);
+    free(names);
+    free(text);
+    return rc;
+}
+
+static void band_grid(double* wl, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        wl[i] = n == 1 ? 550.0 : 400.0 + 500.0 * i / (n - 1);
+}
+
+/* Per-pixel inputs and every spectrum cube, sized for the largest case */
+typedef struct bench_data {
+    double* params;             /* n_pix x N_PARAM */
+    double* fractions;          /* n_pix x N_MIX   */
+    double* h_w;
+    double *a, *bb, *r_b, *rrs, *r_b_out;
+} bench_data;
+
+static void data_free(bench_data* d)
+{
+    free(d->params);
+    free(d->fractions);
+    free(d->h_w);
+    free(d->a);
+    free(d->bb);
+    free(d->r_b);
+    free(d->rrs);
+    free(d->r_b_out);
+    memset(d, 0, sizeof(*d));
+}
+
+static int data_alloc(bench_data* d, size_t n_pix, size_t n_elems)
+{
+    memset(d, 0, sizeof(*d));
+    d->params    = malloc(sizeof(double) * n_pix * N_PARAM);
+    d->fractions = malloc(sizeof(double) * n_pix * N_MIX);
+    d->h_w       = malloc(sizeof(double) * n_pix);
+    d->a         = malloc(sizeof(double) * n_elems);
+    d->bb        = malloc(sizeof(double) * n_elems);
+    d->r_b       = malloc(sizeof(double) * n_elems);
+    d->rrs       = malloc(sizeof(double) * n_elems);
+    d->r_b_out   = malloc(sizeof(double) * n_elems);
+    if (!d->params || !d->fractions || !d->h_w || !d->a || !d->bb ||
+        !d->r_b || !d->rrs || !d->r_b_out) {
+        data_free(d);
+        return 3;
+    }
+
+    srand(7);
+    for (size_t p = 0; p < n_pix; p++) {
+        double* v = d->params + p * N_PARAM;
+        v[0] = pow(10.0, -1.5 + 2.0 * frand());    /* chl       */
+        v[1] = pow(10.0, -2.5 + 1.5 * frand());    /* a_g_440   */
+        v[2] = pow(10.0, -3.0 + 1.5 * frand());    /* bb_p_550  */
+        v[3] = pow(10.0, -2.5 + 1.5 * frand());    /* a_nap_440 */
+        v[4] = 0.012 + 0.008 * frand();
+        v[5] = frand();
+
+        double f0 = frand(), f1 = (1.0 - f0) * frand();
+        double* f = d->fractions + p * N_MIX;
+        f[0] = f0;
+        f[1] = f1;
+        f[2] = 1.0 - f0 - f1;
+        d->h_w[p] = 0.5 + 9.5 * frand();
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------*
+ *  Cases                                                      *
+ *-------------------------------------------------------------*/
+typedef struct build_arg {
+    saber_ctx* ctx;
+    const double* wl;
+    size_t n;
+} build_arg;
+
+static int run_build(void* p)
+{
+    build_arg* b = p;
+    return saber_ctx_build_cache(b->ctx, b->wl, b->n);
+}
+
+typedef struct single_arg {
+    const saber_ctx* ctx;
+    const double* wl;
+    size_t n;
+    const char** classes;
+    bench_data* d;
+    int shallow;
+} single_arg;
+
+static int run_iop_1(void* p)
+{
+    single_arg* s = p;
+    return saber_ctx_iop_from_oac(s->ctx, s->wl, s->n, param_names, s->d->params, N_PARAM,
+                                  s->d->a, s->d->bb);
+}
+
+static int run_lmm_1(void* p)
+{
+    single_arg* s = p;
+    return saber_ctx_compute_r_rs_b_lmm(s->ctx, s->classes, s->d->fractions, N_MIX, s->d->r_b);
+}
+
+static int run_forward_1(void* p)
+{
+    single_arg* s = p;
+    return saber_ctx_forward_am03(s->ctx, s->wl, s->d->a, s->d->bb, s->n, 2, 30.0, 10.0,
+                                  s->shallow, s->d->h_w[0], s->d->r_b, s->d->rrs);
+}
+
+static int run_retrieve_1(void* p)
+{
+    single_arg* s = p;
+    return saber_ctx_retrieve_r_rs_b_am03(s->ctx, s->wl, s->d->a, s->d->bb, s->d->rrs, s->n, 2,
+                                          30.0, 10.0, s->d->h_w[0], s->d->r_b_out);
+}
+
+typedef struct scene_arg {
+    const saber_ctx* ctx;
+    saber_scene scene;
+    size_t threads;
+} scene_arg;
+
+static int run_scene(void* p)
+{
+    scene_arg* s = p;
+    return saber_scene_run(s->ctx, &s->scene, s->threads, 0, NULL);
+}
+
+/* Bytes of spectra read and written per band and pixel */
+enum { KERNEL_IOP, KERNEL_LMM, KERNEL_DEEP, KERNEL_SHALLOW, KERNEL_RETRIEVE, N_KERNEL };
+static const char*  kernel_names[N_KERNEL] = {
+    "iop_from_oac", "r_rs_b_lmm", "forward_deep", "forward_shallow", "retrieve_r_rs_b"
+};
+static const double kernel_bytes[N_KERNEL] = {16, 8, 24, 32, 32};
+
+static int bench_single(const saber_ctx* ctx, const double* wl, size_t n, const char** classes,
+                        bench_data* d, saber_accuracy acc, double min_time)
+{
+    single_arg s = {ctx, wl, n, classes, d, 0};
+    bench_fn fns[N_KERNEL] = {run_iop_1, run_lmm_1, run_forward_1, run_forward_1, run_retrieve_1};
+
+    for (int k = 0; k < N_KERNEL; k++) {
+        s.shallow = k != KERNEL_DEEP;
+        double t = time_call(fns[k], &s, min_time);
+        if (t < 0) return 1;
+        record(kernel_names[k], acc, "none", n, 1, N_MIX, 1, t, kernel_bytes[k] * n);
+    }
+    return 0;
+}
+
+static int bench_scene(const saber_ctx* ctx, const saber_schema* schema, size_t n, size_t n_pix,
+                       saber_layout layout, bench_data* d, saber_accuracy acc, const bench_opts* o)
+{
+    const char* lname = layout == SABER_LAYOUT_BAND_MAJOR ? "band" : "pixel";
+
+    for (size_t ti = 0; ti < o->n_threads; ti++) {
+        scene_arg s;
+        memset(&s, 0, sizeof(s));
+        s.ctx     = ctx;
+        s.threads = o->threads[ti];
+        s.scene.n_pix          = n_pix;
+        s.scene.layout         = layout;
+        s.scene.schema         = schema;
+        s.scene.water_type     = 2;
+        s.scene.theta_sun_deg  = 30.0;
+        s.scene.theta_view_deg = 10.0;
+        s.scene.a       = d->a;
+        s.scene.bb      = d->bb;
+        s.scene.rrs     = d->rrs;
+        s.scene.r_b     = d->r_b;
+        s.scene.h_w     = d->h_w;
+
+        /* In pipeline order, so every kernel sees the previous one's output */
+        for (int k = 0; k < N_KERNEL; k++) {
+            switch (k) {
+                case KERNEL_IOP:
+                    s.scene.op     = SABER_SCENE_IOP;
+                    s.scene.values = d->params;
+                    s.scene.a_out  = d->a;
+                    s.scene.bb_out = d->bb;
+                    break;
+                case KERNEL_LMM:
+                    s.scene.op      = SABER_SCENE_MIXING;
+                    s.scene.values  = d->fractions;
+                    s.scene.r_b_out = d->r_b;
+                    break;
+                case KERNEL_DEEP:
+                case KERNEL_SHALLOW:
+                    s.scene.op      = SABER_SCENE_FORWARD;
+                    s.scene.shallow = k == KERNEL_SHALLOW;
+                    s.scene.rrs_out = d->rrs;
+                    break;
+                default:
+                    s.scene.op      = SABER_SCENE_RETRIEVE;
+                    s.scene.r_b_out = d->r_b_out;
+                    break;
+            }
+            double t = time_call(run_scene, &s, o->min_time);
+            if (t < 0) return 1;
+            record(kernel_names[k], acc, lname, n, n_pix, N_MIX, s.threads, t,
+                   kernel_bytes[k] * n * n_pix);
+        }
+    }
+    return 0;
+}
+
+static int bench_kernels(saber_ctx* ctx, saber_accuracy acc, const bench_opts* o)
+{
+    const char* classes[N_MIX] = {"class_0", "class_1", "class_2"};
+    size_t n_pix_max = 0, n_elem_max = 0;
+    size_t n_pixels = o->quick ? 3 : sizeof(bench_pixels) / sizeof(*bench_pixels);
+
+    for (size_t b = 0; b < sizeof(bench_bands) / sizeof(*bench_bands); b++)
+        for (size_t p = 0; p < n_pixels; p++) {
+            size_t e = bench_bands[b] * bench_pixels[p];
+            if (e > o->max_elems) continue;
+            if (bench_pixels[p] > n_pix_max) n_pix_max = bench_pixels[p];
+            if (e > n_elem_max) n_elem_max = e;
+        }
+
+    bench_data d;
+    if (data_alloc(&d, n_pix_max, n_elem_max)) return 3;
+    saber_ctx_set_accuracy(ctx, acc);
+
+    int rc = 0;
+    for (size_t b = 0; b < sizeof(bench_bands) / sizeof(*bench_bands) && !rc; b++) {
+        size_t n = bench_bands[b];
+        double wl[450];
+        band_grid(wl, n);
+        if ((rc = saber_ctx_build_cache(ctx, wl, n))) break;
+
+        saber_schema* schema = saber_schema_create(ctx, param_names, N_PARAM, classes, N_MIX);
+        if (!schema) {
+            rc = 2;
+            break;
+        }
+
+        for (size_t p = 0; p < n_pixels && !rc; p++) {
+            size_t n_pix = bench_pixels[p];
+            if (n * n_pix > o->max_elems) {
+                fprintf(stderr, "  skipped %zu bands x %zu px (over --max-elems)\n", n, n_pix);
+                continue;
+            }
+            if (n_pix == 1) {
+                rc = bench_single(ctx, wl, n, classes, &d, acc, o->min_time);
+                continue;
+            }
+            rc = bench_scene(ctx, schema, n, n_pix, SABER_LAYOUT_PIXEL_MAJOR, &d, acc, o);
+            if (!rc) rc = bench_scene(ctx, schema, n, n_pix, SABER_LAYOUT_BAND_MAJOR, &d, acc, o);
+        }
+        saber_schema_destroy(schema);
+    }
+
+    data_free(&d);
+    return rc;
+}
+
+static int bench_build_cache(const bench_opts* o)
+{
+    for (size_t c = 0; c < sizeof(bench_classes) / sizeof(*bench_classes); c++) {
+        size_t n_class = bench_classes[c];
+        if (o->quick && n_class > 100) break;
+
+        saber_ctx* ctx = saber_ctx_create();
+        if (!ctx) return 3;
+        int rc = load_library(ctx, n_class);
+        for (size_t b = 0; b < sizeof(bench_bands) / sizeof(*bench_bands) && !rc; b++) {
+            double wl[450];
+            band_grid(wl, bench_bands[b]);
+            build_arg arg = {ctx, wl, bench_bands[b]};
+            double t = time_call(run_build, &arg, o->min_time);
+            if (t < 0) {
+                rc = 1;
+                break;
+            }
+            /* four tables plus one column per class, double and float */
+            record("build_cache", SABER_ACCURACY_EXACT, "none", bench_bands[b], 0, n_class, 1, t,
+                   12.0 * bench_bands[b] * (4 + n_class));
+        }
+        saber_ctx_destroy(ctx);
+        if (rc) return rc;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------*
+ *  JSON output and baseline comparison                        *
+ *-------------------------------------------------------------*/
+
+/* "<cpu model>, <os> <release> <arch>" so a baseline says where it was
+ * recorded; the CPU model is only known on Linux */
+static void machine_name(char* out, size_t len)
+{
+    char cpu[128] = "unknown CPU";
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    if (f) {
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            char* colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) != 0 || !colon) continue;
+            colon += strspn(colon + 1, " \t") + 1;
+            colon[strcspn(colon, "\r\n")] = '\0';
+            for (char* q = colon; *q; q++) if (*q == '"' || *q == '\\') *q = ' ';
+            snprintf(cpu, sizeof(cpu), "%s", colon);
+            break;
+        }
+        fclose(f);
+    }
+
+    struct utsname u;
+    if (uname(&u) == 0) snprintf(out, len, "%s, %s %s %s", cpu, u.sysname, u.release, u.machine);
+    else                snprintf(out, len, "%s", cpu);
+}
+
+static void write_json(FILE* f, const bench_opts* o)
+{
+    char machine[512];
+    machine_name(machine, sizeof(machine));
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"saber_version\": \"%s\",\n", saber_version());
+    fprintf(f, "  \"simd_isa\": \"%s\",\n", saber_simd_isa());
+    fprintf(f, "  \"machine\": \"%s\",\n", machine);
+    fprintf(f, "  \"hardware_threads\": %zu,\n", saber_scene_default_threads());
+    fprintf(f, "  \"min_time_s\": %g,\n", o->min_time);
+    fprintf(f, "  \"results\": [\n");
+    for (size_t k = 0; k < n_results; k++) {
+        const bench_result* r = &results[k];
+        fprintf(f, "    {\"kernel\": \"%s\", \"accuracy\": \"%s\", \"bands\": %zu, \"pixels\": %zu, "
+                   "\"classes\": %zu, \"layout\": \"%s\", \"threads\": %zu, \"seconds\": %.6e, "
+                   "\"ns_per_band\": %.4f, \"gb_per_s\": %.4f, \"speedup\": %.3f}%s\n",
+                r->kernel, r->accuracy, r->bands, r->pixels, r->classes, r->layout, r->threads,
+                r->seconds, r->ns_per_band, r->gb_per_s, r->speedup,
+                k + 1 < n_results ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+/* Field of a one-line result object as written by write_json() */
+static const char* json_field(const char* line, const char* key)
+{
+    char pat[32];
+    snprintf(pat, sizeof(pat), "\"%s\": ", key);
+    const char* s = strstr(line, pat);
+    return s ? s + strlen(pat) : NULL;
+}
+
+static int json_parse(const char* line, bench_result* r)
+{
+    const char *k = json_field(line, "kernel"), *a = json_field(line, "accuracy"),
+               *l = json_field(line, "layout"), *b = json_field(line, "bands"),
+               *p = json_field(line, "pixels"), *c = json_field(line, "classes"),
+               *t = json_field(line, "threads"), *n = json_field(line, "ns_per_band");
+    if (!k || !a || !l || !b || !p || !c || !t || !n) return 1;
+    memset(r, 0, sizeof(*r));
+    if (sscanf(k, "\"%23[^\"]\"", r->kernel) != 1 ||
+        sscanf(a, "\"%7[^\"]\"", r->accuracy) != 1 ||
+        sscanf(l, "\"%7[^\"]\"", r->layout) != 1)
+        return 1;
+    r->bands       = strtoul(b, NULL, 10);
+    r->pixels      = strtoul(p, NULL, 10);
+    r->classes     = strtoul(c, NULL, 10);
+    r->threads     = strtoul(t, NULL, 10);
+    r->ns_per_band = strtod(n, NULL);
+    return 0;
+}
+
+static int same_case(const bench_result* x, const bench_result* y)
+{
+    return x->bands == y->bands && x->pixels == y->pixels && x->classes == y->classes &&
+           x->threads == y->threads && strcmp(x->kernel, y->kernel) == 0 &&
+           strcmp(x->accuracy, y->accuracy) == 0 && strcmp(x->layout, y->layout) == 0;
+}
+
+/* Single cases are noisy, so the gate is per kernel and accuracy tier: the
+ * geometric mean of its new / baseline ratios. Cases over the tolerance are
+ * listed either way. */
+static int compare_baseline(const char* path, double tolerance)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "cannot open baseline %s\n", path);
+        return 2;
+    }
+
+    double* log_ratio = calloc(n_results ? n_results : 1, sizeof(double));
+    char* matched = calloc(n_results ? n_results : 1, 1);
+    if (!log_ratio || !matched) {
+        free(log_ratio);
+        free(matched);
+        fclose(f);
+        return 3;
+    }
+
+    char line[1024];
+    fprintf(stderr, "\ncompare against %s (tolerance %.0f%%)\n", path, 100.0 * tolerance);
+    while (fgets(line, sizeof(line), f)) {
+        bench_result base;
+        if (!strstr(line, "\"kernel\"") || json_parse(line, &base)) continue;
+        for (size_t k = 0; k < n_results; k++) {
+            if (matched[k] || !same_case(&base, &results[k])) continue;
+            double ratio = results[k].ns_per_band / base.ns_per_band;
+            matched[k]   = 1;
+            log_ratio[k] = log(ratio);
+            if (ratio > 1.0 + tolerance)
+                fprintf(stderr, "  slower %-16s %-5s %4zu bands %8zu px %-5s %2zu thr  "
+                                "%10.3f -> %10.3f ns/band (x%.2f)\n",
+                        base.kernel, base.accuracy, base.bands,
+                        base.pixels ? base.pixels : base.classes, base.layout, base.threads,
+                        base.ns_per_band, results[k].ns_per_band, ratio);
+            break;
+        }
+    }
+    fclose(f);
+
+    for (size_t k = 0; k < n_results; k++)
+        if (!matched[k])
+            fprintf(stderr, "  not in baseline: %s %s %zu bands %zu px %s %zu thr\n",
+                    results[k].kernel, results[k].accuracy, results[k].bands,
+                    results[k].pixels ? results[k].pixels : results[k].classes,
+                    results[k].layout, results[k].threads);
+
+    /* matched[k] = 2 once folded into its kernel's mean */
+    int regressed = 0;
+    for (size_t k = 0; k < n_results; k++) {
+        if (matched[k] != 1) continue;
+        double sum = 0.0;
+        size_t cnt = 0;
+        for (size_t j = k; j < n_results; j++) {
+            if (matched[j] != 1 || strcmp(results[j].kernel, results[k].kernel) != 0 ||
+                strcmp(results[j].accuracy, results[k].accuracy) != 0)
+                continue;
+            sum += log_ratio[j];
+            cnt++;
+            matched[j] = 2;
+        }
+        double gmean = exp(sum / cnt);
+        int bad = gmean > 1.0 + tolerance;
+        regressed |= bad;
+        fprintf(stderr, "%-16s %-5s %4zu cases  x%.3f %s\n", results[k].kernel,
+                results[k].accuracy, cnt, gmean, bad ? "REGRESSED" : "ok");
+    }
+
+    free(log_ratio);
+    free(matched);
+    return regressed;
+}
+
+/*-------------------------------------------------------------*
+ *  Driver                                                     *
+ *-------------------------------------------------------------*/
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: saber_bench [--quick] [--accuracy exact|fast|both] [--threads 1,2,4]\n"
+            "                   [--min-time S] [--max-elems N] [--out FILE]\n"
+            "                   [--compare BASELINE] [--tolerance F]\n");
+}
+
+static int parse_threads(const char* s, bench_opts* o)
+{
+    o->n_threads = 0;
+    while (*s && o->n_threads < MAX_THREADS) {
+        char* end;
+        unsigned long t = strtoul(s, &end, 10);
+        if (end == s || t == 0) return 1;
+        o->threads[o->n_threads++] = t;
+        s = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') return 1;
+    }
+    return o->n_threads ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    bench_opts o;
+    memset(&o, 0, sizeof(o));
+    o.acc_lo    = SABER_ACCURACY_EXACT;
+    o.acc_hi    = SABER_ACCURACY_EXACT;
+    o.min_time  = -1.0;
+    o.max_elems = (size_t)1 << 25;
+    o.tolerance = 0.15;
+
+    /* 1, 2, 4, ... up to the hardware threads, and that count itself */
+    size_t hw = saber_scene_default_threads();
+    for (size_t t = 1; t < hw && o.n_threads < MAX_THREADS - 1; t *= 2)
+        o.threads[o.n_threads++] = t;
+    o.threads[o.n_threads++] = hw;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--quick") == 0) {
+            o.quick = 1;
+            continue;
+        }
+        if (!val) {
+            usage();
+            return 2;
+        }
+        i++;
+        if (strcmp(arg, "--accuracy") == 0) {
+            if (strcmp(val, "exact") == 0)     o.acc_lo = o.acc_hi = SABER_ACCURACY_EXACT;
+            else if (strcmp(val, "fast") == 0) o.acc_lo = o.acc_hi = SABER_ACCURACY_FAST;
+            else if (strcmp(val, "both") == 0) o.acc_hi = SABER_ACCURACY_FAST;
+            else {
+                usage();
+                return 2;
+            }
+        } else if (strcmp(arg, "--threads") == 0) {
+            if (parse_threads(val, &o)) {
+                usage();
+                return 2;
+            }
+        } else if (strcmp(arg, "--min-time") == 0) {
+            o.min_time = strtod(val, NULL);
+        } else if (strcmp(arg, "--max-elems") == 0) {
+            o.max_elems = strtoul(val, NULL, 10);
+        } else if (strcmp(arg, "--out") == 0) {
+            o.out = val;
+        } else if (strcmp(arg, "--compare") == 0) {
+            o.compare = val;
+        } else if (strcmp(arg, "--tolerance") == 0) {
+            o.tolerance = strtod(val, NULL);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (o.min_time < 0) o.min_time = o.quick ? 0.02 : 0.1;
+
+    fprintf(stderr, "saber %s, %s, %zu hardware threads\n", saber_version(), saber_simd_isa(), hw);
+
+    int rc = bench_build_cache(&o);
+    if (!rc) {
+        saber_ctx* ctx = saber_ctx_create();
+        rc = ctx ? load_library(ctx, 10) : 3;
+        for (int acc = o.acc_lo; acc <= o.acc_hi && !rc; acc++)
+            rc = bench_kernels(ctx, (saber_accuracy)acc, &o);
+        saber_ctx_destroy(ctx);
+    }
+    if (rc) {
+        fprintf(stderr, "benchmark failed (code %d)\n", rc);
+        return 2;
+    }
+
+    FILE* f = o.out ? fopen(o.out, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", o.out);
+        return 2;
+    }
+    write_json(f, &o);
+    if (o.out) fclose(f);
+
+    return o.compare ? compare_baseline(o.compare, o.tolerance) : 0;
+}
@@ -2,6 +2,7 @@
 #define SABER_LIB_SABER_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "saber_version.h"
 
 //#define SABER_VERSION "0.1.2"
@@ -12,6 +13,1039 @@ extern "C" {
 
 const char *saber_version(void);
 
+/*-------------------------------------------------------------*
+ *  Context API                                                *
+ *                                                             *
+ *  A saber_ctx owns its own spectral tables and resampled     *
+ *  cache. Loaders and saber_ctx_build_cache() must not run    *
+ *  concurrently with anything else on the same context; once  *
+ *  built, every kernel below only reads the context and may   *
+ *  be called from many threads at once. Kernels never rebuild *
+ *  the cache: a wavelength grid other than the built one is   *
+ *  rejected with return code 2.                               *
+ *-------------------------------------------------------------*/
+typedef struct saber_ctx saber_ctx;
+
+saber_ctx* saber_ctx_create(void);
+void saber_ctx_destroy(saber_ctx* ctx);
+
+// Context behind the legacy global API below
+saber_ctx* saber_default_ctx(void);
+
+int saber_ctx_load_pure_water(saber_ctx* ctx, const double* wl, const double* a, size_t n);
+int saber_ctx_load_a0_a1(saber_ctx* ctx, const double* wl, const double* a0, const double* a1, size_t n);
+int saber_ctx_load_r_rs_b(saber_ctx* ctx, const double* wl, const char** colnames, const double* matrix,
+                          size_t wl_n, size_t class_n);
+
+/* Borrowing loaders: like the ones above, but the context keeps pointers
+ * to the caller's arrays (class name strings included) instead of copies.
+ * They must stay valid and unchanged until that table is replaced by
+ * another loader or the context is destroyed, reset or loaded from a
+ * snapshot; the context never writes through them. */
+int saber_ctx_borrow_pure_water(saber_ctx* ctx, const double* wl, const double* a, size_t n);
+int saber_ctx_borrow_a0_a1(saber_ctx* ctx, const double* wl, const double* a0, const double* a1, size_t n);
+int saber_ctx_borrow_r_rs_b(saber_ctx* ctx, const double* wl, const char** colnames, const double* matrix,
+                            size_t wl_n, size_t class_n);
+int saber_ctx_build_cache(saber_ctx* ctx, const double* wl, size_t n);
+
+/* Band-integrated caches for broad sensor bands: Gaussian responses of
+ * the given FWHM, or tabulated responses srf[i * srf_n + k] on srf_wl.
+ * wl[i] stays the band's nominal centre and the grid the kernels check. */
+int saber_ctx_build_cache_fwhm(saber_ctx* ctx, const double* wl, const double* fwhm, size_t n);
+int saber_ctx_build_cache_srf(saber_ctx* ctx, const double* wl, size_t n,
+                              const double* srf_wl, const double* srf, size_t srf_n);
+
+/* Grid tokens. A context keeps the grid of its last build plus a few
+ * earlier ones (least recently used evicted first), each identified by a
+ * token that is never reused. Kernels taking a wavelength array accept any
+ * cached grid, compared element by element; the *_grid kernels take the
+ * token instead and skip even that. A token of an evicted grid is
+ * rejected with return code 2. Loading any source table drops every cached
+ * grid, so the next build resamples it and schemas, unmixers, workspaces,
+ * LUTs and tokens prepared before return 2. ensure_grid() and select_grid()
+ * change which grid is current and, like a build, must not race with
+ * kernels. */
+typedef uint64_t saber_grid_token;
+
+int saber_ctx_ensure_grid(saber_ctx* ctx, const double* wl, size_t n, saber_grid_token* token);
+int saber_ctx_select_grid(saber_ctx* ctx, saber_grid_token token);
+saber_grid_token saber_ctx_grid_token(const saber_ctx* ctx);
+
+/* Snapshots of a built grid. save writes the current grid with its
+ * class names to a versioned, checksummed binary file; load maps it back
+ * read-only in place of everything the context held, so processes on one
+ * node share a single page-cache copy and skip loading and resampling. */
+int saber_ctx_save_snapshot(const saber_ctx* ctx, const char* path);
+int saber_ctx_load_snapshot(saber_ctx* ctx, const char* path);
+
+/* Spectral library files. save writes the source tables (pure water,
+ * a0/a1, bottom reflectance and class names) in the snapshot container;
+ * map borrows all three from the file mapped read-only, which then lives
+ * until the tables are replaced or the context is destroyed. */
+int saber_ctx_save_library(const saber_ctx* ctx, const char* path);
+int saber_ctx_map_library(saber_ctx* ctx, const char* path);
+
+/* Accuracy tier of the transcendental calls inside the kernels.
+ * EXACT (default) reproduces scalar libm results bit for bit; FAST runs
+ * vectorised exp/log/pow on the widest SIMD unit of the host (see
+ * saber_simd_isa()) within 1 ulp for exp/log and 3 + 2 |p ln x| ulp for pow. */
+typedef enum saber_accuracy {
+    SABER_ACCURACY_EXACT = 0,
+    SABER_ACCURACY_FAST  = 1
+} saber_accuracy;
+
+int saber_ctx_set_accuracy(saber_ctx* ctx, saber_accuracy accuracy);
+saber_accuracy saber_ctx_get_accuracy(const saber_ctx* ctx);
+const char* saber_simd_isa(void);
+
+const double* saber_ctx_get_a_w(const saber_ctx* ctx);
+const double* saber_ctx_get_bb_w(const saber_ctx* ctx);
+const double* saber_ctx_get_a0(const saber_ctx* ctx);
+const double* saber_ctx_get_a1(const saber_ctx* ctx);
+const double* saber_ctx_get_r_rs_b(const saber_ctx* ctx);
+const char**  saber_ctx_get_r_rs_b_class_names(const saber_ctx* ctx);
+size_t saber_ctx_get_n_wl(const saber_ctx* ctx);
+size_t saber_ctx_get_n_class(const saber_ctx* ctx);
+
+int saber_ctx_iop_from_oac(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n,
+        const char** param_names, const double* param_values, size_t n_param,
+        double* a_out, double* bb_out
+);
+
+int saber_ctx_compute_r_rs_b_lmm(
+        const saber_ctx* ctx,
+        const char** class_names, const double* class_fractions, size_t n_frac,
+        double* out_r_rs_b
+);
+
+int saber_ctx_forward_am03(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        int shallow,
+        double h_w,
+        const double *r_b,
+        double *rrs_out
+);
+
+int saber_ctx_retrieve_r_rs_b_am03(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        const double *r_rs_obs,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        double h_w,
+        double *r_rs_b_out
+);
+
+int saber_ctx_iop_from_oac_grid(
+        const saber_ctx* ctx, saber_grid_token token,
+        const char** param_names, const double* param_values, size_t n_param,
+        double* a_out, double* bb_out
+);
+
+int saber_ctx_compute_r_rs_b_lmm_grid(
+        const saber_ctx* ctx, saber_grid_token token,
+        const char** class_names, const double* class_fractions, size_t n_frac,
+        double* out_r_rs_b
+);
+
+/*-------------------------------------------------------------*
+ *  Prepared (compiled) parameter layouts                      *
+ *                                                             *
+ *  saber_schema_create() resolves parameter and class names   *
+ *  once; the *_prepared kernels then take plain arrays in the *
+ *  schema's order and run on the context grid with no string  *
+ *  lookups. A schema is invalidated by rebuilding the cache.  *
+ *-------------------------------------------------------------*/
+typedef struct saber_schema saber_schema;
+
+saber_schema* saber_schema_create(
+        const saber_ctx* ctx,
+        const char** param_names, size_t n_param,
+        const char** class_names, size_t n_class
+);
+void saber_schema_destroy(saber_schema* s);
+size_t saber_schema_n_param(const saber_schema* s);
+size_t saber_schema_n_class(const saber_schema* s);
+
+int saber_ctx_iop_from_oac_prepared(
+        const saber_ctx* ctx, const saber_schema* s,
+        const double* param_values,         /* [n_param] in schema order */
+        double* a_out, double* bb_out       /* [n_wl] */
+);
+
+int saber_ctx_compute_r_rs_b_lmm_prepared(
+        const saber_ctx* ctx, const saber_schema* s,
+        const double* class_fractions,      /* [n_class] in schema order */
+        double* out_r_rs_b                  /* [n_wl] */
+);
+
+/*-------------------------------------------------------------*
+ *  AM03 plans                                                 *
+ *                                                             *
+ *  A plan fixes the water type, the shallow flag and the      *
+ *  viewing geometry, with every geometry factor evaluated     *
+ *  once; the *_planned kernels then run loops specialised     *
+ *  for that case. Plans do not depend on a context and may    *
+ *  be shared between threads and contexts.                    *
+ *-------------------------------------------------------------*/
+typedef struct saber_am03_plan saber_am03_plan;
+
+saber_am03_plan* saber_am03_plan_create(int water_type, int shallow,
+                                        double theta_sun_deg, double theta_view_deg);
+void saber_am03_plan_destroy(saber_am03_plan* plan);
+
+int saber_ctx_forward_am03_planned(
+        const saber_ctx *ctx, const saber_am03_plan *plan,
+        const double *a, const double *bb, size_t n,
+        double h_w,                         /* shallow plans only */
+        const double *r_b,                  /* shallow plans only */
+        double *rrs_out
+);
+
+int saber_ctx_retrieve_r_rs_b_am03_planned(
+        const saber_ctx *ctx, const saber_am03_plan *plan,
+        const double *a, const double *bb, const double *r_rs_obs, size_t n,
+        double h_w,
+        double *r_rs_b_out
+);
+
+/*-------------------------------------------------------------*
+ *  Derivative-returning variants (forward mode, value + d/dp  *
+ *  in one pass). Layouts are parameter-major: the derivative  *
+ *  with respect to parameter j of band i is at [j * n + i].   *
+ *-------------------------------------------------------------*/
+int saber_ctx_iop_from_oac_jac(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n,
+        const char** param_names, const double* param_values, size_t n_param,
+        double* a_out, double* bb_out,
+        double* da_dp, double* dbb_dp       /* [n_param x n] each */
+);
+
+int saber_ctx_compute_r_rs_b_lmm_jac(
+        const saber_ctx* ctx,
+        const char** class_names, const double* class_fractions, size_t n_frac,
+        double* out_r_rs_b,
+        double* d_out                       /* [n_frac x n_wl] */
+);
+
+int saber_ctx_forward_am03_jac(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        int shallow,
+        double h_w,
+        const double *r_b,
+        double *rrs_out,
+        double *d_da,                       /* [n] dRrs_i/da_i, optional   */
+        double *d_dbb,                      /* [n] dRrs_i/dbb_i, optional  */
+        double *d_dh_w,                     /* [n] dRrs_i/dh_w, optional   */
+        double *d_dr_b                      /* [n] dRrs_i/dr_b_i, optional */
+);
+
+/*-------------------------------------------------------------*
+ *  Batched API: n_pix spectra on one band set per call        *
+ *-------------------------------------------------------------*/
+typedef enum saber_layout {
+    SABER_LAYOUT_PIXEL_MAJOR = 0,   /* band i of pixel p at [p * n + i]     */
+    SABER_LAYOUT_BAND_MAJOR  = 1    /* band i of pixel p at [i * n_pix + p] */
+} saber_layout;
+
+/* Strided views of n_pix x k values (bands, parameters or fractions):
+ * element k of pixel p at data[p * pix_stride + k * stride]. The *_view
+ * kernels take them in place of a layout, so BIP/BIL lines, BSQ planes and
+ * structure-of-arrays buffers are used where they are, without a
+ * transposed copy. PIXEL_MAJOR is {data, k, 1}, BAND_MAJOR {data, 1, n_pix}. */
+typedef struct saber_view {
+    const double* data;
+    size_t pix_stride;
+    size_t stride;
+} saber_view;
+
+typedef struct saber_view_rw {
+    double* data;
+    size_t pix_stride;
+    size_t stride;
+} saber_view_rw;
+
+int saber_ctx_iop_from_oac_batch(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n, size_t n_pix,
+        const char** param_names, const double* param_values, size_t n_param,
+        saber_layout layout,
+        double* a_out, double* bb_out
+);
+
+int saber_ctx_iop_from_oac_batch_grid(
+        const saber_ctx* ctx, saber_grid_token token, size_t n_pix,
+        const char** param_names, const double* param_values, size_t n_param,
+        saber_layout layout,
+        double* a_out, double* bb_out
+);
+
+int saber_ctx_forward_am03_batch(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,    /* optional [n_pix] */
+        const double *theta_view_pix,   /* optional [n_pix] */
+        int shallow,
+        const double *h_w,              /* [n_pix], shallow only */
+        const double *r_b,              /* n_pix x n, shallow only */
+        saber_layout layout,
+        double *rrs_out
+);
+
+int saber_ctx_retrieve_r_rs_b_am03_batch(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        const double *r_rs_obs,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,    /* optional [n_pix] */
+        const double *theta_view_pix,   /* optional [n_pix] */
+        const double *h_w,              /* [n_pix] */
+        saber_layout layout,
+        double *r_rs_b_out
+);
+
+/* Bottom mixtures of n_pix pixels on the current grid, computed as one
+ * cache-blocked product with the library: class_fractions holds
+ * n_pix x n_frac values in `layout` (fraction j of pixel p at
+ * [p * n_frac + j] or [j * n_pix + p]), out_r_rs_b n_pix x n_wl. */
+int saber_ctx_compute_r_rs_b_lmm_batch(
+        const saber_ctx* ctx, size_t n_pix,
+        const char** class_names, const double* class_fractions, size_t n_frac,
+        saber_layout layout,
+        double* out_r_rs_b
+);
+
+/* Sparse fractions as compressed rows: pixel p mixes entries
+ * pix_start[p] .. pix_start[p + 1] - 1 of class_idx (library columns in
+ * saber_ctx_get_r_rs_b_class_names() order) and fractions. */
+int saber_ctx_compute_r_rs_b_lmm_sparse(
+        const saber_ctx* ctx, size_t n_pix,
+        const size_t* pix_start,            /* [n_pix + 1] */
+        const size_t* class_idx,
+        const double* fractions,
+        saber_layout layout,                /* of out_r_rs_b */
+        double* out_r_rs_b
+);
+
+/* The batches above on strided views, one view per array; counts come
+ * from n / n_pix / n_param / n_frac as in the layout calls. Per-pixel
+ * arrays (h_w, angles) stay contiguous. */
+int saber_ctx_iop_from_oac_view(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n, size_t n_pix,
+        const char** param_names, saber_view values, size_t n_param,
+        saber_view_rw a_out, saber_view_rw bb_out
+);
+
+int saber_ctx_compute_r_rs_b_lmm_view(
+        const saber_ctx* ctx, size_t n_pix,
+        const char** class_names, saber_view fractions, size_t n_frac,
+        saber_view_rw out_r_rs_b
+);
+
+int saber_ctx_forward_am03_view(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        saber_view a,
+        saber_view bb,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,    /* optional [n_pix] */
+        const double *theta_view_pix,   /* optional [n_pix] */
+        int shallow,
+        const double *h_w,              /* [n_pix], shallow only */
+        saber_view r_b,                 /* shallow only */
+        saber_view_rw rrs_out
+);
+
+int saber_ctx_retrieve_r_rs_b_am03_view(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        saber_view a,
+        saber_view bb,
+        saber_view r_rs_obs,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,    /* optional [n_pix] */
+        const double *theta_view_pix,   /* optional [n_pix] */
+        const double *h_w,              /* [n_pix] */
+        saber_view_rw r_rs_b_out
+);
+
+/*-------------------------------------------------------------*
+ *  Fused forward model + misfit                               *
+ *                                                             *
+ *  AM03 forward model reduced against an observed spectrum    *
+ *  in the same pass: only the misfit (and optionally its      *
+ *  gradient with respect to the model inputs) comes out, the  *
+ *  modelled Rrs is never written to memory.                   *
+ *-------------------------------------------------------------*/
+typedef enum saber_misfit_metric {
+    SABER_MISFIT_SSE = 0,           /* 0.5 sum w (Rrs - obs)^2               */
+    SABER_MISFIT_ANGLE,             /* spectral angle (rad), weighted        */
+    SABER_MISFIT_LOG                /* 0.5 sum w (ln Rrs - ln obs)^2         */
+} saber_misfit_metric;
+
+typedef struct saber_misfit {
+    int    metric;                  /* saber_misfit_metric                   */
+    const double* weights;          /* [n] per band, or NULL = all 1         */
+    const unsigned char* mask;      /* [n] 0 = band left out, or NULL        */
+    double log_floor;               /* LOG: Rrs and obs floored, 0 -> 1e-6   */
+} saber_misfit;
+
+int saber_ctx_misfit_am03_planned(
+        const saber_ctx *ctx, const saber_am03_plan *plan,
+        const saber_misfit *mf,
+        const double *a, const double *bb, size_t n,
+        double h_w,                         /* shallow plans only */
+        const double *r_b,                  /* shallow plans only */
+        const double *r_rs_obs,
+        double *cost_out,
+        double *g_a,                        /* [n] dC/da_i, optional   */
+        double *g_bb,                       /* [n] dC/dbb_i, optional  */
+        double *g_h_w,                      /* dC/dh_w, optional       */
+        double *g_r_b                       /* [n] dC/dr_b_i, optional */
+);
+
+int saber_ctx_misfit_am03_batch(
+        const saber_ctx *ctx,
+        const saber_misfit *mf,
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,    /* optional [n_pix] */
+        const double *theta_view_pix,   /* optional [n_pix] */
+        int shallow,
+        const double *h_w,              /* [n_pix], shallow only */
+        const double *r_b,              /* n_pix x n, shallow only */
+        const double *r_rs_obs,         /* n_pix x n */
+        saber_layout layout,
+        double *cost_out,               /* [n_pix] */
+        double *g_a,                    /* n_pix x n or NULL */
+        double *g_bb,                   /* n_pix x n or NULL */
+        double *g_h_w,                  /* [n_pix] or NULL */
+        double *g_r_b                   /* n_pix x n or NULL */
+);
+
+/*-------------------------------------------------------------*
+ *  Constrained unmixing                                       *
+ *                                                             *
+ *  Inverse of the mixing above: class fractions of bottom     *
+ *  reflectance spectra, non-negative and optionally summing   *
+ *  to one. An unmixer holds the library Gram matrix for its   *
+ *  classes on one grid; build it once, then unmix any number  *
+ *  of pixels, from any number of threads.                     *
+ *-------------------------------------------------------------*/
+typedef struct saber_unmixer saber_unmixer;
+
+saber_unmixer* saber_unmixer_create(
+        const saber_ctx* ctx,
+        const saber_schema* s,              /* its classes, or NULL for the whole library */
+        int sum_to_one
+);
+void saber_unmixer_destroy(saber_unmixer* u);
+size_t saber_unmixer_n_class(const saber_unmixer* u);
+
+int saber_ctx_unmix_r_rs_b_batch(
+        const saber_ctx* ctx, const saber_unmixer* u, size_t n_pix,
+        const double* r_rs_b,               /* n_pix x n_wl */
+        saber_layout layout,
+        double* fractions_out,              /* n_pix x n_class, same layout */
+        double* rmse_out                    /* [n_pix] or NULL */
+);
+
+/*-------------------------------------------------------------*
+ *  Bathymetry                                                 *
+ *                                                             *
+ *  Depth-only retrieval where the water column and the bottom *
+ *  are known for a region: a depth solver holds every AM03    *
+ *  term that does not depend on depth, so each pixel costs a  *
+ *  few exponentials per band per Newton iteration. Build one  *
+ *  per region, then solve any number of pixels, from any      *
+ *  number of threads.                                         *
+ *-------------------------------------------------------------*/
+typedef struct saber_depth_solver saber_depth_solver;
+
+saber_depth_solver* saber_depth_solver_create(
+        const saber_ctx* ctx, const saber_am03_plan* plan,
+        const double* a, const double* bb, const double* r_b,  /* [n_wl] */
+        const double* weights,              /* [n_wl] or NULL */
+        double h_min, double h_max
+);
+void saber_depth_solver_destroy(saber_depth_solver* d);
+
+int saber_ctx_solve_depth_batch(
+        const saber_ctx* ctx, const saber_depth_solver* d, size_t n_pix,
+        const double* rrs,                  /* n_pix x n_wl */
+        saber_layout layout,
+        double* h_out,                      /* [n_pix] */
+        double* rmse_out                    /* [n_pix] or NULL */
+);
+
+/*-------------------------------------------------------------*
+ *  Single-precision variants                                  *
+ *                                                             *
+ *  Same contracts as the double kernels above, on float       *
+ *  spectra and the float copy of the context tables. The      *
+ *  wavelength grid, angles and depths stay double. Values     *
+ *  agree with the double kernels to float rounding: within    *
+ *  1e-5 relative in EXACT mode and 5e-5 in FAST mode for      *
+ *  well-conditioned inputs (the r_b retrieval divides by      *
+ *  exp(-Kd h_w) and loses accordingly in deep water).         *
+ *-------------------------------------------------------------*/
+int saber_ctx_iop_from_oac_f(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n,
+        const char** param_names, const float* param_values, size_t n_param,
+        float* a_out, float* bb_out
+);
+
+int saber_ctx_iop_from_oac_batch_f(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n, size_t n_pix,
+        const char** param_names, const float* param_values, size_t n_param,
+        saber_layout layout,
+        float* a_out, float* bb_out
+);
+
+int saber_ctx_iop_from_oac_grid_f(
+        const saber_ctx* ctx, saber_grid_token token,
+        const char** param_names, const float* param_values, size_t n_param,
+        float* a_out, float* bb_out
+);
+
+int saber_ctx_iop_from_oac_batch_grid_f(
+        const saber_ctx* ctx, saber_grid_token token, size_t n_pix,
+        const char** param_names, const float* param_values, size_t n_param,
+        saber_layout layout,
+        float* a_out, float* bb_out
+);
+
+int saber_ctx_compute_r_rs_b_lmm_f(
+        const saber_ctx* ctx,
+        const char** class_names, const float* class_fractions, size_t n_frac,
+        float* out_r_rs_b
+);
+
+int saber_ctx_forward_am03_f(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const float *a,
+        const float *bb,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        int shallow,
+        double h_w,
+        const float *r_b,
+        float *rrs_out
+);
+
+int saber_ctx_retrieve_r_rs_b_am03_f(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const float *a,
+        const float *bb,
+        const float *r_rs_obs,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        double h_w,
+        float *r_rs_b_out
+);
+
+int saber_ctx_forward_am03_batch_f(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const float *a,
+        const float *bb,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,    /* optional [n_pix] */
+        const double *theta_view_pix,   /* optional [n_pix] */
+        int shallow,
+        const double *h_w,              /* [n_pix], shallow only */
+        const float *r_b,               /* n_pix x n, shallow only */
+        saber_layout layout,
+        float *rrs_out
+);
+
+int saber_ctx_retrieve_r_rs_b_am03_batch_f(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const float *a,
+        const float *bb,
+        const float *r_rs_obs,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,    /* optional [n_pix] */
+        const double *theta_view_pix,   /* optional [n_pix] */
+        const double *h_w,              /* [n_pix] */
+        saber_layout layout,
+        float *r_rs_b_out
+);
+
+int saber_ctx_forward_am03_planned_f(
+        const saber_ctx *ctx, const saber_am03_plan *plan,
+        const float *a, const float *bb, size_t n,
+        double h_w,
+        const float *r_b,
+        float *rrs_out
+);
+
+int saber_ctx_retrieve_r_rs_b_am03_planned_f(
+        const saber_ctx *ctx, const saber_am03_plan *plan,
+        const float *a, const float *bb, const float *r_rs_obs, size_t n,
+        double h_w,
+        float *r_rs_b_out
+);
+
+/*-------------------------------------------------------------*
+ *  Per-pixel inversion (Levenberg–Marquardt)                  *
+ *                                                             *
+ *  Parameter vector x, length SABER_INV_N_BASE + n_class:     *
+ *  the saber_inv_param entries followed by one bottom-class   *
+ *  fraction per fitted class. A workspace holds every buffer  *
+ *  the fit needs, so saber_invert_pixel() never allocates;    *
+ *  use one workspace per thread over a shared built context.  *
+ *-------------------------------------------------------------*/
+typedef enum saber_inv_param {
+    SABER_INV_CHL = 0,
+    SABER_INV_A_G_440,
+    SABER_INV_A_NAP_440,
+    SABER_INV_BB_P_550,
+    SABER_INV_A_G_S,
+    SABER_INV_A_NAP_S,
+    SABER_INV_BB_P_GAMMA,
+    SABER_INV_H_W,
+    SABER_INV_N_BASE            /* first bottom fraction */
+} saber_inv_param;
+
+typedef enum saber_inv_status {
+    SABER_INV_CONVERGED_COST = 1,   /* relative cost decrease below tol      */
+    SABER_INV_CONVERGED_STEP = 2,   /* relative step below tol               */
+    SABER_INV_CONVERGED_GRAD = 3,   /* projected gradient below tol * cost   */
+    SABER_INV_MAX_ITER       = 4,
+    SABER_INV_STALLED        = 5,   /* no damping lowered the cost           */
+    SABER_INV_MODEL_ERROR    = 6
+} saber_inv_status;
+
+/* Variable projection: for a given water column Rrs is affine in r_b and
+ * r_b linear in the fractions, so the fractions can be solved exactly at
+ * every evaluation and the nonlinear fit runs over the water column only */
+typedef enum saber_inv_varpro {
+    SABER_INV_VARPRO_OFF = 0,
+    SABER_INV_VARPRO_NNLS,          /* fractions >= 0                 */
+    SABER_INV_VARPRO_SUM_TO_ONE     /* fractions >= 0, summing to one */
+} saber_inv_varpro;
+
+typedef struct saber_inv_config {
+    int    water_type;
+    double theta_sun_deg;
+    double theta_view_deg;
+    int    shallow;
+
+    const char** class_names;   /* bottom classes whose fractions are fitted */
+    size_t       n_class;
+
+    const double* lower;        /* [n_par] or NULL for saber_inv_defaults() */
+    const double* upper;        /* [n_par] or NULL                          */
+    const int*    fit;          /* [n_par] 1 = free, NULL: chl, a_g_440,
+                                   a_nap_440, bb_p_550 (+ h_w, fractions
+                                   when shallow)                            */
+    int    max_iter;            /* 0 -> 100   */
+    double tol;                 /* 0 -> 1e-10 */
+    int    fd_jacobian;         /* 1: finite differences instead of the
+                                   analytic Jacobian                        */
+    int    varpro;              /* saber_inv_varpro, shallow only: every
+                                   fraction is solved, their bounds and fit
+                                   flags are not used                       */
+} saber_inv_config;
+
+typedef struct saber_inv_report {
+    int    status;              /* saber_inv_status */
+    int    iterations;
+    int    n_eval;              /* forward model evaluations */
+    double cost_initial;        /* 0.5 sum w (model - obs)^2 */
+    double cost_final;
+    double rmse;                /* weighted RMS residual     */
+} saber_inv_report;
+
+/* Workspaces are sized for the grid current at create time and return 2
+ * once another grid has been built or selected. One per thread. */
+typedef struct saber_inv_workspace saber_inv_workspace;
+
+size_t saber_inv_n_param(const saber_inv_config* cfg);
+int saber_inv_defaults(const saber_inv_config* cfg, double* x0, double* lower, double* upper);
+
+saber_inv_workspace* saber_inv_workspace_create(const saber_ctx* ctx, const saber_inv_config* cfg);
+void saber_inv_workspace_destroy(saber_inv_workspace* ws);
+void saber_inv_set_geometry(saber_inv_workspace* ws, double theta_sun_deg, double theta_view_deg);
+
+int saber_inv_model_jacobian(
+        saber_inv_workspace* ws,
+        const double* x,            /* [n_par]                     */
+        double* rrs_out,            /* [n]                         */
+        double* jac_out             /* [n_par x n], dRrs_i/dx_k at [k * n + i] */
+);
+
+int saber_invert_pixel(
+        saber_inv_workspace* ws,
+        const double* rrs_obs,      /* [n] on the context grid     */
+        const double* weights,      /* [n] or NULL                 */
+        const double* x0,           /* [n_par]                     */
+        double* x_out,              /* [n_par]                     */
+        saber_inv_report* report    /* optional                    */
+);
+
+/* Incremental forward model over the same parameter vector: per-band
+ * intermediate terms are kept between calls and only the stages
+ * downstream of the parameters that changed are recomputed, so sweeps
+ * and one-parameter steps in h_w or the fractions skip nearly every
+ * pow/exp. Uses the water type, geometry, shallow flag and classes of
+ * cfg. One evaluator per thread; stale once another grid is current. */
+typedef struct saber_inv_evaluator saber_inv_evaluator;
+
+saber_inv_evaluator* saber_inv_evaluator_create(const saber_ctx* ctx, const saber_inv_config* cfg);
+void saber_inv_evaluator_destroy(saber_inv_evaluator* ev);
+void saber_inv_evaluator_set_geometry(saber_inv_evaluator* ev, double theta_sun_deg, double theta_view_deg);
+
+int saber_inv_evaluate(
+        saber_inv_evaluator* ev,
+        const double* x,            /* [n_par]                     */
+        double* rrs_out             /* [n]                         */
+);
+
+/* Many candidate parameter vectors per call, evaluated side by side across
+ * the SIMD lanes: the cost kernel of population-based searches. Costs are
+ * saber_invert_pixel()'s 0.5 sum w (model - obs)^2; fractions are always
+ * taken from x. */
+int saber_inv_eval_population(
+        saber_inv_workspace* ws,
+        size_t n_pix, size_t n_cand,
+        const double* x,            /* [n_pix x n_cand x n_par]    */
+        const double* rrs_obs,      /* [n_pix x n]                 */
+        const double* weights,      /* [n] or NULL                 */
+        double* cost_out,           /* [n_pix x n_cand]            */
+        double* rrs_out             /* [n_pix x n_cand x n] or NULL */
+);
+
+typedef enum saber_global_method {
+    SABER_GLOBAL_DE = 0,            /* differential evolution (rand/1/bin)   */
+    SABER_GLOBAL_MULTISTART         /* sampled starts, then local fits       */
+} saber_global_method;
+
+typedef struct saber_global_config {
+    int    method;              /* saber_global_method                      */
+    size_t population;          /* 0 -> max(16, 10 x free parameters)       */
+    int    generations;         /* DE, 0 -> 200                             */
+    double f;                   /* DE differential weight, 0 -> 0.7         */
+    double cr;                  /* DE crossover rate,      0 -> 0.9         */
+    double tol;                 /* DE stop: worst - best <= tol * best,
+                                   0 -> 1e-6                                */
+    size_t n_starts;            /* multi-start local fits, 0 -> 4           */
+    int    polish;              /* DE: saber_invert_pixel() from the best   */
+    uint64_t seed;              /* 0: fixed default                         */
+} saber_global_config;
+
+int saber_invert_pixel_global(
+        saber_inv_workspace* ws,
+        const double* rrs_obs,      /* [n] on the context grid     */
+        const double* weights,      /* [n] or NULL                 */
+        const saber_global_config* gcfg,
+        const double* x0,           /* [n_par], also the fixed values */
+        double* x_out,              /* [n_par]                     */
+        saber_inv_report* report    /* optional                    */
+);
+
+/*-------------------------------------------------------------*
+ *  Lookup-table (LUT) inversion                               *
+ *                                                             *
+ *  A LUT tabulates the inversion model over a grid of         *
+ *  parameter axes once per sensor / geometry; searches return *
+ *  the nearest tabulated spectra, standalone or as x0 for     *
+ *  saber_invert_pixel(). Searches return 2 once another grid  *
+ *  has been built or selected.                                *
+ *-------------------------------------------------------------*/
+typedef struct saber_lut_axis {
+    int    param;               /* index in the inversion parameter vector */
+    double lo, hi;
+    size_t n;                   /* grid points, 1: fixed at lo             */
+    int    log_spacing;         /* 1: geometric spacing (lo, hi > 0)       */
+} saber_lut_axis;
+
+typedef struct saber_lut saber_lut;
+
+saber_lut* saber_lut_build(
+        const saber_ctx* ctx,
+        const saber_inv_config* cfg,
+        const double* x_fixed,              /* [n_par] or NULL */
+        const saber_lut_axis* axes, size_t n_axes,
+        const double* weights,              /* [n_wl] or NULL  */
+        size_t n_threads                    /* 0: all cores    */
+);
+void saber_lut_destroy(saber_lut* lut);
+size_t saber_lut_size(const saber_lut* lut);
+size_t saber_lut_n_param(const saber_lut* lut);
+int saber_lut_entry(const saber_lut* lut, size_t e, double* x_out);
+
+int saber_lut_search(
+        const saber_lut* lut,
+        const double* rrs, size_t n_pix, saber_layout layout,
+        size_t k,
+        size_t* idx_out,                    /* [n_pix x k], best first */
+        double* dist_out                    /* [n_pix x k] or NULL     */
+);
+
+int saber_lut_first_guess(
+        const saber_lut* lut,
+        const double* rrs, size_t n_pix, saber_layout layout,
+        double* x_out                       /* n_pix x n_par in layout */
+);
+
+/*-------------------------------------------------------------*
+ *  Scene processing                                           *
+ *                                                             *
+ *  One call runs an operation over a whole cube. Pixels are   *
+ *  split into tiles and scheduled on a work-stealing thread   *
+ *  pool, so a few slow tiles (shallow-water fits) do not      *
+ *  leave the other threads idle. Cubes use the batch layouts; *
+ *  only the fields the operation needs are read.              *
+ *-------------------------------------------------------------*/
+typedef enum saber_scene_op {
+    SABER_SCENE_IOP = 0,        /* values (schema params)   -> a_out, bb_out */
+    SABER_SCENE_MIXING,         /* values (schema classes)  -> r_b_out       */
+    SABER_SCENE_FORWARD,        /* a, bb (+ h_w, r_b)       -> rrs_out       */
+    SABER_SCENE_RETRIEVE,       /* a, bb, rrs, h_w          -> r_b_out       */
+    SABER_SCENE_INVERT,         /* rrs (+ x0, weights)      -> x_out         */
+    SABER_SCENE_UNMIX,          /* r_b                      -> fractions_out */
+    SABER_SCENE_DEPTH           /* rrs                      -> h_w_out       */
+} saber_scene_op;
+
+typedef struct saber_scene {
+    saber_scene_op op;
+    size_t         n_pix;
+    saber_layout   layout;              /* every n_pix x k cube below */
+
+    /* IOP / MIXING */
+    const saber_schema* schema;
+    const double* values;               /* n_pix x n_param or n_pix x n_class */
+
+    /* spectra on the context grid, n_pix x n_wl */
+    const double* a;
+    const double* bb;
+    const double* rrs;
+    const double* r_b;
+    const double* h_w;                  /* [n_pix] */
+
+    /* FORWARD / RETRIEVE geometry */
+    int    water_type;
+    double theta_sun_deg;
+    double theta_view_deg;
+    const double* theta_sun_pix;        /* [n_pix] or NULL, also used by INVERT */
+    const double* theta_view_pix;       /* [n_pix] or NULL */
+    int    shallow;
+
+    /* INVERT */
+    const saber_inv_config* inv;
+    const double* x0;                   /* n_pix x n_par, NULL: saber_inv_defaults() */
+    const double* weights;              /* [n_wl] shared by all pixels, or NULL */
+
+    /* UNMIX */
+    const saber_unmixer* unmixer;
+
+    /* DEPTH */
+    const saber_depth_solver* depth;
+
+    /* outputs */
+    double* a_out;
+    double* bb_out;
+    double* r_b_out;
+    double* rrs_out;
+    double* x_out;                      /* n_pix x n_par */
+    saber_inv_report* reports;          /* [n_pix] or NULL */
+    double* fractions_out;              /* n_pix x n_class */
+    double* rmse_out;                   /* [n_pix] or NULL, UNMIX / DEPTH */
+    double* h_w_out;                    /* [n_pix] */
+} saber_scene;
+
+typedef struct saber_scene_thread_stats {
+    double busy_s;                      /* time spent processing tiles */
+    double wall_s;                      /* time the thread was alive   */
+    size_t tiles;
+    size_t steals;
+} saber_scene_thread_stats;
+
+size_t saber_scene_default_threads(void);
+
+int saber_scene_run(
+        const saber_ctx* ctx,
+        const saber_scene* scene,
+        size_t n_threads,                   /* 0: saber_scene_default_threads() */
+        size_t tile_pix,                    /* 0: chosen from op and n_pix     */
+        saber_scene_thread_stats* stats     /* [n_threads] or NULL             */
+);
+
+/*-------------------------------------------------------------*
+ *  Runtime statistics                                         *
+ *                                                             *
+ *  Every context counts cache traffic, retrieval guard hits   *
+ *  and calls / pixels per stage. Kernels count into a block   *
+ *  of the calling thread, published to the context's relaxed  *
+ *  atomics every 64 calls, after batches and scene tiles, and *
+ *  when the thread reads the stats, changes context or exits. *
+ *  Counters live as long as the context, snapshot loads       *
+ *  included; saber_ctx_reset_stats() zeroes them. What other  *
+ *  threads still hold for a destroyed context is dropped.     *
+ *  Stage wall times are only taken once timing is switched on.*
+ *  Built with SABER_STATS=0 the counters are compiled out and *
+ *  saber_stats_enabled() returns 0.                           *
+ *-------------------------------------------------------------*/
+typedef enum saber_stage {
+    SABER_STAGE_IOP = 0,
+    SABER_STAGE_MIXING,
+    SABER_STAGE_FORWARD,
+    SABER_STAGE_RETRIEVE,
+    SABER_STAGE_INVERT,
+    SABER_STAGE_UNMIX,
+    SABER_STAGE_DEPTH,
+    SABER_STAGE_N
+} saber_stage;
+
+typedef struct saber_stats {
+    uint64_t cache_builds;          /* grids built, explicitly or by an ensure miss */
+    uint64_t cache_hits;            /* ensure calls served by the current grid      */
+    uint64_t cache_spare_hits;      /* ensure calls served by an earlier grid       */
+    uint64_t cache_evictions;       /* earlier grids dropped to make room           */
+    uint64_t grid_rejects;          /* kernel calls refused with code 2 (no grid)   */
+    uint64_t build_ns;              /* time spent building, with timing on          */
+
+    uint64_t snell_hits;            /* snell_law() answered by its one-entry cache  */
+    uint64_t snell_misses;
+
+    uint64_t retrieve_ext_guard;    /* bands zeroed because a + bb <= 0             */
+    uint64_t retrieve_denom_guard;  /* spectra zeroed by the denominator guard      */
+
+    uint64_t stage_calls[SABER_STAGE_N];    /* kernel calls or scene runs */
+    uint64_t stage_pixels[SABER_STAGE_N];
+    uint64_t stage_ns[SABER_STAGE_N];       /* with timing on */
+} saber_stats;
+
+int  saber_stats_enabled(void);
+int  saber_ctx_get_stats(const saber_ctx* ctx, saber_stats* out);
+void saber_ctx_reset_stats(saber_ctx* ctx);
+int  saber_ctx_set_timing(saber_ctx* ctx, int enabled);
+
+/*-------------------------------------------------------------*
+ *  ENVI cube I/O                                              *
+ *                                                             *
+ *  Cubes are memory-mapped, never read whole. Tiles of whole  *
+ *  lines are exposed directly when the file's interleave and  *
+ *  type already match a kernel layout (saber_cube_view), and  *
+ *  converted straight from the mapping otherwise.             *
+ *-------------------------------------------------------------*/
+typedef enum saber_interleave {
+    SABER_INTERLEAVE_BSQ = 0,
+    SABER_INTERLEAVE_BIL = 1,
+    SABER_INTERLEAVE_BIP = 2
+} saber_interleave;
+
+typedef struct saber_cube saber_cube;
+
+saber_cube* saber_cube_open(const char* path, int writable);
+saber_cube* saber_cube_create(
+        const char* path,
+        size_t samples, size_t lines, size_t bands,
+        saber_interleave interleave, int data_type,     /* ENVI code: 4 float32, 5 float64 */
+        const double* wavelength, const char** band_names
+);
+int  saber_cube_sync(saber_cube* c);
+void saber_cube_close(saber_cube* c);
+
+size_t saber_cube_samples(const saber_cube* c);
+size_t saber_cube_lines(const saber_cube* c);
+size_t saber_cube_bands(const saber_cube* c);
+saber_interleave saber_cube_interleave(const saber_cube* c);
+int saber_cube_data_type(const saber_cube* c);
+const double* saber_cube_wavelength(const saber_cube* c);      /* NULL if absent */
+const char* const* saber_cube_band_names(const saber_cube* c);  /* NULL if absent */
+
+const double* saber_cube_view(const saber_cube* c, size_t line0, size_t n_lines, saber_layout* layout);
+double* saber_cube_view_rw(saber_cube* c, size_t line0, size_t n_lines, saber_layout* layout);
+
+int saber_cube_read_tile(
+        const saber_cube* c,
+        size_t line0, size_t n_lines,
+        const size_t* band_idx, size_t n_band,  /* NULL: all bands */
+        saber_layout layout,
+        double* out                             /* [n_lines * samples x n_band] */
+);
+
+int saber_cube_write_tile(
+        saber_cube* c,
+        size_t line0, size_t n_lines,
+        const size_t* band_idx, size_t n_band,
+        saber_layout layout,
+        const double* in
+);
+
+/*-------------------------------------------------------------*
+ *  Legacy global API (thin wrappers over saber_default_ctx()) *
+ *-------------------------------------------------------------*/
+
 // Global memory setters
 int load_pure_water(const double* wl, const double* a, size_t n);
 int load_a0_a1(const double* wl, const double* a0, const double* a1, size_t n);
@@ -0,0 +1,534 @@
+/*
+ * AM03 forward and r_rs_b retrieval: cores, single-spectrum and batched
+ * context entry points, written once and instantiated by forward_model.c
+ * in double and in float so the two precisions cannot drift apart.
+ *
+ * The including file defines before every inclusion:
+ *   SK_REAL        element type (double or float)
+ *   SK_FN(name)    symbol for this precision (name, or name##_f)
+ *   SK_VM          vm_impl or vmf_impl
+ *   SK_SELECT      vm_select or vmf_select
+ *   SK_POW, SK_FABS  libm functions of this precision
+ *
+ * Angles and depth arrive in double; geometry factors come from an
+ * am03_plan, computed in double and rounded once. No include guard on
+ * purpose.
+ */
+
+#define SK_C(x) ((SK_REAL)(x))
+
+/* exp(-h_w (Kd + kuW)) and exp(-h_w (Kd + kuB)) for one block of bands.
+ * Both pow() calls and both exp() calls go through the vector layer. */
+static void SK_FN(am03_block_exps)(
+        const SK_VM *vm,
+        const am03_plan *pl,
+        const SK_REAL *ext,
+        const SK_REAL *omega_b,
+        size_t m,
+        SK_REAL h_w,
+        SK_REAL *exp_W,
+        SK_REAL *exp_B
+) {
+    const SK_REAL k0       = SK_C(pl->k0);
+    const SK_REAL cos_sun  = SK_C(pl->cos_sun);
+    const SK_REAL cos_view = SK_C(pl->cos_view);
+    const SK_REAL c_W      = SK_C(pl->c_W);
+    const SK_REAL c_B      = SK_C(pl->c_B);
+
+    SK_REAL base[VM_BLOCK];
+    for (size_t j = 0; j < m; j++) base[j] = 1 + omega_b[j];
+    vm->pow2(base, SK_C(3.5421), SK_C(2.2658), exp_W, exp_B, m);
+
+    for (size_t j = 0; j < m; j++) {
+        SK_REAL Kd  = k0 * (ext[j] / cos_sun);
+        SK_REAL kuW = (ext[j] / cos_view) * exp_W[j] * c_W;
+        SK_REAL kuB = (ext[j] / cos_view) * exp_B[j] * c_B;
+        exp_W[j] = -h_w * (Kd + kuW);
+        exp_B[j] = -h_w * (Kd + kuB);
+    }
+    vm->exp(exp_W, exp_W, m);
+    vm->exp(exp_B, exp_B, m);
+}
+
+/* Forward loop for one (water type, shallow) case. Always inlined with
+ * constant flags, so each case compiles to its own loop without the
+ * per-band branches. */
+AM03_INLINE void SK_FN(am03_forward_loop)(
+        const SK_VM *vm,
+        const am03_plan *pl,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        size_t n,
+        size_t stride,
+        double h_w,
+        const SK_REAL *r_b,
+        SK_REAL *rrs_out,
+        const int type1,
+        const int shallow
+) {
+    const SK_REAL g_sun  = SK_C(pl->g_sun);
+    const SK_REAL g_view = SK_C(pl->g_view);
+
+    const SK_REAL Ars1 = SK_C(1.1576);
+    const SK_REAL Ars2 = SK_C(1.0389);
+
+    SK_REAL ext[VM_BLOCK], omega_b[VM_BLOCK], exp_W[VM_BLOCK], exp_B[VM_BLOCK];
+
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = (b0 + j) * stride;
+            ext[j]     = a[i] + bb[i];
+            omega_b[j] = ext[j] == 0 ? 0 : bb[i] / ext[j];
+        }
+
+        if (shallow)
+            SK_FN(am03_block_exps)(vm, pl, ext, omega_b, m, SK_C(h_w), exp_W, exp_B);
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = (b0 + j) * stride;
+            if (ext[j] == 0) {
+                rrs_out[i] = 0;
+                continue;
+            }
+            SK_REAL w = omega_b[j];
+
+            // Fresnel & geometry factor
+            SK_REAL f_rs;
+            if (type1) {
+                f_rs = SK_C(0.095);
+            } else {
+                f_rs = SK_C(0.0512) *
+                       (1 + SK_C(4.6659) * w +
+                        SK_C(-7.8387) * w * w +
+                        SK_C(5.4571) * w * w * w) *
+                       g_sun *
+                       g_view;
+            }
+
+            SK_REAL rrs_deep = f_rs * w;
+
+            if (shallow) {
+                rrs_out[i] = rrs_deep * (1 - (Ars1 * exp_W[j])) +
+                             Ars2 * r_b[i] * exp_B[j];
+            } else {
+                rrs_out[i] = rrs_deep;
+            }
+        }
+    }
+}
+
+/* One spectrum under a plan; consecutive bands are `stride` elements apart
+ * in a, bb, r_b and rrs_out. Bands are processed in blocks of VM_BLOCK so
+ * the transcendental calls can run as array operations. */
+int SK_FN(am03_forward_core)(
+        const SK_VM *vm,
+        const am03_plan *pl,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        size_t n,
+        size_t stride,
+        double h_w,
+        const SK_REAL *r_b,
+        SK_REAL *rrs_out
+) {
+    if (pl->water_type == 1) {
+        if (pl->shallow) SK_FN(am03_forward_loop)(vm, pl, a, bb, n, stride, h_w, r_b, rrs_out, 1, 1);
+        else             SK_FN(am03_forward_loop)(vm, pl, a, bb, n, stride, h_w, r_b, rrs_out, 1, 0);
+    } else {
+        if (pl->shallow) SK_FN(am03_forward_loop)(vm, pl, a, bb, n, stride, h_w, r_b, rrs_out, 0, 1);
+        else             SK_FN(am03_forward_loop)(vm, pl, a, bb, n, stride, h_w, r_b, rrs_out, 0, 0);
+    }
+    return 0;
+}
+
+/* Retrieval loop for one water type, specialised like the forward one */
+AM03_INLINE int SK_FN(am03_retrieve_loop)(
+        const SK_VM *vm,
+        const am03_plan *pl,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        const SK_REAL *r_rs_obs,
+        size_t        n,
+        size_t        stride,
+        double        h_w,
+        SK_REAL      *r_rs_b_out,
+        const int     type1
+) {
+    /* --- 2. Constant coefficients (Albert & Mobley 2003) --------------- */
+    const SK_REAL Ars1 = SK_C(1.1576);
+    const SK_REAL Ars2 = SK_C(1.0389);
+
+    const SK_REAL g_sun  = SK_C(pl->g_sun);
+    const SK_REAL g_view = SK_C(pl->g_view);
+
+    SK_REAL ext[VM_BLOCK], omega_b[VM_BLOCK], exp_W[VM_BLOCK], exp_B[VM_BLOCK];
+
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        const size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+
+        for (size_t j = 0; j < m; j++) {
+            const size_t i = (b0 + j) * stride;
+            ext[j]     = a[i] + bb[i];                      /* total attenuation a+bb    */
+            omega_b[j] = ext[j] <= 0 ? 0 : bb[i] / ext[j];  /* single-backscatter albedo */
+        }
+
+        /* ----- 2b. Diffuse attenuation, exponential terms once per band */
+        SK_FN(am03_block_exps)(vm, pl, ext, omega_b, m, SK_C(h_w), exp_W, exp_B);
+
+        for (size_t j = 0; j < m; ++j) {
+            const size_t i = (b0 + j) * stride;
+
+            if (ext[j] <= 0) {                  /* avoid division by zero  */
+                STAT_LOCAL(STAT_RETRIEVE_EXT_GUARD);
+                r_rs_b_out[i] = 0;
+                continue;
+            }
+
+            const SK_REAL w = omega_b[j];
+
+            /* ----- 2a. Fresnel/geometry factor f_rs (deep water) ------- */
+            SK_REAL f_rs;
+            if (type1) {                        /* turbid case */
+                f_rs = SK_C(0.095);
+            } else {                            /* clear / case-1 water  */
+                f_rs = SK_C(0.0512) *
+                       (1 + SK_C(4.6659)  * w
+                        - SK_C(7.8387) * w * w
+                        + SK_C(5.4571) * SK_POW(w, SK_C(3.0))) *
+                       g_sun *
+                       g_view;
+            }
+
+            const SK_REAL rrs_deep = f_rs * w;
+
+            /* ----- 3. Invert the shallow-water equation for r_b -------- */
+            const SK_REAL numerator   = r_rs_obs[i] - rrs_deep * (1 - Ars1 * exp_W[j]);
+            const SK_REAL denominator = Ars2 * exp_B[j];
+
+            if (SK_FABS(denominator) < SK_C(1e-12)) {   /* guard against blow-ups */
+                STAT_LOCAL(STAT_RETRIEVE_DENOM_GUARD);
+                r_rs_b_out[i] = 0;
+                return 4;
+            }
+
+            r_rs_b_out[i] = numerator / denominator;
+        }
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------------------------*/
+/*  Recover bottom reflectance r_b(λ) from observed Rrs(λ)                 */
+/*                                                                         */
+/*  The column is always treated as shallow, whatever pl->shallow says.    */
+/*  Returns 0 on success, >0 on error:                                     */
+/*      4 – denominator ≈ 0 (numerically unstable)                         */
+/*-------------------------------------------------------------------------*/
+int SK_FN(am03_retrieve_core)(
+        const SK_VM *vm,
+        const am03_plan *pl,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        const SK_REAL *r_rs_obs,
+        size_t        n,
+        size_t        stride,       /* distance between bands     */
+        double        h_w,
+        SK_REAL      *r_rs_b_out
+)
+{
+    if (pl->water_type == 1)
+        return SK_FN(am03_retrieve_loop)(vm, pl, a, bb, r_rs_obs, n, stride, h_w, r_rs_b_out, 1);
+    return SK_FN(am03_retrieve_loop)(vm, pl, a, bb, r_rs_obs, n, stride, h_w, r_rs_b_out, 0);
+}
+
+static int SK_FN(am03_forward)(
+        const SK_VM *vm,
+        const double *wavelength,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        int shallow,
+        double h_w,
+        const SK_REAL *r_b,
+        SK_REAL *rrs_out
+) {
+    if (!wavelength || !a || !bb || !rrs_out) return 1;
+    if (shallow && (!r_b || h_w < 0)) return 2;
+
+    // Compute viewing geometry
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+
+    am03_plan pl;
+    if (am03_plan_init(&pl, water_type, shallow, view_w_rad, sun_w_rad)) return 3;
+    return SK_FN(am03_forward_core)(vm, &pl, a, bb, n, 1, h_w, r_b, rrs_out);
+}
+
+static int SK_FN(am03_retrieve_r_rs_b)(
+        const SK_VM *vm,
+        const double *wavelength,   /* [n] λ  (nm)               */
+        const SK_REAL *a,           /* [n] absorption a(λ)       */
+        const SK_REAL *bb,          /* [n] backscatter bb(λ)     */
+        const SK_REAL *r_rs_obs,    /* [n] observed Rrs(λ)       */
+        size_t        n,            /* number of bands           */
+        int           water_type,   /* 0 = clear, 1 = turbid     */
+        double        theta_sun_deg,
+        double        theta_view_deg,
+        double        h_w,          /* water depth  (m)          */
+        SK_REAL      *r_rs_b_out    /* [n]  ← recovered r_b(λ)   */
+)
+{
+    if (!wavelength || !a || !bb || !r_rs_obs || !r_rs_b_out) return 1;
+    if (h_w <= 0.0) return 2;           /* bottom retrieval only makes sense for shallow water */
+
+    /* --- 1. Snell conversion of angles to water column ----------------- */
+    double view_w_rad = 0.0, sun_w_rad = 0.0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+
+    am03_plan pl;
+    if (am03_plan_init(&pl, water_type, 1, view_w_rad, sun_w_rad)) return 3;
+    return SK_FN(am03_retrieve_core)(vm, &pl, a, bb, r_rs_obs, n, 1, h_w, r_rs_b_out);
+}
+
+// ---------- Context entry points ----------
+
+int SK_FN(saber_ctx_forward_am03)(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        int shallow,
+        double h_w,
+        const SK_REAL *r_b,
+        SK_REAL *rrs_out
+) {
+    if (!ctx) return 1;
+    STAT_CLOCK_BEGIN(ctx);
+    int rc = SK_FN(am03_forward)(SK_SELECT(ctx->accuracy), wavelength, a, bb, n, water_type,
+                                 theta_sun_deg, theta_view_deg, shallow, h_w, r_b, rrs_out);
+    if (rc == 0) STAT_STAGE_END(ctx, SABER_STAGE_FORWARD, 1);
+    return rc;
+}
+
+int SK_FN(saber_ctx_retrieve_r_rs_b_am03)(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        const SK_REAL *r_rs_obs,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        double h_w,
+        SK_REAL *r_rs_b_out
+) {
+    if (!ctx) return 1;
+    STAT_CLOCK_BEGIN(ctx);
+    int rc = SK_FN(am03_retrieve_r_rs_b)(SK_SELECT(ctx->accuracy), wavelength, a, bb, r_rs_obs, n,
+                                         water_type, theta_sun_deg, theta_view_deg, h_w, r_rs_b_out);
+    if (rc == 0 || rc == 4) STAT_STAGE_END(ctx, SABER_STAGE_RETRIEVE, 1);
+    return rc;
+}
+
+/**
+ * forward_am03() under a plan from saber_am03_plan_create(): water type,
+ * shallowness and geometry come from the plan.
+ *
+ * @return 0 on success, 1 null pointer, 2 shallow plan without r_b or with
+ *         a negative depth
+ */
+int SK_FN(saber_ctx_forward_am03_planned)(
+        const saber_ctx *ctx,
+        const saber_am03_plan *plan,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        size_t n,
+        double h_w,
+        const SK_REAL *r_b,
+        SK_REAL *rrs_out
+) {
+    if (!ctx || !plan || !a || !bb || !rrs_out) return 1;
+    if (plan->shallow && (!r_b || h_w < 0)) return 2;
+
+    STAT_CLOCK_BEGIN(ctx);
+    int rc = SK_FN(am03_forward_core)(SK_SELECT(ctx->accuracy), plan, a, bb, n, 1,
+                                      h_w, r_b, rrs_out);
+    STAT_STAGE_END(ctx, SABER_STAGE_FORWARD, 1);
+    return rc;
+}
+
+/**
+ * retrieve_r_rs_b_am03() under a plan; the plan's shallow flag is ignored.
+ *
+ * @return 0 on success, 1 null pointer, 2 h_w <= 0, 4 denominator guard hit
+ */
+int SK_FN(saber_ctx_retrieve_r_rs_b_am03_planned)(
+        const saber_ctx *ctx,
+        const saber_am03_plan *plan,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        const SK_REAL *r_rs_obs,
+        size_t n,
+        double h_w,
+        SK_REAL *r_rs_b_out
+) {
+    if (!ctx || !plan || !a || !bb || !r_rs_obs || !r_rs_b_out) return 1;
+    if (h_w <= 0.0) return 2;
+
+    STAT_CLOCK_BEGIN(ctx);
+    int rc = SK_FN(am03_retrieve_core)(SK_SELECT(ctx->accuracy), plan, a, bb, r_rs_obs, n, 1,
+                                       h_w, r_rs_b_out);
+    STAT_STAGE_END(ctx, SABER_STAGE_RETRIEVE, 1);
+    return rc;
+}
+
+// ---------- Batched entry points ----------
+
+/**
+ * Batched forward_am03() over n_pix spectra on the same band set.
+ *
+ * a, bb, r_b and rrs_out hold n_pix x n values in `layout`
+ * (PIXEL_MAJOR: band i of pixel p at [p * n + i]; BAND_MAJOR: [i * n_pix + p]).
+ * theta_sun_pix / theta_view_pix are optional [n_pix] per-pixel angles that
+ * override the scalar ones. h_w is [n_pix] and, like r_b, only read when
+ * `shallow` is set.
+ *
+ * @return 0 on success, 1 null pointer, 2 shallow without r_b / h_w or a
+ *         negative depth, 3 invalid water_type or layout
+ */
+int SK_FN(saber_ctx_forward_am03_batch)(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,
+        const double *theta_view_pix,
+        int shallow,
+        const double *h_w,
+        const SK_REAL *r_b,
+        saber_layout layout,
+        SK_REAL *rrs_out
+) {
+    if (!ctx || !wavelength || !a || !bb || !rrs_out) return 1;
+    if (shallow && (!r_b || !h_w)) return 2;
+    if (water_type != 1 && water_type != 2) return 3;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+    if (shallow) {
+        for (size_t px = 0; px < n_pix; px++)
+            if (h_w[px] < 0) return 2;
+    }
+
+    STAT_CLOCK_BEGIN(ctx);
+    const SK_VM *vm = SK_SELECT(ctx->accuracy);
+    int band_major = layout == SABER_LAYOUT_BAND_MAJOR;
+    size_t stride  = band_major ? n_pix : 1;
+    int per_pixel_geometry = theta_sun_pix || theta_view_pix;
+
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+
+    am03_plan pl;
+    am03_plan_init(&pl, water_type, shallow, view_w_rad, sun_w_rad);
+
+    for (size_t px = 0; px < n_pix; px++) {
+        size_t off = band_major ? px : px * n;
+        if (per_pixel_geometry) {
+            pixel_geometry(theta_sun_deg, theta_view_deg, theta_sun_pix, theta_view_pix,
+                           px, &view_w_rad, &sun_w_rad);
+            am03_plan_init(&pl, water_type, shallow, view_w_rad, sun_w_rad);
+        }
+
+        SK_FN(am03_forward_core)(vm, &pl, a + off, bb + off, n, stride,
+                                 shallow ? h_w[px] : 0.0,
+                                 shallow ? r_b + off : NULL, rrs_out + off);
+    }
+
+    STAT_STAGE_END(ctx, SABER_STAGE_FORWARD, n_pix);
+    return 0;
+}
+
+/**
+ * Batched retrieve_r_rs_b_am03(). Same layout rules as
+ * saber_ctx_forward_am03_batch(); h_w is [n_pix].
+ *
+ * Unlike the single-pixel call, a pixel hitting the denominator guard does
+ * not stop the batch: that pixel's output is zeroed, the other pixels are
+ * still processed and 4 is returned at the end.
+ *
+ * @return 0 on success, 1 null pointer, 2 h_w <= 0 for some pixel,
+ *         3 invalid water_type or layout, 4 denominator guard hit
+ */
+int SK_FN(saber_ctx_retrieve_r_rs_b_am03_batch)(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const SK_REAL *a,
+        const SK_REAL *bb,
+        const SK_REAL *r_rs_obs,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,
+        const double *theta_view_pix,
+        const double *h_w,
+        saber_layout layout,
+        SK_REAL *r_rs_b_out
+) {
+    if (!ctx || !wavelength || !a || !bb || !r_rs_obs || !h_w || !r_rs_b_out) return 1;
+    if (water_type != 1 && water_type != 2) return 3;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+    for (size_t px = 0; px < n_pix; px++)
+        if (h_w[px] <= 0.0) return 2;
+
+    STAT_CLOCK_BEGIN(ctx);
+    const SK_VM *vm = SK_SELECT(ctx->accuracy);
+    int band_major = layout == SABER_LAYOUT_BAND_MAJOR;
+    size_t stride  = band_major ? n_pix : 1;
+    int per_pixel_geometry = theta_sun_pix || theta_view_pix;
+
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+
+    am03_plan pl;
+    am03_plan_init(&pl, water_type, 1, view_w_rad, sun_w_rad);
+
+    int status = 0;
+    for (size_t px = 0; px < n_pix; px++) {
+        size_t off = band_major ? px : px * n;
+        if (per_pixel_geometry) {
+            pixel_geometry(theta_sun_deg, theta_view_deg, theta_sun_pix, theta_view_pix,
+                           px, &view_w_rad, &sun_w_rad);
+            am03_plan_init(&pl, water_type, 1, view_w_rad, sun_w_rad);
+        }
+
+        int rc = SK_FN(am03_retrieve_core)(vm, &pl, a + off, bb + off, r_rs_obs + off, n, stride,
+                                           h_w[px], r_rs_b_out + off);
+        if (rc == 4) {
+            for (size_t k = 0; k < n; k++)
+                r_rs_b_out[off + k * stride] = 0;
+            status = 4;
+        }
+    }
+
+    STAT_STAGE_END(ctx, SABER_STAGE_RETRIEVE, n_pix);
+    return status;
+}
+
+#undef SK_C
@@ -0,0 +1,324 @@
+#include "bathymetry.h"
+#include "data_cache.h"
+#include "forward_model.h"
+#include "r_rs_b_lmm.h"
+#include <math.h>
+#include <stdlib.h>
+
+/* Pixels per scan product: the block of scores stays in cache while its
+ * pixels are refined */
+#define DEPTH_BLOCK 64
+
+#define DEPTH_MAX_ITER 50
+#define DEPTH_XTOL     1e-10        /* relative to 1 + h */
+
+static const double Ars1 = 1.1576;
+static const double Ars2 = 1.0389;
+
+struct depth_workspace {
+    double* score;          /* DEPTH_BLOCK x DEPTH_SCAN */
+    const double** rows;    /* operand rows of lmm_mix_dense() */
+    double* e_W;            /* [n_wl] */
+    double* e_B;            /* [n_wl] */
+};
+
+depth_workspace* depth_workspace_create(const saber_depth_solver* d)
+{
+    depth_workspace* ws = calloc(1, sizeof(*ws));
+    if (!ws) return NULL;
+    ws->score = malloc(sizeof(double) * DEPTH_BLOCK * DEPTH_SCAN);
+    ws->rows  = malloc(sizeof(double*) * 2 * d->n_wl);
+    ws->e_W   = malloc(sizeof(double) * d->n_wl);
+    ws->e_B   = malloc(sizeof(double) * d->n_wl);
+    if (!ws->score || !ws->rows || !ws->e_W || !ws->e_B) {
+        depth_workspace_destroy(ws);
+        return NULL;
+    }
+    return ws;
+}
+
+void depth_workspace_destroy(depth_workspace* ws)
+{
+    if (!ws) return;
+    free(ws->score);
+    free(ws->rows);
+    free(ws->e_W);
+    free(ws->e_B);
+    free(ws);
+}
+
+/* Both exponentials of every band at depth h, into e_W and e_B */
+static void depth_exps(const saber_depth_solver* d, double h, double* e_W, double* e_B)
+{
+    for (size_t i = 0; i < d->n_wl; i++) {
+        e_W[i] = -h * d->k_W[i];
+        e_B[i] = -h * d->k_B[i];
+    }
+    d->vm->exp(e_W, e_W, d->n_wl);
+    d->vm->exp(e_B, e_B, d->n_wl);
+}
+
+/* 0.5 sum w (Rrs(h) - y)^2 and its first two derivatives in h */
+static double depth_eval(const saber_depth_solver* d, depth_workspace* ws,
+                         const double* y, size_t stride, double h, double* g, double* H)
+{
+    depth_exps(d, h, ws->e_W, ws->e_B);
+
+    double f = 0.0, g1 = 0.0, g2 = 0.0;
+    for (size_t i = 0; i < d->n_wl; i++) {
+        double tW = d->deep[i] * Ars1 * ws->e_W[i];
+        double tB = d->q_B[i] * ws->e_B[i];
+        double r  = d->deep[i] * (1 - (Ars1 * ws->e_W[i])) + tB - y[i * stride];
+        double m1 = tW * d->k_W[i] - tB * d->k_B[i];
+        double m2 = tB * d->k_B[i] * d->k_B[i] - tW * d->k_W[i] * d->k_W[i];
+        double wr = d->w[i] * r;
+        f  += wr * r;
+        g1 += wr * m1;
+        g2 += d->w[i] * m1 * m1 + wr * m2;
+    }
+    *g = g1;
+    *H = g2;
+    return 0.5 * f;
+}
+
+/* One pixel from its scan scores: the best scan depth and its neighbours
+ * bracket the minimum, then safeguarded Newton on the misfit's slope,
+ * bisecting whenever the step leaves the bracket or the curvature is not
+ * positive. */
+static int depth_pixel(const saber_depth_solver* d, depth_workspace* ws,
+                       const double* y, size_t stride, const double* score,
+                       double* h, double* rmse)
+{
+    size_t best = DEPTH_SCAN;
+    double best_score = INFINITY;
+    for (size_t s = 0; s < DEPTH_SCAN; s++)
+        if (score[s] < best_score) {
+            best_score = score[s];
+            best = s;
+        }
+    if (best == DEPTH_SCAN) {           /* non-finite bands */
+        *h = *rmse = NAN;
+        return 0;
+    }
+
+    double lo = d->h_scan[best > 0 ? best - 1 : 0];
+    double hi = d->h_scan[best + 1 < DEPTH_SCAN ? best + 1 : best];
+    double x  = d->h_scan[best];
+    double f = 0.0, g, H;
+    int it;
+    for (it = 0; it < DEPTH_MAX_ITER; it++) {
+        f = depth_eval(d, ws, y, stride, x, &g, &H);
+        if (g < 0)      lo = x;
+        else if (g > 0) hi = x;
+        else break;
+
+        double tol = DEPTH_XTOL * (1 + x);
+        if (hi - lo <= tol) break;
+        double xn = x - g / H;
+        if (!(H > 0) || !(xn > lo && xn < hi)) xn = 0.5 * (lo + hi);
+        if (fabs(xn - x) <= tol) break;
+        x = xn;
+    }
+
+    *h    = x;
+    *rmse = sqrt(2.0 * f / d->w_sum);
+    return it == DEPTH_MAX_ITER ? 4 : 0;
+}
+
+int depth_pixels(const saber_depth_solver* d, depth_workspace* ws,
+                 const double* rrs, size_t n_pix, int band_major, size_t px0, size_t px1,
+                 double* h_out, double* rmse)
+{
+    size_t n_wl = d->n_wl;
+    size_t stride = band_major ? n_pix : 1;
+    int status = 0;
+
+    const double** a = ws->rows;
+    const double** b = ws->rows + n_wl;
+    for (size_t i = 0; i < n_wl; i++) b[i] = d->wm_t + i * DEPTH_SCAN;
+
+    for (size_t b0 = px0; b0 < px1; b0 += DEPTH_BLOCK) {
+        size_t m = px1 - b0 < DEPTH_BLOCK ? px1 - b0 : DEPTH_BLOCK;
+
+        /* misfit at every scan depth, up to the pixel's own constant
+         * 0.5 sum w y^2, for the whole block in one product */
+        for (size_t i = 0; i < n_wl; i++)
+            a[i] = band_major ? rrs + i * n_pix + b0 : rrs + b0 * n_wl + i;
+        lmm_mix_dense(m, DEPTH_SCAN, n_wl, a, band_major ? 1 : n_wl, b, ws->score, DEPTH_SCAN);
+
+        for (size_t r = 0; r < m; r++) {
+            size_t px = b0 + r;
+            double* score = ws->score + r * DEPTH_SCAN;
+            for (size_t s = 0; s < DEPTH_SCAN; s++) score[s] = d->half_mm[s] - score[s];
+
+            double e;
+            const double* y = rrs + (band_major ? px : px * n_wl);
+            if (depth_pixel(d, ws, y, stride, score, h_out + px, &e)) status = 4;
+            if (rmse) rmse[px] = e;
+        }
+    }
+    return status;
+}
+
+// ---------- Public API ----------
+
+void saber_depth_solver_destroy(saber_depth_solver* d)
+{
+    if (!d) return;
+    free(d->deep);
+    free(d->k_W);
+    free(d->k_B);
+    free(d->q_B);
+    free(d->w);
+    free(d->wm_t);
+    free(d);
+}
+
+/**
+ * Prepare depth retrieval for one region whose water column (a, bb) and
+ * bottom (r_b), all [n_wl] on the context's current grid, are known.
+ * Everything in AM03 that does not depend on depth (rrs_deep, Kd, kuW,
+ * kuB) is evaluated here once, the model is tabulated at DEPTH_SCAN
+ * depths spread evenly in log(1 + h) over [h_min, h_max], and each pixel
+ * then costs a scan product plus two exponentials per band per Newton
+ * iteration.
+ *
+ * The plan gives water type and geometry; it is used as a shallow plan
+ * whatever its flag. Band weights (NULL = all 1, 0 masks a band) weigh
+ * the squared misfit. Transcendentals follow the context's accuracy at
+ * create time. Like an unmixer, the solver is tied to its grid.
+ *
+ * @return new solver, or NULL on bad arguments / no grid / no memory
+ */
+saber_depth_solver* saber_depth_solver_create(
+        const saber_ctx* ctx, const saber_am03_plan* plan,
+        const double* a, const double* bb, const double* r_b,
+        const double* weights, double h_min, double h_max
+) {
+    if (!ctx || !plan || !a || !bb || !r_b || !ctx->grid.wl) return NULL;
+    if (!(h_min >= 0.0 && h_max > h_min) || !isfinite(h_max)) return NULL;
+
+    size_t n = ctx->grid.n_wl;
+    double w_sum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double wi = weights ? weights[i] : 1.0;
+        if (!(wi >= 0.0) || !isfinite(wi)) return NULL;
+        w_sum += wi;
+    }
+    if (!(w_sum > 0.0)) return NULL;
+
+    saber_depth_solver* d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    d->ctx        = ctx;
+    d->grid_token = ctx->grid.token;
+    d->vm         = vm_select(ctx->accuracy);
+    d->n_wl       = n;
+    d->w_sum      = w_sum;
+    d->h_min      = h_min;
+    d->h_max      = h_max;
+    d->deep = malloc(sizeof(double) * n);
+    d->k_W  = malloc(sizeof(double) * n);
+    d->k_B  = malloc(sizeof(double) * n);
+    d->q_B  = malloc(sizeof(double) * n);
+    d->w    = malloc(sizeof(double) * n);
+    d->wm_t = malloc(sizeof(double) * n * DEPTH_SCAN);
+    double* e = malloc(sizeof(double) * 2 * n);
+    if (!d->deep || !d->k_W || !d->k_B || !d->q_B || !d->w || !d->wm_t || !e) {
+        free(e);
+        saber_depth_solver_destroy(d);
+        return NULL;
+    }
+
+    /* Depth-independent terms, as am03_block_exps() and the forward loop
+     * compute them */
+    const double k0 = plan->k0, cos_sun = plan->cos_sun, cos_view = plan->cos_view;
+    double ext[VM_BLOCK], omega_b[VM_BLOCK], base[VM_BLOCK], p_W[VM_BLOCK], p_B[VM_BLOCK];
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+        for (size_t j = 0; j < m; j++) {
+            size_t i = b0 + j;
+            ext[j]     = a[i] + bb[i];
+            omega_b[j] = ext[j] == 0 ? 0 : bb[i] / ext[j];
+            base[j]    = 1 + omega_b[j];
+        }
+        d->vm->pow2(base, 3.5421, 2.2658, p_W, p_B, m);
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = b0 + j;
+            d->w[i] = weights ? weights[i] : 1.0;
+            if (ext[j] == 0) {
+                d->deep[i] = d->k_W[i] = d->k_B[i] = d->q_B[i] = 0.0;
+                continue;
+            }
+            double w = omega_b[j];
+            double f_rs = plan->water_type == 1
+                          ? 0.095
+                          : 0.0512 * (1 + 4.6659 * w + -7.8387 * w * w + 5.4571 * w * w * w) *
+                            plan->g_sun * plan->g_view;
+            double Kd  = k0 * (ext[j] / cos_sun);
+            double kuW = (ext[j] / cos_view) * p_W[j] * plan->c_W;
+            double kuB = (ext[j] / cos_view) * p_B[j] * plan->c_B;
+            d->deep[i] = f_rs * w;
+            d->k_W[i]  = Kd + kuW;
+            d->k_B[i]  = Kd + kuB;
+            d->q_B[i]  = Ars2 * r_b[i];
+        }
+    }
+
+    /* Scan table */
+    double u0 = log1p(h_min), u1 = log1p(h_max);
+    for (size_t s = 0; s < DEPTH_SCAN; s++) {
+        double h = expm1(u0 + (u1 - u0) * (double)s / (DEPTH_SCAN - 1));
+        d->h_scan[s] = s == 0 ? h_min : (s == DEPTH_SCAN - 1 ? h_max : h);
+
+        depth_exps(d, d->h_scan[s], e, e + n);
+        double mm = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            double rrs = d->deep[i] * (1 - (Ars1 * e[i])) + d->q_B[i] * e[n + i];
+            d->wm_t[i * DEPTH_SCAN + s] = d->w[i] * rrs;
+            mm += d->w[i] * rrs * rrs;
+        }
+        d->half_mm[s] = 0.5 * mm;
+    }
+    free(e);
+    return d;
+}
+
+/**
+ * Water depth of n_pix pixels of the solver's region from their observed
+ * Rrs on the context grid, minimising the weighted squared misfit of the
+ * shallow AM03 model over [h_min, h_max].
+ *
+ * Pixels go through in blocks: the misfit at every scan depth is one
+ * matrix product against the solver's table for the whole block, the
+ * best scan depth and its neighbours bracket the minimum, and a
+ * safeguarded Newton iteration on the analytic slope and curvature of the
+ * misfit refines it, typically in 3-6 iterations.
+ *
+ * rrs is n_pix x n_wl in `layout`; h_out and rmse_out (optional, weighted
+ * RMS residual) are [n_pix]. Pixels with non-finite bands get NaN.
+ *
+ * @return 0 on success, 1 null pointer, 2 solver not created on this
+ *         context / its grid is no longer current, 3 unknown layout or
+ *         allocation failure, 4 some pixels hit the iteration limit
+ */
+int saber_ctx_solve_depth_batch(
+        const saber_ctx* ctx, const saber_depth_solver* d, size_t n_pix,
+        const double* rrs, saber_layout layout,
+        double* h_out, double* rmse_out
+) {
+    if (!ctx || !d) return 1;
+    if (d->ctx != ctx || d->grid_token != ctx->grid.token) return 2;
+    if (!rrs || !h_out) return 1;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+
+    depth_workspace* ws = depth_workspace_create(d);
+    if (!ws) return 3;
+
+    STAT_CLOCK_BEGIN(ctx);
+    int rc = depth_pixels(d, ws, rrs, n_pix, layout == SABER_LAYOUT_BAND_MAJOR, 0, n_pix,
+                          h_out, rmse_out);
+    depth_workspace_destroy(ws);
+    STAT_STAGE_END(ctx, SABER_STAGE_DEPTH, n_pix);
+    return rc;
+}
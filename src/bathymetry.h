@@ -0,0 +1,48 @@
+#ifndef SABER_LIB_BATHYMETRY_H
+#define SABER_LIB_BATHYMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "saber.h"
+#include "vec_math.h"
+
+/* Scan depths tabulated per solver; the best of them brackets each
+ * pixel's Newton iterations */
+#define DEPTH_SCAN 32
+
+/* Depth-independent AM03 terms of one region, so that for band i
+ *   Rrs_i(h) = deep_i (1 - 1.1576 exp(-h k_W_i)) + q_B_i exp(-h k_B_i)
+ * with the same rounding as am03_forward_core() */
+struct saber_depth_solver {
+    const saber_ctx* ctx;
+    uint64_t grid_token;        /* ctx->grid.token at create time */
+    const vm_impl* vm;          /* accuracy at create time */
+
+    size_t  n_wl;
+    double* deep;               /* rrs_deep                   */
+    double* k_W;                /* Kd + kuW                   */
+    double* k_B;                /* Kd + kuB                   */
+    double* q_B;                /* 1.0389 r_b                 */
+    double* w;                  /* band weights               */
+    double  w_sum;
+
+    double  h_min, h_max;
+    double  h_scan[DEPTH_SCAN];
+    double* wm_t;               /* n_wl x DEPTH_SCAN, w_i Rrs_i(h_s) */
+    double  half_mm[DEPTH_SCAN];/* 0.5 sum_i w_i Rrs_i(h_s)^2 */
+};
+
+/* Per-thread scratch of the depth solver */
+typedef struct depth_workspace depth_workspace;
+
+depth_workspace* depth_workspace_create(const saber_depth_solver* d);
+void depth_workspace_destroy(depth_workspace* ws);
+
+/* Depths of pixels [px0, px1) of an n_pix-pixel Rrs cube into h_out and
+ * optionally rmse ([n_pix] each). 0 on success, 4 if some pixel hit the
+ * iteration limit (its last iterate is kept). */
+int depth_pixels(const saber_depth_solver* d, depth_workspace* ws,
+                 const double* rrs, size_t n_pix, int band_major, size_t px0, size_t px1,
+                 double* h_out, double* rmse);
+
+#endif //SABER_LIB_BATHYMETRY_H
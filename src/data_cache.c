@@ -4,114 +4,338 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/mman.h>
 
-/* -------------------------------------------------- *
- *  64‑bit FNV‑1a hash – public‑domain implementation *
- * -------------------------------------------------- */
-static uint64_t wl_hash_cache = 0;
-static uint64_t fnv1a64(const void *data, size_t n_bytes)
+// ---------- Context lifecycle ----------
+
+/* Backing store of the legacy global API */
+static saber_ctx default_ctx;
+
+saber_ctx* saber_default_ctx(void) { return &default_ctx; }
+
+saber_ctx* saber_ctx_create(void)
 {
-    const uint8_t *p = (const uint8_t*)data;
-    uint64_t hash = 0xcbf29ce484222325ULL;      /* FNV offset basis */
-    while (n_bytes--) {
-        hash ^= *p++;
-        hash *= 0x100000001b3ULL;              /* FNV prime */
+    saber_ctx* ctx = calloc(1, sizeof(saber_ctx));
+    if (ctx && STAT_REGISTER(ctx)) {
+        free(ctx);
+        return NULL;
     }
-    return hash;
+    return ctx;
 }
 
-// ---------- Global Memory ----------
-static double* wl_cache = NULL;
-static size_t cached_n_wl = 0;
+static void free_grid(saber_grid* g)
+{
+    if (g->borrowed) {
+        memset(g, 0, sizeof(*g));
+        return;
+    }
+    free(g->wl);   free(g->a_w);  free(g->bb_w);
+    free(g->a0);   free(g->a1);   free(g->r_rs_b);
+    free(g->wl_f); free(g->a_w_f); free(g->bb_w_f);
+    free(g->a0_f); free(g->a1_f);  free(g->r_rs_b_f);
+    memset(g, 0, sizeof(*g));
+}
 
-static double* cached_a_w = NULL;
-static double* cached_a0 = NULL;
-static double* cached_a1 = NULL;
-static double* cached_bb_w = NULL;
-static double* cached_r_rs_b = NULL;
+/* Every cached grid, current one included, once a source table changes:
+ * the next build resamples the new tables and the tokens of the dropped
+ * grids, with everything prepared on them, go stale. A snapshot mapping
+ * stays until release, the class names may still point into it. */
+static void drop_grids(saber_ctx* ctx)
+{
+    free_grid(&ctx->grid);
+    for (size_t k = 0; k < SABER_GRID_SPARES; k++)
+        free_grid(&ctx->spare[k]);
+}
 
-static double* a_w_wl = NULL, *a_w_val = NULL;
-static size_t a_w_wl_n = 0;
-static double* a0a1_wl = NULL, *a0_val = NULL, *a1_val = NULL;
-static size_t a0a1_wl_n = 0;
-static double* r_rs_b_wl = NULL, *r_rs_b_matrix = NULL;
-static char** r_rs_b_class_names = NULL;
-static size_t r_rs_b_class_n = 0, r_rs_b_wl_n = 0;
+static void free_class_names(saber_ctx* ctx)
+{
+    if (ctx->r_rs_b_class_names) {
+        if (!ctx->r_rs_b_names_borrowed)
+            for (size_t j = 0; j < ctx->r_rs_b_class_n; ++j)
+                free(ctx->r_rs_b_class_names[j]);
+        free(ctx->r_rs_b_class_names);
+    }
+    ctx->r_rs_b_class_names    = NULL;
+    ctx->r_rs_b_class_n        = 0;
+    ctx->r_rs_b_names_borrowed = 0;
+}
 
-// ---------- Loaders ----------
+/* Master tables: free what we own, forget what we borrow */
+static void free_pure_water(saber_ctx* ctx)
+{
+    if (!ctx->a_w_borrowed) {
+        free(ctx->a_w_wl);
+        free(ctx->a_w_val);
+    }
+    ctx->a_w_wl = ctx->a_w_val = NULL;
+    ctx->a_w_wl_n = 0;
+    ctx->a_w_borrowed = 0;
+}
 
-int load_pure_water(const double* wl, const double* a, size_t n) {
-    if (!wl || !a || n == 0) return 1;
-    a_w_wl_n = n;
-    a_w_wl = realloc(a_w_wl, sizeof(double) * n);
-    a_w_val = realloc(a_w_val, sizeof(double) * n);
-    if (!a_w_wl || !a_w_val) return 2;
-    memcpy(a_w_wl, wl, sizeof(double) * n);
-    memcpy(a_w_val, a, sizeof(double) * n);
-    return 0;
+static void free_a0_a1(saber_ctx* ctx)
+{
+    if (!ctx->a0a1_borrowed) {
+        free(ctx->a0a1_wl);
+        free(ctx->a0_val);
+        free(ctx->a1_val);
+    }
+    ctx->a0a1_wl = ctx->a0_val = ctx->a1_val = NULL;
+    ctx->a0a1_wl_n = 0;
+    ctx->a0a1_borrowed = 0;
 }
 
-int load_a0_a1(const double* wl, const double* a0, const double* a1, size_t n) {
-    if (!wl || !a0 || !a1 || n == 0) return 1;
-    a0a1_wl_n = n;
-    a0a1_wl = realloc(a0a1_wl, sizeof(double) * n);
-    a0_val = realloc(a0_val, sizeof(double) * n);
-    a1_val = realloc(a1_val, sizeof(double) * n);
-    if (!a0a1_wl || !a0_val || !a1_val) return 2;
-    memcpy(a0a1_wl, wl, sizeof(double) * n);
-    memcpy(a0_val, a0, sizeof(double) * n);
-    memcpy(a1_val, a1, sizeof(double) * n);
+static void free_r_rs_b(saber_ctx* ctx)
+{
+    if (!ctx->r_rs_b_borrowed) {
+        free(ctx->r_rs_b_wl);
+        free(ctx->r_rs_b_matrix);
+    }
+    ctx->r_rs_b_wl = ctx->r_rs_b_matrix = NULL;
+    ctx->r_rs_b_wl_n = 0;
+    ctx->r_rs_b_borrowed = 0;
+}
+
+/* The library mapping once no master table points into it any more */
+static void unmap_library(saber_ctx* ctx)
+{
+    if (!ctx->lib_map || ctx->a_w_borrowed || ctx->a0a1_borrowed || ctx->r_rs_b_borrowed)
+        return;
+    munmap(ctx->lib_map, ctx->lib_len);
+    ctx->lib_map = NULL;
+    ctx->lib_len = 0;
+}
+
+/* Free every dynamically allocated table so valgrind stays quiet */
+void ctx_release(saber_ctx* ctx)
+{
+    /* wavelength & optics tables, then the library they may point into */
+    free_pure_water(ctx);
+    free_a0_a1(ctx);
+    free_r_rs_b(ctx);
+    free_class_names(ctx);
+    if (ctx->lib_map) munmap(ctx->lib_map, ctx->lib_len);
+
+    /* cached spectra, then the snapshot some of them may point into */
+    drop_grids(ctx);
+    if (ctx->snap_map) munmap(ctx->snap_map, ctx->snap_len);
+
+    /* keep the kernel settings, the build counter and the statistics,
+     * drop everything else */
+    saber_accuracy accuracy = ctx->accuracy;
+    int timing = ctx->timing;
+    uint64_t epoch = ctx->grid_epoch;
+#if SABER_STATS
+    saber_stat_counters stats;
+    memcpy(&stats, &ctx->stats, sizeof(stats));
+#endif
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->accuracy = accuracy;
+    ctx->timing = timing;
+    ctx->grid_epoch = epoch;
+#if SABER_STATS
+    memcpy(&ctx->stats, &stats, sizeof(stats));
+#endif
+}
+
+void saber_ctx_destroy(saber_ctx* ctx)
+{
+    if (!ctx) return;
+    STAT_FORGET(ctx);
+    ctx_release(ctx);
+    free(ctx);
+}
+
+int saber_ctx_set_accuracy(saber_ctx* ctx, saber_accuracy accuracy)
+{
+    if (!ctx) return 1;
+    if (accuracy != SABER_ACCURACY_EXACT && accuracy != SABER_ACCURACY_FAST) return 2;
+    ctx->accuracy = accuracy;
     return 0;
 }
 
-static void free_class_names(void)
+saber_accuracy saber_ctx_get_accuracy(const saber_ctx* ctx)
 {
-    if (r_rs_b_class_names) {
-        for (size_t j = 0; j < r_rs_b_class_n; ++j)
-            free(r_rs_b_class_names[j]);
-        free(r_rs_b_class_names);
+    return ctx ? ctx->accuracy : SABER_ACCURACY_EXACT;
+}
+
+// ---------- Loaders ----------
+
+int saber_ctx_load_pure_water(saber_ctx* ctx, const double* wl, const double* a, size_t n) {
+    if (!ctx || !wl || !a || n == 0) return 1;
+    if (n > SIZE_MAX / sizeof(double)) return 1;
+
+    /* allocate and fill first, so a failed load keeps the current table */
+    double* tmp_wl  = malloc(sizeof(double) * n);
+    double* tmp_val = malloc(sizeof(double) * n);
+    if (!tmp_wl || !tmp_val) {
+        free(tmp_wl);
+        free(tmp_val);
+        return 2;
     }
-    r_rs_b_class_names = NULL;
-    r_rs_b_class_n     = 0;
+    memcpy(tmp_wl, wl, sizeof(double) * n);
+    memcpy(tmp_val, a, sizeof(double) * n);
+
+    free_pure_water(ctx);
+    ctx->a_w_wl   = tmp_wl;
+    ctx->a_w_val  = tmp_val;
+    ctx->a_w_wl_n = n;
+    drop_grids(ctx);
+    unmap_library(ctx);
+    return 0;
 }
 
-int load_r_rs_b(const double  *wl,
-                const char   **class_names,
-                const double  *matrix,
-                size_t         wl_n,
-                size_t         class_n)
-{
-    /* 1. Allocate new blocks ------------------------------------ */
-    double *tmp_wl     = realloc(r_rs_b_wl, sizeof(double) * wl_n);
-    double *tmp_matrix = realloc(r_rs_b_matrix, sizeof(double) * wl_n * class_n);
-    if (!tmp_wl || !tmp_matrix) return 1;
+int saber_ctx_load_a0_a1(saber_ctx* ctx, const double* wl, const double* a0, const double* a1, size_t n) {
+    if (!ctx || !wl || !a0 || !a1 || n == 0) return 1;
+    if (n > SIZE_MAX / sizeof(double)) return 1;
+
+    /* allocate and fill first, so a failed load keeps the current table */
+    double* tmp_wl = malloc(sizeof(double) * n);
+    double* tmp_a0 = malloc(sizeof(double) * n);
+    double* tmp_a1 = malloc(sizeof(double) * n);
+    if (!tmp_wl || !tmp_a0 || !tmp_a1) {
+        free(tmp_wl);
+        free(tmp_a0);
+        free(tmp_a1);
+        return 2;
+    }
+    memcpy(tmp_wl, wl, sizeof(double) * n);
+    memcpy(tmp_a0, a0, sizeof(double) * n);
+    memcpy(tmp_a1, a1, sizeof(double) * n);
+
+    free_a0_a1(ctx);
+    ctx->a0a1_wl   = tmp_wl;
+    ctx->a0_val    = tmp_a0;
+    ctx->a1_val    = tmp_a1;
+    ctx->a0a1_wl_n = n;
+    drop_grids(ctx);
+    unmap_library(ctx);
+    return 0;
+}
 
-    char **tmp_names = malloc(sizeof(char*) * class_n);
-    if (!tmp_names) return 1;
+int saber_ctx_load_r_rs_b(saber_ctx     *ctx,
+                          const double  *wl,
+                          const char   **class_names,
+                          const double  *matrix,
+                          size_t         wl_n,
+                          size_t         class_n)
+{
+    if (!ctx || !wl || !matrix || (class_n && !class_names)) return 1;
+    if (class_n && wl_n > SIZE_MAX / sizeof(double) / class_n) return 1;
+
+    /* 1. Allocate new blocks, leaving the current table intact --- */
+    double *tmp_wl     = malloc(sizeof(double) * (wl_n ? wl_n : 1));
+    double *tmp_matrix = malloc(sizeof(double) * ((wl_n && class_n) ? wl_n * class_n : 1));
+    char  **tmp_names  = malloc(sizeof(char*) * (class_n ? class_n : 1));
+    if (!tmp_wl || !tmp_matrix || !tmp_names) {
+        free(tmp_wl);
+        free(tmp_matrix);
+        free(tmp_names);
+        return 1;
+    }
 
     for (size_t j = 0; j < class_n; ++j) {
         tmp_names[j] = strdup(class_names[j]);
         if (!tmp_names[j]) {
             for (size_t k = 0; k < j; ++k) free(tmp_names[k]);
             free(tmp_names);
+            free(tmp_wl);
+            free(tmp_matrix);
             return 1;
         }
     }
+    memcpy(tmp_wl,     wl,     sizeof(double) * wl_n);
+    memcpy(tmp_matrix, matrix, sizeof(double) * wl_n * class_n);
+
+    /* 2. Commit -------------------------------------------------- */
+    free_r_rs_b(ctx);                   /* release previous table */
+    free_class_names(ctx);              /* release previous names */
+    ctx->r_rs_b_wl     = tmp_wl;
+    ctx->r_rs_b_matrix = tmp_matrix;
+    ctx->r_rs_b_wl_n   = wl_n;
+    ctx->r_rs_b_class_names = tmp_names;
+    ctx->r_rs_b_class_n = class_n;
+    drop_grids(ctx);
+    unmap_library(ctx);
 
-    /* 2. Commit + copy data ------------------------------------- */
-    free_class_names();                 /* release previous names */
-    r_rs_b_wl         = tmp_wl;
-    r_rs_b_matrix     = tmp_matrix;
-    r_rs_b_class_names = tmp_names;
-    r_rs_b_class_n = class_n;
-    r_rs_b_wl_n = wl_n;
+    return 0;
+}
 
-    memcpy(r_rs_b_wl,     wl, sizeof(double) * wl_n);
-    memcpy(r_rs_b_matrix, matrix, sizeof(double) * wl_n * class_n);
+/* Borrowing loaders: the context points at the caller's (or a library
+ * mapping's) arrays until the table is replaced or released. The casts
+ * drop const only to share the master-table fields; borrowed tables are
+ * never written. */
+int saber_ctx_borrow_pure_water(saber_ctx* ctx, const double* wl, const double* a, size_t n)
+{
+    if (!ctx || !wl || !a || n == 0) return 1;
+    free_pure_water(ctx);
+    ctx->a_w_wl   = (double*)wl;
+    ctx->a_w_val  = (double*)a;
+    ctx->a_w_wl_n = n;
+    ctx->a_w_borrowed = 1;
+    drop_grids(ctx);
+    unmap_library(ctx);
+    return 0;
+}
 
+int saber_ctx_borrow_a0_a1(saber_ctx* ctx, const double* wl, const double* a0, const double* a1, size_t n)
+{
+    if (!ctx || !wl || !a0 || !a1 || n == 0) return 1;
+    free_a0_a1(ctx);
+    ctx->a0a1_wl   = (double*)wl;
+    ctx->a0_val    = (double*)a0;
+    ctx->a1_val    = (double*)a1;
+    ctx->a0a1_wl_n = n;
+    ctx->a0a1_borrowed = 1;
+    drop_grids(ctx);
+    unmap_library(ctx);
+    return 0;
+}
+
+int saber_ctx_borrow_r_rs_b(saber_ctx     *ctx,
+                            const double  *wl,
+                            const char   **class_names,
+                            const double  *matrix,
+                            size_t         wl_n,
+                            size_t         class_n)
+{
+    if (!ctx || !wl || !matrix || (class_n && !class_names)) return 1;
+
+    /* only the pointer array is copied, the strings stay the caller's */
+    char **names = malloc(sizeof(char*) * (class_n ? class_n : 1));
+    if (!names) return 1;
+    for (size_t j = 0; j < class_n; ++j) names[j] = (char*)class_names[j];
+
+    free_r_rs_b(ctx);
+    free_class_names(ctx);
+    ctx->r_rs_b_wl     = (double*)wl;
+    ctx->r_rs_b_matrix = (double*)matrix;
+    ctx->r_rs_b_wl_n   = wl_n;
+    ctx->r_rs_b_borrowed = 1;
+    ctx->r_rs_b_class_names    = names;
+    ctx->r_rs_b_class_n        = class_n;
+    ctx->r_rs_b_names_borrowed = 1;
+    drop_grids(ctx);
+    unmap_library(ctx);
     return 0;
 }
 
+int load_pure_water(const double* wl, const double* a, size_t n) {
+    return saber_ctx_load_pure_water(&default_ctx, wl, a, n);
+}
+
+int load_a0_a1(const double* wl, const double* a0, const double* a1, size_t n) {
+    return saber_ctx_load_a0_a1(&default_ctx, wl, a0, a1, n);
+}
+
+int load_r_rs_b(const double  *wl,
+                const char   **class_names,
+                const double  *matrix,
+                size_t         wl_n,
+                size_t         class_n)
+{
+    return saber_ctx_load_r_rs_b(&default_ctx, wl, class_names, matrix, wl_n, class_n);
+}
+
 // ---------- Interpolation Functions ----------
 
 //double interpolate_scalar(const double* wl, const double* val, size_t n, double target) {
@@ -160,147 +384,562 @@ double interpolate_scalar(const double *wl,
 
 }
 
-int interpolate_vector(const double* wl_old, const double* val_old,
-                       const double* wl_new, size_t n_old, size_t n_new,
-                       double* val_out) {
-    if (wl_old[0] > wl_new[0] || wl_old[n_old-1] < wl_new[cached_n_wl-1])
-        fprintf(stderr,
-                "build_cache: target grid extends beyond source table (%g–%g vs %g–%g)\n",
-                wl_new[0], wl_new[cached_n_wl-1], wl_old[0], wl_old[n_old-1]);
+// ---------- Band resampling ----------
+
+/* Response of each target band: a Gaussian of the given FWHM centred on the
+ * band, or tabulated responses on one shared wavelength axis. */
+typedef struct band_response {
+    const double* fwhm;         /* [n] nm, or NULL                       */
+    const double* srf_wl;       /* [srf_n], increasing                   */
+    const double* srf;          /* band i at [i * srf_n + k]             */
+    size_t        srf_n;
+} band_response;
+
+#define NO_SAMPLE SIZE_MAX
+
+/* Source-to-band weights for one source grid, built once per cache build
+ * and applied to every table on that grid, all r_rs_b classes included.
+ *
+ * Point sampling keeps interpolate_scalar()'s arithmetic, so caches built
+ * without a response are unchanged:
+ *   out_i = v[lo] + t (v[hi] - v[lo]),   0 when lo == NO_SAMPLE
+ * Band integration stores one sparse (CSR) row per band:
+ *   out_i = sum_k w[k] v[col[k]],        k in [start[i], start[i + 1]) */
+typedef struct band_weights {
+    size_t  n_band;
+    size_t *lo, *hi;
+    double *t;
+    size_t *start, *col;
+    double *w;
+} band_weights;
+
+static void band_weights_free(band_weights* bw)
+{
+    free(bw->lo);    free(bw->hi);  free(bw->t);
+    free(bw->start); free(bw->col); free(bw->w);
+    memset(bw, 0, sizeof(*bw));
+}
+
+/* interpolate_scalar() split into where to read and how to blend */
+static void point_weight(const double* src, size_t m, double target,
+                         size_t* lo_out, size_t* hi_out, double* t_out)
+{
+    *t_out = 0.0;
+    if (target < src[0] || target > src[m-1]) {
+        *lo_out = *hi_out = NO_SAMPLE;
+        return;
+    }
+    if (target == src[0])   { *lo_out = *hi_out = 0;     return; }
+    if (target == src[m-1]) { *lo_out = *hi_out = m - 1; return; }
+
+    size_t lo = 0, hi = m - 1;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (target < src[mid])
+            hi = mid;
+        else
+            lo = mid;
+    }
+    *lo_out = lo;
+    *hi_out = hi;
+    *t_out  = (target - src[lo]) / (src[hi] - src[lo]);
+}
+
+/* First k with src[k] >= v */
+static size_t lower_bound(const double* src, size_t m, double v)
+{
+    size_t lo = 0, hi = m;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (src[mid] < v) lo = mid + 1;
+        else              hi = mid;
+    }
+    return lo;
+}
+
+/* Wavelength interval outside which band i has no response */
+static void response_support(const band_response* r, size_t i, double center,
+                             double* lo, double* hi)
+{
+    if (r->fwhm) {
+        *lo = center - 2.0 * r->fwhm[i];     /* ±4.7 sigma */
+        *hi = center + 2.0 * r->fwhm[i];
+        return;
+    }
+    const double* row = r->srf + i * r->srf_n;
+    size_t k0 = 0, k1 = r->srf_n;
+    while (k0 < r->srf_n && row[k0] <= 0.0) k0++;
+    while (k1 > k0 && row[k1 - 1] <= 0.0) k1--;
+    if (k0 == k1) {                          /* no response at all */
+        *lo = 1.0;
+        *hi = 0.0;
+        return;
+    }
+    *lo = r->srf_wl[k0 > 0 ? k0 - 1 : 0];
+    *hi = r->srf_wl[k1 < r->srf_n ? k1 : r->srf_n - 1];
+}
 
-    for (size_t i = 0; i < n_new; i++) {
-        val_out[i] = interpolate_scalar(wl_old, val_old, n_old, wl_new[i]);
+static double response_at(const band_response* r, size_t i, double center, double lambda)
+{
+    if (r->fwhm) {
+        double z = (lambda - center) / (r->fwhm[i] / 2.354820045030949);
+        return exp(-0.5 * z * z);
     }
+    return interpolate_scalar(r->srf_wl, r->srf + i * r->srf_n, r->srf_n, lambda);
+}
+
+/* Trapezoid weight of source node k */
+static double node_width(const double* src, size_t m, size_t k)
+{
+    if (m == 1) return 1.0;
+    double left  = k > 0     ? src[k] - src[k - 1] : 0.0;
+    double right = k < m - 1 ? src[k + 1] - src[k] : 0.0;
+    return 0.5 * (left + right);
+}
+
+/* Weights from source grid src[m] onto the n target bands. With no
+ * response the bands are point samples; otherwise each band is the
+ * response-weighted mean of the source spectrum (trapezoid rule on the
+ * source nodes). A band narrower than the source spacing, whose response
+ * misses every node, falls back to interpolation at its centre. */
+static int band_weights_build(band_weights* bw, const double* src, size_t m,
+                              const double* wl, size_t n, const band_response* r)
+{
+    memset(bw, 0, sizeof(*bw));
+    bw->n_band = n;
+
+    if (!r) {
+        bw->lo = malloc(sizeof(size_t) * n);
+        bw->hi = malloc(sizeof(size_t) * n);
+        bw->t  = malloc(sizeof(double) * n);
+        if (!bw->lo || !bw->hi || !bw->t) {
+            band_weights_free(bw);
+            return 3;
+        }
+        for (size_t i = 0; i < n; i++)
+            point_weight(src, m, wl[i], &bw->lo[i], &bw->hi[i], &bw->t[i]);
+        return 0;
+    }
+
+    /* Pass 1: row sizes (two slots at least, for the fallback) */
+    bw->start = malloc(sizeof(size_t) * (n + 1));
+    if (!bw->start) return 3;
+    bw->start[0] = 0;
+    for (size_t i = 0; i < n; i++) {
+        double lo, hi;
+        response_support(r, i, wl[i], &lo, &hi);
+        size_t k0 = lower_bound(src, m, lo);
+        size_t k1 = lower_bound(src, m, hi);
+        while (k1 < m && src[k1] <= hi) k1++;
+        size_t cnt = k1 > k0 ? k1 - k0 : 0;
+        bw->start[i + 1] = bw->start[i] + (cnt > 2 ? cnt : 2);
+    }
+
+    size_t cap = bw->start[n];
+    bw->col = malloc(sizeof(size_t) * (cap ? cap : 1));
+    bw->w   = malloc(sizeof(double) * (cap ? cap : 1));
+    if (!bw->col || !bw->w) {
+        band_weights_free(bw);
+        return 3;
+    }
+
+    /* Pass 2: fill and normalise; compact the rows as we go */
+    size_t nnz = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t row0 = nnz;
+        double lo, hi, sum = 0.0;
+        response_support(r, i, wl[i], &lo, &hi);
+        for (size_t k = lower_bound(src, m, lo); k < m && src[k] <= hi; k++) {
+            double w = response_at(r, i, wl[i], src[k]) * node_width(src, m, k);
+            if (w <= 0.0) continue;
+            bw->col[nnz] = k;
+            bw->w[nnz]   = w;
+            sum += w;
+            nnz++;
+        }
+
+        if (sum > 0.0) {
+            for (size_t k = row0; k < nnz; k++) bw->w[k] /= sum;
+        } else {
+            size_t a, b;
+            double t;
+            nnz = row0;
+            point_weight(src, m, wl[i], &a, &b, &t);
+            if (a != NO_SAMPLE) {
+                bw->col[nnz] = a; bw->w[nnz] = 1.0 - t; nnz++;
+                bw->col[nnz] = b; bw->w[nnz] = t;       nnz++;
+            }
+        }
+        bw->start[i] = row0;
+    }
+    bw->start[n] = nnz;
     return 0;
 }
 
-int interpolate_matrix(const double* wl_old, const double* mat_old,
-                       const double* wl_new, size_t n_old, size_t n_new, size_t n_class,
-                       double* mat_out) {
-    if (wl_old[0] > wl_new[0] || wl_old[n_old-1] < wl_new[cached_n_wl-1])
+static void band_weights_apply(const band_weights* bw, const double* v, double* out)
+{
+    if (bw->lo) {
+        for (size_t i = 0; i < bw->n_band; i++) {
+            if (bw->lo[i] == NO_SAMPLE) {
+                out[i] = 0.0;
+                continue;
+            }
+            double v_lo = v[bw->lo[i]];
+            out[i] = v_lo + bw->t[i] * (v[bw->hi[i]] - v_lo);
+        }
+        return;
+    }
+    for (size_t i = 0; i < bw->n_band; i++) {
+        double acc = 0.0;
+        for (size_t k = bw->start[i]; k < bw->start[i + 1]; k++)
+            acc += bw->w[k] * v[bw->col[k]];
+        out[i] = acc;
+    }
+}
+
+static void warn_range(const double* src, size_t m, const double* wl, size_t n)
+{
+    if (src[0] > wl[0] || src[m-1] < wl[n-1])
         fprintf(stderr,
                 "build_cache: target grid extends beyond source table (%g–%g vs %g–%g)\n",
-                wl_new[0], wl_new[cached_n_wl-1], wl_old[0], wl_old[n_old-1]);
+                wl[0], wl[n-1], src[0], src[m-1]);
+}
 
-    for (size_t j = 0; j < n_class; j++) {
-        for (size_t i = 0; i < n_new; i++) {
-            const double* col = mat_old + j * n_old;
-            mat_out[i + j * n_new] = interpolate_scalar(wl_old, col, n_old, wl_new[i]);
+static double bb_w_at(double lambda)
+{
+    double b1 = 0.00111;
+    double lambda1 = 500.0;
+    double exponent = -4.32;
+    return b1 * pow(lambda / lambda1, exponent);
+}
+
+// ---------- Grid LRU ----------
+
+/* Make a freshly built grid current. A cached grid on the same wavelengths
+ * is replaced; otherwise the previous current grid moves to a spare slot,
+ * evicting the least recently used one when all are taken. */
+void ctx_install_grid(saber_ctx* ctx, saber_grid* g)
+{
+    for (size_t k = 0; k < SABER_GRID_SPARES; k++)
+        if (grid_matches(&ctx->spare[k], g->wl, g->n_wl)) free_grid(&ctx->spare[k]);
+
+    if (ctx->grid.wl && !grid_matches(&ctx->grid, g->wl, g->n_wl)) {
+        size_t victim = 0;
+        for (size_t k = 0; k < SABER_GRID_SPARES; k++) {
+            if (!ctx->spare[k].wl) {
+                victim = k;
+                break;
+            }
+            if (ctx->spare[k].last_used < ctx->spare[victim].last_used) victim = k;
         }
+        if (ctx->spare[victim].wl) STAT_ADD(ctx, STAT_CACHE_EVICTIONS, 1);
+        free_grid(&ctx->spare[victim]);
+        ctx->spare[victim] = ctx->grid;
+    } else {
+        free_grid(&ctx->grid);
     }
-    return 0;
+    ctx->grid = *g;
+}
+
+/* Swap spare k in as the current grid */
+static void promote_spare(saber_ctx* ctx, size_t k)
+{
+    saber_grid tmp = ctx->grid;
+    ctx->grid = ctx->spare[k];
+    ctx->spare[k] = tmp;
+    ctx->grid.last_used = ++ctx->use_clock;
 }
 
 // ---------- Cache Builder ----------
 
-int build_cache(const double* wl, size_t n) {
-    if (!a0a1_wl || !a0_val || !a1_val || !a_w_wl || !a_w_val || !r_rs_b_wl || !r_rs_b_matrix)
+static int build_grid(saber_ctx* ctx, const double* wl, size_t n, const band_response* resp) {
+    if (!ctx || !wl || n == 0) return 1;
+    if (!ctx->a0a1_wl || !ctx->a0_val || !ctx->a1_val || !ctx->a_w_wl || !ctx->a_w_val ||
+        !ctx->r_rs_b_wl || !ctx->r_rs_b_matrix)
         return 1;
+    STAT_CLOCK_BEGIN(ctx);
+
+    /* Build into a fresh grid and only swap it in once complete, so a
+     * failed rebuild leaves the previous cache untouched. */
+    saber_grid g = {0};
+    g.wl     = malloc(sizeof(double) * n);
+    g.a0     = malloc(sizeof(double) * n);
+    g.a1     = malloc(sizeof(double) * n);
+    g.a_w    = malloc(sizeof(double) * n);
+    g.bb_w   = malloc(sizeof(double) * n);
+    g.r_rs_b = malloc(sizeof(double) * n * ctx->r_rs_b_class_n);
+    if (!g.wl || !g.a0 || !g.a1 || !g.a_w || !g.bb_w ||
+        (!g.r_rs_b && ctx->r_rs_b_class_n)) {
+        free_grid(&g);
+        return 3;
+    }
+
+    memcpy(g.wl, wl, sizeof(double) * n);
+    g.n_wl = n;
+
+    /* One set of weights per source grid, shared by all its tables */
+    band_weights w_aw, w_a0a1, w_rb;
+    int rc = band_weights_build(&w_aw, ctx->a_w_wl, ctx->a_w_wl_n, wl, n, resp);
+    if (!rc) {
+        rc = band_weights_build(&w_a0a1, ctx->a0a1_wl, ctx->a0a1_wl_n, wl, n, resp);
+        if (rc) band_weights_free(&w_aw);
+    }
+    if (!rc) {
+        rc = band_weights_build(&w_rb, ctx->r_rs_b_wl, ctx->r_rs_b_wl_n, wl, n, resp);
+        if (rc) {
+            band_weights_free(&w_aw);
+            band_weights_free(&w_a0a1);
+        }
+    }
+    if (rc) {
+        free_grid(&g);
+        return rc;
+    }
 
-    double *tmp = realloc(wl_cache, sizeof(double) * n);
-    if (!tmp) return 3;
-    wl_cache = tmp;
-
-    memcpy(wl_cache, wl, sizeof(double) * n);
-    cached_n_wl = n;
-
-    tmp = realloc(cached_a0, sizeof(double) * n);
-    if (!tmp) return 3;
-    cached_a0 = tmp;
-    tmp = realloc(cached_a1, sizeof(double) * n);
-    if (!tmp) return 3;
-    cached_a1 = tmp;
-    tmp = realloc(cached_a_w, sizeof(double) * n);
-    if (!tmp) return 3;
-    cached_a_w = tmp;
-    tmp = realloc(cached_bb_w, sizeof(double) * n);
-    if (!tmp) return 3;
-    cached_bb_w = tmp;
-    tmp = realloc(cached_r_rs_b, sizeof(double) * n * r_rs_b_class_n);
-    if (!tmp) return 3;
-    cached_r_rs_b = tmp;
-
-    interpolate_vector(a_w_wl, a_w_val, wl, a_w_wl_n, cached_n_wl, cached_a_w);
-    interpolate_vector(a0a1_wl, a0_val, wl, a0a1_wl_n, cached_n_wl, cached_a0);
-    interpolate_vector(a0a1_wl, a1_val, wl, a0a1_wl_n, cached_n_wl, cached_a1);
-    interpolate_matrix(r_rs_b_wl, r_rs_b_matrix, wl, r_rs_b_wl_n, cached_n_wl, r_rs_b_class_n, cached_r_rs_b);
+    warn_range(ctx->a_w_wl, ctx->a_w_wl_n, wl, n);
+    warn_range(ctx->a0a1_wl, ctx->a0a1_wl_n, wl, n);
+    warn_range(ctx->r_rs_b_wl, ctx->r_rs_b_wl_n, wl, n);
+
+    band_weights_apply(&w_aw, ctx->a_w_val, g.a_w);
+    band_weights_apply(&w_a0a1, ctx->a0_val, g.a0);
+    band_weights_apply(&w_a0a1, ctx->a1_val, g.a1);
+    for (size_t j = 0; j < ctx->r_rs_b_class_n; j++)
+        band_weights_apply(&w_rb, ctx->r_rs_b_matrix + j * ctx->r_rs_b_wl_n, g.r_rs_b + j * n);
+
+    /* Analytic bb_w: at the band centre, or integrated over the a_w nodes */
+    if (!resp) {
+        for (size_t i = 0; i < n; i++) g.bb_w[i] = bb_w_at(wl[i]);
+    } else {
+        double* bb_src = malloc(sizeof(double) * ctx->a_w_wl_n);
+        if (!bb_src) rc = 3;
+        else {
+            for (size_t k = 0; k < ctx->a_w_wl_n; k++) bb_src[k] = bb_w_at(ctx->a_w_wl[k]);
+            band_weights_apply(&w_aw, bb_src, g.bb_w);
+            free(bb_src);
+        }
+    }
 
+    band_weights_free(&w_aw);
+    band_weights_free(&w_a0a1);
+    band_weights_free(&w_rb);
+    if (rc) {
+        free_grid(&g);
+        return rc;
+    }
+
+    /* float tables, rounded once from the double ones */
+    size_t n_rb = n * ctx->r_rs_b_class_n;
+    g.wl_f     = malloc(sizeof(float) * n);
+    g.a_w_f    = malloc(sizeof(float) * n);
+    g.bb_w_f   = malloc(sizeof(float) * n);
+    g.a0_f     = malloc(sizeof(float) * n);
+    g.a1_f     = malloc(sizeof(float) * n);
+    g.r_rs_b_f = malloc(sizeof(float) * (n_rb ? n_rb : 1));
+    if (!g.wl_f || !g.a_w_f || !g.bb_w_f || !g.a0_f || !g.a1_f || !g.r_rs_b_f) {
+        free_grid(&g);
+        return 3;
+    }
     for (size_t i = 0; i < n; i++) {
-        double lambda = wl[i];
-        double b1 = 0.00111;
-        double lambda1 = 500.0;
-        double exponent = -4.32;
-        cached_bb_w[i] = b1 * pow(lambda / lambda1, exponent);
+        g.wl_f[i]   = (float)g.wl[i];
+        g.a_w_f[i]  = (float)g.a_w[i];
+        g.bb_w_f[i] = (float)g.bb_w[i];
+        g.a0_f[i]   = (float)g.a0[i];
+        g.a1_f[i]   = (float)g.a1[i];
     }
+    for (size_t i = 0; i < n_rb; i++) g.r_rs_b_f[i] = (float)g.r_rs_b[i];
 
-    wl_hash_cache = fnv1a64(wl, n * sizeof(double));
+    g.token     = ++ctx->grid_epoch;
+    g.last_used = ++ctx->use_clock;
+    ctx_install_grid(ctx, &g);
+
+    STAT_ADD(ctx, STAT_CACHE_BUILDS, 1);
+    STAT_CLOCK_END(ctx, STAT_BUILD_NS);
     return 0;
 }
 
+/* Point-sample every table at the band centres `wl` */
+int saber_ctx_build_cache(saber_ctx* ctx, const double* wl, size_t n) {
+    return build_grid(ctx, wl, n, NULL);
+}
+
+/**
+ * Build the cache for bands with Gaussian responses: band i is centred on
+ * wl[i] with full width at half maximum fwhm[i] (nm). Every table is the
+ * response-weighted mean of its source spectrum over the band; the kernels
+ * still address the grid by the centres `wl`.
+ *
+ * @return 0 on success, 1 on null pointer / tables not loaded,
+ *         2 on a non-positive fwhm, 3 on allocation failure
+ */
+int saber_ctx_build_cache_fwhm(saber_ctx* ctx, const double* wl, const double* fwhm, size_t n) {
+    if (!fwhm) return 1;
+    for (size_t i = 0; i < n; i++)
+        if (!(fwhm[i] > 0.0)) return 2;
+
+    band_response r = {fwhm, NULL, NULL, 0};
+    return build_grid(ctx, wl, n, &r);
+}
+
+/**
+ * Build the cache for bands with tabulated spectral responses: srf holds
+ * n rows of srf_n values on the increasing axis srf_wl, band i at
+ * [i * srf_n + k]. Rows need not be normalised. wl[i] is the nominal
+ * centre the kernels use to address band i.
+ *
+ * @return 0 on success, 1 on null pointer / tables not loaded,
+ *         2 on a non-increasing axis or a negative response,
+ *         3 on allocation failure
+ */
+int saber_ctx_build_cache_srf(saber_ctx* ctx, const double* wl, size_t n,
+                              const double* srf_wl, const double* srf, size_t srf_n) {
+    if (!srf_wl || !srf || srf_n == 0) return 1;
+    for (size_t k = 1; k < srf_n; k++)
+        if (!(srf_wl[k] > srf_wl[k - 1])) return 2;
+    for (size_t i = 0; i < n * srf_n; i++)
+        if (srf[i] < 0.0) return 2;
+
+    band_response r = {NULL, srf_wl, srf, srf_n};
+    return build_grid(ctx, wl, n, &r);
+}
+
+int build_cache(const double* wl, size_t n) {
+    return saber_ctx_build_cache(&default_ctx, wl, n);
+}
+
 /*-------------------------------------------------------------*
  *  Cache guard / validation utilities                         *
  *-------------------------------------------------------------*/
 
 /* return codes:
- *  0  – OK, cache ready (built or already compatible)
+ *  0  – OK, cache ready (built, already current or taken from the LRU)
  *  1  – spectral tables not loaded yet
- *  2  – wavelength list differs from existing cache
  *  3  – build_cache() failed (propagates its error)
+ *
+ * Lookups compare the wavelengths themselves, so two grids can never be
+ * confused; only a miss rebuilds.
  */
-int ensure_cache(const double *wl, size_t n)
+int saber_ctx_ensure_cache(saber_ctx* ctx, const double *wl, size_t n)
 {
     /* 1.  Are the master tables in memory? */
-    if (!a0a1_wl || !a_w_wl || !r_rs_b_wl) return 1;
+    if (!ctx->a0a1_wl || !ctx->a_w_wl || !ctx->r_rs_b_wl) return 1;
 
-    if (cached_n_wl == n && wl_hash_cache) {
-        uint64_t h = fnv1a64(wl, n * sizeof(double));
-        if (h == wl_hash_cache)
+    /* 2.  Current grid, then the cached ones */
+    if (grid_matches(&ctx->grid, wl, n)) {
+        STAT_ADD(ctx, STAT_CACHE_HITS, 1);
+        return 0;
+    }
+    for (size_t k = 0; k < SABER_GRID_SPARES; k++) {
+        if (grid_matches(&ctx->spare[k], wl, n)) {
+            promote_spare(ctx, k);
+            STAT_ADD(ctx, STAT_CACHE_SPARE_HITS, 1);
             return 0;
+        }
     }
 
-    /* 3.  Build (or rebuild) the cache --------------------------- */
-    int rc = build_cache(wl, n);
+    /* 3.  Build the cache ---------------------------------------- */
+    int rc = saber_ctx_build_cache(ctx, wl, n);
     if (rc) return 3;
 
     return 0;
 }
 
+int ensure_cache(const double *wl, size_t n)
+{
+    return saber_ctx_ensure_cache(&default_ctx, wl, n);
+}
+
+/**
+ * saber_ctx_ensure_cache() that also hands back the grid's token, for the
+ * *_grid kernels.
+ *
+ * @return as saber_ctx_ensure_cache()
+ */
+int saber_ctx_ensure_grid(saber_ctx* ctx, const double* wl, size_t n, saber_grid_token* token)
+{
+    if (!ctx || !wl || !token) return 1;
+    int rc = saber_ctx_ensure_cache(ctx, wl, n);
+    *token = rc ? 0 : ctx->grid.token;
+    return rc;
+}
+
+/* Token of the current grid, 0 before the first build */
+saber_grid_token saber_ctx_grid_token(const saber_ctx* ctx)
+{
+    return ctx && ctx->grid.wl ? ctx->grid.token : 0;
+}
+
+/**
+ * Make a cached grid current again (for schemas, scenes, workspaces and
+ * the getters, which all work on the current grid).
+ *
+ * @return 0 on success, 1 on null pointer, 2 if the grid was evicted
+ */
+int saber_ctx_select_grid(saber_ctx* ctx, saber_grid_token token)
+{
+    if (!ctx) return 1;
+    if (token && ctx->grid.wl && ctx->grid.token == token) return 0;
+    for (size_t k = 0; k < SABER_GRID_SPARES; k++) {
+        if (token && ctx->spare[k].wl && ctx->spare[k].token == token) {
+            promote_spare(ctx, k);
+            return 0;
+        }
+    }
+    return 2;
+}
+
+/* Read-only counterpart of ensure_cache() for shared contexts:
+ * 1 if the built grid is exactly `wl`, 0 otherwise. */
+int grid_matches(const saber_grid* g, const double* wl, size_t n)
+{
+    if (!g->wl || g->n_wl != n) return 0;
+    return g->wl == wl || memcmp(g->wl, wl, n * sizeof(double)) == 0;
+}
+
+/* Cached grid on exactly `wl`, current first; NULL when none is */
+const saber_grid* ctx_find_grid(const saber_ctx* ctx, const double* wl, size_t n)
+{
+    if (grid_matches(&ctx->grid, wl, n)) return &ctx->grid;
+    for (size_t k = 0; k < SABER_GRID_SPARES; k++)
+        if (grid_matches(&ctx->spare[k], wl, n)) return &ctx->spare[k];
+    STAT_ADD(ctx, STAT_GRID_REJECTS, 1);
+    return NULL;
+}
+
+/* Cached grid with this token; NULL once evicted */
+const saber_grid* ctx_grid_by_token(const saber_ctx* ctx, saber_grid_token token)
+{
+    if (!token) return NULL;
+    if (ctx->grid.wl && ctx->grid.token == token) return &ctx->grid;
+    for (size_t k = 0; k < SABER_GRID_SPARES; k++)
+        if (ctx->spare[k].wl && ctx->spare[k].token == token) return &ctx->spare[k];
+    STAT_ADD(ctx, STAT_GRID_REJECTS, 1);
+    return NULL;
+}
+
 // ---------- Cache Accessors ----------
 
-const double* get_a_w()      { return cached_a_w; }
-const double* get_a0()       { return cached_a0; }
-const double* get_a1()       { return cached_a1; }
-const double* get_bb_w()     { return cached_bb_w; }
-const double* get_r_rs_b()   { return cached_r_rs_b; }
-const char**  get_r_rs_b_class_names() { return (const char**)r_rs_b_class_names; }
-size_t get_n_wl()              { return cached_n_wl; }
-size_t get_n_class()      { return r_rs_b_class_n; }
+const double* saber_ctx_get_a_w(const saber_ctx* ctx)    { return ctx->grid.a_w; }
+const double* saber_ctx_get_a0(const saber_ctx* ctx)     { return ctx->grid.a0; }
+const double* saber_ctx_get_a1(const saber_ctx* ctx)     { return ctx->grid.a1; }
+const double* saber_ctx_get_bb_w(const saber_ctx* ctx)   { return ctx->grid.bb_w; }
+const double* saber_ctx_get_r_rs_b(const saber_ctx* ctx) { return ctx->grid.r_rs_b; }
+const char**  saber_ctx_get_r_rs_b_class_names(const saber_ctx* ctx)
+{
+    return (const char**)ctx->r_rs_b_class_names;
+}
+size_t saber_ctx_get_n_wl(const saber_ctx* ctx)    { return ctx->grid.n_wl; }
+size_t saber_ctx_get_n_class(const saber_ctx* ctx) { return ctx->r_rs_b_class_n; }
+
+const double* get_a_w()      { return saber_ctx_get_a_w(&default_ctx); }
+const double* get_a0()       { return saber_ctx_get_a0(&default_ctx); }
+const double* get_a1()       { return saber_ctx_get_a1(&default_ctx); }
+const double* get_bb_w()     { return saber_ctx_get_bb_w(&default_ctx); }
+const double* get_r_rs_b()   { return saber_ctx_get_r_rs_b(&default_ctx); }
+const char**  get_r_rs_b_class_names() { return saber_ctx_get_r_rs_b_class_names(&default_ctx); }
+size_t get_n_wl()              { return saber_ctx_get_n_wl(&default_ctx); }
+size_t get_n_class()      { return saber_ctx_get_n_class(&default_ctx); }
 
-/* Free every dynamically allocated table so valgrind stays quiet */
 void saber_reset_tables(void)
 {
-    /* wavelength & optics tables */
-    free(a_w_wl);      free(a_w_val);
-    free(a0a1_wl);     free(a0_val);  free(a1_val);
-    free(r_rs_b_wl);   free(r_rs_b_matrix);
-
-    /* class names */
-    if (r_rs_b_class_names) {
-        for (size_t j = 0; j < r_rs_b_class_n; ++j)
-            free(r_rs_b_class_names[j]);
-        free(r_rs_b_class_names);
-    }
-
-    /* cached spectra */
-    free(wl_cache);   free(cached_a_w);  free(cached_a0);
-    free(cached_a1);  free(cached_bb_w); free(cached_r_rs_b);
-
-    /* reset globals */
-    a_w_wl = a_w_val = a0a1_wl = a0_val = a1_val = NULL;
-    r_rs_b_wl = r_rs_b_matrix = NULL;
-    r_rs_b_class_names = NULL;
-    wl_cache = cached_a_w = cached_a0 = cached_a1 =
-    cached_bb_w = cached_r_rs_b = NULL;
-    cached_n_wl = r_rs_b_class_n = 0;
-    wl_hash_cache = 0;
-}
\ No newline at end of file
+    ctx_release(&default_ctx);
+}
@@ -6,6 +6,83 @@
 #define SABER_LIB_DATA_CACHE_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include "saber.h"
+#include "stats.h"
+
+/* Resampled grids a context keeps besides the current one */
+#define SABER_GRID_SPARES 3
+
+/* Spectral tables resampled onto one target wavelength grid */
+typedef struct saber_grid {
+    double*  wl;
+    size_t   n_wl;
+    uint64_t token;         /* unique per build, never 0 */
+    uint64_t last_used;     /* LRU clock at the last build / selection */
+
+    double*  a_w;
+    double*  bb_w;
+    double*  a0;
+    double*  a1;
+    double*  r_rs_b;        /* n_wl x n_class, column-major (one class per column) */
+
+    /* float copies of the above for the *_f kernels */
+    float*   wl_f;
+    float*   a_w_f;
+    float*   bb_w_f;
+    float*   a0_f;
+    float*   a1_f;
+    float*   r_rs_b_f;
+
+    int      borrowed;      /* arrays live in a snapshot mapping, not malloc */
+} saber_grid;
+
+/* Everything a caller used to reach through file-level statics.
+ * Loaders and build_cache mutate it; once built, kernels only read it. */
+struct saber_ctx {
+    /* master tables as loaded, or borrowed from the caller / a library
+     * mapping when the table's *_borrowed flag is set */
+    double* a_w_wl;
+    double* a_w_val;
+    size_t  a_w_wl_n;
+    int     a_w_borrowed;
+
+    double* a0a1_wl;
+    double* a0_val;
+    double* a1_val;
+    size_t  a0a1_wl_n;
+    int     a0a1_borrowed;
+
+    double* r_rs_b_wl;
+    double* r_rs_b_matrix;
+    char**  r_rs_b_class_names;
+    size_t  r_rs_b_class_n;
+    size_t  r_rs_b_wl_n;
+    int     r_rs_b_borrowed;        /* wl and matrix */
+    int     r_rs_b_names_borrowed;  /* only the pointer array is ours */
+
+    /* resampled cache: the current grid, then the least recently used */
+    saber_grid grid;
+    saber_grid spare[SABER_GRID_SPARES];
+    uint64_t   grid_epoch;      /* bumped by every successful build, source of tokens */
+    uint64_t   use_clock;
+
+    /* read-only snapshot mapping backing borrowed grids and names */
+    void*      snap_map;
+    size_t     snap_len;
+
+    /* read-only library mapping backing borrowed master tables */
+    void*      lib_map;
+    size_t     lib_len;
+
+    /* kernel settings */
+    saber_accuracy accuracy;
+    int            timing;      /* stage timers of saber_ctx_get_stats() */
+
+#if SABER_STATS
+    saber_stat_counters stats;
+#endif
+};
 
 // Global memory setters
 int load_pure_water(const double* wl, const double* a, size_t n);
@@ -15,8 +92,18 @@ int load_r_rs_b(const double* wl, const char** class_names, const double* matrix
 // Cache builder
 int build_cache(const double* wl, size_t n);
 int ensure_cache(const double *wl, size_t n);
+int saber_ctx_ensure_cache(saber_ctx* ctx, const double* wl, size_t n);
 void saber_reset_tables(void);
 
+// Context internals shared with snapshot.c
+void ctx_release(saber_ctx* ctx);
+void ctx_install_grid(saber_ctx* ctx, saber_grid* g);
+
+// Grid lookups used by the context kernels (read-only, never rebuild)
+int grid_matches(const saber_grid* g, const double* wl, size_t n);
+const saber_grid* ctx_find_grid(const saber_ctx* ctx, const double* wl, size_t n);
+const saber_grid* ctx_grid_by_token(const saber_ctx* ctx, saber_grid_token token);
+
 // Cached data getters
 const double* get_a_w();
 const double* get_bb_w();
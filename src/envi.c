@@ -0,0 +1,651 @@
+#include "saber.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ENVI data types handled here */
+enum {
+    ENVI_U8  = 1,
+    ENVI_I16 = 2,
+    ENVI_I32 = 3,
+    ENVI_F32 = 4,
+    ENVI_F64 = 5,
+    ENVI_U16 = 12,
+    ENVI_U32 = 13
+};
+
+struct saber_cube {
+    size_t samples, lines, bands;
+    saber_interleave interleave;
+    int    data_type;
+    size_t elem;            /* bytes per element       */
+    int    swap;            /* file byte order != host */
+    size_t offset;          /* header offset in bytes  */
+
+    double* wavelength;     /* [bands] or NULL */
+    char**  band_names;     /* [bands] or NULL */
+
+    int      fd;
+    int      writable;
+    uint8_t* map;           /* whole file */
+    size_t   map_len;
+    uint8_t* data;          /* map + offset */
+};
+
+static size_t type_size(int t)
+{
+    switch (t) {
+        case ENVI_U8:  return 1;
+        case ENVI_I16:
+        case ENVI_U16: return 2;
+        case ENVI_I32:
+        case ENVI_U32:
+        case ENVI_F32: return 4;
+        case ENVI_F64: return 8;
+        default:       return 0;
+    }
+}
+
+static int host_big_endian(void)
+{
+    const uint16_t one = 1;
+    return *(const uint8_t*)&one == 0;
+}
+
+/* ---------- Element conversion ---------- */
+
+static void swap_bytes(uint8_t* b, size_t n)
+{
+    for (size_t i = 0; i < n / 2; i++) {
+        uint8_t t = b[i];
+        b[i] = b[n - 1 - i];
+        b[n - 1 - i] = t;
+    }
+}
+
+static double load_elem(const uint8_t* src, int type, int swap)
+{
+    uint8_t b[8];
+    size_t sz = type_size(type);
+    memcpy(b, src, sz);
+    if (swap) swap_bytes(b, sz);
+
+    switch (type) {
+        case ENVI_U8:  return b[0];
+        case ENVI_I16: { int16_t  v; memcpy(&v, b, 2); return v; }
+        case ENVI_U16: { uint16_t v; memcpy(&v, b, 2); return v; }
+        case ENVI_I32: { int32_t  v; memcpy(&v, b, 4); return v; }
+        case ENVI_U32: { uint32_t v; memcpy(&v, b, 4); return v; }
+        case ENVI_F32: { float    v; memcpy(&v, b, 4); return v; }
+        default:       { double   v; memcpy(&v, b, 8); return v; }
+    }
+}
+
+/* v clamped to [lo, hi] so the integer cast below is defined; NaN -> 0 */
+static double clamp_elem(double v, double lo, double hi)
+{
+    if (v != v) return 0.0;
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static void store_elem(uint8_t* dst, double v, int type, int swap)
+{
+    uint8_t b[8];
+    size_t sz = type_size(type);
+
+    switch (type) {
+        case ENVI_U8:  b[0] = (uint8_t)clamp_elem(v, 0.0, UINT8_MAX); break;
+        case ENVI_I16: { int16_t  x = (int16_t)clamp_elem(v, INT16_MIN, INT16_MAX);  memcpy(b, &x, 2); break; }
+        case ENVI_U16: { uint16_t x = (uint16_t)clamp_elem(v, 0.0, UINT16_MAX);      memcpy(b, &x, 2); break; }
+        case ENVI_I32: { int32_t  x = (int32_t)clamp_elem(v, INT32_MIN, INT32_MAX);  memcpy(b, &x, 4); break; }
+        case ENVI_U32: { uint32_t x = (uint32_t)clamp_elem(v, 0.0, UINT32_MAX);      memcpy(b, &x, 4); break; }
+        case ENVI_F32: { float    x = (float)v;    memcpy(b, &x, 4); break; }
+        default:       memcpy(b, &v, 8); break;
+    }
+    if (swap) swap_bytes(b, sz);
+    memcpy(dst, b, sz);
+}
+
+/* offset + samples * lines * bands * elem bytes, or 1 when it does not
+ * fit size_t */
+static int cube_bytes(size_t samples, size_t lines, size_t bands, size_t elem,
+                      size_t offset, size_t* out)
+{
+    const size_t dims[3] = {samples, lines, bands};
+    size_t total = elem;
+    for (int d = 0; d < 3; d++) {
+        if (dims[d] > SIZE_MAX / total) return 1;
+        total *= dims[d];
+    }
+    if (offset > SIZE_MAX - total) return 1;
+    *out = offset + total;
+    return 0;
+}
+
+/* Element index of (line, sample, band) in the file */
+static size_t elem_index(const saber_cube* c, size_t l, size_t s, size_t b)
+{
+    switch (c->interleave) {
+        case SABER_INTERLEAVE_BSQ: return (b * c->lines + l) * c->samples + s;
+        case SABER_INTERLEAVE_BIL: return (l * c->bands + b) * c->samples + s;
+        default:                   return (l * c->samples + s) * c->bands + b;
+    }
+}
+
+/* ---------- Header ---------- */
+
+static char* trim(char* s)
+{
+    while (isspace((unsigned char)*s)) s++;
+    char* e = s + strlen(s);
+    while (e > s && isspace((unsigned char)e[-1])) *--e = '\0';
+    return s;
+}
+
+static char* read_text(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* buf = len >= 0 ? malloc((size_t)len + 1) : NULL;
+    if (buf) {
+        size_t got = fread(buf, 1, (size_t)len, f);
+        buf[got] = '\0';
+    }
+    fclose(f);
+    return buf;
+}
+
+/* Split a "{a, b, c}" list in place; returns the item count */
+static size_t split_list(char* v, char** items, size_t max)
+{
+    size_t n = 0;
+    char* p = v;
+    if (*p == '{') p++;
+    char* end = strrchr(p, '}');
+    if (end) *end = '\0';
+
+    while (*p && n < max) {
+        char* comma = strchr(p, ',');
+        if (comma) *comma = '\0';
+        char* item = trim(p);
+        if (*item || comma) items[n++] = item;
+        if (!comma) break;
+        p = comma + 1;
+    }
+    return n;
+}
+
+/* Parse key = value pairs; braced values may span lines */
+static int parse_header(saber_cube* c, char* text)
+{
+    int have_s = 0, have_l = 0, have_b = 0;
+    char* wl_text = NULL;
+    char* names_text = NULL;
+    int big_endian = 0;
+
+    if (strncmp(trim(text), "ENVI", 4) != 0) {
+        fprintf(stderr, "Not an ENVI header\n");
+        return 1;
+    }
+
+    c->interleave = SABER_INTERLEAVE_BSQ;
+    char* p = text;
+    while (*p) {
+        char* eq = strchr(p, '=');
+        char* nl = strchr(p, '\n');
+        if (!eq || (nl && nl < eq)) {           /* no key on this line */
+            if (!nl) break;
+            p = nl + 1;
+            continue;
+        }
+        *eq = '\0';
+        char* key = trim(p);
+        for (char* k = key; *k; k++) *k = (char)tolower((unsigned char)*k);
+
+        char* v = eq + 1;
+        while (*v == ' ' || *v == '\t') v++;
+        char* next;
+        if (*v == '{') {
+            char* close = strchr(v, '}');
+            if (!close) { fprintf(stderr, "Unterminated '{' for header key '%s'\n", key); return 1; }
+            next = close + 1;
+            if (*next) *next++ = '\0';
+        } else {
+            char* e = strchr(v, '\n');
+            next = e ? e + 1 : v + strlen(v);
+            if (e) *e = '\0';
+        }
+        v = trim(v);
+
+        if      (!strcmp(key, "samples"))        { c->samples = strtoul(v, NULL, 10); have_s = 1; }
+        else if (!strcmp(key, "lines"))          { c->lines   = strtoul(v, NULL, 10); have_l = 1; }
+        else if (!strcmp(key, "bands"))          { c->bands   = strtoul(v, NULL, 10); have_b = 1; }
+        else if (!strcmp(key, "header offset"))  c->offset    = strtoul(v, NULL, 10);
+        else if (!strcmp(key, "data type"))      c->data_type = atoi(v);
+        else if (!strcmp(key, "byte order"))     big_endian   = atoi(v) == 1;
+        else if (!strcmp(key, "interleave")) {
+            if      (!strncasecmp(v, "bsq", 3)) c->interleave = SABER_INTERLEAVE_BSQ;
+            else if (!strncasecmp(v, "bil", 3)) c->interleave = SABER_INTERLEAVE_BIL;
+            else if (!strncasecmp(v, "bip", 3)) c->interleave = SABER_INTERLEAVE_BIP;
+            else { fprintf(stderr, "Unknown interleave '%s'\n", v); return 1; }
+        }
+        else if (!strcmp(key, "wavelength"))     wl_text = v;
+        else if (!strcmp(key, "band names"))     names_text = v;
+
+        p = next;
+    }
+
+    if (!have_s || !have_l || !have_b || !c->samples || !c->lines || !c->bands) {
+        fprintf(stderr, "ENVI header lacks samples / lines / bands\n");
+        return 1;
+    }
+    c->elem = type_size(c->data_type);
+    if (!c->elem) {
+        fprintf(stderr, "Unsupported ENVI data type %d\n", c->data_type);
+        return 1;
+    }
+    c->swap = big_endian != host_big_endian();
+
+    /* every later size and index stays below the mapped length */
+    size_t need;
+    if (cube_bytes(c->samples, c->lines, c->bands, c->elem, c->offset, &need) ||
+        c->bands > SIZE_MAX / sizeof(double)) {
+        fprintf(stderr, "ENVI header sizes overflow: %zu x %zu x %zu x %zu + %zu bytes\n",
+                c->samples, c->lines, c->bands, c->elem, c->offset);
+        return 1;
+    }
+
+    char** items = malloc(sizeof(char*) * c->bands);
+    if (!items) return 1;
+
+    if (wl_text && split_list(wl_text, items, c->bands) == c->bands) {
+        c->wavelength = malloc(sizeof(double) * c->bands);
+        if (c->wavelength)
+            for (size_t b = 0; b < c->bands; b++) c->wavelength[b] = strtod(items[b], NULL);
+    }
+    if (names_text && split_list(names_text, items, c->bands) == c->bands) {
+        c->band_names = calloc(c->bands, sizeof(char*));
+        if (c->band_names)
+            for (size_t b = 0; b < c->bands; b++) c->band_names[b] = strdup(items[b]);
+    }
+
+    free(items);
+    return 0;
+}
+
+/* "<data>.hdr", else the data path with its extension replaced */
+static char* header_path(const char* data_path)
+{
+    size_t len = strlen(data_path);
+    char* h = malloc(len + 5);
+    if (!h) return NULL;
+
+    sprintf(h, "%s.hdr", data_path);
+    if (access(h, R_OK) == 0) return h;
+
+    strcpy(h, data_path);
+    char* dot = strrchr(h, '.');
+    char* slash = strrchr(h, '/');
+    if (dot && (!slash || dot > slash)) strcpy(dot, ".hdr");
+    else strcat(h, ".hdr");
+    return h;
+}
+
+/* ---------- Open / create / close ---------- */
+
+static void cube_free(saber_cube* c)
+{
+    if (!c) return;
+    if (c->map && c->map != MAP_FAILED) munmap(c->map, c->map_len);
+    if (c->fd >= 0) close(c->fd);
+    if (c->band_names)
+        for (size_t b = 0; b < c->bands; b++) free(c->band_names[b]);
+    free(c->band_names);
+    free(c->wavelength);
+    free(c);
+}
+
+static int cube_map(saber_cube* c, const char* path, int writable)
+{
+    c->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (c->fd < 0) {
+        fprintf(stderr, "Cannot open '%s': %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(c->fd, &st) != 0) return 1;
+    size_t need;
+    if (cube_bytes(c->samples, c->lines, c->bands, c->elem, c->offset, &need)) return 1;
+    if ((size_t)st.st_size < need) {
+        fprintf(stderr, "'%s' holds %lld bytes, header describes %zu\n",
+                path, (long long)st.st_size, need);
+        return 1;
+    }
+
+    c->map_len = need;
+    c->map = mmap(NULL, need, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, c->fd, 0);
+    if (c->map == MAP_FAILED) {
+        fprintf(stderr, "mmap of '%s' failed: %s\n", path, strerror(errno));
+        return 1;
+    }
+    c->data = c->map + c->offset;
+    c->writable = writable;
+    return 0;
+}
+
+/**
+ * Map an existing ENVI cube. `path` is the data file; its header is
+ * "<path>.hdr" or the same name with the extension replaced by ".hdr".
+ * Nothing is read up front: pages come in as tiles are touched.
+ *
+ * @return cube handle, or NULL (reason on stderr)
+ */
+saber_cube* saber_cube_open(const char* path, int writable)
+{
+    if (!path) return NULL;
+
+    saber_cube* c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->fd = -1;
+
+    char* hdr = header_path(path);
+    char* text = hdr ? read_text(hdr) : NULL;
+    if (!text) {
+        fprintf(stderr, "Cannot read ENVI header '%s'\n", hdr ? hdr : path);
+        free(hdr);
+        cube_free(c);
+        return NULL;
+    }
+    free(hdr);
+
+    int rc = parse_header(c, text);
+    free(text);
+    if (rc || cube_map(c, path, writable)) {
+        cube_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+/* A band name fits the header's "{a, b, c}" list when it holds no list
+ * delimiter and survives the trimming split_list() applies */
+static int band_name_ok(const char* name)
+{
+    if (!name || !*name || strpbrk(name, ",{}\n\r")) return 0;
+    return !isspace((unsigned char)name[0]) && !isspace((unsigned char)name[strlen(name) - 1]);
+}
+
+/**
+ * Create a zero-filled output cube (data file plus "<path>.hdr") and map
+ * it read-write. data_type is an ENVI code (4 float32, 5 float64, ...).
+ * wavelength and band_names are optional [bands] header entries; names
+ * must be non-empty, without ',', '{', '}', line breaks or surrounding
+ * blanks, which the header list could not give back.
+ *
+ * @return cube handle, or NULL (reason on stderr)
+ */
+saber_cube* saber_cube_create(
+        const char* path,
+        size_t samples, size_t lines, size_t bands,
+        saber_interleave interleave, int data_type,
+        const double* wavelength, const char** band_names
+) {
+    if (!path || !samples || !lines || !bands) return NULL;
+    if (interleave != SABER_INTERLEAVE_BSQ && interleave != SABER_INTERLEAVE_BIL &&
+        interleave != SABER_INTERLEAVE_BIP) return NULL;
+    if (!type_size(data_type)) {
+        fprintf(stderr, "Unsupported ENVI data type %d\n", data_type);
+        return NULL;
+    }
+    size_t bytes;
+    if (cube_bytes(samples, lines, bands, type_size(data_type), 0, &bytes)) return NULL;
+    if (band_names)
+        for (size_t b = 0; b < bands; b++)
+            if (!band_name_ok(band_names[b])) {
+                fprintf(stderr, "Band name %zu cannot be stored in an ENVI header list\n", b);
+                return NULL;
+            }
+
+    char* hdr = malloc(strlen(path) + 5);
+    if (!hdr) return NULL;
+    sprintf(hdr, "%s.hdr", path);
+    FILE* f = fopen(hdr, "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write '%s': %s\n", hdr, strerror(errno));
+        free(hdr);
+        return NULL;
+    }
+    free(hdr);
+
+    static const char* const il_names[] = { "bsq", "bil", "bip" };
+    fprintf(f, "ENVI\ndescription = {saber-lib output}\n");
+    fprintf(f, "samples = %zu\nlines = %zu\nbands = %zu\n", samples, lines, bands);
+    fprintf(f, "header offset = 0\nfile type = ENVI Standard\n");
+    fprintf(f, "data type = %d\ninterleave = %s\nbyte order = %d\n",
+            data_type, il_names[interleave], host_big_endian());
+    if (band_names) {
+        fprintf(f, "band names = {");
+        for (size_t b = 0; b < bands; b++) fprintf(f, "%s%s", b ? ", " : "", band_names[b]);
+        fprintf(f, "}\n");
+    }
+    if (wavelength) {
+        fprintf(f, "wavelength = {");
+        for (size_t b = 0; b < bands; b++) fprintf(f, "%s%.17g", b ? ", " : "", wavelength[b]);
+        fprintf(f, "}\n");
+    }
+    fclose(f);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)bytes) != 0) {
+        fprintf(stderr, "Cannot create '%s': %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    return saber_cube_open(path, 1);
+}
+
+/* Flush a writable cube to disk; also done by saber_cube_close() */
+int saber_cube_sync(saber_cube* c)
+{
+    if (!c) return 1;
+    if (c->writable && msync(c->map, c->map_len, MS_SYNC) != 0) return 3;
+    return 0;
+}
+
+void saber_cube_close(saber_cube* c)
+{
+    if (!c) return;
+    saber_cube_sync(c);
+    cube_free(c);
+}
+
+size_t saber_cube_samples(const saber_cube* c) { return c ? c->samples : 0; }
+size_t saber_cube_lines(const saber_cube* c)   { return c ? c->lines   : 0; }
+size_t saber_cube_bands(const saber_cube* c)   { return c ? c->bands   : 0; }
+saber_interleave saber_cube_interleave(const saber_cube* c) { return c ? c->interleave : SABER_INTERLEAVE_BSQ; }
+int saber_cube_data_type(const saber_cube* c)  { return c ? c->data_type : 0; }
+const double* saber_cube_wavelength(const saber_cube* c) { return c ? c->wavelength : NULL; }
+const char* const* saber_cube_band_names(const saber_cube* c) { return c ? (const char* const*)c->band_names : NULL; }
+
+/* ---------- Zero-copy views ---------- */
+
+/**
+ * Direct pointer to lines [line0, line0 + n_lines) as an n_pix x bands
+ * array the batch kernels accept, with n_pix = n_lines * samples.
+ *
+ * Only possible for native float64 data, and then when the interleave
+ * already is a kernel layout over that range:
+ *   BIP  any lines            -> SABER_LAYOUT_PIXEL_MAJOR
+ *   BIL  a single line        -> SABER_LAYOUT_BAND_MAJOR
+ *   BSQ  the whole cube       -> SABER_LAYOUT_BAND_MAJOR
+ * Otherwise, or when the header offset leaves the data misaligned for
+ * double, returns NULL; use saber_cube_read_tile() instead.
+ */
+const double* saber_cube_view(const saber_cube* c, size_t line0, size_t n_lines, saber_layout* layout)
+{
+    if (!c || !layout || !n_lines || n_lines > c->lines || line0 > c->lines - n_lines) return NULL;
+    if (c->data_type != ENVI_F64 || c->swap) return NULL;
+    if (c->offset % sizeof(double)) return NULL;        /* the mapping itself is page-aligned */
+
+    switch (c->interleave) {
+        case SABER_INTERLEAVE_BIP:
+            *layout = SABER_LAYOUT_PIXEL_MAJOR;
+            break;
+        case SABER_INTERLEAVE_BIL:
+            if (n_lines != 1) return NULL;
+            *layout = SABER_LAYOUT_BAND_MAJOR;
+            break;
+        default:
+            if (line0 != 0 || n_lines != c->lines) return NULL;
+            *layout = SABER_LAYOUT_BAND_MAJOR;
+            break;
+    }
+    return (const double*)(c->data + elem_index(c, line0, 0, 0) * c->elem);
+}
+
+/* Writable counterpart of saber_cube_view(); NULL on read-only cubes */
+double* saber_cube_view_rw(saber_cube* c, size_t line0, size_t n_lines, saber_layout* layout)
+{
+    if (!c || !c->writable) return NULL;
+    return (double*)saber_cube_view(c, line0, n_lines, layout);
+}
+
+/* ---------- Converting tile access ---------- */
+
+static int tile_check(const saber_cube* c, size_t line0, size_t n_lines, saber_layout layout,
+                      const size_t* band_idx, size_t n_band)
+{
+    if (n_lines > c->lines || line0 > c->lines - n_lines) return 2;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+    if (band_idx)
+        for (size_t k = 0; k < n_band; k++)
+            if (band_idx[k] >= c->bands) return 2;
+    return 0;
+}
+
+/**
+ * Convert lines [line0, line0 + n_lines) to doubles in a kernel layout,
+ * straight from the mapping (no whole-cube staging). band_idx selects and
+ * orders n_band bands; NULL takes all bands in file order (n_band ignored).
+ * `out` holds n_pix x n_band values, n_pix = n_lines * samples. The file
+ * is walked in its own order so reads stay sequential.
+ *
+ * @return 0 on success, 1 null pointer, 2 lines or bands out of range,
+ *         3 unknown layout
+ */
+int saber_cube_read_tile(
+        const saber_cube* c,
+        size_t line0, size_t n_lines,
+        const size_t* band_idx, size_t n_band,
+        saber_layout layout,
+        double* out
+) {
+    if (!c || !out) return 1;
+    if (!band_idx) n_band = c->bands;
+    int rc = tile_check(c, line0, n_lines, layout, band_idx, n_band);
+    if (rc) return rc;
+
+    size_t S = c->samples;
+    size_t n_pix = n_lines * S;
+    int band_major = layout == SABER_LAYOUT_BAND_MAJOR;
+
+    for (size_t l = 0; l < n_lines; l++) {
+        if (c->interleave == SABER_INTERLEAVE_BIP) {
+            /* one contiguous spectrum per pixel */
+            for (size_t s = 0; s < S; s++) {
+                const uint8_t* src = c->data + elem_index(c, line0 + l, s, 0) * c->elem;
+                size_t px = l * S + s;
+                for (size_t k = 0; k < n_band; k++) {
+                    size_t b = band_idx ? band_idx[k] : k;
+                    double v = load_elem(src + b * c->elem, c->data_type, c->swap);
+                    if (band_major) out[k * n_pix + px] = v;
+                    else            out[px * n_band + k] = v;
+                }
+            }
+            continue;
+        }
+
+        /* BSQ / BIL: one contiguous run of samples per band */
+        for (size_t k = 0; k < n_band; k++) {
+            size_t b = band_idx ? band_idx[k] : k;
+            const uint8_t* src = c->data + elem_index(c, line0 + l, 0, b) * c->elem;
+            size_t px0 = l * S;
+            if (band_major && c->data_type == ENVI_F64 && !c->swap) {
+                memcpy(out + k * n_pix + px0, src, sizeof(double) * S);
+                continue;
+            }
+            for (size_t s = 0; s < S; s++) {
+                double v = load_elem(src + s * c->elem, c->data_type, c->swap);
+                if (band_major) out[k * n_pix + px0 + s] = v;
+                else            out[(px0 + s) * n_band + k] = v;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Inverse of saber_cube_read_tile(): store n_pix x n_band doubles from a
+ * kernel layout into bands band_idx[] of a writable cube, converting to
+ * its data type. Integer types truncate toward zero and saturate at the
+ * type's range; NaN is stored as 0.
+ *
+ * @return 0 on success, 1 null pointer / read-only cube, 2 lines or bands
+ *         out of range, 3 unknown layout
+ */
+int saber_cube_write_tile(
+        saber_cube* c,
+        size_t line0, size_t n_lines,
+        const size_t* band_idx, size_t n_band,
+        saber_layout layout,
+        const double* in
+) {
+    if (!c || !in || !c->writable) return 1;
+    if (!band_idx) n_band = c->bands;
+    int rc = tile_check(c, line0, n_lines, layout, band_idx, n_band);
+    if (rc) return rc;
+
+    size_t S = c->samples;
+    size_t n_pix = n_lines * S;
+    int band_major = layout == SABER_LAYOUT_BAND_MAJOR;
+
+    for (size_t l = 0; l < n_lines; l++) {
+        if (c->interleave == SABER_INTERLEAVE_BIP) {
+            for (size_t s = 0; s < S; s++) {
+                uint8_t* dst = c->data + elem_index(c, line0 + l, s, 0) * c->elem;
+                size_t px = l * S + s;
+                for (size_t k = 0; k < n_band; k++) {
+                    size_t b = band_idx ? band_idx[k] : k;
+                    double v = band_major ? in[k * n_pix + px] : in[px * n_band + k];
+                    store_elem(dst + b * c->elem, v, c->data_type, c->swap);
+                }
+            }
+            continue;
+        }
+
+        for (size_t k = 0; k < n_band; k++) {
+            size_t b = band_idx ? band_idx[k] : k;
+            uint8_t* dst = c->data + elem_index(c, line0 + l, 0, b) * c->elem;
+            size_t px0 = l * S;
+            for (size_t s = 0; s < S; s++) {
+                double v = band_major ? in[k * n_pix + px0 + s] : in[(px0 + s) * n_band + k];
+                store_elem(dst + s * c->elem, v, c->data_type, c->swap);
+            }
+        }
+    }
+    return 0;
+}
@@ -1,164 +1,464 @@
 #include "forward_model.h"
 #include "snell_law.h"
+#include "data_cache.h"
+#include "vec_math.h"
 #include <math.h>
+#include <stdlib.h>
 
-int forward_am03(
-        const double *wavelength,
+/* The specialised AM03 loops are instantiated once per case from one body */
+#if defined(__GNUC__)
+#define AM03_INLINE static inline __attribute__((always_inline))
+#else
+#define AM03_INLINE static inline
+#endif
+
+/* Per-pixel geometry: NULL arrays fall back to the scalar angle, and the
+ * Snell conversion is done once per call when no array is given. */
+static void pixel_geometry(double theta_sun_deg, double theta_view_deg,
+                           const double *theta_sun_pix, const double *theta_view_pix,
+                           size_t px, double *view_w_rad, double *sun_w_rad)
+{
+    double sun  = theta_sun_pix  ? theta_sun_pix[px]  : theta_sun_deg;
+    double view = theta_view_pix ? theta_view_pix[px] : theta_view_deg;
+    snell_law(view, sun, view_w_rad, sun_w_rad);
+}
+
+int am03_plan_init(am03_plan *pl, int water_type, int shallow, double view_w_rad, double sun_w_rad)
+{
+    if (water_type != 1 && water_type != 2) return 3;
+
+    pl->water_type = water_type;
+    pl->shallow    = shallow != 0;
+    pl->view_w_rad = view_w_rad;
+    pl->sun_w_rad  = sun_w_rad;
+
+    pl->cos_sun  = cos(sun_w_rad);
+    pl->cos_view = cos(view_w_rad);
+    pl->g_sun    = 1 + (0.1098 / pl->cos_sun);
+    pl->g_view   = 1 + (0.4021 / pl->cos_view);
+    pl->c_W      = 1 - 0.2786 / pl->cos_sun;
+    pl->c_B      = 1 - 0.0577 / pl->cos_sun;
+    pl->k0       = (water_type == 1) ? 1.0395 : 1.0546;
+    return 0;
+}
+
+/**
+ * Plan for one water type, shallow flag and viewing geometry (degrees, in
+ * air). Immutable once created: share it between threads and reuse it for
+ * every spectrum seen under that geometry.
+ *
+ * @return NULL on an invalid water_type or allocation failure
+ */
+saber_am03_plan* saber_am03_plan_create(int water_type, int shallow,
+                                        double theta_sun_deg, double theta_view_deg)
+{
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+
+    am03_plan pl;
+    if (am03_plan_init(&pl, water_type, shallow, view_w_rad, sun_w_rad)) return NULL;
+
+    saber_am03_plan* plan = malloc(sizeof(*plan));
+    if (plan) *plan = pl;
+    return plan;
+}
+
+void saber_am03_plan_destroy(saber_am03_plan* plan)
+{
+    free(plan);
+}
+
+/* Cores, single-spectrum and batched entry points, in both precisions */
+#define SK_REAL        double
+#define SK_FN(name)    name
+#define SK_VM          vm_impl
+#define SK_SELECT      vm_select
+#define SK_POW         pow
+#define SK_FABS        fabs
+#include "am03_kernel_impl.h"
+#undef SK_REAL
+#undef SK_FN
+#undef SK_VM
+#undef SK_SELECT
+#undef SK_POW
+#undef SK_FABS
+
+#define SK_REAL        float
+#define SK_FN(name)    name##_f
+#define SK_VM          vmf_impl
+#define SK_SELECT      vmf_select
+#define SK_POW         powf
+#define SK_FABS        fabsf
+#include "am03_kernel_impl.h"
+#undef SK_REAL
+#undef SK_FN
+#undef SK_VM
+#undef SK_SELECT
+#undef SK_POW
+#undef SK_FABS
+#undef AM03_INLINE
+
+/*-------------------------------------------------------------------------*/
+/*  Forward model with derivatives                                         */
+/*                                                                         */
+/*  Same value as am03_forward_core() plus, per band, the partials of Rrs  */
+/*  with respect to a, bb, h_w and r_b. omega_b, Kd, kuW, kuB and both     */
+/*  exponentials are shared between value and derivatives. Any derivative  */
+/*  pointer may be NULL. Contiguous (stride 1) spectra only.               */
+/*-------------------------------------------------------------------------*/
+int am03_forward_jac_core(
+        const vm_impl *vm,
+        const am03_plan *pl,
         const double *a,
         const double *bb,
         size_t n,
-        int water_type,
-        double theta_sun_deg,
-        double theta_view_deg,
-        int shallow,
         double h_w,
         const double *r_b,
-        double *rrs_out
+        double *rrs_out,
+        double *d_da,
+        double *d_dbb,
+        double *d_dh_w,
+        double *d_dr_b
 ) {
-    if (!wavelength || !a || !bb || !rrs_out) return 1;
-    if (shallow && (!r_b || h_w < 0)) return 2;
+    const int    water_type = pl->water_type;
+    const int    shallow    = pl->shallow;
+    const double cos_sun    = pl->cos_sun;
+    const double cos_view   = pl->cos_view;
+    const double g_sun      = pl->g_sun;
+    const double g_view     = pl->g_view;
+    const double k0         = pl->k0;
+    const double c_W        = pl->c_W;
+    const double c_B        = pl->c_B;
 
-    // Compute viewing geometry
-    double view_w_rad = 0, sun_w_rad = 0;
-    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+    const double Ars1 = 1.1576;
+    const double Ars2 = 1.0389;
 
-    for (size_t i = 0; i < n; i++) {
-        double ext = a[i] + bb[i];
-        if (ext == 0) {
-            rrs_out[i] = 0;
-            continue;
+    double ext[VM_BLOCK], omega_b[VM_BLOCK];
+    double kuW[VM_BLOCK], kuB[VM_BLOCK], exp_W[VM_BLOCK], exp_B[VM_BLOCK];
+
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = b0 + j;
+            ext[j]     = a[i] + bb[i];
+            omega_b[j] = ext[j] == 0 ? 0.0 : bb[i] / ext[j];
         }
 
-        double omega_b = bb[i] / ext;
-
-        // Fresnel & geometry factor
-        double f_rs;
-        if (water_type == 1) {
-            f_rs = 0.095;
-        } else if (water_type == 2) {
-            f_rs = 0.0512 *
-                   (1 + 4.6659 * omega_b +
-                    -7.8387 * omega_b * omega_b +
-                    5.4571 * omega_b * omega_b * omega_b) *
-                   (1 + (0.1098 / cos(sun_w_rad))) *
-                   (1 + (0.4021 / cos(view_w_rad)));
-        } else {
-            return 3;
+        if (shallow) {
+            for (size_t j = 0; j < m; j++) exp_W[j] = 1 + omega_b[j];
+            vm->pow2(exp_W, 3.5421, 2.2658, kuW, kuB, m);
+            for (size_t j = 0; j < m; j++) {
+                double Kd = k0 * (ext[j] / cos_sun);
+                kuW[j] = (ext[j] / cos_view) * kuW[j] * c_W;
+                kuB[j] = (ext[j] / cos_view) * kuB[j] * c_B;
+                exp_W[j] = -h_w * (Kd + kuW[j]);
+                exp_B[j] = -h_w * (Kd + kuB[j]);
+            }
+            vm->exp(exp_W, exp_W, m);
+            vm->exp(exp_B, exp_B, m);
         }
 
-        double rrs_deep = f_rs * omega_b;
+        for (size_t j = 0; j < m; j++) {
+            size_t i = b0 + j;
+            if (ext[j] == 0) {
+                rrs_out[i] = 0;
+                if (d_da)   d_da[i]   = 0;
+                if (d_dbb)  d_dbb[i]  = 0;
+                if (d_dh_w) d_dh_w[i] = 0;
+                if (d_dr_b) d_dr_b[i] = 0;
+                continue;
+            }
+            double w = omega_b[j];
 
-        if (shallow) {
-            double k0 = (water_type == 1) ? 1.0395 : 1.0546;
+            /* rrs_deep = f_rs(w) w and its slope in w */
+            double rrs_deep, d_deep_dw;
+            if (water_type == 1) {
+                rrs_deep  = 0.095 * w;
+                d_deep_dw = 0.095;
+            } else {
+                double P  = 1 + 4.6659 * w + -7.8387 * w * w + 5.4571 * w * w * w;
+                double dP = 4.6659 - 2 * 7.8387 * w + 3 * 5.4571 * w * w;
+                double c  = 0.0512 * g_sun * g_view;
+                rrs_deep  = 0.0512 * P * g_sun * g_view * w;
+                d_deep_dw = c * (P + w * dP);
+            }
 
-            double Kd = k0 * (ext / cos(sun_w_rad));
-            double kuW = (ext / cos(view_w_rad)) *
-                         pow(1 + omega_b, 3.5421) *
-                         (1 - 0.2786 / cos(sun_w_rad));
-            double kuB = (ext / cos(view_w_rad)) *
-                         pow(1 + omega_b, 2.2658) *
-                         (1 - 0.0577 / cos(sun_w_rad));
+            /* partials at fixed ext (dR_dw) and at fixed omega_b (dR_dext) */
+            double dR_dw, dR_dext;
+            if (shallow) {
+                double rb  = r_b[i];
+                double EW  = exp_W[j], EB = exp_B[j];
+                double Kd  = k0 * (ext[j] / cos_sun);
+                double tW  = rrs_deep * Ars1 * EW;     /* -dR/d(sum_W) / h_w */
+                double tB  = Ars2 * rb * EB;           /*  dR/dE_B           */
 
-            double Ars1 = 1.1576;
-            double Ars2 = 1.0389;
+                rrs_out[i] = rrs_deep * (1 - (Ars1 * EW)) + tB;
 
-            rrs_out[i] = rrs_deep * (1 - (Ars1 * exp(-h_w * (Kd + kuW)))) +
-                         Ars2 * r_b[i] * exp(-h_w * (Kd + kuB));
-        } else {
-            rrs_out[i] = rrs_deep;
+                dR_dw   = d_deep_dw * (1 - Ars1 * EW)
+                          + h_w * tW * kuW[j] * 3.5421 / (1 + w)
+                          - h_w * tB * kuB[j] * 2.2658 / (1 + w);
+                dR_dext = h_w * tW * (k0 / cos_sun + kuW[j] / ext[j])
+                          - h_w * tB * (k0 / cos_sun + kuB[j] / ext[j]);
+
+                if (d_dh_w) d_dh_w[i] = tW * (Kd + kuW[j]) - tB * (Kd + kuB[j]);
+                if (d_dr_b) d_dr_b[i] = Ars2 * EB;
+            } else {
+                rrs_out[i] = rrs_deep;
+                dR_dw   = d_deep_dw;
+                dR_dext = 0.0;
+                if (d_dh_w) d_dh_w[i] = 0.0;
+                if (d_dr_b) d_dr_b[i] = 0.0;
+            }
+
+            /* ext = a + bb, omega_b = bb / ext */
+            if (d_da)  d_da[i]  = dR_dext - dR_dw * w / ext[j];
+            if (d_dbb) d_dbb[i] = dR_dext + dR_dw * (1 - w) / ext[j];
         }
     }
 
     return 0;
 }
 
-/*-------------------------------------------------------------------------*/
-/*  Recover bottom reflectance r_b(λ) from observed Rrs(λ)                 */
-/*                                                                         */
-/*  Returns 0 on success, >0 on error:                                     */
-/*      1 – null pointer                                                   */
-/*      2 – invalid geometry/parameters (h_w ≤ 0 or deep water requested)  */
-/*      3 – denominator ≈ 0 (numerically unstable)                         */
-/*-------------------------------------------------------------------------*/
-int retrieve_r_rs_b_am03(
-        const double *wavelength,   /* [n] λ  (nm)               */
-        const double *a,            /* [n] absorption a(λ)       */
-        const double *bb,           /* [n] backscatter bb(λ)     */
-        const double *r_rs_obs,      /* [n] observed Rrs(λ)       */
-        size_t        n,            /* number of bands           */
-        int           water_type,   /* 0 = clear, 1 = turbid     */
-        double        theta_sun_deg,
-        double        theta_view_deg,
-        double        h_w,          /* water depth  (m)          */
-        double       *r_rs_b_out       /* [n]  ← recovered r_b(λ)   */
-)
+/**
+ * forward_am03() plus per-band partial derivatives of Rrs:
+ * d_da[i] = dRrs_i/da_i, d_dbb[i] = dRrs_i/dbb_i, d_dh_w[i] = dRrs_i/dh_w,
+ * d_dr_b[i] = dRrs_i/dr_b_i (the model is band-diagonal). Each derivative
+ * array is optional.
+ */
+int saber_ctx_forward_am03_jac(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        int shallow,
+        double h_w,
+        const double *r_b,
+        double *rrs_out,
+        double *d_da,
+        double *d_dbb,
+        double *d_dh_w,
+        double *d_dr_b
+) {
+    if (!ctx || !wavelength || !a || !bb || !rrs_out) return 1;
+    if (shallow && (!r_b || h_w < 0)) return 2;
+
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+
+    am03_plan pl;
+    if (am03_plan_init(&pl, water_type, shallow, view_w_rad, sun_w_rad)) return 3;
+    return am03_forward_jac_core(vm_select(ctx->accuracy), &pl, a, bb, n, h_w, r_b, rrs_out,
+                                 d_da, d_dbb, d_dh_w, d_dr_b);
+}
+
+// ---------- Strided views ----------
+
+/* Copy n strided values into contiguous tmp */
+static const double *view_gather(const double *src, size_t stride, size_t n, double *tmp)
 {
-    if (!wavelength || !a || !bb || !r_rs_obs || !r_rs_b_out) return 1;
-    if (h_w <= 0.0) return 2;           /* bottom retrieval only makes sense for shallow water */
+    for (size_t i = 0; i < n; i++) tmp[i] = src[i * stride];
+    return tmp;
+}
 
-    /* --- 1. Snell conversion of angles to water column ----------------- */
-    double view_w_rad = 0.0, sun_w_rad = 0.0;
+/**
+ * saber_ctx_forward_am03_batch() on strided views (see saber_view): band i
+ * of pixel p at v.data[p * v.pix_stride + i * v.stride] for a, bb, r_b and
+ * rrs_out, each with its own strides. When all of them share one band
+ * stride, as for a cube in its native interleave, pixels run in place;
+ * otherwise each spectrum is gathered into contiguous scratch and its
+ * result scattered. Values equal the layout batch bit for bit.
+ *
+ * @return as saber_ctx_forward_am03_batch(), 3 also on allocation failure
+ */
+int saber_ctx_forward_am03_view(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        saber_view a,
+        saber_view bb,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,
+        const double *theta_view_pix,
+        int shallow,
+        const double *h_w,
+        saber_view r_b,
+        saber_view_rw rrs_out
+) {
+    if (!ctx || !wavelength || !a.data || !bb.data || !rrs_out.data) return 1;
+    if (shallow && (!r_b.data || !h_w)) return 2;
+    if (water_type != 1 && water_type != 2) return 3;
+    if (shallow) {
+        for (size_t px = 0; px < n_pix; px++)
+            if (h_w[px] < 0) return 2;
+    }
+
+    size_t stride = rrs_out.stride;
+    int in_place = a.stride == stride && bb.stride == stride && (!shallow || r_b.stride == stride);
+    double *tmp = NULL;
+    if (!in_place) {
+        tmp = malloc(sizeof(double) * 4 * (n ? n : 1));
+        if (!tmp) return 3;
+    }
+
+    STAT_CLOCK_BEGIN(ctx);
+    const vm_impl *vm = vm_select(ctx->accuracy);
+    int per_pixel_geometry = theta_sun_pix || theta_view_pix;
+
+    double view_w_rad = 0, sun_w_rad = 0;
     snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
 
-    /* --- 2. Constant coefficients (Albert & Mobley 2003) --------------- */
-    const double Ars1 = 1.1576;
-    const double Ars2 = 1.0389;
-    const double k0   = (water_type == 1) ? 1.0395 : 1.0546;
+    am03_plan pl;
+    am03_plan_init(&pl, water_type, shallow, view_w_rad, sun_w_rad);
 
-    for (size_t i = 0; i < n; ++i) {
+    for (size_t px = 0; px < n_pix; px++) {
+        if (per_pixel_geometry) {
+            pixel_geometry(theta_sun_deg, theta_view_deg, theta_sun_pix, theta_view_pix,
+                           px, &view_w_rad, &sun_w_rad);
+            am03_plan_init(&pl, water_type, shallow, view_w_rad, sun_w_rad);
+        }
+        const double *a_px  = a.data + px * a.pix_stride;
+        const double *bb_px = bb.data + px * bb.pix_stride;
+        const double *rb_px = shallow ? r_b.data + px * r_b.pix_stride : NULL;
+        double *out_px      = rrs_out.data + px * rrs_out.pix_stride;
+        double h            = shallow ? h_w[px] : 0.0;
 
-        const double ext = a[i] + bb[i];        /* total attenuation a+bb */
-        if (ext <= 0.0) {                       /* avoid division by zero  */
-            r_rs_b_out[i] = 0.0;
+        if (in_place) {
+            am03_forward_core(vm, &pl, a_px, bb_px, n, stride, h, rb_px, out_px);
             continue;
         }
+        a_px  = view_gather(a_px, a.stride, n, tmp);
+        bb_px = view_gather(bb_px, bb.stride, n, tmp + n);
+        if (shallow) rb_px = view_gather(rb_px, r_b.stride, n, tmp + 2 * n);
+        am03_forward_core(vm, &pl, a_px, bb_px, n, 1, h, rb_px, tmp + 3 * n);
+        for (size_t i = 0; i < n; i++) out_px[i * stride] = tmp[3 * n + i];
+    }
 
-        const double omega_b = bb[i] / ext;     /* single-backscatter albedo */
-
-        /* ----- 2a. Fresnel/geometry factor f_rs (deep water) ----------- */
-        double f_rs;
-        if (water_type == 1) {                  /* turbid case */
-            f_rs = 0.095;
-        } else if (water_type == 2) {                                /* clear / case-1 water  */
-            f_rs = 0.0512 *
-                   (1 + 4.6659  * omega_b
-                    - 7.8387 * omega_b * omega_b
-                    + 5.4571 * pow(omega_b, 3.0)) *
-                   (1 + 0.1098 / cos(sun_w_rad)) *
-                   (1 + 0.4021 / cos(view_w_rad));
-        } else {
-            return 3;
-        }
+    STAT_STAGE_END(ctx, SABER_STAGE_FORWARD, n_pix);
+    free(tmp);
+    return 0;
+}
 
-        const double rrs_deep = f_rs * omega_b;
+/**
+ * saber_ctx_retrieve_r_rs_b_am03_batch() on strided views, with the view
+ * rules of saber_ctx_forward_am03_view(). A pixel hitting the denominator
+ * guard is zeroed and 4 returned once the batch is done.
+ *
+ * @return as saber_ctx_retrieve_r_rs_b_am03_batch(), 3 also on allocation
+ *         failure
+ */
+int saber_ctx_retrieve_r_rs_b_am03_view(
+        const saber_ctx *ctx,
+        const double *wavelength,
+        saber_view a,
+        saber_view bb,
+        saber_view r_rs_obs,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,
+        const double *theta_view_pix,
+        const double *h_w,
+        saber_view_rw r_rs_b_out
+) {
+    if (!ctx || !wavelength || !a.data || !bb.data || !r_rs_obs.data || !h_w || !r_rs_b_out.data)
+        return 1;
+    if (water_type != 1 && water_type != 2) return 3;
+    for (size_t px = 0; px < n_pix; px++)
+        if (h_w[px] <= 0.0) return 2;
 
-        /* ----- 2b. Diffuse attenuation coefficients ------------------- */
-        const double Kd  = k0 * (ext / cos(sun_w_rad));
+    size_t stride = r_rs_b_out.stride;
+    int in_place = a.stride == stride && bb.stride == stride && r_rs_obs.stride == stride;
+    double *tmp = NULL;
+    if (!in_place) {
+        tmp = malloc(sizeof(double) * 4 * (n ? n : 1));
+        if (!tmp) return 3;
+    }
 
-        const double kuW = (ext / cos(view_w_rad))
-                           * pow(1 + omega_b, 3.5421)
-                           * (1 - 0.2786 / cos(sun_w_rad));
+    STAT_CLOCK_BEGIN(ctx);
+    const vm_impl *vm = vm_select(ctx->accuracy);
+    int per_pixel_geometry = theta_sun_pix || theta_view_pix;
 
-        const double kuB = (ext / cos(view_w_rad))
-                           * pow(1 + omega_b, 2.2658)
-                           * (1 - 0.0577 / cos(sun_w_rad));
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
 
-        /* Pre-compute the exponential terms once */
-        const double exp_W = exp(-h_w * (Kd + kuW));
-        const double exp_B = exp(-h_w * (Kd + kuB));
+    am03_plan pl;
+    am03_plan_init(&pl, water_type, 1, view_w_rad, sun_w_rad);
 
-        /* ----- 3. Invert the shallow-water equation for r_b ------------ */
-        const double numerator   = r_rs_obs[i] - rrs_deep * (1.0 - Ars1 * exp_W);
-        const double denominator = Ars2 * exp_B;
+    int status = 0;
+    for (size_t px = 0; px < n_pix; px++) {
+        if (per_pixel_geometry) {
+            pixel_geometry(theta_sun_deg, theta_view_deg, theta_sun_pix, theta_view_pix,
+                           px, &view_w_rad, &sun_w_rad);
+            am03_plan_init(&pl, water_type, 1, view_w_rad, sun_w_rad);
+        }
+        const double *a_px   = a.data + px * a.pix_stride;
+        const double *bb_px  = bb.data + px * bb.pix_stride;
+        const double *obs_px = r_rs_obs.data + px * r_rs_obs.pix_stride;
+        double *out_px       = r_rs_b_out.data + px * r_rs_b_out.pix_stride;
 
-        if (fabs(denominator) < 1e-12) {        /* guard against blow-ups */
-            r_rs_b_out[i] = 0.0;
-            return 4;
+        int rc;
+        if (in_place) {
+            rc = am03_retrieve_core(vm, &pl, a_px, bb_px, obs_px, n, stride, h_w[px], out_px);
+        } else {
+            a_px   = view_gather(a_px, a.stride, n, tmp);
+            bb_px  = view_gather(bb_px, bb.stride, n, tmp + n);
+            obs_px = view_gather(obs_px, r_rs_obs.stride, n, tmp + 2 * n);
+            rc = am03_retrieve_core(vm, &pl, a_px, bb_px, obs_px, n, 1, h_w[px], tmp + 3 * n);
+            for (size_t i = 0; i < n; i++) out_px[i * stride] = tmp[3 * n + i];
         }
+        if (rc == 4) {
+            for (size_t i = 0; i < n; i++) out_px[i * stride] = 0;
+            status = 4;
+        }
+    }
 
-        r_rs_b_out[i] = numerator / denominator;
+    STAT_STAGE_END(ctx, SABER_STAGE_RETRIEVE, n_pix);
+    free(tmp);
+    return status;
+}
 
-    }
+// ---------- Legacy global API ----------
 
-    return 0;
+int forward_am03(
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        int shallow,
+        double h_w,
+        const double *r_b,
+        double *rrs_out
+) {
+    return saber_ctx_forward_am03(saber_default_ctx(), wavelength, a, bb, n, water_type,
+                                  theta_sun_deg, theta_view_deg, shallow, h_w, r_b, rrs_out);
+}
+
+int retrieve_r_rs_b_am03(
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        const double *r_rs_obs,
+        size_t n,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        double h_w,
+        double *r_rs_b_out
+) {
+    return saber_ctx_retrieve_r_rs_b_am03(saber_default_ctx(), wavelength, a, bb, r_rs_obs, n,
+                                          water_type, theta_sun_deg, theta_view_deg, h_w,
+                                          r_rs_b_out);
 }
@@ -6,6 +6,8 @@
 #define SABER_LIB_FORWARD_MODEL_H
 
 #include <stddef.h>
+#include "saber.h"
+#include "vec_math.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,6 +27,96 @@ int forward_am03(
         double* rrs_out
 );
 
+/* ---------- internal: AM03 plans ---------- */
+
+/* Everything in AM03 that depends only on the water type, the shallow flag
+ * and the in-water geometry, evaluated once and shared by the forward,
+ * derivative and bottom-retrieval kernels. */
+struct saber_am03_plan {
+    int    water_type;
+    int    shallow;
+    double view_w_rad;
+    double sun_w_rad;
+
+    double cos_sun;
+    double cos_view;
+    double g_sun;           /* 1 + 0.1098 / cos_sun  */
+    double g_view;          /* 1 + 0.4021 / cos_view */
+    double c_W;             /* 1 - 0.2786 / cos_sun  */
+    double c_B;             /* 1 - 0.0577 / cos_sun  */
+    double k0;              /* 1.0395 or 1.0546      */
+};
+typedef struct saber_am03_plan am03_plan;
+
+/* @return 0, or 3 for an invalid water_type */
+int am03_plan_init(am03_plan *pl, int water_type, int shallow, double view_w_rad, double sun_w_rad);
+
+/* ---------- internal: single-spectrum cores under a plan ---------- */
+
+int am03_forward_core(
+        const vm_impl *vm,
+        const am03_plan *pl,
+        const double *a,
+        const double *bb,
+        size_t n,
+        size_t stride,
+        double h_w,
+        const double *r_b,
+        double *rrs_out
+);
+
+int am03_forward_jac_core(
+        const vm_impl *vm,
+        const am03_plan *pl,
+        const double *a,
+        const double *bb,
+        size_t n,
+        double h_w,
+        const double *r_b,
+        double *rrs_out,
+        double *d_da,
+        double *d_dbb,
+        double *d_dh_w,
+        double *d_dr_b
+);
+
+int am03_retrieve_core(
+        const vm_impl *vm,
+        const am03_plan *pl,
+        const double *a,
+        const double *bb,
+        const double *r_rs_obs,
+        size_t n,
+        size_t stride,
+        double h_w,
+        double *r_rs_b_out
+);
+
+/* float instantiations (am03_kernel_impl.h); the plan and depth stay double */
+int am03_forward_core_f(
+        const vmf_impl *vm,
+        const am03_plan *pl,
+        const float *a,
+        const float *bb,
+        size_t n,
+        size_t stride,
+        double h_w,
+        const float *r_b,
+        float *rrs_out
+);
+
+int am03_retrieve_core_f(
+        const vmf_impl *vm,
+        const am03_plan *pl,
+        const float *a,
+        const float *bb,
+        const float *r_rs_obs,
+        size_t n,
+        size_t stride,
+        double h_w,
+        float *r_rs_b_out
+);
+
 #ifdef __cplusplus
 }
 #endif
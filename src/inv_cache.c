@@ -0,0 +1,313 @@
+#include "inversion.h"
+#include "data_cache.h"
+#include "iop_from_oac.h"
+#include "forward_model.h"
+#include "snell_law.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+static const double Ars1 = 1.1576;
+static const double Ars2 = 1.0389;
+
+int inv_cache_init(inv_cache* c, size_t n, size_t n_class)
+{
+    memset(c, 0, sizeof(*c));
+    c->n       = n;
+    c->n_class = n_class;
+    c->x     = malloc(sizeof(double) * (SABER_INV_N_BASE + n_class));
+    c->block = malloc(sizeof(double) * 14 * n);
+    if (!c->x || !c->block) {
+        inv_cache_free(c);
+        return 3;
+    }
+
+    double* s = c->block;
+    c->g_shape   = s; s += n;
+    c->nap_shape = s; s += n;
+    c->bbp_shape = s; s += n;
+    c->a_phy     = s; s += n;
+    c->a_g       = s; s += n;
+    c->a_nap     = s; s += n;
+    c->bb_p      = s; s += n;
+    c->ext       = s; s += n;
+    c->rrs_deep  = s; s += n;
+    c->k_W       = s; s += n;
+    c->k_B       = s; s += n;
+    c->deep      = s; s += n;
+    c->exp_B     = s; s += n;
+    c->r_b       = s;
+    return 0;
+}
+
+void inv_cache_free(inv_cache* c)
+{
+    free(c->x);
+    free(c->block);
+    memset(c, 0, sizeof(*c));
+}
+
+/* Bitwise, so that a step to -0 or between NaNs is still seen */
+static int moved(const inv_cache* c, const double* x, size_t k)
+{
+    return !c->valid || memcmp(&c->x[k], &x[k], sizeof(double)) != 0;
+}
+
+/* Spectral shape of one slope, by VM_BLOCK like oac_iop_spectrum() */
+void inv_shape(const vm_impl* vm, const double* wl, size_t n, int slot, double slope, double* shape)
+{
+    oac_params p;
+    memset(&p, 0, sizeof(p));
+    p.v[slot]   = slope;
+    p.has[slot] = 1;
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+        oac_shapes_fill(vm, wl + b0, m, &p,
+                        slot == OAC_A_G_S      ? shape + b0 : NULL,
+                        slot == OAC_A_NAP_S    ? shape + b0 : NULL,
+                        slot == OAC_BB_P_GAMMA ? shape + b0 : NULL);
+    }
+}
+
+/* Water column: everything of am03_forward_core() but the depth */
+static void cache_water(inv_cache* c, const vm_impl* vm, const saber_grid* g, const am03_plan* pl)
+{
+    size_t n = c->n;
+    const double* aw = g->a_w;
+    const double* bw = g->bb_w;
+    double omega_b[VM_BLOCK], e_W[VM_BLOCK], e_B[VM_BLOCK];
+
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = b0 + j;
+            double a  = aw[i] + c->a_phy[i] + c->a_g[i] + c->a_nap[i];
+            double bb = bw[i] + c->bb_p[i];
+            c->ext[i]  = a + bb;
+            omega_b[j] = c->ext[i] == 0 ? 0 : bb / c->ext[i];
+        }
+
+        if (pl->shallow) {
+            double base[VM_BLOCK];
+            for (size_t j = 0; j < m; j++) base[j] = 1 + omega_b[j];
+            vm->pow2(base, 3.5421, 2.2658, e_W, e_B, m);
+            for (size_t j = 0; j < m; j++) {
+                double ext = c->ext[b0 + j];
+                double Kd  = pl->k0 * (ext / pl->cos_sun);
+                double kuW = (ext / pl->cos_view) * e_W[j] * pl->c_W;
+                double kuB = (ext / pl->cos_view) * e_B[j] * pl->c_B;
+                c->k_W[b0 + j] = Kd + kuW;
+                c->k_B[b0 + j] = Kd + kuB;
+            }
+        }
+
+        for (size_t j = 0; j < m; j++) {
+            double w = omega_b[j];
+            double f_rs;
+            if (pl->water_type == 1) {
+                f_rs = 0.095;
+            } else {
+                f_rs = 0.0512 *
+                       (1 + 4.6659 * w +
+                        -7.8387 * w * w +
+                        5.4571 * w * w * w) *
+                       pl->g_sun *
+                       pl->g_view;
+            }
+            c->rrs_deep[b0 + j] = f_rs * w;
+        }
+    }
+}
+
+/* Depth: the two attenuation exponentials */
+static void cache_depth(inv_cache* c, const vm_impl* vm, double h_w)
+{
+    size_t n = c->n;
+    double e_W[VM_BLOCK];
+
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+        double* e_B = c->exp_B + b0;
+        for (size_t j = 0; j < m; j++) {
+            e_W[j] = -h_w * c->k_W[b0 + j];
+            e_B[j] = -h_w * c->k_B[b0 + j];
+        }
+        vm->exp(e_W, e_W, m);
+        vm->exp(e_B, e_B, m);
+        for (size_t j = 0; j < m; j++)
+            c->deep[b0 + j] = c->rrs_deep[b0 + j] * (1 - (Ars1 * e_W[j]));
+    }
+}
+
+/**
+ * inv_model() through the cache: compare x (and the plan) with the
+ * values of the cached terms and redo only the stages they feed.
+ * A depth step costs two exp() per band, a fraction step none.
+ *
+ * @return 0 (the model cannot fail once the workspace exists)
+ */
+int inv_cache_eval(inv_cache* c, const vm_impl* vm, const saber_grid* g, const am03_plan* pl,
+                   const size_t* class_idx, const double* x, double* out)
+{
+    size_t n = c->n;
+    const double* wl = g->wl;
+
+    int d_plan = !c->valid || memcmp(&c->plan, pl, sizeof(*pl)) != 0;
+    int d_gs   = moved(c, x, SABER_INV_A_G_S);
+    int d_ns   = moved(c, x, SABER_INV_A_NAP_S);
+    int d_bs   = moved(c, x, SABER_INV_BB_P_GAMMA);
+    int d_phy  = moved(c, x, SABER_INV_CHL);
+    int d_g    = d_gs || moved(c, x, SABER_INV_A_G_440);
+    int d_nap  = d_ns || moved(c, x, SABER_INV_A_NAP_440);
+    int d_bbp  = d_bs || moved(c, x, SABER_INV_BB_P_550);
+    int d_water = d_plan || d_phy || d_g || d_nap || d_bbp;
+    int d_depth = pl->shallow && (d_water || moved(c, x, SABER_INV_H_W));
+    int d_frac  = pl->shallow && c->valid && !c->plan.shallow;
+    for (size_t j = 0; j < c->n_class && pl->shallow; j++)
+        d_frac |= moved(c, x, SABER_INV_N_BASE + j);
+
+    if (d_phy) {
+        double chl = x[SABER_INV_CHL], aph_440, log_aph_440;
+        vm->pow(&chl, 0.65, &aph_440, 1);
+        aph_440 = 0.06 * aph_440;
+        vm->log(&aph_440, &log_aph_440, 1);
+        for (size_t i = 0; i < n; i++) {
+            double a_phy = (g->a0[i] + g->a1[i] * log_aph_440) * aph_440;
+            c->a_phy[i] = a_phy < 0 ? 0 : a_phy;
+        }
+    }
+    if (d_gs) inv_shape(vm, wl, n, OAC_A_G_S, x[SABER_INV_A_G_S], c->g_shape);
+    if (d_ns) inv_shape(vm, wl, n, OAC_A_NAP_S, x[SABER_INV_A_NAP_S], c->nap_shape);
+    if (d_bs) inv_shape(vm, wl, n, OAC_BB_P_GAMMA, x[SABER_INV_BB_P_GAMMA], c->bbp_shape);
+    if (d_g)
+        for (size_t i = 0; i < n; i++) c->a_g[i] = x[SABER_INV_A_G_440] * c->g_shape[i];
+    if (d_nap)
+        for (size_t i = 0; i < n; i++) c->a_nap[i] = x[SABER_INV_A_NAP_440] * c->nap_shape[i];
+    if (d_bbp)
+        for (size_t i = 0; i < n; i++) c->bb_p[i] = x[SABER_INV_BB_P_550] * c->bbp_shape[i];
+
+    if (d_water) cache_water(c, vm, g, pl);
+    if (d_depth) cache_depth(c, vm, x[SABER_INV_H_W]);
+    if (d_frac) {
+        memset(c->r_b, 0, sizeof(double) * n);
+        for (size_t j = 0; j < c->n_class; j++) {
+            double f = x[SABER_INV_N_BASE + j];
+            const double* col = g->r_rs_b + class_idx[j] * n;
+            for (size_t i = 0; i < n; i++) c->r_b[i] += f * col[i];
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (c->ext[i] == 0)
+            out[i] = 0;
+        else if (pl->shallow)
+            out[i] = c->deep[i] + Ars2 * c->r_b[i] * c->exp_B[i];
+        else
+            out[i] = c->rrs_deep[i];
+    }
+
+    memcpy(c->x, x, sizeof(double) * (SABER_INV_N_BASE + c->n_class));
+    c->plan  = *pl;
+    c->valid = 1;
+    return 0;
+}
+
+// ---------- Incremental evaluator ----------
+
+struct saber_inv_evaluator {
+    const saber_ctx* ctx;
+    uint64_t grid_token;        /* ctx->grid.token at create time */
+    const vm_impl* vm;
+    am03_plan plan;
+    size_t* class_idx;
+    inv_cache cache;
+};
+
+/**
+ * Forward model of `cfg` (water type, geometry, shallow flag and bottom
+ * classes; bounds, fit flags and solver settings are not used) over the
+ * inversion parameter vector, keeping every per-band intermediate term
+ * between calls. Each evaluation recomputes only the stages downstream of
+ * the parameters that differ from the previous call's: a step in h_w or in
+ * the bottom fractions skips the IOP model and the AM03 water-column terms
+ * with all their pow/exp calls. Results are bit-identical to a full
+ * evaluation. One evaluator per thread; tied to the current grid like a
+ * schema.
+ *
+ * @return new evaluator, or NULL on bad arguments / unknown class / no memory
+ */
+saber_inv_evaluator* saber_inv_evaluator_create(const saber_ctx* ctx, const saber_inv_config* cfg)
+{
+    if (!ctx || !cfg || !ctx->grid.wl) return NULL;
+    if (cfg->water_type != 1 && cfg->water_type != 2) return NULL;
+    if (cfg->shallow && cfg->n_class == 0) return NULL;
+    if (cfg->n_class && !cfg->class_names) return NULL;
+
+    saber_inv_evaluator* ev = calloc(1, sizeof(*ev));
+    if (!ev) return NULL;
+    ev->ctx        = ctx;
+    ev->grid_token = ctx->grid.token;
+    ev->vm         = vm_select(ctx->accuracy);
+
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(cfg->theta_view_deg, cfg->theta_sun_deg, &view_w_rad, &sun_w_rad);
+    am03_plan_init(&ev->plan, cfg->water_type, cfg->shallow, view_w_rad, sun_w_rad);
+
+    ev->class_idx = malloc(sizeof(size_t) * (cfg->n_class ? cfg->n_class : 1));
+    if (!ev->class_idx || inv_cache_init(&ev->cache, ctx->grid.n_wl, cfg->n_class)) goto fail;
+
+    const char** colnames = saber_ctx_get_r_rs_b_class_names(ctx);
+    size_t lib_n = saber_ctx_get_n_class(ctx);
+    for (size_t j = 0; j < cfg->n_class; j++) {
+        size_t k = 0;
+        while (k < lib_n && strcmp(cfg->class_names[j], colnames[k]) != 0) k++;
+        if (k == lib_n) {
+            fprintf(stderr, "Class name '%s' not found in cached bottom reflectance\n",
+                    cfg->class_names[j]);
+            goto fail;
+        }
+        ev->class_idx[j] = k;
+    }
+    return ev;
+
+fail:
+    saber_inv_evaluator_destroy(ev);
+    return NULL;
+}
+
+void saber_inv_evaluator_destroy(saber_inv_evaluator* ev)
+{
+    if (!ev) return;
+    free(ev->class_idx);
+    inv_cache_free(&ev->cache);
+    free(ev);
+}
+
+/* New geometry; the next evaluation redoes the water-column terms */
+void saber_inv_evaluator_set_geometry(saber_inv_evaluator* ev, double theta_sun_deg, double theta_view_deg)
+{
+    if (!ev) return;
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+    am03_plan_init(&ev->plan, ev->plan.water_type, ev->plan.shallow, view_w_rad, sun_w_rad);
+}
+
+/**
+ * Modelled Rrs at x ([n_par], saber_inv_param order then the fractions)
+ * on the context grid.
+ *
+ * @return 0 on success, 1 null pointer, 2 evaluator not created on this
+ *         context / its grid is no longer current
+ */
+int saber_inv_evaluate(saber_inv_evaluator* ev, const double* x, double* rrs_out)
+{
+    if (!ev || !x || !rrs_out) return 1;
+    const saber_ctx* ctx = ev->ctx;
+    if (ev->grid_token != ctx->grid.token) return 2;
+
+    STAT_CLOCK_BEGIN(ctx);
+    int rc = inv_cache_eval(&ev->cache, ev->vm, &ctx->grid, &ev->plan, ev->class_idx, x, rrs_out);
+    STAT_STAGE_END(ctx, SABER_STAGE_FORWARD, 1);
+    return rc;
+}
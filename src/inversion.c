@@ -0,0 +1,638 @@
+#include "inversion.h"
+#include "data_cache.h"
+#include "iop_from_oac.h"
+#include "forward_model.h"
+#include "snell_law.h"
+#include "linalg.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+
+/* Default search box and starting point for the base parameters,
+ * in saber_inv_param order. */
+static const double inv_default_x0[SABER_INV_N_BASE] = {
+        1.0, 0.1, 0.01, 0.005, 0.017, 0.0116, 0.46, 5.0
+};
+static const double inv_default_lower[SABER_INV_N_BASE] = {
+        1e-4, 0.0, 0.0, 0.0, 0.005, 0.005, 0.0, 0.05
+};
+static const double inv_default_upper[SABER_INV_N_BASE] = {
+        500.0, 10.0, 10.0, 1.0, 0.03, 0.03, 3.0, 50.0
+};
+
+size_t saber_inv_n_param(const saber_inv_config* cfg)
+{
+    return SABER_INV_N_BASE + (cfg ? cfg->n_class : 0);
+}
+
+/* x0 / lower / upper may each be NULL */
+int saber_inv_defaults(const saber_inv_config* cfg, double* x0, double* lower, double* upper)
+{
+    if (!cfg) return 1;
+    size_t n_par = saber_inv_n_param(cfg);
+
+    for (size_t k = 0; k < n_par; k++) {
+        int base = k < SABER_INV_N_BASE;
+        if (x0)    x0[k]    = base ? inv_default_x0[k]    : 1.0 / (double)cfg->n_class;
+        if (lower) lower[k] = base ? inv_default_lower[k] : 0.0;
+        if (upper) upper[k] = base ? inv_default_upper[k] : 1.0;
+    }
+    return 0;
+}
+
+// ---------- Workspace ----------
+
+saber_inv_workspace* saber_inv_workspace_create(const saber_ctx* ctx, const saber_inv_config* cfg)
+{
+    if (!ctx || !cfg || !ctx->grid.wl) return NULL;
+    if (cfg->water_type != 1 && cfg->water_type != 2) return NULL;
+    if (cfg->shallow && cfg->n_class == 0) return NULL;
+    if (cfg->n_class && !cfg->class_names) return NULL;
+
+    size_t n     = ctx->grid.n_wl;
+    size_t n_par = saber_inv_n_param(cfg);
+
+    saber_inv_workspace* ws = calloc(1, sizeof(*ws));
+    if (!ws) return NULL;
+
+    ws->ctx   = ctx;
+    ws->vm    = vm_select(ctx->accuracy);
+    ws->grid_token = ctx->grid.token;
+    ws->n     = n;
+    ws->n_par = n_par;
+    ws->water_type = cfg->water_type;
+    ws->shallow    = cfg->shallow;
+    ws->max_iter   = cfg->max_iter > 0 ? cfg->max_iter : 100;
+    ws->tol        = cfg->tol > 0 ? cfg->tol : 1e-10;
+    ws->fd_jacobian = cfg->fd_jacobian;
+    if (cfg->varpro < SABER_INV_VARPRO_OFF || cfg->varpro > SABER_INV_VARPRO_SUM_TO_ONE) goto fail;
+    ws->varpro     = cfg->shallow ? cfg->varpro : SABER_INV_VARPRO_OFF;
+    saber_inv_set_geometry(ws, cfg->theta_sun_deg, cfg->theta_view_deg);
+
+    /* Resolve bottom classes once */
+    ws->n_class   = cfg->n_class;
+    ws->class_idx = malloc(sizeof(size_t) * (cfg->n_class ? cfg->n_class : 1));
+    if (!ws->class_idx) goto fail;
+
+    const char** colnames = saber_ctx_get_r_rs_b_class_names(ctx);
+    size_t lib_n = saber_ctx_get_n_class(ctx);
+    for (size_t j = 0; j < cfg->n_class; j++) {
+        size_t k = 0;
+        while (k < lib_n && strcmp(cfg->class_names[j], colnames[k]) != 0) k++;
+        if (k == lib_n) {
+            fprintf(stderr, "Class name '%s' not found in cached bottom reflectance\n",
+                    cfg->class_names[j]);
+            goto fail;
+        }
+        ws->class_idx[j] = k;
+    }
+
+    /* Bounds and free mask */
+    ws->lower = malloc(sizeof(double) * n_par);
+    ws->upper = malloc(sizeof(double) * n_par);
+    ws->free_idx = malloc(sizeof(size_t) * n_par);
+    if (!ws->lower || !ws->upper || !ws->free_idx) goto fail;
+
+    saber_inv_defaults(cfg, NULL, ws->lower, ws->upper);
+    if (cfg->lower) memcpy(ws->lower, cfg->lower, sizeof(double) * n_par);
+    if (cfg->upper) memcpy(ws->upper, cfg->upper, sizeof(double) * n_par);
+
+    ws->n_free = 0;
+    for (size_t k = 0; k < n_par; k++) {
+        int fit;
+        if (cfg->fit) {
+            fit = cfg->fit[k] != 0;
+        } else {
+            /* default: concentrations, and depth + fractions when shallow */
+            fit = k <= SABER_INV_BB_P_550 ||
+                  (cfg->shallow && (k == SABER_INV_H_W || k >= SABER_INV_N_BASE));
+        }
+        if (!cfg->shallow && (k == SABER_INV_H_W || k >= SABER_INV_N_BASE)) fit = 0;
+        if (ws->varpro && k >= SABER_INV_N_BASE) fit = 0;
+        if (fit) ws->free_idx[ws->n_free++] = k;
+    }
+    if (ws->n_free == 0) goto fail;
+
+    /* All scratch for the iteration loop in one block */
+    size_t p = ws->n_free;
+    size_t n_doubles = 6 * n                 /* a, bb, r_b, rrs, rrs_h, sqrt_w */
+                       + 2 * n               /* r, r_trial */
+                       + n * p               /* J */
+                       + 2 * p * p           /* JtJ, A */
+                       + 3 * p               /* g, delta, diag */
+                       + 2 * n_par           /* x, x_trial */
+                       + 2 * OAC_N * n       /* da, dbb */
+                       + 4 * n               /* dR/da, dR/dbb, dR/dh_w, dR/dr_b */
+                       + n_par * n;          /* jac */
+    size_t m = ws->varpro ? ws->n_class : 0;
+    n_doubles += 2 * n                       /* vp_c, vp_y */
+                 + 2 * m * n                 /* vp_A, vp_Q */
+                 + 2 * m * m                 /* gram, vp_M */
+                 + m * p                     /* vp_T */
+                 + 2 * m;                    /* vp_rhs, vp_f */
+    ws->scratch = malloc(sizeof(double) * n_doubles);
+    if (!ws->scratch) goto fail;
+
+    double* s = ws->scratch;
+    ws->a      = s; s += n;
+    ws->bb     = s; s += n;
+    ws->r_b    = s; s += n;
+    ws->rrs    = s; s += n;
+    ws->rrs_h  = s; s += n;
+    ws->sqrt_w = s; s += n;
+    ws->r      = s; s += n;
+    ws->r_trial = s; s += n;
+    ws->J      = s; s += n * p;
+    ws->JtJ    = s; s += p * p;
+    ws->A      = s; s += p * p;
+    ws->g      = s; s += p;
+    ws->delta  = s; s += p;
+    ws->diag   = s; s += p;
+    ws->x      = s; s += n_par;
+    ws->x_trial = s; s += n_par;
+    ws->da     = s; s += OAC_N * n;
+    ws->dbb    = s; s += OAC_N * n;
+    ws->dR_da  = s; s += n;
+    ws->dR_dbb = s; s += n;
+    ws->dR_dh_w = s; s += n;
+    ws->dR_dr_b = s; s += n;
+    ws->jac    = s; s += n_par * n;
+
+    if (ws->varpro) {
+        ws->vp_c   = s; s += n;
+        ws->vp_y   = s; s += n;
+        ws->vp_A   = s; s += m * n;
+        ws->vp_Q   = s; s += m * n;
+        ws->vp_M   = s; s += m * m;
+        ws->vp_T   = s; s += m * p;
+        ws->vp_rhs = s; s += m;
+        ws->vp_f   = s; s += m;
+
+        ws->vp_u.n_wl       = n;
+        ws->vp_u.n_class    = m;
+        ws->vp_u.sum_to_one = ws->varpro == SABER_INV_VARPRO_SUM_TO_ONE;
+        ws->vp_u.gram       = s;
+        ws->vp_act = malloc(sizeof(size_t) * m);
+        ws->vp_ws  = unmix_workspace_create(&ws->vp_u);
+        if (!ws->vp_act || !ws->vp_ws) goto fail;
+    }
+    if (inv_cache_init(&ws->cache, n, ws->n_class)) goto fail;
+
+    return ws;
+
+fail:
+    saber_inv_workspace_destroy(ws);
+    return NULL;
+}
+
+void saber_inv_workspace_destroy(saber_inv_workspace* ws)
+{
+    if (!ws) return;
+    free(ws->class_idx);
+    free(ws->lower);
+    free(ws->upper);
+    free(ws->free_idx);
+    free(ws->scratch);
+    free(ws->vp_act);
+    unmix_workspace_destroy(ws->vp_ws);
+    inv_cache_free(&ws->cache);
+    free(ws->pop);
+    free(ws);
+}
+
+void saber_inv_set_geometry(saber_inv_workspace* ws, double theta_sun_deg, double theta_view_deg)
+{
+    if (!ws) return;
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+    am03_plan_init(&ws->plan, ws->water_type, ws->shallow, view_w_rad, sun_w_rad);
+}
+
+// ---------- Model ----------
+
+/* Rrs(x) into `out`; no allocation, no string lookups */
+int inv_model(saber_inv_workspace* ws, const double* x, double* out)
+{
+    const saber_grid* g = &ws->ctx->grid;
+    size_t n = ws->n;
+
+    oac_params p;
+    for (int k = 0; k < OAC_N; k++) {
+        p.v[k]   = x[k];
+        p.has[k] = 1;
+    }
+    p.aph_ready = 0;
+    oac_iop_spectrum(ws->vm, g, g->wl, n, &p, NULL, ws->a, ws->bb, 1);
+
+    if (ws->shallow) {
+        memset(ws->r_b, 0, sizeof(double) * n);
+        for (size_t j = 0; j < ws->n_class; j++) {
+            double f = x[SABER_INV_N_BASE + j];
+            const double* col = g->r_rs_b + ws->class_idx[j] * n;
+            for (size_t i = 0; i < n; i++) ws->r_b[i] += f * col[i];
+        }
+    }
+
+    return am03_forward_core(ws->vm, &ws->plan, ws->a, ws->bb, n, 1,
+                             x[SABER_INV_H_W], ws->r_b, out);
+}
+
+/* inv_model() reusing the terms of the workspace's previous cached
+ * evaluation that x leaves unchanged; bit-identical, but leaves
+ * ws->a / bb / r_b alone */
+int inv_model_cached(saber_inv_workspace* ws, const double* x, double* out)
+{
+    return inv_cache_eval(&ws->cache, ws->vm, &ws->ctx->grid, &ws->plan, ws->class_idx, x, out);
+}
+
+/* Rrs(x) and jac[k * n + i] = dRrs_i / dx_k for every parameter, in one
+ * pass sharing the IOP shapes and the AM03 exponentials. */
+int inv_model_jac(saber_inv_workspace* ws, const double* x, double* out, double* jac)
+{
+    const saber_grid* g = &ws->ctx->grid;
+    size_t n = ws->n;
+
+    oac_params p;
+    for (int k = 0; k < OAC_N; k++) {
+        p.v[k]   = x[k];
+        p.has[k] = 1;
+    }
+    p.aph_ready = 0;
+    oac_iop_jac(ws->vm, g, g->wl, n, &p, ws->a, ws->bb, ws->da, ws->dbb);
+
+    if (ws->shallow) {
+        memset(ws->r_b, 0, sizeof(double) * n);
+        for (size_t j = 0; j < ws->n_class; j++) {
+            double f = x[SABER_INV_N_BASE + j];
+            const double* col = g->r_rs_b + ws->class_idx[j] * n;
+            for (size_t i = 0; i < n; i++) ws->r_b[i] += f * col[i];
+        }
+    }
+
+    int rc = am03_forward_jac_core(ws->vm, &ws->plan, ws->a, ws->bb, n,
+                                   x[SABER_INV_H_W], ws->r_b, out,
+                                   ws->dR_da, ws->dR_dbb, ws->dR_dh_w, ws->dR_dr_b);
+    if (rc) return rc;
+
+    /* chain rule: IOP parameters through a and bb */
+    for (int k = 0; k < OAC_N; k++) {
+        const double* da_k  = ws->da  + (size_t)k * n;
+        const double* dbb_k = ws->dbb + (size_t)k * n;
+        double* row = jac + (size_t)k * n;
+        for (size_t i = 0; i < n; i++)
+            row[i] = ws->dR_da[i] * da_k[i] + ws->dR_dbb[i] * dbb_k[i];
+    }
+
+    memcpy(jac + SABER_INV_H_W * n, ws->dR_dh_w, sizeof(double) * n);
+
+    for (size_t j = 0; j < ws->n_class; j++) {
+        const double* col = g->r_rs_b + ws->class_idx[j] * n;
+        double* row = jac + (SABER_INV_N_BASE + j) * n;
+        for (size_t i = 0; i < n; i++) row[i] = ws->dR_dr_b[i] * col[i];
+    }
+
+    return 0;
+}
+
+/**
+ * Modelled Rrs at x and its Jacobian with respect to every parameter of the
+ * workspace layout: jac_out[k * n + i] = dRrs_i / dx_k ([n_par x n]).
+ * Returns 2 once another grid is current.
+ */
+int saber_inv_model_jacobian(saber_inv_workspace* ws, const double* x,
+                             double* rrs_out, double* jac_out)
+{
+    if (!ws || !x || !rrs_out || !jac_out) return 1;
+    if (ws->grid_token != ws->ctx->grid.token) return 2;
+    return inv_model_jac(ws, x, rrs_out, jac_out);
+}
+
+/* inv_model() with the bottom fractions of x first replaced by their
+ * best values for ws->obs under the current water column: Rrs = c + d r_b
+ * band by band, so the weighted misfit is linear least squares in the
+ * fractions, solved warm from the previous evaluation's. */
+static int inv_model_varpro(saber_inv_workspace* ws, double* x, double* out)
+{
+    const saber_grid* g = &ws->ctx->grid;
+    size_t n = ws->n, m = ws->n_class;
+
+    oac_params p;
+    for (int k = 0; k < OAC_N; k++) {
+        p.v[k]   = x[k];
+        p.has[k] = 1;
+    }
+    p.aph_ready = 0;
+    oac_iop_spectrum(ws->vm, g, g->wl, n, &p, NULL, ws->a, ws->bb, 1);
+
+    /* c: Rrs over a black bottom, d: its slope in r_b */
+    memset(ws->r_b, 0, sizeof(double) * n);
+    int rc = am03_forward_jac_core(ws->vm, &ws->plan, ws->a, ws->bb, n, x[SABER_INV_H_W],
+                                   ws->r_b, ws->vp_c, NULL, NULL, NULL, ws->dR_dr_b);
+    if (rc) return rc;
+
+    for (size_t i = 0; i < n; i++)
+        ws->vp_y[i] = ws->sqrt_w[i] * (ws->obs[i] - ws->vp_c[i]);
+    for (size_t j = 0; j < m; j++) {
+        const double* col = g->r_rs_b + ws->class_idx[j] * n;
+        double* aj = ws->vp_A + j * n;
+        for (size_t i = 0; i < n; i++) aj[i] = ws->sqrt_w[i] * ws->dR_dr_b[i] * col[i];
+    }
+
+    double* gram = ws->vp_u.gram;
+    for (size_t j = 0; j < m; j++) {
+        const double* aj = ws->vp_A + j * n;
+        for (size_t l = 0; l <= j; l++) {
+            const double* al = ws->vp_A + l * n;
+            double s = 0.0;
+            for (size_t i = 0; i < n; i++) s += aj[i] * al[i];
+            gram[j * m + l] = gram[l * m + j] = s;
+        }
+        double s = 0.0;
+        for (size_t i = 0; i < n; i++) s += aj[i] * ws->vp_y[i];
+        ws->vp_rhs[j] = s;
+    }
+    unmix_tune(&ws->vp_u);
+    unmix_gram_changed(ws->vp_ws);
+    unmix_solve(&ws->vp_u, ws->vp_ws, ws->vp_rhs, ws->vp_f);
+
+    for (size_t j = 0; j < m; j++) {
+        double f = ws->vp_f[j];
+        const double* col = g->r_rs_b + ws->class_idx[j] * n;
+        x[SABER_INV_N_BASE + j] = f;
+        for (size_t i = 0; i < n; i++) ws->r_b[i] += f * col[i];
+    }
+    for (size_t i = 0; i < n; i++) out[i] = ws->vp_c[i] + ws->dR_dr_b[i] * ws->r_b[i];
+    return 0;
+}
+
+/* The model as the fit sees it */
+int inv_eval(saber_inv_workspace* ws, double* x, double* out)
+{
+    return ws->varpro ? inv_model_varpro(ws, x, out) : inv_model(ws, x, out);
+}
+
+/* Kaufman's variable-projection Jacobian: remove from J its part along
+ * the directions the fraction solve can still move in (the weighted
+ * derivatives of the positive fractions, or their differences under
+ * sum-to-one). J^T r is unchanged, as the residual is orthogonal to them
+ * at the inner optimum; J^T J then knows that the fractions re-adapt.
+ * Needs dR/dr_b at x in ws->dR_dr_b, as left by the last model
+ * evaluation there. */
+static void inv_project_fractions(saber_inv_workspace* ws, const double* x)
+{
+    const double* lib = ws->ctx->grid.r_rs_b;
+    size_t n = ws->n, p = ws->n_free;
+    size_t r = 0;
+    for (size_t j = 0; j < ws->n_class; j++)
+        if (x[SABER_INV_N_BASE + j] > 0.0) ws->vp_act[r++] = j;
+
+    int sto = ws->varpro == SABER_INV_VARPRO_SUM_TO_ONE;
+    if (sto) {
+        if (r < 2) return;
+        r--;
+    }
+    if (r == 0) return;
+
+    double* Q = ws->vp_Q;
+    const double* last = sto ? lib + ws->class_idx[ws->vp_act[r]] * n : NULL;
+    for (size_t q = 0; q < r; q++) {
+        const double* col = lib + ws->class_idx[ws->vp_act[q]] * n;
+        for (size_t i = 0; i < n; i++)
+            Q[q * n + i] = ws->sqrt_w[i] * ws->dR_dr_b[i] * (sto ? col[i] - last[i] : col[i]);
+    }
+
+    /* M = Q Q^T, T = Q J */
+    for (size_t q = 0; q < r; q++) {
+        for (size_t t = 0; t <= q; t++) {
+            double s = 0.0;
+            for (size_t i = 0; i < n; i++) s += Q[q * n + i] * Q[t * n + i];
+            ws->vp_M[q * r + t] = ws->vp_M[t * r + q] = s;
+        }
+        for (size_t c = 0; c < p; c++) ws->vp_T[q * p + c] = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            double qi = Q[q * n + i];
+            for (size_t c = 0; c < p; c++) ws->vp_T[q * p + c] += qi * ws->J[i * p + c];
+        }
+    }
+    if (la_cholesky(ws->vp_M, r)) return;
+
+    /* J -= Q^T M^-1 T, column by column */
+    double* t = ws->vp_rhs;
+    for (size_t c = 0; c < p; c++) {
+        for (size_t q = 0; q < r; q++) t[q] = ws->vp_T[q * p + c];
+        la_cholesky_solve(ws->vp_M, t, r);
+        for (size_t i = 0; i < n; i++) {
+            double s = 0.0;
+            for (size_t q = 0; q < r; q++) s += Q[q * n + i] * t[q];
+            ws->J[i * p + c] -= s;
+        }
+    }
+}
+
+/* Weighted residuals sqrt(w) (model - obs) and 0.5 |r|^2 */
+double inv_residual(const saber_inv_workspace* ws, const double* model,
+                    const double* obs, double* r)
+{
+    double cost = 0.0;
+    for (size_t i = 0; i < ws->n; i++) {
+        r[i] = ws->sqrt_w[i] * (model[i] - obs[i]);
+        cost += r[i] * r[i];
+    }
+    return 0.5 * cost;
+}
+
+/* Jacobian of the weighted residuals over the free parameters: analytic,
+ * or forward differences (steps leaving the box are taken backwards). */
+static int inv_jacobian(saber_inv_workspace* ws, double* x)
+{
+    size_t n = ws->n, p = ws->n_free;
+
+    if (!ws->fd_jacobian) {
+        int rc = inv_model_jac(ws, x, ws->rrs_h, ws->jac);
+        if (rc) return rc;
+        ws->n_eval++;
+        for (size_t c = 0; c < p; c++) {
+            const double* row = ws->jac + ws->free_idx[c] * n;
+            for (size_t i = 0; i < n; i++)
+                ws->J[i * p + c] = ws->sqrt_w[i] * row[i];
+        }
+        if (ws->varpro) inv_project_fractions(ws, x);
+        return 0;
+    }
+
+    /* The model keeps ws->dR_dr_b, the varpro evaluation's at x. Each
+     * step moves one parameter away from x and the previous one back,
+     * so the cache only redoes the stages of those two. */
+    for (size_t c = 0; c < p; c++) {
+        size_t k  = ws->free_idx[c];
+        double xk = x[k];
+        double h  = sqrt(DBL_EPSILON) * fmax(fabs(xk), 1e-3);
+        if (xk + h > ws->upper[k]) h = -h;
+
+        x[k] = xk + h;
+        int rc = inv_model_cached(ws, x, ws->rrs_h);
+        x[k] = xk;
+        if (rc) return rc;
+        ws->n_eval++;
+
+        for (size_t i = 0; i < n; i++)
+            ws->J[i * p + c] = ws->sqrt_w[i] * (ws->rrs_h[i] - ws->rrs[i]) / h;
+    }
+    if (ws->varpro) inv_project_fractions(ws, x);
+    return 0;
+}
+
+// ---------- Levenberg–Marquardt ----------
+
+static double clamp(double v, double lo, double hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/**
+ * Fit one observed spectrum.
+ *
+ * @param rrs_obs  [n] observed Rrs on the context grid
+ * @param weights  [n] per-band weights (0 masks a band), NULL = all 1
+ * @param x0       [n_par] starting point; fixed parameters keep these values
+ *                 (with cfg->varpro its fractions are ignored, being solved
+ *                 for at every evaluation)
+ * @param x_out    [n_par] solution (may alias x0)
+ * @param report   optional convergence report
+ *
+ * @return 0 when the fit ran (see report->status for how it stopped),
+ *         1 null pointer, 2 the model could not be evaluated at x0 or
+ *         another grid has been made current since the workspace was made
+ */
+int saber_invert_pixel(
+        saber_inv_workspace* ws,
+        const double* rrs_obs,
+        const double* weights,
+        const double* x0,
+        double* x_out,
+        saber_inv_report* report
+) {
+    if (!ws || !rrs_obs || !x0 || !x_out) return 1;
+    if (ws->grid_token != ws->ctx->grid.token) return 2;
+    STAT_CLOCK_BEGIN(ws->ctx);
+
+    size_t n = ws->n, p = ws->n_free, n_par = ws->n_par;
+    double* x = ws->x;
+    double* x_trial = ws->x_trial;
+
+    for (size_t i = 0; i < n; i++)
+        ws->sqrt_w[i] = weights ? sqrt(fmax(weights[i], 0.0)) : 1.0;
+    for (size_t k = 0; k < n_par; k++)
+        x[k] = clamp(x0[k], ws->lower[k], ws->upper[k]);
+
+    ws->n_eval = 0;
+    ws->obs = rrs_obs;
+    if (inv_eval(ws, x, ws->rrs)) return 2;
+    ws->n_eval++;
+    double cost = inv_residual(ws, ws->rrs, rrs_obs, ws->r);
+    double cost0 = cost;
+
+    double lambda = 1e-3;
+    int status = SABER_INV_MAX_ITER;
+    int iter = 0;
+
+    for (; iter < ws->max_iter; iter++) {
+        if (inv_jacobian(ws, x)) { status = SABER_INV_MODEL_ERROR; break; }
+
+        /* Normal equations */
+        double g_max = 0.0;
+        for (size_t c = 0; c < p; c++) {
+            double gc = 0.0;
+            for (size_t i = 0; i < n; i++) gc += ws->J[i * p + c] * ws->r[i];
+            ws->g[c] = gc;
+
+            /* projected gradient: ignore components pushing into an active bound */
+            size_t k = ws->free_idx[c];
+            int blocked = (x[k] <= ws->lower[k] && gc > 0) || (x[k] >= ws->upper[k] && gc < 0);
+            if (!blocked && fabs(gc) > g_max) g_max = fabs(gc);
+
+            for (size_t d = 0; d <= c; d++) {
+                double s = 0.0;
+                for (size_t i = 0; i < n; i++) s += ws->J[i * p + c] * ws->J[i * p + d];
+                ws->JtJ[c * p + d] = s;
+                ws->JtJ[d * p + c] = s;
+            }
+            ws->diag[c] = fmax(ws->JtJ[c * p + c], 1e-30);
+        }
+
+        if (g_max <= ws->tol * fmax(cost, DBL_MIN) || cost == 0.0) {
+            status = SABER_INV_CONVERGED_GRAD;
+            break;
+        }
+
+        /* Damped step, raising lambda until the cost goes down */
+        int accepted = 0;
+        for (;;) {
+            memcpy(ws->A, ws->JtJ, sizeof(double) * p * p);
+            for (size_t c = 0; c < p; c++) {
+                ws->A[c * p + c] += lambda * ws->diag[c];
+                ws->delta[c] = -ws->g[c];
+            }
+
+            if (la_cholesky(ws->A, p) == 0) {
+                la_cholesky_solve(ws->A, ws->delta, p);
+
+                memcpy(x_trial, x, sizeof(double) * n_par);
+                for (size_t c = 0; c < p; c++) {
+                    size_t k = ws->free_idx[c];
+                    x_trial[k] = clamp(x[k] + ws->delta[c], ws->lower[k], ws->upper[k]);
+                }
+
+                int rc = inv_eval(ws, x_trial, ws->rrs_h);
+                ws->n_eval++;
+                double cost_trial = rc ? HUGE_VAL : inv_residual(ws, ws->rrs_h, rrs_obs, ws->r_trial);
+
+                if (cost_trial < cost) {
+                    double step = 0.0, size = 0.0;
+                    for (size_t c = 0; c < p; c++) {
+                        size_t k = ws->free_idx[c];
+                        step += (x_trial[k] - x[k]) * (x_trial[k] - x[k]);
+                        size += x[k] * x[k];
+                    }
+                    double drop = cost - cost_trial;
+
+                    memcpy(x, x_trial, sizeof(double) * n_par);
+                    memcpy(ws->rrs, ws->rrs_h, sizeof(double) * n);
+                    memcpy(ws->r, ws->r_trial, sizeof(double) * n);
+                    cost = cost_trial;
+                    lambda = fmax(lambda * 0.3, 1e-12);
+                    accepted = 1;
+
+                    if (drop <= ws->tol * cost) status = SABER_INV_CONVERGED_COST;
+                    else if (sqrt(step) <= ws->tol * (sqrt(size) + ws->tol))
+                        status = SABER_INV_CONVERGED_STEP;
+                    break;
+                }
+            }
+
+            lambda *= 10.0;
+            if (lambda > 1e16) break;
+        }
+
+        if (!accepted) { status = SABER_INV_STALLED; break; }
+        if (status != SABER_INV_MAX_ITER) { iter++; break; }
+    }
+
+    memcpy(x_out, x, sizeof(double) * n_par);
+
+    if (report) {
+        double w_sum = 0.0;
+        for (size_t i = 0; i < n; i++) w_sum += ws->sqrt_w[i] * ws->sqrt_w[i];
+
+        report->status       = status;
+        report->iterations   = iter;
+        report->n_eval       = ws->n_eval;
+        report->cost_initial = cost0;
+        report->cost_final   = cost;
+        report->rmse         = w_sum > 0 ? sqrt(2.0 * cost / w_sum) : 0.0;
+    }
+    STAT_STAGE_END(ws->ctx, SABER_STAGE_INVERT, 1);
+    return 0;
+}
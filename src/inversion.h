@@ -0,0 +1,111 @@
+#ifndef SABER_LIB_INVERSION_H
+#define SABER_LIB_INVERSION_H
+
+#include <stddef.h>
+#include "saber.h"
+#include "data_cache.h"
+#include "vec_math.h"
+#include "forward_model.h"
+#include "unmix.h"
+
+/* Per-band terms of inv_model() kept between evaluations, each stage
+ * tagged with the parameters it was computed from, so that an evaluation
+ * only redoes the stages downstream of what changed (inv_cache.c):
+ *
+ *   chl                      -> a_phy
+ *   a_g_440, S_g             -> a_g        (shape: S_g only)
+ *   a_nap_440, S_nap         -> a_nap      (shape: S_nap only)
+ *   bb_p_550, gamma          -> bb_p       (shape: gamma only)
+ *   any IOP, plan            -> a, bb, rrs_deep, k_W, k_B
+ *   water column, h_w        -> deep term, exp(-h_w k_B)
+ *   fractions                -> r_b
+ *
+ * Values are bit-identical to inv_model()'s. */
+typedef struct inv_cache {
+    size_t n;
+    size_t n_class;
+    int    valid;
+    double* x;              /* [SABER_INV_N_BASE + n_class] of the cached terms */
+    am03_plan plan;
+
+    double* block;          /* every array below */
+    double *g_shape, *nap_shape, *bbp_shape;
+    double *a_phy, *a_g, *a_nap, *bb_p;
+    double *ext, *rrs_deep, *k_W, *k_B;
+    double *deep;           /* rrs_deep (1 - 1.1576 exp(-h_w k_W)) */
+    double *exp_B;          /* exp(-h_w k_B) */
+    double *r_b;
+} inv_cache;
+
+int  inv_cache_init(inv_cache* c, size_t n, size_t n_class);
+void inv_cache_free(inv_cache* c);
+/* Spectral shape of one OAC slope slot (OAC_A_G_S, OAC_A_NAP_S or
+ * OAC_BB_P_GAMMA) over wl, as oac_iop_spectrum() computes it */
+void inv_shape(const vm_impl* vm, const double* wl, size_t n, int slot, double slope, double* shape);
+int  inv_cache_eval(inv_cache* c, const vm_impl* vm, const saber_grid* g, const am03_plan* pl,
+                    const size_t* class_idx, const double* x, double* out);
+
+/* Everything saber_invert_pixel() touches, allocated once per workspace */
+struct saber_inv_workspace {
+    const saber_ctx* ctx;
+    const vm_impl*   vm;
+    uint64_t grid_token;    /* ctx->grid.token at create time  */
+
+    size_t n;               /* bands (context grid)            */
+    size_t n_par;           /* SABER_INV_N_BASE + n_class      */
+    size_t n_class;
+    size_t* class_idx;      /* fitted class -> library column  */
+
+    int    water_type;
+    int    shallow;
+    am03_plan plan;         /* water type, shallow flag and geometry */
+
+    int    max_iter;
+    double tol;
+    int    fd_jacobian;
+    int    n_eval;
+
+    double* lower;
+    double* upper;
+    size_t* free_idx;       /* free parameter -> index in x    */
+    size_t  n_free;
+
+    /* scratch, carved out of one block */
+    double* scratch;
+    double *a, *bb, *r_b, *rrs, *rrs_h, *sqrt_w;
+    double *r, *r_trial;
+    double *J, *JtJ, *A, *g, *delta, *diag;
+    double *x, *x_trial;
+    double *da, *dbb;                           /* [OAC_N x n] each  */
+    double *dR_da, *dR_dbb, *dR_dh_w, *dR_dr_b;
+    double *jac;                                /* [n_par x n]       */
+
+    /* variable projection: fractions solved inside every evaluation */
+    int    varpro;                              /* saber_inv_varpro  */
+    const double* obs;                          /* spectrum being fitted */
+    saber_unmixer    vp_u;                      /* gram of the current design */
+    unmix_workspace* vp_ws;
+    size_t* vp_act;                             /* [n_class]         */
+    double *vp_c, *vp_y;                        /* black-bottom Rrs, weighted target */
+    double *vp_A, *vp_rhs, *vp_f;               /* weighted design [n_class x n] */
+    double *vp_Q, *vp_M, *vp_T;                 /* Jacobian projection */
+
+    /* one-parameter steps (finite differences, LUT axes) */
+    inv_cache cache;
+
+    /* lane scratch of the population kernel, allocated on first use */
+    double* pop;
+};
+
+int inv_model(saber_inv_workspace* ws, const double* x, double* out);
+int inv_model_jac(saber_inv_workspace* ws, const double* x, double* out, double* jac);
+int inv_model_cached(saber_inv_workspace* ws, const double* x, double* out);
+
+/* The fit's model (varpro solves the fractions of x in place, against
+ * ws->obs) and its weighted residuals sqrt_w (model - obs), returning
+ * 0.5 |r|^2; both need ws->sqrt_w set */
+int inv_eval(saber_inv_workspace* ws, double* x, double* out);
+double inv_residual(const saber_inv_workspace* ws, const double* model,
+                    const double* obs, double* r);
+
+#endif //SABER_LIB_INVERSION_H
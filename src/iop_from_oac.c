@@ -1,30 +1,240 @@
 #include "iop_from_oac.h"
 #include "data_cache.h"
+#include "vec_math.h"
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
-static double get_named_value(const char* name, const char** names, const double* values, size_t n, int* found) {
-    for (size_t i = 0; i < n; i++) {
-        if (strcmp(names[i], name) == 0) {
-            *found = 1;
-            return values[i];
+static const char* const oac_names[OAC_N] = {
+        "chl", "a_g_440", "a_nap_440", "bb_p_550", "a_g_s", "a_nap_s", "bb_p_gamma"
+};
+
+/* Resolve the caller's parameter names into OAC slots, once per call
+ * (and once per batch, not once per pixel). idx[k] = -1 when absent. */
+void oac_resolve_index(const char** param_names, size_t n_param, int idx[OAC_N])
+{
+    for (int k = 0; k < OAC_N; k++) {
+        idx[k] = -1;
+        for (size_t i = 0; i < n_param; i++) {
+            if (strcmp(param_names[i], oac_names[k]) == 0) {
+                idx[k] = (int)i;
+                break;
+            }
         }
     }
-    *found = 0;
-    return 0.0;
 }
 
+/* aph(440) = 0.06 chl^0.65 and its log for m pixels at once, so batches
+ * vectorise these across pixels instead of calling libm per pixel. */
+void oac_prepare_aph(const vm_impl* vm, oac_params* p, size_t m)
+{
+    double chl[VM_BLOCK], aph[VM_BLOCK], log_aph[VM_BLOCK];
+
+    for (size_t b0 = 0; b0 < m; b0 += VM_BLOCK) {
+        size_t nb = m - b0 < VM_BLOCK ? m - b0 : VM_BLOCK;
+        for (size_t j = 0; j < nb; j++)
+            chl[j] = p[b0 + j].has[OAC_CHL] ? p[b0 + j].v[OAC_CHL] : 1.0;
+        vm->pow(chl, 0.65, aph, nb);
+        for (size_t j = 0; j < nb; j++) aph[j] = 0.06 * aph[j];
+        vm->log(aph, log_aph, nb);
+        for (size_t j = 0; j < nb; j++) {
+            p[b0 + j].aph_440     = aph[j];
+            p[b0 + j].log_aph_440 = log_aph[j];
+            p[b0 + j].aph_ready   = 1;
+        }
+    }
+}
+
+/* Gather, shapes, the per-pixel spectrum and the context entry points,
+ * in both precisions */
+#define SK_REAL          double
+#define SK_FN(name)      name
+#define SK_VM            vm_impl
+#define SK_SHAPES        oac_shapes
+#define SK_TAB(g, tab)   ((g)->tab)
+#define SK_SELECT        vm_select
+#include "iop_kernel_impl.h"
+#undef SK_REAL
+#undef SK_FN
+#undef SK_VM
+#undef SK_SHAPES
+#undef SK_TAB
+#undef SK_SELECT
+
+#define SK_REAL          float
+#define SK_FN(name)      name##_f
+#define SK_VM            vmf_impl
+#define SK_SHAPES        oac_shapes_f
+#define SK_TAB(g, tab)   ((g)->tab##_f)
+#define SK_SELECT        vmf_select
+#include "iop_kernel_impl.h"
+#undef SK_REAL
+#undef SK_FN
+#undef SK_VM
+#undef SK_SHAPES
+#undef SK_TAB
+#undef SK_SELECT
+
 /**
+ * oac_iop_spectrum() plus derivatives with respect to every OAC slot.
+ * da[k * n + i] = da_i / dv_k and dbb[k * n + i] = dbb_i / dv_k for
+ * k in [0, OAC_N); rows of parameters not set in `p` are zero.
+ * Contiguous output only.
+ */
+void oac_iop_jac(
+        const vm_impl* vm,
+        const saber_grid* g,
+        const double* wavelength, size_t n,
+        const oac_params* p,
+        double* a_out, double* bb_out,
+        double* da, double* dbb
+) {
+    int has_chl       = p->has[OAC_CHL];
+    int has_a_g_440   = p->has[OAC_A_G_440];
+    int has_a_nap_440 = p->has[OAC_A_NAP_440];
+    int has_bb_p_550  = p->has[OAC_BB_P_550];
+
+    double slope_g   = p->has[OAC_A_G_S]      ? p->v[OAC_A_G_S]      : 0.017;
+    double slope_nap = p->has[OAC_A_NAP_S]    ? p->v[OAC_A_NAP_S]    : 0.0116;
+    double gamma     = p->has[OAC_BB_P_GAMMA] ? p->v[OAC_BB_P_GAMMA] : 0.46;
+
+    memset(da,  0, sizeof(double) * OAC_N * n);
+    memset(dbb, 0, sizeof(double) * OAC_N * n);
+
+    double aph_440 = 0.0, log_aph_440 = 0.0, daph_dchl = 0.0;
+    if (has_chl) {
+        double chl = p->v[OAC_CHL];
+        if (p->aph_ready) {
+            aph_440     = p->aph_440;
+            log_aph_440 = p->log_aph_440;
+        } else {
+            vm->pow(&chl, 0.65, &aph_440, 1);
+            aph_440 = 0.06 * aph_440;
+            vm->log(&aph_440, &log_aph_440, 1);
+        }
+        daph_dchl = chl > 0.0 ? 0.65 * aph_440 / chl : 0.0;
+    }
+
+    double g_blk[VM_BLOCK], nap_blk[VM_BLOCK], bbp_blk[VM_BLOCK];
+
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+        shapes_block(vm, wavelength + b0, m, slope_g, slope_nap, gamma,
+                     has_a_g_440 ? g_blk : NULL,
+                     has_a_nap_440 ? nap_blk : NULL,
+                     has_bb_p_550 ? bbp_blk : NULL);
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = b0 + j;
+            double wl = wavelength[i];
+
+            double a_phy = 0.0;
+            if (has_chl) {
+                a_phy = (g->a0[i] + g->a1[i] * log_aph_440) * aph_440;
+                if (a_phy < 0.0) {
+                    a_phy = 0.0;
+                } else {
+                    /* d/daph [(a0 + a1 ln aph) aph] = a0 + a1 (ln aph + 1) */
+                    da[OAC_CHL * n + i] =
+                            (g->a0[i] + g->a1[i] * (log_aph_440 + 1.0)) * daph_dchl;
+                }
+            }
+
+            double a_g = 0.0;
+            if (has_a_g_440) {
+                a_g = p->v[OAC_A_G_440] * g_blk[j];
+                da[OAC_A_G_440 * n + i] = g_blk[j];
+                if (p->has[OAC_A_G_S]) da[OAC_A_G_S * n + i] = -(wl - 440.0) * a_g;
+            }
+
+            double a_nap = 0.0;
+            if (has_a_nap_440) {
+                a_nap = p->v[OAC_A_NAP_440] * nap_blk[j];
+                da[OAC_A_NAP_440 * n + i] = nap_blk[j];
+                if (p->has[OAC_A_NAP_S]) da[OAC_A_NAP_S * n + i] = -(wl - 440.0) * a_nap;
+            }
+
+            double bb_p = 0.0;
+            if (has_bb_p_550) {
+                bb_p = p->v[OAC_BB_P_550] * bbp_blk[j];
+                dbb[OAC_BB_P_550 * n + i] = bbp_blk[j];
+                if (p->has[OAC_BB_P_GAMMA]) dbb[OAC_BB_P_GAMMA * n + i] = -log(wl / 550.0) * bb_p;
+            }
+
+            a_out[i]  = g->a_w[i] + a_phy + a_g + a_nap;
+            bb_out[i] = g->bb_w[i] + bb_p;
+        }
+    }
+}
+
+/**
+ * iop_from_oac() plus derivatives with respect to the caller's parameters:
+ * da_dp[j * n + i] = da_i / d param_values[j], same for dbb_dp. Rows of
+ * names the model does not use are zero. Derivative rows are only defined
+ * for parameters present in param_names (absent slopes are constants).
  *
- * @param wavelength
- * @param n
- * @param param_names
- * @param param_values
- * @param n_param
- * @param a_out
- * @param bb_out
- * @return
+ * @return as saber_ctx_iop_from_oac(), or 3 on allocation failure
  */
+int saber_ctx_iop_from_oac_jac(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n,
+        const char** param_names, const double* param_values, size_t n_param,
+        double* a_out, double* bb_out,
+        double* da_dp, double* dbb_dp
+) {
+    if (!ctx || !wavelength || !a_out || !bb_out || !da_dp || !dbb_dp) return 1;
+    if (!ctx->grid.wl) return 1;
+    const saber_grid* g = ctx_find_grid(ctx, wavelength, n);
+    if (!g) return 2;
+
+    int idx[OAC_N];
+    oac_params p;
+    oac_resolve_index(param_names, n_param, idx);
+    oac_gather(idx, param_values, 1, &p);
+
+    double* d = malloc(sizeof(double) * 2 * OAC_N * n);
+    if (!d) return 3;
+    oac_iop_jac(vm_select(ctx->accuracy), g, wavelength, n, &p,
+                a_out, bb_out, d, d + OAC_N * n);
+
+    memset(da_dp,  0, sizeof(double) * n_param * n);
+    memset(dbb_dp, 0, sizeof(double) * n_param * n);
+    for (int k = 0; k < OAC_N; k++) {
+        if (idx[k] < 0) continue;
+        memcpy(da_dp  + (size_t)idx[k] * n, d + (size_t)k * n,         sizeof(double) * n);
+        memcpy(dbb_dp + (size_t)idx[k] * n, d + (size_t)(OAC_N + k) * n, sizeof(double) * n);
+    }
+
+    free(d);
+    return 0;
+}
+
+/**
+ * saber_ctx_iop_from_oac_batch() on strided views: parameter k of pixel p
+ * at values.data[p * values.pix_stride + k * values.stride], band i of
+ * pixel p at a_out.data[p * a_out.pix_stride + i * a_out.stride] (bb_out
+ * alike). Results equal the layout batch bit for bit; a and bb with
+ * different band strides cost one copy of each spectrum.
+ *
+ * @return as saber_ctx_iop_from_oac_batch()
+ */
+int saber_ctx_iop_from_oac_view(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n, size_t n_pix,
+        const char** param_names, saber_view values, size_t n_param,
+        saber_view_rw a_out, saber_view_rw bb_out
+) {
+    if (!ctx || !wavelength || !a_out.data || !bb_out.data) return 1;
+    if (n_param && (!param_names || !values.data)) return 1;
+    if (!ctx->grid.wl) return 1;
+    const saber_grid* g = ctx_find_grid(ctx, wavelength, n);
+    if (!g) return 2;
+
+    return iop_batch_on_grid(ctx, g, n_pix, param_names, values.data, n_param,
+                             values.pix_stride, values.stride,
+                             a_out.data, a_out.pix_stride, a_out.stride,
+                             bb_out.data, bb_out.pix_stride, bb_out.stride);
+}
 
 int iop_from_oac(
         const double* wavelength, size_t n,
@@ -32,77 +242,12 @@ int iop_from_oac(
         double* a_out, double* bb_out
 ) {
     if (!wavelength || !a_out || !bb_out) return 1;
-    int rc = ensure_cache(wavelength, n);
+    saber_ctx* ctx = saber_default_ctx();
+    int rc = saber_ctx_ensure_cache(ctx, wavelength, n);
     if (rc) {
         return rc; // propagate the error if problem with the data cache
     }
 
-    const double* aw_ptr   = get_a_w();
-    const double* a0_ptr   = get_a0();
-    const double* a1_ptr   = get_a1();
-    const double* bb_w_ptr = get_bb_w();
-
-    // Fetch named parameters
-    int found;
-    double chl          = get_named_value("chl", param_names, param_values, n_param, &found);
-    int has_chl         = found;
-
-    double a_g_440      = get_named_value("a_g_440", param_names, param_values, n_param, &found);
-    int has_a_g_440     = found;
-
-    double a_nap_440    = get_named_value("a_nap_440", param_names, param_values, n_param, &found);
-    int has_a_nap_440   = found;
-
-    double bb_p_550     = get_named_value("bb_p_550", param_names, param_values, n_param, &found);
-    int has_bb_p_550    = found;
-
-    double a_g_s      = get_named_value("a_g_s", param_names, param_values, n_param, &found);
-    int has_a_g_slopes  = found;
-
-    double a_nap_s    = get_named_value("a_nap_s", param_names, param_values, n_param, &found);
-    int has_a_nap_slope = found;
-
-    double bb_p_gamma   = get_named_value("bb_p_gamma", param_names, param_values, n_param, &found);
-    int has_bb_p_gamma  = found;
-
-    // Compute loop
-    for (size_t i = 0; i < n; i++) {
-        double wl = wavelength[i];
-
-        // Phytoplankton absorption
-        double a_phy = 0.0;
-        if (has_chl) {
-            double aph_440 = 0.06 * pow(chl, 0.65);
-            double a0 = a0_ptr[i];
-            double a1 = a1_ptr[i];
-            a_phy = (a0 + a1 * log(aph_440)) * aph_440;
-            if (a_phy < 0.0) a_phy = 0.0;
-        }
-
-        // CDOM absorption
-        double a_g = 0.0;
-        if (has_a_g_440) {
-            double slope = has_a_g_slopes ? (a_g_s) : 0.017;
-            a_g = a_g_440 * exp(-slope * (wl - 440.0));
-        }
-
-        // NAP absorption
-        double a_nap = 0.0;
-        if (has_a_nap_440) {
-            double slope = has_a_nap_slope ? a_nap_s : 0.0116;
-            a_nap = a_nap_440 * exp(-slope * (wl - 440.0));
-        }
-
-        // Particle backscattering
-        double bb_p = 0.0;
-        if (has_bb_p_550) {
-            double gamma = has_bb_p_gamma ? bb_p_gamma : 0.46;
-            bb_p = bb_p_550 * pow(wl / 550.0, -gamma);
-        }
-
-        a_out[i]  = aw_ptr[i] + a_phy + a_g + a_nap;
-        bb_out[i] = bb_w_ptr[i] + bb_p;
-    }
-
-    return 0;
+    return saber_ctx_iop_from_oac(ctx, wavelength, n, param_names, param_values, n_param,
+                                  a_out, bb_out);
 }
@@ -6,6 +6,9 @@
 #define SABER_LIB_IOP_FROM_OAC_H
 
 #include <stddef.h>
+#include "saber.h"
+#include "data_cache.h"
+#include "vec_math.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +20,75 @@ int iop_from_oac(
         double* a_out, double* bb_out
 );
 
+/* ---------- internal: resolved optically-active constituents ---------- */
+
+enum {
+    OAC_CHL = 0,
+    OAC_A_G_440,
+    OAC_A_NAP_440,
+    OAC_BB_P_550,
+    OAC_A_G_S,
+    OAC_A_NAP_S,
+    OAC_BB_P_GAMMA,
+    OAC_N
+};
+
+typedef struct oac_params {
+    double v[OAC_N];
+    int    has[OAC_N];
+
+    /* 0.06 chl^0.65 and its log, valid when aph_ready */
+    double aph_440;
+    double log_aph_440;
+    int    aph_ready;
+} oac_params;
+
+typedef struct oac_shapes {
+    const double* g;        /* exp(-S_g (λ-440))     */
+    const double* nap;      /* exp(-S_nap (λ-440))   */
+    const double* bbp;      /* (λ/550)^-γ            */
+} oac_shapes;
+
+typedef struct oac_shapes_f {
+    const float* g;
+    const float* nap;
+    const float* bbp;
+} oac_shapes_f;
+
+void oac_resolve_index(const char** param_names, size_t n_param, int idx[OAC_N]);
+void oac_gather(const int idx[OAC_N], const double* values, size_t stride, oac_params* p);
+void oac_prepare_aph(const vm_impl* vm, oac_params* p, size_t m);
+void oac_shapes_fill(const vm_impl* vm, const double* wavelength, size_t n, const oac_params* p,
+                     double* g_shape, double* nap_shape, double* bbp_shape);
+void oac_iop_spectrum(
+        const vm_impl* vm,
+        const saber_grid* g,
+        const double* wavelength, size_t n,
+        const oac_params* p, const oac_shapes* shapes,
+        double* a_out, double* bb_out, size_t stride
+);
+
+/* float instantiations (iop_kernel_impl.h), on the grid's float tables */
+void oac_gather_f(const int idx[OAC_N], const float* values, size_t stride, oac_params* p);
+void oac_shapes_fill_f(const vmf_impl* vm, const float* wavelength, size_t n, const oac_params* p,
+                       float* g_shape, float* nap_shape, float* bbp_shape);
+void oac_iop_spectrum_f(
+        const vmf_impl* vm,
+        const saber_grid* g,
+        const float* wavelength, size_t n,
+        const oac_params* p, const oac_shapes_f* shapes,
+        float* a_out, float* bb_out, size_t stride
+);
+
+void oac_iop_jac(
+        const vm_impl* vm,
+        const saber_grid* g,
+        const double* wavelength, size_t n,
+        const oac_params* p,
+        double* a_out, double* bb_out,
+        double* da, double* dbb
+);
+
 #ifdef __cplusplus
 }
 #endif
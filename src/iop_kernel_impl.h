@@ -0,0 +1,354 @@
+/*
+ * Spectral IOP kernel, written once and instantiated by iop_from_oac.c in
+ * double and in float so the two precisions cannot drift apart.
+ *
+ * The including file defines before every inclusion:
+ *   SK_REAL          element type (double or float)
+ *   SK_FN(name)      symbol for this precision (name, or name##_f)
+ *   SK_VM            vm_impl or vmf_impl
+ *   SK_SHAPES        oac_shapes or oac_shapes_f
+ *   SK_TAB(g, tab)   grid table of this precision (g->tab or g->tab##_f)
+ *   SK_SELECT        vm_select or vmf_select
+ *
+ * Per-pixel scalars (oac_params) stay double; they are widened on gather
+ * and rounded once on entry to the spectrum. The caller's wavelength grid
+ * stays double in both precisions. No include guard on purpose.
+ */
+
+#define SK_C(x) ((SK_REAL)(x))
+
+/* Gather one pixel's values; parameter j lives at values[j * stride] */
+void SK_FN(oac_gather)(const int idx[OAC_N], const SK_REAL* values, size_t stride, oac_params* p)
+{
+    for (int k = 0; k < OAC_N; k++) {
+        p->has[k] = idx[k] >= 0;
+        p->v[k]   = p->has[k] ? (double)values[(size_t)idx[k] * stride] : 0.0;
+    }
+    p->aph_ready = 0;
+}
+
+/* Spectral shapes over bands [0, n) that only depend on the slopes */
+static void SK_FN(shapes_block)(const SK_VM* vm, const SK_REAL* wavelength, size_t n,
+                                SK_REAL s_g, SK_REAL s_nap, SK_REAL gamma,
+                                SK_REAL* g_shape, SK_REAL* nap_shape, SK_REAL* bbp_shape)
+{
+    for (size_t i = 0; i < n; i++) {
+        SK_REAL wl = wavelength[i];
+        if (g_shape)   g_shape[i]   = -s_g * (wl - SK_C(440.0));
+        if (nap_shape) nap_shape[i] = -s_nap * (wl - SK_C(440.0));
+        if (bbp_shape) bbp_shape[i] = wl / SK_C(550.0);
+    }
+    if (g_shape)   vm->exp(g_shape, g_shape, n);
+    if (nap_shape) vm->exp(nap_shape, nap_shape, n);
+    if (bbp_shape) vm->pow(bbp_shape, -gamma, bbp_shape, n);
+}
+
+/* Spectral shapes that only depend on the slopes. With default slopes they
+ * are identical for every pixel and a batch computes them once. */
+void SK_FN(oac_shapes_fill)(const SK_VM* vm, const SK_REAL* wavelength, size_t n, const oac_params* p,
+                            SK_REAL* g_shape, SK_REAL* nap_shape, SK_REAL* bbp_shape)
+{
+    SK_REAL s_g   = SK_C(p->has[OAC_A_G_S]      ? p->v[OAC_A_G_S]      : 0.017);
+    SK_REAL s_nap = SK_C(p->has[OAC_A_NAP_S]    ? p->v[OAC_A_NAP_S]    : 0.0116);
+    SK_REAL gamma = SK_C(p->has[OAC_BB_P_GAMMA] ? p->v[OAC_BB_P_GAMMA] : 0.46);
+
+    SK_FN(shapes_block)(vm, wavelength, n, s_g, s_nap, gamma, g_shape, nap_shape, bbp_shape);
+}
+
+/**
+ * Evaluate a(λ) and bb(λ) for one pixel.
+ *
+ * @param g       resampled tables matching `wavelength`
+ * @param shapes  optional precomputed {CDOM, NAP, bb_p} spectral shapes
+ *                (oac_shapes_fill); any NULL entry is evaluated per block
+ * @param stride  distance between consecutive bands in a_out / bb_out
+ */
+void SK_FN(oac_iop_spectrum)(
+        const SK_VM* vm,
+        const saber_grid* g,
+        const SK_REAL* wavelength, size_t n,
+        const oac_params* p, const SK_SHAPES* shapes,
+        SK_REAL* a_out, SK_REAL* bb_out, size_t stride
+) {
+    const SK_REAL* aw_ptr   = SK_TAB(g, a_w);
+    const SK_REAL* a0_ptr   = SK_TAB(g, a0);
+    const SK_REAL* a1_ptr   = SK_TAB(g, a1);
+    const SK_REAL* bb_w_ptr = SK_TAB(g, bb_w);
+
+    int has_chl         = p->has[OAC_CHL];
+    int has_a_g_440     = p->has[OAC_A_G_440];
+    int has_a_nap_440   = p->has[OAC_A_NAP_440];
+    int has_bb_p_550    = p->has[OAC_BB_P_550];
+
+    SK_REAL a_g_440     = SK_C(p->v[OAC_A_G_440]);
+    SK_REAL a_nap_440   = SK_C(p->v[OAC_A_NAP_440]);
+    SK_REAL bb_p_550    = SK_C(p->v[OAC_BB_P_550]);
+    SK_REAL slope_g     = SK_C(p->has[OAC_A_G_S]      ? p->v[OAC_A_G_S]      : 0.017);
+    SK_REAL slope_nap   = SK_C(p->has[OAC_A_NAP_S]    ? p->v[OAC_A_NAP_S]    : 0.0116);
+    SK_REAL gamma       = SK_C(p->has[OAC_BB_P_GAMMA] ? p->v[OAC_BB_P_GAMMA] : 0.46);
+
+    const SK_REAL* g_shape   = shapes ? shapes->g   : NULL;
+    const SK_REAL* nap_shape = shapes ? shapes->nap : NULL;
+    const SK_REAL* bbp_shape = shapes ? shapes->bbp : NULL;
+
+    // Pixel constants of the phytoplankton term (band independent)
+    SK_REAL aph_440 = 0, log_aph_440 = 0;
+    if (has_chl) {
+        if (p->aph_ready) {
+            aph_440     = SK_C(p->aph_440);
+            log_aph_440 = SK_C(p->log_aph_440);
+        } else {
+            SK_REAL chl = SK_C(p->v[OAC_CHL]);
+            vm->pow(&chl, SK_C(0.65), &aph_440, 1);
+            aph_440 = SK_C(0.06) * aph_440;
+            vm->log(&aph_440, &log_aph_440, 1);
+        }
+    }
+
+    SK_REAL g_blk[VM_BLOCK], nap_blk[VM_BLOCK], bbp_blk[VM_BLOCK];
+
+    // Compute loop
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+
+        // Shapes not supplied by the caller are evaluated for this block
+        const SK_REAL* gs = g_shape   ? g_shape + b0   : g_blk;
+        const SK_REAL* ns = nap_shape ? nap_shape + b0 : nap_blk;
+        const SK_REAL* bs = bbp_shape ? bbp_shape + b0 : bbp_blk;
+        SK_FN(shapes_block)(vm, wavelength + b0, m, slope_g, slope_nap, gamma,
+                            (has_a_g_440 && !g_shape)     ? g_blk   : NULL,
+                            (has_a_nap_440 && !nap_shape) ? nap_blk : NULL,
+                            (has_bb_p_550 && !bbp_shape)  ? bbp_blk : NULL);
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = b0 + j;
+
+            // Phytoplankton absorption
+            SK_REAL a_phy = 0;
+            if (has_chl) {
+                a_phy = (a0_ptr[i] + a1_ptr[i] * log_aph_440) * aph_440;
+                if (a_phy < 0) a_phy = 0;
+            }
+
+            // CDOM absorption
+            SK_REAL a_g = has_a_g_440 ? a_g_440 * gs[j] : 0;
+
+            // NAP absorption
+            SK_REAL a_nap = has_a_nap_440 ? a_nap_440 * ns[j] : 0;
+
+            // Particle backscattering
+            SK_REAL bb_p = has_bb_p_550 ? bb_p_550 * bs[j] : 0;
+
+            a_out[i * stride]  = aw_ptr[i] + a_phy + a_g + a_nap;
+            bb_out[i * stride] = bb_w_ptr[i] + bb_p;
+        }
+    }
+}
+
+/* iop_from_oac() on one cached grid */
+static void SK_FN(iop_on_grid)(
+        const saber_ctx* ctx, const saber_grid* g,
+        const char** param_names, const SK_REAL* param_values, size_t n_param,
+        SK_REAL* a_out, SK_REAL* bb_out
+) {
+    // Fetch named parameters
+    STAT_CLOCK_BEGIN(ctx);
+    int idx[OAC_N];
+    oac_params p;
+    oac_resolve_index(param_names, n_param, idx);
+    SK_FN(oac_gather)(idx, param_values, 1, &p);
+
+    SK_FN(oac_iop_spectrum)(SK_SELECT(ctx->accuracy), g, SK_TAB(g, wl), g->n_wl,
+                            &p, NULL, a_out, bb_out, 1);
+    STAT_STAGE_END(ctx, SABER_STAGE_IOP, 1);
+}
+
+/* Batched iop_from_oac() on one cached grid, on strided views: parameter k
+ * of pixel p at values[p * v_pix + k * v_par], band i at a_out[p * a_pix +
+ * i * a_band] (bb_out alike). When a and bb do not share a band stride
+ * each spectrum goes through contiguous scratch. 3 on allocation failure */
+static int SK_FN(iop_batch_on_grid)(
+        const saber_ctx* ctx, const saber_grid* g, size_t n_pix,
+        const char** param_names, const SK_REAL* param_values, size_t n_param,
+        size_t v_pix, size_t v_par,
+        SK_REAL* a_out, size_t a_pix, size_t a_band,
+        SK_REAL* bb_out, size_t bb_pix, size_t bb_band
+) {
+    STAT_CLOCK_BEGIN(ctx);
+    const SK_VM* vm = SK_SELECT(ctx->accuracy);
+    const vm_impl* vm_aph = vm_select(ctx->accuracy);
+    const SK_REAL* wl = SK_TAB(g, wl);
+    size_t n = g->n_wl;
+    int idx[OAC_N];
+    oac_resolve_index(param_names, n_param, idx);
+
+    /* Shared shapes with the default (or absent) slopes, then the
+     * scratch spectra of the gathered path */
+    int gathered = a_band != bb_band;
+    oac_params defaults = {{0}, {0}, 0, 0, 0};
+    SK_REAL* shape_buf = malloc(sizeof(SK_REAL) * (gathered ? 5 : 3) * n);
+    if (!shape_buf) return 3;
+    SK_FN(oac_shapes_fill)(vm, wl, n, &defaults, shape_buf, shape_buf + n, shape_buf + 2 * n);
+    SK_REAL* a_tmp  = shape_buf + 3 * n;
+    SK_REAL* bb_tmp = shape_buf + 4 * n;
+
+    SK_SHAPES shapes = {
+            idx[OAC_A_G_S]      < 0 ? shape_buf         : NULL,
+            idx[OAC_A_NAP_S]    < 0 ? shape_buf + n     : NULL,
+            idx[OAC_BB_P_GAMMA] < 0 ? shape_buf + 2 * n : NULL
+    };
+
+    /* Pixels go by blocks so the per-pixel pow/log of chl vectorise */
+    oac_params p[VM_BLOCK];
+    for (size_t px0 = 0; px0 < n_pix; px0 += VM_BLOCK) {
+        size_t m = n_pix - px0 < VM_BLOCK ? n_pix - px0 : VM_BLOCK;
+
+        for (size_t j = 0; j < m; j++)
+            SK_FN(oac_gather)(idx, param_values + (px0 + j) * v_pix, v_par, &p[j]);
+        if (idx[OAC_CHL] >= 0)
+            oac_prepare_aph(vm_aph, p, m);
+
+        for (size_t j = 0; j < m; j++) {
+            size_t px = px0 + j;
+            SK_REAL* a_px  = a_out + px * a_pix;
+            SK_REAL* bb_px = bb_out + px * bb_pix;
+            if (!gathered) {
+                SK_FN(oac_iop_spectrum)(vm, g, wl, n, &p[j], &shapes, a_px, bb_px, a_band);
+                continue;
+            }
+            SK_FN(oac_iop_spectrum)(vm, g, wl, n, &p[j], &shapes, a_tmp, bb_tmp, 1);
+            for (size_t i = 0; i < n; i++) {
+                a_px[i * a_band]   = a_tmp[i];
+                bb_px[i * bb_band] = bb_tmp[i];
+            }
+        }
+    }
+
+    free(shape_buf);
+    STAT_STAGE_END(ctx, SABER_STAGE_IOP, n_pix);
+    return 0;
+}
+
+/* Strides of a batch layout: between pixels and between bands (or
+ * parameters) for arrays of n_pix x k values */
+static void SK_FN(layout_strides)(saber_layout layout, size_t n_pix, size_t k,
+                                  size_t* pix_stride, size_t* stride)
+{
+    int band_major = layout == SABER_LAYOUT_BAND_MAJOR;
+    *pix_stride = band_major ? 1 : k;
+    *stride     = band_major ? n_pix : 1;
+}
+
+/* iop_batch_on_grid() in one of the two batch layouts */
+static int SK_FN(iop_batch_layout)(
+        const saber_ctx* ctx, const saber_grid* g, size_t n_pix,
+        const char** param_names, const SK_REAL* param_values, size_t n_param,
+        saber_layout layout,
+        SK_REAL* a_out, SK_REAL* bb_out
+) {
+    size_t v_pix, v_par, o_pix, o_band;
+    SK_FN(layout_strides)(layout, n_pix, n_param, &v_pix, &v_par);
+    SK_FN(layout_strides)(layout, n_pix, g->n_wl, &o_pix, &o_band);
+    return SK_FN(iop_batch_on_grid)(ctx, g, n_pix, param_names, param_values, n_param,
+                                    v_pix, v_par, a_out, o_pix, o_band, bb_out, o_pix, o_band);
+}
+
+/**
+ * Context variant: reads the cache built by saber_ctx_build_cache() and never
+ * rebuilds it, so a built context can be shared between threads. Any grid
+ * still cached on the context is accepted, not only the current one.
+ *
+ * @return 0 on success, 1 on null pointer / cache not built,
+ *         2 if `wavelength` is not a grid the context has cached
+ */
+int SK_FN(saber_ctx_iop_from_oac)(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n,
+        const char** param_names, const SK_REAL* param_values, size_t n_param,
+        SK_REAL* a_out, SK_REAL* bb_out
+) {
+    if (!ctx || !wavelength || !a_out || !bb_out) return 1;
+    if (!ctx->grid.wl) return 1;
+    const saber_grid* g = ctx_find_grid(ctx, wavelength, n);
+    if (!g) return 2;
+
+    SK_FN(iop_on_grid)(ctx, g, param_names, param_values, n_param, a_out, bb_out);
+    return 0;
+}
+
+/**
+ * saber_ctx_iop_from_oac() on the grid behind `token` (see
+ * saber_ctx_ensure_grid()): no wavelength comparison at all.
+ *
+ * @return 0 on success, 1 on null pointer, 2 if the grid was evicted
+ */
+int SK_FN(saber_ctx_iop_from_oac_grid)(
+        const saber_ctx* ctx, saber_grid_token token,
+        const char** param_names, const SK_REAL* param_values, size_t n_param,
+        SK_REAL* a_out, SK_REAL* bb_out
+) {
+    if (!ctx || !a_out || !bb_out) return 1;
+    const saber_grid* g = ctx_grid_by_token(ctx, token);
+    if (!g) return 2;
+
+    SK_FN(iop_on_grid)(ctx, g, param_names, param_values, n_param, a_out, bb_out);
+    return 0;
+}
+
+/**
+ * Batched iop_from_oac() over n_pix pixels sharing one wavelength grid.
+ *
+ * Names are resolved once for the whole batch and the CDOM / NAP / bb_p
+ * spectral shapes are shared by all pixels unless the slope parameters are
+ * themselves provided per pixel.
+ *
+ * Layout (applies to param_values, a_out and bb_out alike):
+ *   SABER_LAYOUT_PIXEL_MAJOR  param k of pixel p at [p * n_param + k],
+ *                             band i of pixel p at  [p * n + i]
+ *   SABER_LAYOUT_BAND_MAJOR   param k of pixel p at [k * n_pix + p],
+ *                             band i of pixel p at  [i * n_pix + p]
+ *
+ * @return 0 on success, 1 on null pointer / cache not built,
+ *         2 if `wavelength` is not a cached grid, 3 on allocation failure
+ *         or unknown layout
+ */
+int SK_FN(saber_ctx_iop_from_oac_batch)(
+        const saber_ctx* ctx,
+        const double* wavelength, size_t n, size_t n_pix,
+        const char** param_names, const SK_REAL* param_values, size_t n_param,
+        saber_layout layout,
+        SK_REAL* a_out, SK_REAL* bb_out
+) {
+    if (!ctx || !wavelength || !a_out || !bb_out) return 1;
+    if (n_param && (!param_names || !param_values)) return 1;
+    if (!ctx->grid.wl) return 1;
+    const saber_grid* g = ctx_find_grid(ctx, wavelength, n);
+    if (!g) return 2;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+
+    return SK_FN(iop_batch_layout)(ctx, g, n_pix, param_names, param_values, n_param,
+                                   layout, a_out, bb_out);
+}
+
+/**
+ * saber_ctx_iop_from_oac_batch() on the grid behind `token`.
+ *
+ * @return as saber_ctx_iop_from_oac_batch(), 2 meaning the grid was evicted
+ */
+int SK_FN(saber_ctx_iop_from_oac_batch_grid)(
+        const saber_ctx* ctx, saber_grid_token token, size_t n_pix,
+        const char** param_names, const SK_REAL* param_values, size_t n_param,
+        saber_layout layout,
+        SK_REAL* a_out, SK_REAL* bb_out
+) {
+    if (!ctx || !a_out || !bb_out) return 1;
+    if (n_param && (!param_names || !param_values)) return 1;
+    const saber_grid* g = ctx_grid_by_token(ctx, token);
+    if (!g) return 2;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+
+    return SK_FN(iop_batch_layout)(ctx, g, n_pix, param_names, param_values, n_param,
+                                   layout, a_out, bb_out);
+}
+
+#undef SK_C
@@ -0,0 +1,63 @@
+#include "linalg.h"
+#include <math.h>
+
+int la_cholesky(double* A, size_t p)
+{
+    return la_cholesky_ld(A, p, p);
+}
+
+int la_cholesky_ld(double* A, size_t ld, size_t p)
+{
+    for (size_t j = 0; j < p; j++) {
+        double d = A[j * ld + j];
+        for (size_t k = 0; k < j; k++) d -= A[j * ld + k] * A[j * ld + k];
+        if (!(d > 0.0)) return 1;
+        d = sqrt(d);
+        A[j * ld + j] = d;
+
+        for (size_t i = j + 1; i < p; i++) {
+            double s = A[i * ld + j];
+            for (size_t k = 0; k < j; k++) s -= A[i * ld + k] * A[j * ld + k];
+            A[i * ld + j] = s / d;
+        }
+    }
+    return 0;
+}
+
+void la_cholesky_solve(const double* L, double* b, size_t p)
+{
+    la_cholesky_solve_ld(L, p, b, p);
+}
+
+void la_cholesky_solve_ld(const double* L, size_t ld, double* b, size_t p)
+{
+    /* forward: L y = b */
+    for (size_t i = 0; i < p; i++) {
+        double s = b[i];
+        for (size_t k = 0; k < i; k++) s -= L[i * ld + k] * b[k];
+        b[i] = s / L[i * ld + i];
+    }
+    /* backward: L^T x = y */
+    for (size_t i = p; i-- > 0;) {
+        double s = b[i];
+        for (size_t k = i + 1; k < p; k++) s -= L[k * ld + i] * b[k];
+        b[i] = s / L[i * ld + i];
+    }
+}
+
+int la_cholesky_append(double* L, size_t ld, size_t p, const double* row, double min_pivot)
+{
+    double* l = L + p * ld;
+
+    /* forward: L l = row */
+    double d = row[p];
+    for (size_t i = 0; i < p; i++) {
+        double s = row[i];
+        for (size_t k = 0; k < i; k++) s -= L[i * ld + k] * l[k];
+        l[i] = s / L[i * ld + i];
+        d -= l[i] * l[i];
+    }
+    if (!(d > min_pivot)) return 1;
+    l[p] = sqrt(d);
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef SABER_LIB_LINALG_H
+#define SABER_LIB_LINALG_H
+
+#include <stddef.h>
+
+/* Small dense helpers for the inversion and unmixing code. Matrices are
+ * row-major p x p (leading dimension ld in the *_ld forms); nothing here
+ * allocates. */
+
+/* In-place Cholesky A = L L^T (lower triangle overwritten).
+ * Returns 0 on success, 1 if A is not positive definite. */
+int la_cholesky(double* A, size_t p);
+int la_cholesky_ld(double* A, size_t ld, size_t p);
+
+/* Solve L L^T x = b with the factor from la_cholesky(); b is overwritten by x. */
+void la_cholesky_solve(const double* L, double* b, size_t p);
+void la_cholesky_solve_ld(const double* L, size_t ld, double* b, size_t p);
+
+/* Grow the p x p factor in L by one row for a matrix bordered by `row`
+ * (its p off-diagonal entries, then the diagonal). Returns 1, with the
+ * p x p factor still valid, if the new pivot^2 is <= min_pivot. */
+int la_cholesky_append(double* L, size_t ld, size_t p, const double* row, double min_pivot);
+
+#endif //SABER_LIB_LINALG_H
@@ -0,0 +1,444 @@
+#include "saber.h"
+#include "data_cache.h"
+#include "inversion.h"
+#include "tile_pool.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Entries per interleaved block: spectra of LUT_LANES entries are stored
+ * band by band so the distance loop runs across entries without any
+ * horizontal reduction. */
+#define LUT_LANES 16
+
+/* Pixels scored together against one block (each block load is reused) */
+#define LUT_PIX_BLOCK 4
+
+/* Refuse grids larger than this many entries */
+#define LUT_MAX_ENTRIES ((size_t)1 << 28)
+
+struct saber_lut {
+    const saber_ctx* ctx;
+    uint64_t grid_token;    /* ctx->grid.token at build time */
+    size_t n;               /* bands (context grid) */
+    size_t n_par;
+    size_t n_axes;
+    saber_lut_axis* axes;
+    double* x_fixed;        /* [n_par] values of the parameters not on an axis */
+
+    size_t n_entries;
+    size_t n_blocks;
+    float* spec;            /* [n_blocks][n][LUT_LANES], weighted by sqrt_w */
+    float* norm;            /* [n_blocks * LUT_LANES] |s|^2, INFINITY for padding */
+    double* sqrt_w;         /* [n] */
+};
+
+static double axis_value(const saber_lut_axis* ax, size_t j)
+{
+    if (ax->n <= 1) return ax->lo;
+    double t = (double)j / (double)(ax->n - 1);
+    return ax->log_spacing ? ax->lo * pow(ax->hi / ax->lo, t) : ax->lo + (ax->hi - ax->lo) * t;
+}
+
+/* Mixed radix, first axis fastest */
+static void entry_x(const saber_lut* lut, size_t e, double* x)
+{
+    memcpy(x, lut->x_fixed, sizeof(double) * lut->n_par);
+    for (size_t a = 0; a < lut->n_axes; a++) {
+        const saber_lut_axis* ax = &lut->axes[a];
+        x[ax->param] = axis_value(ax, e % ax->n);
+        e /= ax->n;
+    }
+}
+
+// ---------- Build ----------
+
+typedef struct lut_worker {
+    saber_inv_workspace* ws;
+    double* x;              /* [n_par] */
+    double* rrs;            /* [n]     */
+} lut_worker;
+
+static int build_block(void* user, void* state, size_t blk)
+{
+    saber_lut* lut = user;
+    lut_worker* w = state;
+    size_t n = lut->n;
+    float* dst = lut->spec + blk * n * LUT_LANES;
+
+    for (size_t j = 0; j < LUT_LANES; j++) {
+        size_t e = blk * LUT_LANES + j;
+        double norm = INFINITY;
+
+        if (e < lut->n_entries) {
+            entry_x(lut, e, w->x);
+            if (inv_model_cached(w->ws, w->x, w->rrs) == 0) {
+                norm = 0.0;
+                for (size_t i = 0; i < n; i++) {
+                    float v = (float)(w->rrs[i] * lut->sqrt_w[i]);
+                    dst[i * LUT_LANES + j] = v;
+                    norm += (double)v * v;
+                }
+                if (!isfinite(norm)) norm = INFINITY;
+            }
+        }
+        if (isinf(norm))
+            for (size_t i = 0; i < n; i++) dst[i * LUT_LANES + j] = 0.0f;
+        lut->norm[blk * LUT_LANES + j] = (float)norm;
+    }
+    return 0;
+}
+
+/**
+ * Tabulate the inversion model of `cfg` (same parameter vector, geometry
+ * and classes as saber_invert_pixel) over the product of `axes`.
+ *
+ * Each axis spans [lo, hi] on n points (geometric when log_spacing) for one
+ * parameter; the other parameters keep x_fixed (NULL: saber_inv_defaults).
+ * Spectra are stored as float, pre-multiplied by sqrt(weights) (NULL: 1),
+ * so searches minimise the same weighted misfit as the inversion.
+ * Entries whose model fails are kept but never matched. Consecutive
+ * entries differ in the first axis only and the model keeps the terms
+ * the other parameters feed, so tables are quickest to build with h_w or
+ * a bottom fraction on the first axis. Like an inversion workspace, the
+ * table is tied to the grid it was built on.
+ *
+ * @return new table, or NULL on bad arguments / too many entries / no memory
+ */
+saber_lut* saber_lut_build(
+        const saber_ctx* ctx,
+        const saber_inv_config* cfg,
+        const double* x_fixed,
+        const saber_lut_axis* axes, size_t n_axes,
+        const double* weights,
+        size_t n_threads
+) {
+    if (!ctx || !cfg || !ctx->grid.wl || (n_axes && !axes)) return NULL;
+
+    size_t n_par = saber_inv_n_param(cfg);
+    size_t n_entries = 1;
+    for (size_t a = 0; a < n_axes; a++) {
+        if (axes[a].param < 0 || (size_t)axes[a].param >= n_par || axes[a].n == 0) return NULL;
+        if (axes[a].log_spacing && (axes[a].lo <= 0 || axes[a].hi <= 0)) return NULL;
+        if (n_entries > LUT_MAX_ENTRIES / axes[a].n) {
+            fprintf(stderr, "LUT grid exceeds %zu entries\n", LUT_MAX_ENTRIES);
+            return NULL;
+        }
+        n_entries *= axes[a].n;
+    }
+
+    saber_lut* lut = calloc(1, sizeof(*lut));
+    if (!lut) return NULL;
+
+    size_t n = ctx->grid.n_wl;
+    lut->ctx        = ctx;
+    lut->grid_token = ctx->grid.token;
+    lut->n         = n;
+    lut->n_par     = n_par;
+    lut->n_axes    = n_axes;
+    lut->n_entries = n_entries;
+    lut->n_blocks  = (n_entries + LUT_LANES - 1) / LUT_LANES;
+
+    lut->axes    = malloc(sizeof(saber_lut_axis) * (n_axes ? n_axes : 1));
+    lut->x_fixed = malloc(sizeof(double) * n_par);
+    lut->sqrt_w  = malloc(sizeof(double) * n);
+    lut->spec    = malloc(sizeof(float) * lut->n_blocks * n * LUT_LANES);
+    lut->norm    = malloc(sizeof(float) * lut->n_blocks * LUT_LANES);
+    if (!lut->axes || !lut->x_fixed || !lut->sqrt_w || !lut->spec || !lut->norm) goto fail;
+
+    if (n_axes) memcpy(lut->axes, axes, sizeof(saber_lut_axis) * n_axes);
+    if (x_fixed) memcpy(lut->x_fixed, x_fixed, sizeof(double) * n_par);
+    else saber_inv_defaults(cfg, lut->x_fixed, NULL, NULL);
+    for (size_t i = 0; i < n; i++)
+        lut->sqrt_w[i] = weights ? sqrt(fmax(weights[i], 0.0)) : 1.0;
+
+    /* One inversion workspace per thread provides the model */
+    if (n_threads == 0) n_threads = tile_pool_hardware_threads();
+    if (n_threads > lut->n_blocks) n_threads = lut->n_blocks;
+
+    lut_worker* workers = calloc(n_threads, sizeof(lut_worker));
+    void** states = calloc(n_threads, sizeof(void*));
+    int rc = (!workers || !states) ? -1 : 0;
+    for (size_t k = 0; k < n_threads && !rc; k++) {
+        workers[k].ws  = saber_inv_workspace_create(ctx, cfg);
+        workers[k].x   = malloc(sizeof(double) * (n_par + n));
+        if (!workers[k].ws || !workers[k].x) { rc = -1; break; }
+        workers[k].rrs = workers[k].x + n_par;
+        states[k] = &workers[k];
+    }
+
+    if (!rc) {
+        rc = tile_pool_run(lut->n_blocks, n_threads, build_block, lut, states, NULL);
+    }
+
+    if (workers)
+        for (size_t k = 0; k < n_threads; k++) {
+            saber_inv_workspace_destroy(workers[k].ws);
+            free(workers[k].x);
+        }
+    free(workers);
+    free(states);
+    if (rc) goto fail;
+
+    return lut;
+
+fail:
+    saber_lut_destroy(lut);
+    return NULL;
+}
+
+void saber_lut_destroy(saber_lut* lut)
+{
+    if (!lut) return;
+    free(lut->axes);
+    free(lut->x_fixed);
+    free(lut->sqrt_w);
+    free(lut->spec);
+    free(lut->norm);
+    free(lut);
+}
+
+size_t saber_lut_size(const saber_lut* lut)    { return lut ? lut->n_entries : 0; }
+size_t saber_lut_n_param(const saber_lut* lut) { return lut ? lut->n_par : 0; }
+
+/* Parameter vector of entry `e` */
+int saber_lut_entry(const saber_lut* lut, size_t e, double* x_out)
+{
+    if (!lut || !x_out) return 1;
+    if (e >= lut->n_entries) return 2;
+    entry_x(lut, e, x_out);
+    return 0;
+}
+
+// ---------- Search ----------
+
+/* Widest vectors the CPU has for the scoring loop (x86 GCC / Clang) */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(__INTEL_COMPILER)
+#define LUT_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define LUT_CLONES
+#endif
+
+/* dot[q][j] = <obs_q, entry j of the block> for one interleaved block */
+LUT_CLONES
+static void score_block(const float* restrict s, const float* restrict obs, size_t n,
+                        float dot[restrict LUT_PIX_BLOCK][LUT_LANES])
+{
+    float acc[LUT_PIX_BLOCK][LUT_LANES] = {{0}};
+    for (size_t i = 0; i < n; i++) {
+        const float* si = s + i * LUT_LANES;
+        for (size_t q = 0; q < LUT_PIX_BLOCK; q++) {
+            float o = obs[q * n + i];
+            for (size_t j = 0; j < LUT_LANES; j++) acc[q][j] += o * si[j];
+        }
+    }
+    memcpy(dot, acc, sizeof(acc));
+}
+
+/* Bound on |float score - double distance| between an observation of
+ * norm onorm and an entry of norm snorm (both weighted): the float sums
+ * of n products, the float norm and the observation rounded to float
+ * stay within n + 4 float roundings of (|o| + |s|)^2 */
+static double score_error(size_t n, double onorm, double snorm)
+{
+    double r = sqrt(onorm) + sqrt(snorm);
+    return (double)(n + 4) * 0.5 * FLT_EPSILON * r * r;
+}
+
+/* Weighted squared distance of pixel p from entry e, in double */
+static double entry_dist(const saber_lut* lut, const double* rrs, size_t n_pix, int band_major,
+                         size_t p, size_t e)
+{
+    size_t n = lut->n;
+    const float* s = lut->spec + (e / LUT_LANES) * n * LUT_LANES + e % LUT_LANES;
+    double d = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double o = band_major ? rrs[i * n_pix + p] : rrs[p * n + i];
+        double r = o * lut->sqrt_w[i] - (double)s[i * LUT_LANES];
+        d += r * r;
+    }
+    return d;
+}
+
+/* Insert (d, e) into an ascending top-k list of current length *len */
+static void topk_push(double* dist, size_t* idx, size_t* len, size_t k, double d, size_t e)
+{
+    if (*len == k && d >= dist[k - 1]) return;
+    size_t pos = *len < k ? (*len)++ : k - 1;
+    while (pos > 0 && dist[pos - 1] > d) {
+        dist[pos] = dist[pos - 1];
+        idx[pos]  = idx[pos - 1];
+        pos--;
+    }
+    dist[pos] = d;
+    idx[pos]  = e;
+}
+
+/**
+ * k nearest entries of each observed spectrum under the weighted squared
+ * distance. rrs holds n_pix spectra on the context grid in `layout`;
+ * idx_out / dist_out receive n_pix x k values, pixel-major, best first.
+ *
+ * Candidates are scored in float against blocks of entries, then the
+ * retained few are rescored in double. When entries past them score
+ * within the float error of the k-th (near-duplicate entries), the pixel
+ * is scanned again and every entry that error leaves in reach is
+ * rescored, so the result is the double-precision k nearest. The table
+ * is read-only, so several threads may search it at once.
+ *
+ * @return 0 on success, 1 null pointer, 2 k == 0 or k > table size, or
+ *         another grid is current, 3 unknown layout or allocation failure
+ */
+int saber_lut_search(
+        const saber_lut* lut,
+        const double* rrs, size_t n_pix, saber_layout layout,
+        size_t k,
+        size_t* idx_out,
+        double* dist_out
+) {
+    if (!lut || !rrs || !idx_out) return 1;
+    if (k == 0 || k > lut->n_entries) return 2;
+    if (lut->grid_token != lut->ctx->grid.token) return 2;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+
+    size_t n = lut->n;
+    int band_major = layout == SABER_LAYOUT_BAND_MAJOR;
+
+    /* Coarse candidates: a few more than k, to absorb float rounding */
+    size_t kc = k + 4 < lut->n_entries ? k + 4 : lut->n_entries;
+    float*  obs  = malloc(sizeof(float) * LUT_PIX_BLOCK * n);
+    double* cd   = malloc(sizeof(double) * LUT_PIX_BLOCK * kc);
+    size_t* ci   = malloc(sizeof(size_t) * LUT_PIX_BLOCK * kc);
+    double* fd   = malloc(sizeof(double) * LUT_PIX_BLOCK * k);
+    if (!obs || !cd || !ci || !fd) {
+        free(obs); free(cd); free(ci); free(fd);
+        return 3;
+    }
+
+    for (size_t p0 = 0; p0 < n_pix; p0 += LUT_PIX_BLOCK) {
+        size_t m = n_pix - p0 < LUT_PIX_BLOCK ? n_pix - p0 : LUT_PIX_BLOCK;
+        float onorm[LUT_PIX_BLOCK] = {0};
+        size_t clen[LUT_PIX_BLOCK] = {0};
+        size_t flen[LUT_PIX_BLOCK] = {0};
+        double reach[LUT_PIX_BLOCK];
+        int rescan = 0;
+
+        for (size_t q = 0; q < LUT_PIX_BLOCK; q++)
+            for (size_t i = 0; i < n; i++) {
+                double v = 0.0;
+                if (q < m) v = (band_major ? rrs[i * n_pix + p0 + q] : rrs[(p0 + q) * n + i]) * lut->sqrt_w[i];
+                obs[q * n + i] = (float)v;
+                onorm[q] += (float)v * (float)v;
+            }
+
+        for (size_t blk = 0; blk < lut->n_blocks; blk++) {
+            const float* s = lut->spec + blk * n * LUT_LANES;
+            float dot[LUT_PIX_BLOCK][LUT_LANES];
+            score_block(s, obs, n, dot);
+
+            const float* sn = lut->norm + blk * LUT_LANES;
+            for (size_t q = 0; q < m; q++)
+                for (size_t j = 0; j < LUT_LANES; j++) {
+                    if (isinf(sn[j])) continue;
+                    double d = (double)onorm[q] + sn[j] - 2.0 * dot[q][j];
+                    topk_push(cd + q * kc, ci + q * kc, &clen[q], kc, d, blk * LUT_LANES + j);
+                }
+        }
+
+        /* Exact rescoring of the candidates. The k-th distance is at
+         * most `upper`, so only entries of norm up to (|o| + sqrt(upper))^2
+         * can beat it, and those score at most `lim` in float. The
+         * entries left out score at least cd[kc - 1]. */
+        for (size_t q = 0; q < m; q++) {
+            size_t* out_i = idx_out + (p0 + q) * k;
+            reach[q] = -INFINITY;
+            if (clen[q] == kc && kc < lut->n_entries) {
+                double snorm = 0.0;
+                for (size_t c = 0; c < k; c++)
+                    snorm = fmax(snorm, lut->norm[ci[q * kc + c]]);
+                double upper = cd[q * kc + k - 1] + score_error(n, onorm[q], snorm);
+                double r = sqrt(onorm[q]) + sqrt(fmax(upper, 0.0));
+                double lim = upper + score_error(n, onorm[q], r * r);
+                if (cd[q * kc + kc - 1] <= lim) {
+                    reach[q] = lim;
+                    rescan = 1;
+                    continue;
+                }
+            }
+            for (size_t c = 0; c < clen[q]; c++) {
+                size_t e = ci[q * kc + c];
+                double d = entry_dist(lut, rrs, n_pix, band_major, p0 + q, e);
+                topk_push(fd + q * k, out_i, &flen[q], k, d, e);
+            }
+        }
+
+        /* Near-duplicate margins: rescore every entry in reach */
+        for (size_t blk = 0; rescan && blk < lut->n_blocks; blk++) {
+            const float* s = lut->spec + blk * n * LUT_LANES;
+            float dot[LUT_PIX_BLOCK][LUT_LANES];
+            score_block(s, obs, n, dot);
+
+            const float* sn = lut->norm + blk * LUT_LANES;
+            for (size_t q = 0; q < m; q++)
+                for (size_t j = 0; j < LUT_LANES; j++) {
+                    if (isinf(sn[j]) || (double)onorm[q] + sn[j] - 2.0 * dot[q][j] > reach[q]) continue;
+                    size_t e = blk * LUT_LANES + j;
+                    double d = entry_dist(lut, rrs, n_pix, band_major, p0 + q, e);
+                    topk_push(fd + q * k, idx_out + (p0 + q) * k, &flen[q], k, d, e);
+                }
+        }
+
+        for (size_t q = 0; q < m; q++) {
+            size_t* out_i = idx_out + (p0 + q) * k;
+            for (size_t c = flen[q]; c < k; c++) { out_i[c] = 0; fd[q * k + c] = INFINITY; }
+            if (dist_out) memcpy(dist_out + (p0 + q) * k, fd + q * k, sizeof(double) * k);
+        }
+    }
+
+    free(obs);
+    free(cd);
+    free(ci);
+    free(fd);
+    return 0;
+}
+
+/**
+ * Best entry of each pixel as a parameter vector, ready to pass as x0 to
+ * saber_invert_pixel() or saber_scene (x_out is n_pix x n_par in
+ * `layout`, like the scene's x0). Pixels with no finite match get x_fixed.
+ *
+ * @return as saber_lut_search()
+ */
+int saber_lut_first_guess(
+        const saber_lut* lut,
+        const double* rrs, size_t n_pix, saber_layout layout,
+        double* x_out
+) {
+    if (!lut || !rrs || !x_out) return 1;
+
+    size_t* idx  = malloc(sizeof(size_t) * (n_pix ? n_pix : 1));
+    double* dist = malloc(sizeof(double) * (n_pix ? n_pix : 1));
+    double* x    = malloc(sizeof(double) * lut->n_par);
+    if (!idx || !dist || !x) {
+        free(idx); free(dist); free(x);
+        return 3;
+    }
+
+    int rc = saber_lut_search(lut, rrs, n_pix, layout, 1, idx, dist);
+    for (size_t p = 0; p < n_pix && !rc; p++) {
+        if (isfinite(dist[p])) entry_x(lut, idx[p], x);
+        else memcpy(x, lut->x_fixed, sizeof(double) * lut->n_par);
+
+        for (size_t c = 0; c < lut->n_par; c++) {
+            if (layout == SABER_LAYOUT_BAND_MAJOR) x_out[c * n_pix + p] = x[c];
+            else                                   x_out[p * lut->n_par + c] = x[c];
+        }
+    }
+
+    free(idx);
+    free(dist);
+    free(x);
+    return rc;
+}
@@ -0,0 +1,381 @@
+#include "forward_model.h"
+#include "snell_law.h"
+#include "data_cache.h"
+#include "vec_math.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const double Ars1 = 1.1576;
+static const double Ars2 = 1.0389;
+
+/* The misfit loop is instantiated once per case from one body */
+#if defined(__GNUC__)
+#define MISFIT_INLINE static inline __attribute__((always_inline))
+#else
+#define MISFIT_INLINE static inline
+#endif
+
+/* Running sums of one spectrum's misfit */
+typedef struct misfit_acc {
+    double sse;                 /* SSE, LOG: sum w d^2               */
+    double ro, rr, oo;          /* ANGLE: sum w R O, w R^2, w O^2    */
+    double h_o, h_r;            /* ANGLE: sum w O dR/dh_w, w R dR/dh_w */
+    double g_h_w;               /* SSE, LOG: dC/dh_w                 */
+} misfit_acc;
+
+/*-------------------------------------------------------------------------*/
+/*  AM03 forward model and misfit against r_rs_obs in one pass             */
+/*                                                                         */
+/*  Rrs of each block of bands is formed exactly as am03_forward_core()    */
+/*  does and consumed on the spot, never stored. With gradients, the       */
+/*  partials of am03_forward_jac_core() are chained with dC/dRrs in the    */
+/*  same pass; the spectral angle needs its three sums first, so its       */
+/*  per-band gradients hold dRrs/dx until a second pass over `r_keep`      */
+/*  ([n], the modelled Rrs) scales them. Any gradient pointer may be NULL. */
+/*-------------------------------------------------------------------------*/
+MISFIT_INLINE void misfit_loop(
+        const vm_impl *vm,
+        const am03_plan *pl,
+        const saber_misfit *mf,
+        const double *a,
+        const double *bb,
+        size_t n,
+        size_t stride,
+        double h_w,
+        const double *r_b,
+        const double *obs,
+        double *cost,
+        double *g_a,
+        double *g_bb,
+        double *g_h_w,
+        double *g_r_b,
+        double *r_keep,
+        const int type1,
+        const int shallow,
+        const int grad
+) {
+    const int    metric   = mf->metric;
+    const double k0       = pl->k0;
+    const double cos_sun  = pl->cos_sun;
+    const double cos_view = pl->cos_view;
+    const double g_sun    = pl->g_sun;
+    const double g_view   = pl->g_view;
+    const double floor_   = mf->log_floor > 0 ? mf->log_floor : 1e-6;
+
+    double ext[VM_BLOCK], omega_b[VM_BLOCK];
+    double kuW[VM_BLOCK], kuB[VM_BLOCK], exp_W[VM_BLOCK], exp_B[VM_BLOCK];
+    double R[VM_BLOCK], O[VM_BLOCK];
+    double dRa[VM_BLOCK], dRbb[VM_BLOCK], dRh[VM_BLOCK], dRrb[VM_BLOCK];
+    misfit_acc s = { 0 };
+
+    for (size_t b0 = 0; b0 < n; b0 += VM_BLOCK) {
+        size_t m = n - b0 < VM_BLOCK ? n - b0 : VM_BLOCK;
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = (b0 + j) * stride;
+            ext[j]     = a[i] + bb[i];
+            omega_b[j] = ext[j] == 0 ? 0 : bb[i] / ext[j];
+        }
+
+        if (shallow) {
+            for (size_t j = 0; j < m; j++) exp_W[j] = 1 + omega_b[j];
+            vm->pow2(exp_W, 3.5421, 2.2658, kuW, kuB, m);
+            for (size_t j = 0; j < m; j++) {
+                double Kd = k0 * (ext[j] / cos_sun);
+                kuW[j] = (ext[j] / cos_view) * kuW[j] * pl->c_W;
+                kuB[j] = (ext[j] / cos_view) * kuB[j] * pl->c_B;
+                exp_W[j] = -h_w * (Kd + kuW[j]);
+                exp_B[j] = -h_w * (Kd + kuB[j]);
+            }
+            vm->exp(exp_W, exp_W, m);
+            vm->exp(exp_B, exp_B, m);
+        }
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = (b0 + j) * stride;
+            O[j] = obs[i];
+            if (ext[j] == 0) {
+                R[j] = 0;
+                dRa[j] = dRbb[j] = dRh[j] = dRrb[j] = 0;
+                continue;
+            }
+            double w = omega_b[j];
+
+            double f_rs;
+            if (type1) {
+                f_rs = 0.095;
+            } else {
+                f_rs = 0.0512 *
+                       (1 + 4.6659 * w +
+                        -7.8387 * w * w +
+                        5.4571 * w * w * w) *
+                       g_sun *
+                       g_view;
+            }
+            double rrs_deep = f_rs * w;
+            R[j] = shallow ? rrs_deep * (1 - (Ars1 * exp_W[j])) + Ars2 * r_b[i] * exp_B[j]
+                           : rrs_deep;
+            if (!grad) continue;
+
+            /* as am03_forward_jac_core() */
+            double d_deep_dw = 0.095;
+            if (!type1) {
+                double P  = 1 + 4.6659 * w + -7.8387 * w * w + 5.4571 * w * w * w;
+                double dP = 4.6659 - 2 * 7.8387 * w + 3 * 5.4571 * w * w;
+                d_deep_dw = 0.0512 * g_sun * g_view * (P + w * dP);
+            }
+            double dR_dw = d_deep_dw, dR_dext = 0.0;
+            dRh[j] = dRrb[j] = 0.0;
+            if (shallow) {
+                double Kd = k0 * (ext[j] / cos_sun);
+                double tW = rrs_deep * Ars1 * exp_W[j];
+                double tB = Ars2 * r_b[i] * exp_B[j];
+                dR_dw   = d_deep_dw * (1 - Ars1 * exp_W[j])
+                          + h_w * tW * kuW[j] * 3.5421 / (1 + w)
+                          - h_w * tB * kuB[j] * 2.2658 / (1 + w);
+                dR_dext = h_w * tW * (k0 / cos_sun + kuW[j] / ext[j])
+                          - h_w * tB * (k0 / cos_sun + kuB[j] / ext[j]);
+                dRh[j]  = tW * (Kd + kuW[j]) - tB * (Kd + kuB[j]);
+                dRrb[j] = Ars2 * exp_B[j];
+            }
+            dRa[j]  = dR_dext - dR_dw * w / ext[j];
+            dRbb[j] = dR_dext + dR_dw * (1 - w) / ext[j];
+        }
+
+        /* residuals in log space: ln Rrs of the block through the vector layer */
+        double lR[VM_BLOCK], lO[VM_BLOCK];
+        if (metric == SABER_MISFIT_LOG) {
+            for (size_t j = 0; j < m; j++) {
+                lR[j] = R[j] > floor_ ? R[j] : floor_;
+                lO[j] = O[j] > floor_ ? O[j] : floor_;
+            }
+            vm->log(lR, lR, m);
+            vm->log(lO, lO, m);
+        }
+
+        for (size_t j = 0; j < m; j++) {
+            size_t i = (b0 + j) * stride;
+            double wt = mf->weights ? fmax(mf->weights[b0 + j], 0.0) : 1.0;
+            if (mf->mask && !mf->mask[b0 + j]) wt = 0.0;
+
+            double dC_dR;
+            if (metric == SABER_MISFIT_ANGLE) {
+                s.ro += wt * R[j] * O[j];
+                s.rr += wt * R[j] * R[j];
+                s.oo += wt * O[j] * O[j];
+                if (!grad) continue;
+                s.h_o += wt * O[j] * dRh[j];
+                s.h_r += wt * R[j] * dRh[j];
+                r_keep[b0 + j] = R[j];
+                dC_dR = 1.0;            /* scaled in the second pass */
+            } else {
+                double d = metric == SABER_MISFIT_LOG ? lR[j] - lO[j] : R[j] - O[j];
+                s.sse += wt * d * d;
+                if (!grad) continue;
+                dC_dR = wt * d;
+                if (metric == SABER_MISFIT_LOG) dC_dR = R[j] > floor_ ? dC_dR / R[j] : 0.0;
+                s.g_h_w += dC_dR * dRh[j];
+            }
+            if (g_a)   g_a[i]   = dC_dR * dRa[j];
+            if (g_bb)  g_bb[i]  = dC_dR * dRbb[j];
+            if (g_r_b) g_r_b[i] = dC_dR * dRrb[j];
+        }
+    }
+
+    if (metric != SABER_MISFIT_ANGLE) {
+        *cost = 0.5 * s.sse;
+        if (g_h_w) *g_h_w = s.g_h_w;
+        return;
+    }
+
+    /* angle = acos(c), c = <R, O>_w / (|R|_w |O|_w);
+     * dC/dR_i = -(w_i O_i / (|R| |O|) - c w_i R_i / |R|^2) / sqrt(1 - c^2) */
+    double nr = sqrt(s.rr), no = sqrt(s.oo);
+    double c = nr > 0 && no > 0 ? s.ro / (nr * no) : 0.0;
+    if (c > 1) c = 1;
+    if (c < -1) c = -1;
+    *cost = acos(c);
+    if (!grad) return;
+
+    double sn = sqrt(1 - c * c);
+    double alpha = 0.0, beta = 0.0;     /* dC/dR_i = w_i (alpha O_i + beta R_i) */
+    if (sn > 0 && nr > 0 && no > 0) {
+        alpha = -1.0 / (sn * nr * no);
+        beta  = c / (sn * s.rr);
+    }
+    if (g_h_w) *g_h_w = alpha * s.h_o + beta * s.h_r;
+    for (size_t k = 0; k < n; k++) {
+        size_t i = k * stride;
+        double wt = mf->weights ? fmax(mf->weights[k], 0.0) : 1.0;
+        if (mf->mask && !mf->mask[k]) wt = 0.0;
+        double dC_dR = wt * (alpha * obs[i] + beta * r_keep[k]);
+        if (g_a)   g_a[i]   *= dC_dR;
+        if (g_bb)  g_bb[i]  *= dC_dR;
+        if (g_r_b) g_r_b[i] *= dC_dR;
+    }
+}
+
+/* One loop per (water type, shallow, gradient) case, as am03_forward_core() */
+static void misfit_core(
+        const vm_impl *vm, const am03_plan *pl, const saber_misfit *mf,
+        const double *a, const double *bb, size_t n, size_t stride, double h_w,
+        const double *r_b, const double *obs, double *cost,
+        double *g_a, double *g_bb, double *g_h_w, double *g_r_b, double *r_keep
+) {
+#define MISFIT_CASE(t1, sh, gr) \
+    misfit_loop(vm, pl, mf, a, bb, n, stride, h_w, r_b, obs, cost, \
+                g_a, g_bb, g_h_w, g_r_b, r_keep, t1, sh, gr)
+    int type1 = pl->water_type == 1;
+    if (g_a || g_bb || g_h_w || g_r_b) {
+        if (pl->shallow) { if (type1) MISFIT_CASE(1, 1, 1); else MISFIT_CASE(0, 1, 1); }
+        else             { if (type1) MISFIT_CASE(1, 0, 1); else MISFIT_CASE(0, 0, 1); }
+    } else {
+        if (pl->shallow) { if (type1) MISFIT_CASE(1, 1, 0); else MISFIT_CASE(0, 1, 0); }
+        else             { if (type1) MISFIT_CASE(1, 0, 0); else MISFIT_CASE(0, 0, 0); }
+    }
+#undef MISFIT_CASE
+}
+#undef MISFIT_INLINE
+
+static int misfit_check(const saber_misfit *mf)
+{
+    return mf->metric == SABER_MISFIT_SSE || mf->metric == SABER_MISFIT_ANGLE ||
+           mf->metric == SABER_MISFIT_LOG ? 0 : 3;
+}
+
+/* Modelled Rrs kept for the second pass of the angle gradient */
+static double* misfit_scratch(const saber_misfit *mf, size_t n, int grad)
+{
+    if (mf->metric != SABER_MISFIT_ANGLE || !grad) return NULL;
+    return malloc(sizeof(double) * (n ? n : 1));
+}
+
+/**
+ * forward_am03() under a plan, reduced straight to one misfit value
+ * against r_rs_obs, without writing the modelled spectrum anywhere:
+ *
+ *   SABER_MISFIT_SSE    0.5 sum w (Rrs - obs)^2
+ *   SABER_MISFIT_ANGLE  spectral angle (rad) between Rrs and obs, weighted
+ *   SABER_MISFIT_LOG    0.5 sum w (ln Rrs - ln obs)^2, both floored at
+ *                       mf->log_floor
+ *
+ * Bands masked out or weighted 0 do not count. Each gradient is optional:
+ * g_a, g_bb and g_r_b are [n] dC/da_i, dC/dbb_i, dC/dr_b_i, g_h_w one
+ * value; chain them with saber_ctx_iop_from_oac_jac() for OAC gradients.
+ *
+ * @return 0 on success, 1 null pointer, 2 shallow plan without r_b or with
+ *         a negative depth, 3 unknown metric or allocation failure
+ */
+int saber_ctx_misfit_am03_planned(
+        const saber_ctx *ctx,
+        const saber_am03_plan *plan,
+        const saber_misfit *mf,
+        const double *a,
+        const double *bb,
+        size_t n,
+        double h_w,
+        const double *r_b,
+        const double *r_rs_obs,
+        double *cost_out,
+        double *g_a,
+        double *g_bb,
+        double *g_h_w,
+        double *g_r_b
+) {
+    if (!ctx || !plan || !mf || !a || !bb || !r_rs_obs || !cost_out) return 1;
+    if (plan->shallow && (!r_b || h_w < 0)) return 2;
+    if (misfit_check(mf)) return 3;
+
+    int grad = g_a || g_bb || g_h_w || g_r_b;
+    double *r_keep = misfit_scratch(mf, n, grad);
+    if (mf->metric == SABER_MISFIT_ANGLE && grad && !r_keep) return 3;
+
+    STAT_CLOCK_BEGIN(ctx);
+    misfit_core(vm_select(ctx->accuracy), plan, mf, a, bb, n, 1, h_w, r_b, r_rs_obs,
+                cost_out, g_a, g_bb, g_h_w, g_r_b, r_keep);
+    STAT_STAGE_END(ctx, SABER_STAGE_FORWARD, 1);
+    free(r_keep);
+    return 0;
+}
+
+/**
+ * Batched saber_ctx_misfit_am03_planned() with the arguments of
+ * saber_ctx_forward_am03_batch(): r_rs_obs and the optional g_a, g_bb,
+ * g_r_b hold n_pix x n values in `layout`, cost_out and g_h_w [n_pix].
+ * Weights and mask are per band, shared by every pixel.
+ *
+ * @return 0 on success, 1 null pointer, 2 shallow without r_b / h_w or a
+ *         negative depth, 3 invalid water_type, layout or metric, or
+ *         allocation failure
+ */
+int saber_ctx_misfit_am03_batch(
+        const saber_ctx *ctx,
+        const saber_misfit *mf,
+        const double *wavelength,
+        const double *a,
+        const double *bb,
+        size_t n,
+        size_t n_pix,
+        int water_type,
+        double theta_sun_deg,
+        double theta_view_deg,
+        const double *theta_sun_pix,
+        const double *theta_view_pix,
+        int shallow,
+        const double *h_w,
+        const double *r_b,
+        const double *r_rs_obs,
+        saber_layout layout,
+        double *cost_out,
+        double *g_a,
+        double *g_bb,
+        double *g_h_w,
+        double *g_r_b
+) {
+    if (!ctx || !mf || !wavelength || !a || !bb || !r_rs_obs || !cost_out) return 1;
+    if (shallow && (!r_b || !h_w)) return 2;
+    if (water_type != 1 && water_type != 2) return 3;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+    if (misfit_check(mf)) return 3;
+    if (shallow) {
+        for (size_t px = 0; px < n_pix; px++)
+            if (h_w[px] < 0) return 2;
+    }
+
+    int grad = g_a || g_bb || g_h_w || g_r_b;
+    double *r_keep = misfit_scratch(mf, n, grad);
+    if (mf->metric == SABER_MISFIT_ANGLE && grad && !r_keep) return 3;
+
+    STAT_CLOCK_BEGIN(ctx);
+    const vm_impl *vm = vm_select(ctx->accuracy);
+    int band_major = layout == SABER_LAYOUT_BAND_MAJOR;
+    size_t stride  = band_major ? n_pix : 1;
+    int per_pixel_geometry = theta_sun_pix || theta_view_pix;
+
+    double view_w_rad = 0, sun_w_rad = 0;
+    snell_law(theta_view_deg, theta_sun_deg, &view_w_rad, &sun_w_rad);
+
+    am03_plan pl;
+    am03_plan_init(&pl, water_type, shallow, view_w_rad, sun_w_rad);
+
+    for (size_t px = 0; px < n_pix; px++) {
+        size_t off = band_major ? px : px * n;
+        if (per_pixel_geometry) {
+            double sun  = theta_sun_pix  ? theta_sun_pix[px]  : theta_sun_deg;
+            double view = theta_view_pix ? theta_view_pix[px] : theta_view_deg;
+            snell_law(view, sun, &view_w_rad, &sun_w_rad);
+            am03_plan_init(&pl, water_type, shallow, view_w_rad, sun_w_rad);
+        }
+
+        misfit_core(vm, &pl, mf, a + off, bb + off, n, stride,
+                    shallow ? h_w[px] : 0.0, shallow ? r_b + off : NULL, r_rs_obs + off,
+                    cost_out + px,
+                    g_a ? g_a + off : NULL, g_bb ? g_bb + off : NULL,
+                    g_h_w ? g_h_w + px : NULL, g_r_b ? g_r_b + off : NULL, r_keep);
+    }
+
+    STAT_STAGE_END(ctx, SABER_STAGE_FORWARD, n_pix);
+    free(r_keep);
+    return 0;
+}
@@ -0,0 +1,429 @@
+#include "inversion.h"
+#include "data_cache.h"
+#include "iop_from_oac.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const double Ars1 = 1.1576;
+static const double Ars2 = 1.0389;
+
+// ---------- Population kernel ----------
+
+/* Lane scratch: one row per lane for each of the three spectral shapes,
+ * then the fractions of every lane */
+static int pop_scratch(saber_inv_workspace* ws)
+{
+    if (!ws->pop)
+        ws->pop = malloc(sizeof(double) * VM_BLOCK * (3 * ws->n + ws->n_class));
+    return ws->pop ? 0 : 3;
+}
+
+/* Candidates x[j * n_par], j < m, against one spectrum, one candidate per
+ * lane: every transcendental call runs across the lanes of a band, so a
+ * few bands still fill the vector unit. Same arithmetic, band by band, as
+ * inv_model() and inv_residual() for each lane. Needs ws->sqrt_w. */
+static void pop_block(saber_inv_workspace* ws, const double* x, size_t m,
+                      const double* obs, double* cost, double* rrs_out)
+{
+    const saber_grid* g = &ws->ctx->grid;
+    const am03_plan* pl = &ws->plan;
+    const vm_impl* vm = ws->vm;
+    size_t n = ws->n, n_par = ws->n_par, n_class = ws->n_class;
+    int shallow = pl->shallow;
+
+    double chl[VM_BLOCK], aph[VM_BLOCK], log_aph[VM_BLOCK];
+    double a_g_440[VM_BLOCK], a_nap_440[VM_BLOCK], bb_p_550[VM_BLOCK], h_w[VM_BLOCK];
+    double* f = ws->pop + 3 * VM_BLOCK * n;         /* fraction k of lane j at [k * VM_BLOCK + j] */
+
+    for (size_t j = 0; j < m; j++) {
+        const double* xj = x + j * n_par;
+        chl[j]       = xj[SABER_INV_CHL];
+        a_g_440[j]   = xj[SABER_INV_A_G_440];
+        a_nap_440[j] = xj[SABER_INV_A_NAP_440];
+        bb_p_550[j]  = xj[SABER_INV_BB_P_550];
+        h_w[j]       = xj[SABER_INV_H_W];
+        for (size_t k = 0; k < n_class; k++) f[k * VM_BLOCK + j] = xj[SABER_INV_N_BASE + k];
+        cost[j] = 0.0;
+    }
+    vm->pow(chl, 0.65, aph, m);
+    for (size_t j = 0; j < m; j++) aph[j] = 0.06 * aph[j];
+    vm->log(aph, log_aph, m);
+
+    /* Shapes per lane, shared with the previous lane when its slope is the
+     * same (as in DE populations with fixed slopes) */
+    static const int slot[3] = { OAC_A_G_S, OAC_A_NAP_S, OAC_BB_P_GAMMA };
+    const double* shape[3][VM_BLOCK];
+    for (int s = 0; s < 3; s++) {
+        for (size_t j = 0; j < m; j++) {
+            const double* slope = x + j * n_par + slot[s];
+            if (j && memcmp(slope, slope - n_par, sizeof(double)) == 0) {
+                shape[s][j] = shape[s][j - 1];
+                continue;
+            }
+            double* row = ws->pop + ((size_t)s * VM_BLOCK + j) * n;
+            inv_shape(vm, g->wl, n, slot[s], *slope, row);
+            shape[s][j] = row;
+        }
+    }
+
+    double ext[VM_BLOCK], omega_b[VM_BLOCK], exp_W[VM_BLOCK], exp_B[VM_BLOCK], r_b[VM_BLOCK];
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < m; j++) {
+            double a_phy = (g->a0[i] + g->a1[i] * log_aph[j]) * aph[j];
+            if (a_phy < 0) a_phy = 0;
+            double a  = g->a_w[i] + a_phy + a_g_440[j] * shape[0][j][i] + a_nap_440[j] * shape[1][j][i];
+            double bb = g->bb_w[i] + bb_p_550[j] * shape[2][j][i];
+            ext[j]     = a + bb;
+            omega_b[j] = ext[j] == 0 ? 0 : bb / ext[j];
+        }
+
+        if (shallow) {
+            double base[VM_BLOCK];
+            for (size_t j = 0; j < m; j++) base[j] = 1 + omega_b[j];
+            vm->pow2(base, 3.5421, 2.2658, exp_W, exp_B, m);
+            for (size_t j = 0; j < m; j++) {
+                double Kd  = pl->k0 * (ext[j] / pl->cos_sun);
+                double kuW = (ext[j] / pl->cos_view) * exp_W[j] * pl->c_W;
+                double kuB = (ext[j] / pl->cos_view) * exp_B[j] * pl->c_B;
+                exp_W[j] = -h_w[j] * (Kd + kuW);
+                exp_B[j] = -h_w[j] * (Kd + kuB);
+            }
+            vm->exp(exp_W, exp_W, m);
+            vm->exp(exp_B, exp_B, m);
+
+            for (size_t j = 0; j < m; j++) r_b[j] = 0.0;
+            for (size_t k = 0; k < n_class; k++) {
+                double col = g->r_rs_b[ws->class_idx[k] * n + i];
+                for (size_t j = 0; j < m; j++) r_b[j] += f[k * VM_BLOCK + j] * col;
+            }
+        }
+
+        for (size_t j = 0; j < m; j++) {
+            double w = omega_b[j];
+            double f_rs;
+            if (pl->water_type == 1) {
+                f_rs = 0.095;
+            } else {
+                f_rs = 0.0512 *
+                       (1 + 4.6659 * w +
+                        -7.8387 * w * w +
+                        5.4571 * w * w * w) *
+                       pl->g_sun *
+                       pl->g_view;
+            }
+            double rrs_deep = f_rs * w, rrs;
+            if (ext[j] == 0)
+                rrs = 0;
+            else if (shallow)
+                rrs = rrs_deep * (1 - (Ars1 * exp_W[j])) + Ars2 * r_b[j] * exp_B[j];
+            else
+                rrs = rrs_deep;
+
+            if (rrs_out) rrs_out[j * n + i] = rrs;
+            double r = ws->sqrt_w[i] * (rrs - obs[i]);
+            cost[j] += r * r;
+        }
+    }
+    for (size_t j = 0; j < m; j++) cost[j] = 0.5 * cost[j];
+}
+
+/* n_cand candidates against one spectrum; ws->sqrt_w set */
+static int pop_eval(saber_inv_workspace* ws, size_t n_cand, const double* x,
+                    const double* obs, double* cost, double* rrs_out)
+{
+    if (pop_scratch(ws)) return 3;
+    for (size_t c0 = 0; c0 < n_cand; c0 += VM_BLOCK) {
+        size_t m = n_cand - c0 < VM_BLOCK ? n_cand - c0 : VM_BLOCK;
+        pop_block(ws, x + c0 * ws->n_par, m, obs, cost + c0, rrs_out ? rrs_out + c0 * ws->n : NULL);
+    }
+    return 0;
+}
+
+static void set_weights(saber_inv_workspace* ws, const double* weights)
+{
+    for (size_t i = 0; i < ws->n; i++)
+        ws->sqrt_w[i] = weights ? sqrt(fmax(weights[i], 0.0)) : 1.0;
+}
+
+/**
+ * Model and misfit of a population of parameter vectors in one call, for
+ * derivative-free optimisers (differential evolution, Nelder-Mead
+ * simplices, multi-start sampling). Candidates are evaluated side by side
+ * across the SIMD lanes rather than band by band, which keeps the vector
+ * unit busy for sensors with few bands. Values are those of
+ * saber_inv_model_jacobian() and the cost that of saber_invert_pixel()
+ * (0.5 sum w (model - obs)^2); the fractions are taken from x whatever
+ * cfg->varpro says.
+ *
+ * @param x        [n_pix x n_cand x n_par], candidate c of pixel p at
+ *                 [(p * n_cand + c) * n_par]
+ * @param rrs_obs  [n_pix x n] observed spectra, pixel-major
+ * @param weights  [n] per-band weights shared by every pixel, NULL = all 1
+ * @param cost_out [n_pix x n_cand]
+ * @param rrs_out  [n_pix x n_cand x n] modelled spectra, or NULL
+ *
+ * @return 0 on success, 1 null pointer, 2 another grid is current,
+ *         3 allocation failure
+ */
+int saber_inv_eval_population(
+        saber_inv_workspace* ws,
+        size_t n_pix, size_t n_cand,
+        const double* x,
+        const double* rrs_obs,
+        const double* weights,
+        double* cost_out,
+        double* rrs_out
+) {
+    if (!ws || !x || !rrs_obs || !cost_out) return 1;
+    if (ws->grid_token != ws->ctx->grid.token) return 2;
+    STAT_CLOCK_BEGIN(ws->ctx);
+    set_weights(ws, weights);
+
+    size_t n = ws->n, n_par = ws->n_par;
+    for (size_t p = 0; p < n_pix; p++) {
+        size_t c0 = p * n_cand;
+        int rc = pop_eval(ws, n_cand, x + c0 * n_par, rrs_obs + p * n, cost_out + c0,
+                          rrs_out ? rrs_out + c0 * n : NULL);
+        if (rc) return rc;
+    }
+    STAT_STAGE_END(ws->ctx, SABER_STAGE_FORWARD, n_pix * n_cand);
+    return 0;
+}
+
+// ---------- Global search ----------
+
+/* splitmix64 */
+static uint64_t rng_next(uint64_t* s)
+{
+    uint64_t z = (*s += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static double rng_unit(uint64_t* s)
+{
+    return (double)(rng_next(s) >> 11) * 0x1.0p-53;
+}
+
+static size_t rng_below(uint64_t* s, size_t n)
+{
+    return (size_t)(rng_unit(s) * (double)n);
+}
+
+/* Search coordinate u in [0, 1] of free parameter k: geometric over boxes
+ * spanning more than two decades above zero (concentrations, depth),
+ * linear otherwise */
+static int log_axis(const saber_inv_workspace* ws, size_t k)
+{
+    return ws->lower[k] > 0 && ws->upper[k] > 100.0 * ws->lower[k];
+}
+
+static double axis_x(const saber_inv_workspace* ws, size_t k, double u)
+{
+    double lo = ws->lower[k], hi = ws->upper[k];
+    double v = log_axis(ws, k) ? lo * pow(hi / lo, u) : lo + (hi - lo) * u;
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static double axis_u(const saber_inv_workspace* ws, size_t k, double v)
+{
+    double lo = ws->lower[k], hi = ws->upper[k];
+    if (!(hi > lo)) return 0.0;
+    double u = log_axis(ws, k) ? log(v / lo) / log(hi / lo) : (v - lo) / (hi - lo);
+    return u < 0 ? 0 : (u > 1 ? 1 : u);
+}
+
+/* Costs of n_cand candidates; with varpro one by one, as the fit sees them */
+static int global_costs(saber_inv_workspace* ws, size_t n_cand, double* x,
+                        const double* obs, double* cost)
+{
+    if (!ws->varpro) return pop_eval(ws, n_cand, x, obs, cost, NULL);
+    for (size_t c = 0; c < n_cand; c++)
+        cost[c] = inv_eval(ws, x + c * ws->n_par, ws->rrs_h) ? HUGE_VAL
+                : inv_residual(ws, ws->rrs_h, obs, ws->r_trial);
+    return 0;
+}
+
+/* Population rows from search coordinates; fixed parameters keep x0 */
+static void global_rows(const saber_inv_workspace* ws, size_t n_cand, const double* u,
+                        const double* x0, double* x)
+{
+    size_t p = ws->n_free, n_par = ws->n_par;
+    for (size_t c = 0; c < n_cand; c++) {
+        double* xc = x + c * n_par;
+        memcpy(xc, x0, sizeof(double) * n_par);
+        for (size_t d = 0; d < p; d++) {
+            size_t k = ws->free_idx[d];
+            xc[k] = axis_x(ws, k, u[c * p + d]);
+        }
+    }
+}
+
+static void global_report(const saber_inv_workspace* ws, int status, int iterations, int n_eval,
+                          double cost0, double cost, saber_inv_report* report)
+{
+    if (!report) return;
+    double w_sum = 0.0;
+    for (size_t i = 0; i < ws->n; i++) w_sum += ws->sqrt_w[i] * ws->sqrt_w[i];
+    report->status       = status;
+    report->iterations   = iterations;
+    report->n_eval       = n_eval;
+    report->cost_initial = cost0;
+    report->cost_final   = cost;
+    report->rmse         = w_sum > 0 ? sqrt(2.0 * cost / w_sum) : 0.0;
+}
+
+/**
+ * Global fit of one observed spectrum for pixels where a single local fit
+ * from x0 stalls in a poor minimum. The workspace's free parameters are
+ * searched inside its bounds (geometrically over boxes spanning more than
+ * two decades), every population going through the population kernel:
+ *
+ *   SABER_GLOBAL_DE          differential evolution (DE/rand/1/bin) for up
+ *                            to `generations`, stopping early once the
+ *                            population's costs agree to `tol`; with
+ *                            `polish`, saber_invert_pixel() from the best
+ *   SABER_GLOBAL_MULTISTART  one sampled population, then
+ *                            saber_invert_pixel() from its n_starts best
+ *
+ * x0 is always a member of the initial population and supplies the fixed
+ * parameters. The report covers the whole search: n_eval counts every
+ * model evaluation, cost_initial is the best of the initial population,
+ * status is the final local fit's (DE without polish: CONVERGED_COST or
+ * MAX_ITER) and iterations adds generations and local iterations.
+ *
+ * @return 0 when the search ran, 1 null pointer, 2 another grid has been
+ *         made current since the workspace was made, 3 invalid global
+ *         config (unknown method, DE population below 4) or allocation
+ *         failure
+ */
+int saber_invert_pixel_global(
+        saber_inv_workspace* ws,
+        const double* rrs_obs,
+        const double* weights,
+        const saber_global_config* gcfg,
+        const double* x0,
+        double* x_out,
+        saber_inv_report* report
+) {
+    if (!ws || !rrs_obs || !gcfg || !x0 || !x_out) return 1;
+    if (ws->grid_token != ws->ctx->grid.token) return 2;
+    if (gcfg->method != SABER_GLOBAL_DE && gcfg->method != SABER_GLOBAL_MULTISTART) return 3;
+
+    size_t p = ws->n_free, n_par = ws->n_par;
+    size_t n_pop = gcfg->population ? gcfg->population : (10 * p > 16 ? 10 * p : 16);
+    int    n_gen = gcfg->generations > 0 ? gcfg->generations : 200;
+    double F     = gcfg->f > 0 ? gcfg->f : 0.7;
+    double CR    = gcfg->cr > 0 ? gcfg->cr : 0.9;
+    double tol   = gcfg->tol > 0 ? gcfg->tol : 1e-6;
+    size_t n_starts = gcfg->n_starts ? gcfg->n_starts : 4;
+    uint64_t rng = gcfg->seed ? gcfg->seed : 0x5eed5abe12ull;
+    int de = gcfg->method == SABER_GLOBAL_DE;
+    if (de && n_pop < 4) return 3;
+    if (n_starts > n_pop) n_starts = n_pop;
+
+    /* population and trials: search coordinates, rows, costs */
+    size_t per = p + n_par + 1;
+    double* buf = malloc(sizeof(double) * 2 * n_pop * per + sizeof(double) * n_par);
+    if (!buf) return 3;
+    double* u      = buf;
+    double* x      = u + n_pop * p;
+    double* cost   = x + n_pop * n_par;
+    double* u_t    = cost + n_pop;
+    double* x_t    = u_t + n_pop * p;
+    double* cost_t = x_t + n_pop * n_par;
+    double* xs     = cost_t + n_pop;
+
+    set_weights(ws, weights);
+    ws->obs = rrs_obs;
+    for (size_t k = 0; k < n_par; k++)
+        xs[k] = x0[k] < ws->lower[k] ? ws->lower[k] : (x0[k] > ws->upper[k] ? ws->upper[k] : x0[k]);
+
+    for (size_t d = 0; d < p; d++) u[d] = axis_u(ws, ws->free_idx[d], xs[ws->free_idx[d]]);
+    for (size_t c = 1; c < n_pop; c++)
+        for (size_t d = 0; d < p; d++) u[c * p + d] = rng_unit(&rng);
+    global_rows(ws, n_pop, u, xs, x);
+
+    int rc = global_costs(ws, n_pop, x, rrs_obs, cost);
+    int n_eval = (int)n_pop, iterations = 0, status = SABER_INV_MAX_ITER;
+    size_t best = 0;
+    for (size_t c = 1; c < n_pop && !rc; c++)
+        if (cost[c] < cost[best]) best = c;
+    double cost0 = cost[best];
+
+    for (int gen = 0; de && !rc && gen < n_gen; gen++) {
+        /* DE/rand/1/bin; mutants leaving [0, 1] land between their base and the bound */
+        for (size_t i = 0; i < n_pop; i++) {
+            size_t r1, r2, r3;
+            do r1 = rng_below(&rng, n_pop); while (r1 == i);
+            do r2 = rng_below(&rng, n_pop); while (r2 == i || r2 == r1);
+            do r3 = rng_below(&rng, n_pop); while (r3 == i || r3 == r1 || r3 == r2);
+            size_t d_rand = rng_below(&rng, p);
+            for (size_t d = 0; d < p; d++) {
+                double v = u[i * p + d];
+                if (d == d_rand || rng_unit(&rng) < CR) {
+                    double b = u[r1 * p + d];
+                    v = b + F * (u[r2 * p + d] - u[r3 * p + d]);
+                    if (v < 0) v = b * rng_unit(&rng);
+                    if (v > 1) v = b + (1 - b) * rng_unit(&rng);
+                }
+                u_t[i * p + d] = v;
+            }
+        }
+        global_rows(ws, n_pop, u_t, xs, x_t);
+        rc = global_costs(ws, n_pop, x_t, rrs_obs, cost_t);
+        n_eval += (int)n_pop;
+        iterations++;
+
+        double worst = 0.0;
+        for (size_t i = 0; i < n_pop && !rc; i++) {
+            if (cost_t[i] <= cost[i]) {
+                memcpy(u + i * p, u_t + i * p, sizeof(double) * p);
+                memcpy(x + i * n_par, x_t + i * n_par, sizeof(double) * n_par);
+                cost[i] = cost_t[i];
+            }
+            if (cost[i] < cost[best]) best = i;
+            if (cost[i] > worst) worst = cost[i];
+        }
+        if (worst - cost[best] <= tol * cost[best]) {
+            status = SABER_INV_CONVERGED_COST;
+            break;
+        }
+    }
+    if (rc) {
+        free(buf);
+        return rc;
+    }
+
+    double cost_best = cost[best];
+    memcpy(x_out, x + best * n_par, sizeof(double) * n_par);
+
+    /* local fits: the DE winner, or the n_starts best samples */
+    size_t n_local = de ? (gcfg->polish ? 1 : 0) : n_starts;
+    int local_iter = 0;
+    for (size_t s = 0; s < n_local; s++) {
+        size_t pick = best;
+        if (!de) {
+            pick = 0;
+            for (size_t c = 1; c < n_pop; c++)
+                if (cost[c] < cost[pick]) pick = c;
+            cost[pick] = HUGE_VAL;      /* taken */
+        }
+        saber_inv_report r;
+        if (saber_invert_pixel(ws, rrs_obs, weights, x + pick * n_par, xs, &r)) continue;
+        n_eval += r.n_eval;
+        local_iter += r.iterations;
+        if (r.cost_final <= cost_best) {        /* the first fit never loses */
+            cost_best = r.cost_final;
+            status    = r.status;
+            memcpy(x_out, xs, sizeof(double) * n_par);
+        }
+    }
+
+    global_report(ws, status, iterations + local_iter, n_eval, cost0, cost_best, report);
+    free(buf);
+    return 0;
+}
@@ -1,20 +1,20 @@
 #include "r_rs_b_lmm.h"
 #include "data_cache.h"
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-int compute_r_rs_b_lmm(
+/* Linear mixture of the class columns of one resampled library */
+static int lmm_on_grid(
+        const saber_ctx* ctx, const double* r_rs_b, size_t n_wl,
         const char** class_names, const double* class_fractions, size_t n_frac,
         double* out_r_rs_b
 ) {
-    if (!class_names || !class_fractions || !out_r_rs_b) return 1;
-
-    const double* r_rs_b = get_r_rs_b();
-    const char** colnames = get_r_rs_b_class_names();
-    size_t n_wl = get_n_wl();
-    size_t n_class = get_n_class();
+    const char** colnames = saber_ctx_get_r_rs_b_class_names(ctx);
+    size_t n_class = saber_ctx_get_n_class(ctx);
 
     if (!r_rs_b || !colnames || n_wl == 0 || n_class == 0) return 2;
+    STAT_CLOCK_BEGIN(ctx);
 
     // Zero initialize
     for (size_t i = 0; i < n_wl; i++) out_r_rs_b[i] = 0.0;
@@ -55,5 +55,414 @@ int compute_r_rs_b_lmm(
         }
     }
 
+    STAT_STAGE_END(ctx, SABER_STAGE_MIXING, 1);
+    return 0;
+}
+
+int saber_ctx_compute_r_rs_b_lmm(
+        const saber_ctx* ctx,
+        const char** class_names, const double* class_fractions, size_t n_frac,
+        double* out_r_rs_b
+) {
+    if (!ctx || !class_names || !class_fractions || !out_r_rs_b) return 1;
+
+    return lmm_on_grid(ctx, saber_ctx_get_r_rs_b(ctx), saber_ctx_get_n_wl(ctx),
+                       class_names, class_fractions, n_frac, out_r_rs_b);
+}
+
+/**
+ * compute_r_rs_b_lmm() on the grid behind `token` rather than the current
+ * one; out_r_rs_b holds that grid's bands.
+ *
+ * @return as saber_ctx_compute_r_rs_b_lmm(), 2 also when the grid was evicted
+ */
+int saber_ctx_compute_r_rs_b_lmm_grid(
+        const saber_ctx* ctx, saber_grid_token token,
+        const char** class_names, const double* class_fractions, size_t n_frac,
+        double* out_r_rs_b
+) {
+    if (!ctx || !class_names || !class_fractions || !out_r_rs_b) return 1;
+    const saber_grid* g = ctx_grid_by_token(ctx, token);
+    if (!g) return 2;
+
+    return lmm_on_grid(ctx, g->r_rs_b, g->n_wl, class_names, class_fractions, n_frac, out_r_rs_b);
+}
+
+/**
+ * Single-precision compute_r_rs_b_lmm() on the float copy of the library.
+ * Fractions are accumulated in float, in the same class order.
+ */
+int saber_ctx_compute_r_rs_b_lmm_f(
+        const saber_ctx* ctx,
+        const char** class_names, const float* class_fractions, size_t n_frac,
+        float* out_r_rs_b
+) {
+    if (!ctx || !class_names || !class_fractions || !out_r_rs_b) return 1;
+
+    const float* r_rs_b = ctx->grid.r_rs_b_f;
+    const char** colnames = saber_ctx_get_r_rs_b_class_names(ctx);
+    size_t n_wl = saber_ctx_get_n_wl(ctx);
+    size_t n_class = saber_ctx_get_n_class(ctx);
+
+    if (!r_rs_b || !colnames || n_wl == 0 || n_class == 0) return 2;
+    STAT_CLOCK_BEGIN(ctx);
+
+    for (size_t i = 0; i < n_wl; i++) out_r_rs_b[i] = 0.0f;
+
+    for (size_t j = 0; j < n_frac; j++) {
+        int matched = -1;
+        for (size_t k = 0; k < n_class; k++) {
+            if (strcmp(class_names[j], colnames[k]) == 0) {
+                matched = (int)k;
+                break;
+            }
+        }
+
+        if (matched < 0) {
+            fprintf(stderr, "Class name '%s' not found in cached bottom reflectance\n", class_names[j]);
+            return 5;
+        }
+
+        float weight = class_fractions[j];
+        for (size_t i = 0; i < n_wl; i++) {
+            out_r_rs_b[i] += weight * r_rs_b[i + matched * n_wl];
+        }
+    }
+
+    STAT_STAGE_END(ctx, SABER_STAGE_MIXING, 1);
+    return 0;
+}
+
+/**
+ * compute_r_rs_b_lmm() plus its derivative with respect to each fraction:
+ * d_out[j * n_wl + i] = d r_b_i / d class_fractions[j], i.e. the cached
+ * library column of class j (the mixture is linear).
+ */
+int saber_ctx_compute_r_rs_b_lmm_jac(
+        const saber_ctx* ctx,
+        const char** class_names, const double* class_fractions, size_t n_frac,
+        double* out_r_rs_b, double* d_out
+) {
+    if (!d_out) return 1;
+    int rc = saber_ctx_compute_r_rs_b_lmm(ctx, class_names, class_fractions, n_frac, out_r_rs_b);
+    if (rc) return rc;
+
+    const double* r_rs_b = saber_ctx_get_r_rs_b(ctx);
+    const char** colnames = saber_ctx_get_r_rs_b_class_names(ctx);
+    size_t n_wl = saber_ctx_get_n_wl(ctx);
+
+    /* names were validated by the value pass */
+    for (size_t j = 0; j < n_frac; j++) {
+        size_t k = 0;
+        while (strcmp(class_names[j], colnames[k]) != 0) k++;
+        memcpy(d_out + j * n_wl, r_rs_b + k * n_wl, sizeof(double) * n_wl);
+    }
+
     return 0;
 }
+
+// ---------- Batched mixing ----------
+
+/* Register tile and cache blocks of lmm_mix_dense(): an MIX_MR x MIX_NR block
+ * of the output is accumulated in registers, and MIX_KC rows of MIX_NC
+ * columns of b stay in L1/L2 while every row block of the output uses
+ * them. */
+#define MIX_MR 4
+#define MIX_NR 8
+#define MIX_KC 128
+#define MIX_NC 256
+
+/* Full MIX_MR x MIX_NR tile at (r0, c0), classes [k0, k1) */
+static inline void mix_tile(const double* const* a, size_t a_rs, const double* const* b,
+                            double* c, size_t ldc, size_t r0, size_t c0, size_t k0, size_t k1)
+{
+    double acc[MIX_MR][MIX_NR];
+    for (int r = 0; r < MIX_MR; r++)
+        for (int q = 0; q < MIX_NR; q++) acc[r][q] = c[(r0 + r) * ldc + c0 + q];
+
+    for (size_t j = k0; j < k1; j++) {
+        const double* aj = a[j] + r0 * a_rs;
+        const double* bj = b[j] + c0;
+        for (int r = 0; r < MIX_MR; r++) {
+            double f = aj[r * a_rs];
+            for (int q = 0; q < MIX_NR; q++) acc[r][q] += f * bj[q];
+        }
+    }
+
+    for (int r = 0; r < MIX_MR; r++)
+        for (int q = 0; q < MIX_NR; q++) c[(r0 + r) * ldc + c0 + q] = acc[r][q];
+}
+
+/* Ragged edge of the output, same summation order */
+static void mix_edge(const double* const* a, size_t a_rs, const double* const* b,
+                     double* c, size_t ldc, size_t r0, size_t r1, size_t c0, size_t c1,
+                     size_t k0, size_t k1)
+{
+    for (size_t r = r0; r < r1; r++) {
+        double* cr = c + r * ldc;
+        for (size_t j = k0; j < k1; j++) {
+            double f = a[j][r * a_rs];
+            const double* bj = b[j];
+            for (size_t q = c0; q < c1; q++) cr[q] += f * bj[q];
+        }
+    }
+}
+
+/* c[r * ldc + q] = sum_j a[j][r * a_rs] * b[j][q] for r < m, q < nc */
+void lmm_mix_dense(size_t m, size_t nc, size_t k,
+                   const double* const* a, size_t a_rs, const double* const* b,
+                   double* c, size_t ldc)
+{
+    for (size_t r = 0; r < m; r++)
+        memset(c + r * ldc, 0, sizeof(double) * nc);
+
+    for (size_t c0 = 0; c0 < nc; c0 += MIX_NC) {
+        size_t c1 = nc - c0 < MIX_NC ? nc : c0 + MIX_NC;
+        for (size_t k0 = 0; k0 < k; k0 += MIX_KC) {
+            size_t k1 = k - k0 < MIX_KC ? k : k0 + MIX_KC;
+
+            size_t r0 = 0;
+            for (; r0 + MIX_MR <= m; r0 += MIX_MR) {
+                size_t q = c0;
+                for (; q + MIX_NR <= c1; q += MIX_NR)
+                    mix_tile(a, a_rs, b, c, ldc, r0, q, k0, k1);
+                if (q < c1) mix_edge(a, a_rs, b, c, ldc, r0, r0 + MIX_MR, q, c1, k0, k1);
+            }
+            if (r0 < m) mix_edge(a, a_rs, b, c, ldc, r0, m, c0, c1, k0, k1);
+        }
+    }
+}
+
+int lmm_mix_pixels(const double* lib, size_t n_wl, const size_t* cls, size_t k,
+                   const double* fractions, size_t n_pix, int band_major,
+                   size_t px0, size_t px1, double* out)
+{
+    const double** rows = malloc(sizeof(double*) * (2 * k + 1));
+    if (!rows) return 3;
+    const double** a = rows;
+    const double** b = rows + k;
+
+    if (!band_major) {
+        /* rows = pixels: fraction columns times library columns */
+        for (size_t j = 0; j < k; j++) {
+            a[j] = fractions + px0 * k + j;
+            b[j] = lib + cls[j] * n_wl;
+        }
+        lmm_mix_dense(px1 - px0, n_wl, k, a, k, b, out + px0 * n_wl, n_wl);
+    } else {
+        /* rows = bands: library columns times fraction rows */
+        for (size_t j = 0; j < k; j++) {
+            a[j] = lib + cls[j] * n_wl;
+            b[j] = fractions + j * n_pix + px0;
+        }
+        lmm_mix_dense(n_wl, px1 - px0, k, a, 1, b, out + px0, n_pix);
+    }
+
+    free(rows);
+    return 0;
+}
+
+void lmm_mix_sparse(const double* lib, size_t n_wl, size_t n_pix,
+                    const size_t* start, const size_t* cls, const double* frac,
+                    double* out, size_t p_stride, size_t b_stride)
+{
+    double acc[MIX_NC];
+
+    for (size_t p = 0; p < n_pix; p++) {
+        double* out_p = out + p * p_stride;
+        for (size_t i0 = 0; i0 < n_wl; i0 += MIX_NC) {
+            size_t m = n_wl - i0 < MIX_NC ? n_wl - i0 : MIX_NC;
+
+            for (size_t i = 0; i < m; i++) acc[i] = 0.0;
+            for (size_t e = start[p]; e < start[p + 1]; e++) {
+                double f = frac[e];
+                const double* col = lib + cls[e] * n_wl + i0;
+                for (size_t i = 0; i < m; i++) acc[i] += f * col[i];
+            }
+            for (size_t i = 0; i < m; i++) out_p[(i0 + i) * b_stride] = acc[i];
+        }
+    }
+}
+
+/* Library columns of the caller's classes; 3 allocation failure,
+ * 5 unknown class */
+static int lmm_class_index(const saber_ctx* ctx, const char** class_names, size_t n_frac,
+                           size_t** cls_out)
+{
+    size_t* cls = malloc(sizeof(size_t) * (n_frac ? n_frac : 1));
+    if (!cls) return 3;
+    for (size_t j = 0; j < n_frac; j++) {
+        size_t k = 0;
+        while (k < ctx->r_rs_b_class_n && strcmp(class_names[j], ctx->r_rs_b_class_names[k]) != 0) k++;
+        if (k == ctx->r_rs_b_class_n) {
+            fprintf(stderr, "Class name '%s' not found in cached bottom reflectance\n", class_names[j]);
+            free(cls);
+            return 5;
+        }
+        cls[j] = k;
+    }
+    *cls_out = cls;
+    return 0;
+}
+
+/**
+ * Bottom mixtures of n_pix pixels on the current grid, as one cache-blocked
+ * matrix product of the fractions with the cached library, so libraries of
+ * hundreds of classes stay compute-bound. Results equal n_pix calls of
+ * compute_r_rs_b_lmm() bit for bit.
+ *
+ * Layout (class_fractions and out_r_rs_b alike):
+ *   SABER_LAYOUT_PIXEL_MAJOR  fraction j of pixel p at [p * n_frac + j],
+ *                             band i of pixel p at     [p * n_wl + i]
+ *   SABER_LAYOUT_BAND_MAJOR   fraction j of pixel p at [j * n_pix + p],
+ *                             band i of pixel p at     [i * n_pix + p]
+ *
+ * @return 0 on success, 1 on null pointer / cache not built, 2 no library
+ *         loaded, 3 unknown layout or allocation failure, 5 unknown class
+ */
+int saber_ctx_compute_r_rs_b_lmm_batch(
+        const saber_ctx* ctx, size_t n_pix,
+        const char** class_names, const double* class_fractions, size_t n_frac,
+        saber_layout layout,
+        double* out_r_rs_b
+) {
+    if (!ctx || !out_r_rs_b) return 1;
+    if (n_frac && (!class_names || !class_fractions)) return 1;
+    if (!ctx->grid.wl) return 1;
+    if (!ctx->grid.r_rs_b || ctx->r_rs_b_class_n == 0) return 2;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+
+    size_t* cls = NULL;
+    int rc = lmm_class_index(ctx, class_names, n_frac, &cls);
+    if (rc) return rc;
+
+    STAT_CLOCK_BEGIN(ctx);
+    rc = lmm_mix_pixels(ctx->grid.r_rs_b, ctx->grid.n_wl, cls, n_frac, class_fractions,
+                        n_pix, layout == SABER_LAYOUT_BAND_MAJOR, 0, n_pix, out_r_rs_b);
+    free(cls);
+    if (!rc) STAT_STAGE_END(ctx, SABER_STAGE_MIXING, n_pix);
+    return rc;
+}
+
+/* Pixels per scratch block when neither operand orientation of
+ * lmm_mix_dense() fits the output view */
+#define MIX_GATHER 64
+
+/* Dense mixing on strided views. An output with contiguous bands is the
+ * pixel-rows product written in place, one with contiguous pixels (and
+ * fractions) the band-rows product; anything else is mixed by blocks of
+ * pixels into scratch and scattered. Same sums in every case. */
+static int lmm_mix_view(const double* lib, size_t n_wl, const size_t* cls, size_t k,
+                        size_t n_pix, saber_view f, saber_view_rw out)
+{
+    const double** rows = malloc(sizeof(double*) * (2 * k + 1));
+    if (!rows) return 3;
+    const double** a = rows;
+    const double** b = rows + k;
+
+    if (out.stride == 1) {
+        for (size_t j = 0; j < k; j++) {
+            a[j] = f.data + j * f.stride;
+            b[j] = lib + cls[j] * n_wl;
+        }
+        lmm_mix_dense(n_pix, n_wl, k, a, f.pix_stride, b, out.data, out.pix_stride);
+    } else if (out.pix_stride == 1 && f.pix_stride == 1) {
+        for (size_t j = 0; j < k; j++) {
+            a[j] = lib + cls[j] * n_wl;
+            b[j] = f.data + j * f.stride;
+        }
+        lmm_mix_dense(n_wl, n_pix, k, a, 1, b, out.data, out.stride);
+    } else {
+        double* tmp = malloc(sizeof(double) * MIX_GATHER * (n_wl ? n_wl : 1));
+        if (!tmp) {
+            free(rows);
+            return 3;
+        }
+        for (size_t j = 0; j < k; j++) b[j] = lib + cls[j] * n_wl;
+        for (size_t px0 = 0; px0 < n_pix; px0 += MIX_GATHER) {
+            size_t m = n_pix - px0 < MIX_GATHER ? n_pix - px0 : MIX_GATHER;
+            for (size_t j = 0; j < k; j++) a[j] = f.data + px0 * f.pix_stride + j * f.stride;
+            lmm_mix_dense(m, n_wl, k, a, f.pix_stride, b, tmp, n_wl);
+            for (size_t r = 0; r < m; r++) {
+                double* o = out.data + (px0 + r) * out.pix_stride;
+                for (size_t i = 0; i < n_wl; i++) o[i * out.stride] = tmp[r * n_wl + i];
+            }
+        }
+        free(tmp);
+    }
+
+    free(rows);
+    return 0;
+}
+
+/**
+ * saber_ctx_compute_r_rs_b_lmm_batch() on strided views (see saber_view)
+ * of the fractions and the output. Outputs with contiguous bands, or
+ * contiguous pixels fed by contiguous fractions, are mixed in place; other
+ * views through blocks of scratch. Bit for bit the layout batch.
+ *
+ * @return as saber_ctx_compute_r_rs_b_lmm_batch()
+ */
+int saber_ctx_compute_r_rs_b_lmm_view(
+        const saber_ctx* ctx, size_t n_pix,
+        const char** class_names, saber_view fractions, size_t n_frac,
+        saber_view_rw out_r_rs_b
+) {
+    if (!ctx || !out_r_rs_b.data) return 1;
+    if (n_frac && (!class_names || !fractions.data)) return 1;
+    if (!ctx->grid.wl) return 1;
+    if (!ctx->grid.r_rs_b || ctx->r_rs_b_class_n == 0) return 2;
+
+    size_t* cls = NULL;
+    int rc = lmm_class_index(ctx, class_names, n_frac, &cls);
+    if (rc) return rc;
+
+    STAT_CLOCK_BEGIN(ctx);
+    rc = lmm_mix_view(ctx->grid.r_rs_b, ctx->grid.n_wl, cls, n_frac, n_pix, fractions, out_r_rs_b);
+    free(cls);
+    if (!rc) STAT_STAGE_END(ctx, SABER_STAGE_MIXING, n_pix);
+    return rc;
+}
+
+/**
+ * saber_ctx_compute_r_rs_b_lmm_batch() for sparse fractions, e.g. pixels
+ * mixing 2-4 classes out of hundreds. Compressed rows: pixel p mixes
+ * entries pix_start[p] .. pix_start[p + 1] - 1 of class_idx (library
+ * columns, in saber_ctx_get_r_rs_b_class_names() order) and fractions.
+ * `layout` applies to out_r_rs_b only.
+ *
+ * @return 0 on success, 1 on null pointer / cache not built, 2 no library
+ *         loaded or a class index out of range, 3 unknown layout
+ */
+int saber_ctx_compute_r_rs_b_lmm_sparse(
+        const saber_ctx* ctx, size_t n_pix,
+        const size_t* pix_start, const size_t* class_idx, const double* fractions,
+        saber_layout layout,
+        double* out_r_rs_b
+) {
+    if (!ctx || !pix_start || !out_r_rs_b) return 1;
+    if (pix_start[n_pix] > pix_start[0] && (!class_idx || !fractions)) return 1;
+    if (!ctx->grid.wl) return 1;
+    if (!ctx->grid.r_rs_b || ctx->r_rs_b_class_n == 0) return 2;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+    for (size_t p = 0; p < n_pix; p++)
+        if (pix_start[p + 1] < pix_start[p]) return 2;
+    for (size_t e = pix_start[0]; e < pix_start[n_pix]; e++)
+        if (class_idx[e] >= ctx->r_rs_b_class_n) return 2;
+
+    STAT_CLOCK_BEGIN(ctx);
+    size_t n_wl = ctx->grid.n_wl;
+    int band_major = layout == SABER_LAYOUT_BAND_MAJOR;
+    lmm_mix_sparse(ctx->grid.r_rs_b, n_wl, n_pix, pix_start, class_idx, fractions, out_r_rs_b,
+                   band_major ? 1 : n_wl, band_major ? n_pix : 1);
+    STAT_STAGE_END(ctx, SABER_STAGE_MIXING, n_pix);
+    return 0;
+}
+
+int compute_r_rs_b_lmm(
+        const char** class_names, const double* class_fractions, size_t n_frac,
+        double* out_r_rs_b
+) {
+    return saber_ctx_compute_r_rs_b_lmm(saber_default_ctx(),
+                                        class_names, class_fractions, n_frac, out_r_rs_b);
+}
@@ -9,6 +9,7 @@
 #define SABER_RRS_H
 
 #include <stddef.h>
+#include "saber.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +20,28 @@ int compute_r_rs_b_lmm(
         double* out_r_rs_b  // output: array of length saber_get_n()
 );
 
+/* c[r * ldc + q] = sum_j a[j][r * a_rs] * b[j][q] for r < m, q < nc:
+ * row r of a strided left operand times k contiguous rows of b, summed
+ * in j order, register-tiled and cache-blocked */
+void lmm_mix_dense(size_t m, size_t nc, size_t k,
+                   const double* const* a, size_t a_rs, const double* const* b,
+                   double* c, size_t ldc);
+
+/* Dense mixing of pixels [px0, px1) of an n_pix-pixel cube, as a blocked
+ * matrix product: fraction j of a pixel (n_pix x k in the cube's layout)
+ * weights library column cls[j] of lib, into out (n_pix x n_wl). Classes
+ * are summed in order from 0.0, i.e. bit for bit the one-axpy-per-class
+ * loop. 3 on allocation failure. */
+int lmm_mix_pixels(const double* lib, size_t n_wl, const size_t* cls, size_t k,
+                   const double* fractions, size_t n_pix, int band_major,
+                   size_t px0, size_t px1, double* out);
+
+/* Sparse mixing: pixel p mixes entries [start[p], start[p + 1]) of
+ * (cls, frac); band i of pixel p goes to out[p * p_stride + i * b_stride]. */
+void lmm_mix_sparse(const double* lib, size_t n_wl, size_t n_pix,
+                    const size_t* start, const size_t* cls, const double* frac,
+                    double* out, size_t p_stride, size_t b_stride);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,387 @@
+#include "saber.h"
+#include "data_cache.h"
+#include "bathymetry.h"
+#include "forward_model.h"
+#include "iop_from_oac.h"
+#include "inversion.h"
+#include "r_rs_b_lmm.h"
+#include "schema.h"
+#include "snell_law.h"
+#include "tile_pool.h"
+#include "unmix.h"
+#include "vec_math.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Shared, read-only description of one run */
+typedef struct scene_job {
+    const saber_ctx*   ctx;
+    const saber_scene* sc;
+    const vm_impl*     vm;
+
+    size_t n;               /* bands      */
+    size_t n_par;           /* INVERT     */
+    size_t tile_pix;
+    int    band_major;
+    size_t stride;          /* between bands of one pixel */
+
+    am03_plan plan;         /* FORWARD / RETRIEVE under the scalar geometry */
+
+    double* x0_default;     /* [n_par] when sc->x0 is NULL */
+} scene_job;
+
+/* Per-thread scratch */
+typedef struct scene_worker {
+    saber_inv_workspace* ws;
+    unmix_workspace* uws;
+    depth_workspace* dws;
+    double* buf;            /* obs, x0, x (INVERT, band-major) */
+} scene_worker;
+
+static size_t pix_off(const scene_job* job, size_t px, size_t len)
+{
+    return job->band_major ? px : px * len;
+}
+
+/* The job plan, or one for this pixel's own angles built in `local` */
+static const am03_plan* scene_plan(const scene_job* job, size_t px, am03_plan* local)
+{
+    const saber_scene* sc = job->sc;
+    if (!sc->theta_sun_pix && !sc->theta_view_pix) return &job->plan;
+
+    double sun  = sc->theta_sun_pix  ? sc->theta_sun_pix[px]  : sc->theta_sun_deg;
+    double view = sc->theta_view_pix ? sc->theta_view_pix[px] : sc->theta_view_deg;
+    double view_w_rad, sun_w_rad;
+    snell_law(view, sun, &view_w_rad, &sun_w_rad);
+    am03_plan_init(local, job->plan.water_type, job->plan.shallow, view_w_rad, sun_w_rad);
+    return local;
+}
+
+static int tile_iop(const scene_job* job, size_t px0, size_t px1)
+{
+    const saber_scene*  sc = job->sc;
+    const saber_schema* s  = sc->schema;
+    size_t p_stride = job->band_major ? sc->n_pix : 1;
+
+    /* Blocks of pixels so the per-pixel chl powers vectorise */
+    oac_params p[VM_BLOCK];
+    for (size_t b0 = px0; b0 < px1; b0 += VM_BLOCK) {
+        size_t m = px1 - b0 < VM_BLOCK ? px1 - b0 : VM_BLOCK;
+
+        for (size_t j = 0; j < m; j++)
+            oac_gather(s->idx, sc->values + pix_off(job, b0 + j, s->n_param), p_stride, &p[j]);
+        if (s->idx[OAC_CHL] >= 0)
+            oac_prepare_aph(job->vm, p, m);
+
+        for (size_t j = 0; j < m; j++) {
+            size_t off = pix_off(job, b0 + j, job->n);
+            oac_iop_spectrum(job->vm, &job->ctx->grid, job->ctx->grid.wl, job->n, &p[j],
+                             &s->shapes, sc->a_out + off, sc->bb_out + off, job->stride);
+        }
+    }
+    return 0;
+}
+
+static int tile_mixing(const scene_job* job, size_t px0, size_t px1)
+{
+    const saber_scene*  sc = job->sc;
+    const saber_schema* s  = sc->schema;
+
+    return lmm_mix_pixels(job->ctx->grid.r_rs_b, job->n, s->class_idx, s->n_class, sc->values,
+                          sc->n_pix, job->band_major, px0, px1, sc->r_b_out);
+}
+
+static int tile_forward(const scene_job* job, size_t px0, size_t px1)
+{
+    const saber_scene* sc = job->sc;
+
+    for (size_t px = px0; px < px1; px++) {
+        size_t off = pix_off(job, px, job->n);
+        am03_plan local;
+        const am03_plan* pl = scene_plan(job, px, &local);
+
+        am03_forward_core(job->vm, pl, sc->a + off, sc->bb + off, job->n, job->stride,
+                          sc->shallow ? sc->h_w[px] : 0.0,
+                          sc->shallow ? sc->r_b + off : NULL, sc->rrs_out + off);
+    }
+    return 0;
+}
+
+static int tile_retrieve(const scene_job* job, size_t px0, size_t px1)
+{
+    const saber_scene* sc = job->sc;
+    int status = 0;
+
+    for (size_t px = px0; px < px1; px++) {
+        size_t off = pix_off(job, px, job->n);
+        am03_plan local;
+        const am03_plan* pl = scene_plan(job, px, &local);
+
+        int rc = am03_retrieve_core(job->vm, pl, sc->a + off, sc->bb + off, sc->rrs + off, job->n,
+                                    job->stride, sc->h_w[px], sc->r_b_out + off);
+        if (rc == 4) {
+            for (size_t k = 0; k < job->n; k++)
+                sc->r_b_out[off + k * job->stride] = 0.0;
+            status = 4;
+        }
+    }
+    return status;
+}
+
+static int tile_invert(const scene_job* job, scene_worker* w, size_t px0, size_t px1)
+{
+    const saber_scene* sc = job->sc;
+    size_t n = job->n, n_par = job->n_par;
+    size_t p_stride = job->band_major ? sc->n_pix : 1;
+    int per_pixel_geometry = sc->theta_sun_pix || sc->theta_view_pix;
+    int status = 0;
+
+    double* obs = w->buf;
+    double* x0  = obs + n;
+    double* x   = x0 + n_par;
+
+    for (size_t px = px0; px < px1; px++) {
+        if (per_pixel_geometry)
+            saber_inv_set_geometry(w->ws,
+                                   sc->theta_sun_pix  ? sc->theta_sun_pix[px]  : sc->inv->theta_sun_deg,
+                                   sc->theta_view_pix ? sc->theta_view_pix[px] : sc->inv->theta_view_deg);
+
+        /* Pixel-major pixels are used in place, band-major ones are gathered */
+        const double* obs_px;
+        const double* x0_px;
+        double* x_px;
+        if (!job->band_major) {
+            obs_px = sc->rrs + px * n;
+            x0_px  = sc->x0 ? sc->x0 + px * n_par : job->x0_default;
+            x_px   = sc->x_out + px * n_par;
+        } else {
+            for (size_t i = 0; i < n; i++) obs[i] = sc->rrs[i * sc->n_pix + px];
+            for (size_t k = 0; k < n_par; k++)
+                x0[k] = sc->x0 ? sc->x0[k * p_stride + px] : job->x0_default[k];
+            obs_px = obs;
+            x0_px  = x0;
+            x_px   = x;
+        }
+
+        saber_inv_report rep;
+        if (saber_invert_pixel(w->ws, obs_px, sc->weights, x0_px, x_px, &rep) != 0) {
+            memset(&rep, 0, sizeof(rep));
+            rep.status = SABER_INV_MODEL_ERROR;
+            if (x_px != x0_px) memcpy(x_px, x0_px, sizeof(double) * n_par);
+            status = 4;
+        }
+
+        if (job->band_major)
+            for (size_t k = 0; k < n_par; k++) sc->x_out[k * p_stride + px] = x[k];
+        if (sc->reports) sc->reports[px] = rep;
+    }
+    return status;
+}
+
+static int tile_unmix(const scene_job* job, scene_worker* w, size_t px0, size_t px1)
+{
+    const saber_scene* sc = job->sc;
+    return unmix_pixels(sc->unmixer, w->uws, sc->r_b, sc->n_pix, job->band_major, px0, px1,
+                        sc->fractions_out, sc->rmse_out);
+}
+
+static int tile_depth(const scene_job* job, scene_worker* w, size_t px0, size_t px1)
+{
+    const saber_scene* sc = job->sc;
+    return depth_pixels(sc->depth, w->dws, sc->rrs, sc->n_pix, job->band_major, px0, px1,
+                        sc->h_w_out, sc->rmse_out);
+}
+
+static int scene_tile(void* user, void* state, size_t tile)
+{
+    const scene_job* job = user;
+    size_t px0 = tile * job->tile_pix;
+    size_t px1 = px0 + job->tile_pix < job->sc->n_pix ? px0 + job->tile_pix : job->sc->n_pix;
+
+    int rc = 3;
+    switch (job->sc->op) {
+        case SABER_SCENE_IOP:      rc = tile_iop(job, px0, px1); break;
+        case SABER_SCENE_MIXING:   rc = tile_mixing(job, px0, px1); break;
+        case SABER_SCENE_FORWARD:  rc = tile_forward(job, px0, px1); break;
+        case SABER_SCENE_RETRIEVE: rc = tile_retrieve(job, px0, px1); break;
+        case SABER_SCENE_INVERT:   rc = tile_invert(job, state, px0, px1); break;
+        case SABER_SCENE_UNMIX:    rc = tile_unmix(job, state, px0, px1); break;
+        case SABER_SCENE_DEPTH:    rc = tile_depth(job, state, px0, px1); break;
+    }
+
+    /* guard and geometry-cache events of this worker thread */
+    STAT_FLUSH(job->ctx);
+    return rc;
+}
+
+/* Argument checks, mirroring the batch entry points */
+static int scene_check(const saber_ctx* ctx, const saber_scene* sc)
+{
+    if (sc->layout != SABER_LAYOUT_PIXEL_MAJOR && sc->layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+
+    switch (sc->op) {
+        case SABER_SCENE_IOP:
+        case SABER_SCENE_MIXING: {
+            const saber_schema* s = sc->schema;
+            if (!s) return 1;
+            if (s->ctx != ctx || s->grid_token != ctx->grid.token) return 2;
+            size_t len = sc->op == SABER_SCENE_IOP ? s->n_param : s->n_class;
+            if (len && !sc->values) return 1;
+            if (sc->op == SABER_SCENE_IOP ? (!sc->a_out || !sc->bb_out) : !sc->r_b_out) return 1;
+            return 0;
+        }
+        case SABER_SCENE_FORWARD:
+            if (!sc->a || !sc->bb || !sc->rrs_out) return 1;
+            if (sc->shallow && (!sc->r_b || !sc->h_w)) return 2;
+            if (sc->water_type != 1 && sc->water_type != 2) return 3;
+            if (sc->shallow)
+                for (size_t px = 0; px < sc->n_pix; px++)
+                    if (sc->h_w[px] < 0) return 2;
+            return 0;
+        case SABER_SCENE_RETRIEVE:
+            if (!sc->a || !sc->bb || !sc->rrs || !sc->h_w || !sc->r_b_out) return 1;
+            if (sc->water_type != 1 && sc->water_type != 2) return 3;
+            for (size_t px = 0; px < sc->n_pix; px++)
+                if (sc->h_w[px] <= 0.0) return 2;
+            return 0;
+        case SABER_SCENE_INVERT:
+            /* no token to compare: the config is grid-free and the worker
+             * workspaces are created per run on ctx's current grid, and
+             * saber_invert_pixel() rejects them should that grid change */
+            if (!sc->inv || !sc->rrs || !sc->x_out) return 1;
+            return 0;
+        case SABER_SCENE_UNMIX:
+            if (!sc->unmixer || !sc->r_b || !sc->fractions_out) return 1;
+            if (sc->unmixer->ctx != ctx || sc->unmixer->grid_token != ctx->grid.token) return 2;
+            return 0;
+        case SABER_SCENE_DEPTH:
+            if (!sc->depth || !sc->rrs || !sc->h_w_out) return 1;
+            if (sc->depth->ctx != ctx || sc->depth->grid_token != ctx->grid.token) return 2;
+            return 0;
+    }
+    return 3;
+}
+
+size_t saber_scene_default_threads(void)
+{
+    return tile_pool_hardware_threads();
+}
+
+/**
+ * Run one operation over a whole scene on n_threads threads (the caller's
+ * thread is one of them). Pixels are cut into tiles of tile_pix pixels;
+ * threads start on equal contiguous shares and steal half of another
+ * thread's remaining tiles when they run out.
+ *
+ * Per-pixel failures do not stop the scene: RETRIEVE zeroes the pixel as
+ * in the batch call, INVERT copies x0 to x_out and reports
+ * SABER_INV_MODEL_ERROR, UNMIX keeps the last feasible fractions and
+ * DEPTH the last Newton iterate; either way 4 is returned at the end.
+ *
+ * stats, when given, receives one entry per thread; busy_s / wall_s is
+ * that thread's utilisation. With n_threads = 0 it must hold
+ * saber_scene_default_threads() entries.
+ *
+ * @return 0 on success, 1 null pointer / cache not built, 2 schema,
+ *         unmixer or depth solver stale, or invalid depth, 3 invalid op, layout,
+ *         water_type or allocation failure, 4 some pixels failed
+ */
+int saber_scene_run(
+        const saber_ctx* ctx,
+        const saber_scene* scene,
+        size_t n_threads,
+        size_t tile_pix,
+        saber_scene_thread_stats* stats
+) {
+    if (!ctx || !scene || !ctx->grid.wl) return 1;
+    int rc = scene_check(ctx, scene);
+    if (rc) return rc;
+
+    if (n_threads == 0) n_threads = saber_scene_default_threads();
+    if (stats) memset(stats, 0, sizeof(*stats) * n_threads);
+    if (scene->n_pix == 0) return 0;
+    STAT_CLOCK_BEGIN(ctx);
+
+    scene_job job;
+    memset(&job, 0, sizeof(job));
+    job.ctx        = ctx;
+    job.sc         = scene;
+    job.vm         = vm_select(ctx->accuracy);
+    job.n          = ctx->grid.n_wl;
+    job.band_major = scene->layout == SABER_LAYOUT_BAND_MAJOR;
+    job.stride     = job.band_major ? scene->n_pix : 1;
+    if (scene->op == SABER_SCENE_FORWARD || scene->op == SABER_SCENE_RETRIEVE) {
+        double view_w_rad, sun_w_rad;
+        snell_law(scene->theta_view_deg, scene->theta_sun_deg, &view_w_rad, &sun_w_rad);
+        am03_plan_init(&job.plan, scene->water_type,
+                       scene->op == SABER_SCENE_RETRIEVE || scene->shallow,
+                       view_w_rad, sun_w_rad);
+    }
+
+    /* Small tiles for the fits, whose cost varies most between pixels */
+    if (tile_pix == 0) {
+        size_t target = scene->op == SABER_SCENE_INVERT ? 16 : 1024;
+        size_t even   = scene->n_pix / (n_threads * 8);
+        tile_pix = even < target ? even : target;
+        if (tile_pix == 0) tile_pix = 1;
+    }
+    job.tile_pix = tile_pix;
+    size_t n_tiles = (scene->n_pix + tile_pix - 1) / tile_pix;
+    if (n_threads > n_tiles) n_threads = n_tiles;
+
+    scene_worker* workers = calloc(n_threads, sizeof(scene_worker));
+    void** states = calloc(n_threads, sizeof(void*));
+    tile_worker_stats* tstats = calloc(n_threads, sizeof(tile_worker_stats));
+    rc = (!workers || !states || !tstats) ? 3 : 0;
+
+    if (!rc && scene->op == SABER_SCENE_INVERT) {
+        job.n_par = saber_inv_n_param(scene->inv);
+        if (!scene->x0) {
+            job.x0_default = malloc(sizeof(double) * job.n_par);
+            if (!job.x0_default || saber_inv_defaults(scene->inv, job.x0_default, NULL, NULL)) rc = 3;
+        }
+        for (size_t k = 0; k < n_threads && !rc; k++) {
+            workers[k].ws  = saber_inv_workspace_create(ctx, scene->inv);
+            workers[k].buf = malloc(sizeof(double) * (job.n + 2 * job.n_par));
+            if (!workers[k].ws || !workers[k].buf) rc = 3;
+        }
+    }
+    if (!rc && scene->op == SABER_SCENE_UNMIX)
+        for (size_t k = 0; k < n_threads && !rc; k++)
+            if (!(workers[k].uws = unmix_workspace_create(scene->unmixer))) rc = 3;
+    if (!rc && scene->op == SABER_SCENE_DEPTH)
+        for (size_t k = 0; k < n_threads && !rc; k++)
+            if (!(workers[k].dws = depth_workspace_create(scene->depth))) rc = 3;
+
+    if (!rc) {
+        for (size_t k = 0; k < n_threads; k++) states[k] = &workers[k];
+        rc = tile_pool_run(n_tiles, n_threads, scene_tile, &job, states, tstats);
+        if (rc < 0) rc = 3;
+
+        if (stats)
+            for (size_t k = 0; k < n_threads; k++) {
+                stats[k].busy_s = tstats[k].busy_s;
+                stats[k].wall_s = tstats[k].wall_s;
+                stats[k].tiles  = tstats[k].tiles;
+                stats[k].steals = tstats[k].steals;
+            }
+    }
+
+    if (workers)
+        for (size_t k = 0; k < n_threads; k++) {
+            saber_inv_workspace_destroy(workers[k].ws);
+            unmix_workspace_destroy(workers[k].uws);
+            depth_workspace_destroy(workers[k].dws);
+            free(workers[k].buf);
+        }
+    free(workers);
+    free(states);
+    free(tstats);
+    free(job.x0_default);
+
+    /* INVERT is counted pixel by pixel in saber_invert_pixel(); the scene
+     * ops share the stage order */
+    if ((rc == 0 || rc == 4) && scene->op != SABER_SCENE_INVERT)
+        STAT_STAGE_END(ctx, (saber_stage)scene->op, scene->n_pix);
+    return rc;
+}
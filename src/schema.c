@@ -0,0 +1,148 @@
+#include "schema.h"
+#include "data_cache.h"
+#include "vec_math.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/**
+ * Resolve parameter names (for iop_from_oac) and bottom class names (for
+ * compute_r_rs_b_lmm) once, against a built context. The *_prepared kernels
+ * then take plain value arrays in the same order, without any strcmp.
+ *
+ * Names unknown to the IOP model are ignored, as in iop_from_oac(). A class
+ * name missing from the library makes the call fail. Either list may be
+ * empty. The schema is tied to the current grid: the prepared kernels
+ * return 2 while another grid is current (after a rebuild or a switch) and
+ * work again once saber_ctx_select_grid() brings this one back.
+ *
+ * @return new schema, or NULL on bad arguments / unknown class / no memory
+ */
+saber_schema* saber_schema_create(
+        const saber_ctx* ctx,
+        const char** param_names, size_t n_param,
+        const char** class_names, size_t n_class
+) {
+    if (!ctx || !ctx->grid.wl) return NULL;
+    if ((n_param && !param_names) || (n_class && !class_names)) return NULL;
+
+    saber_schema* s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+
+    s->ctx        = ctx;
+    s->grid_token = ctx->grid.token;
+    s->n_param    = n_param;
+    oac_resolve_index(param_names, n_param, s->idx);
+
+    /* Bottom classes */
+    s->n_class   = n_class;
+    s->class_idx = malloc(sizeof(size_t) * (n_class ? n_class : 1));
+    if (!s->class_idx) goto fail;
+
+    const char** colnames = saber_ctx_get_r_rs_b_class_names(ctx);
+    size_t lib_n = saber_ctx_get_n_class(ctx);
+    for (size_t j = 0; j < n_class; j++) {
+        size_t k = 0;
+        while (k < lib_n && strcmp(class_names[j], colnames[k]) != 0) k++;
+        if (k == lib_n) {
+            fprintf(stderr, "Class name '%s' not found in cached bottom reflectance\n", class_names[j]);
+            goto fail;
+        }
+        s->class_idx[j] = k;
+    }
+
+    /* Default-slope shapes are constant for this grid */
+    size_t n = ctx->grid.n_wl;
+    s->shape_buf = malloc(sizeof(double) * 3 * n);
+    if (!s->shape_buf) goto fail;
+
+    oac_params defaults = {{0}, {0}, 0, 0, 0};
+    oac_shapes_fill(vm_select(ctx->accuracy), ctx->grid.wl, n, &defaults,
+                    s->shape_buf, s->shape_buf + n, s->shape_buf + 2 * n);
+    s->shapes.g   = s->idx[OAC_A_G_S]      < 0 ? s->shape_buf         : NULL;
+    s->shapes.nap = s->idx[OAC_A_NAP_S]    < 0 ? s->shape_buf + n     : NULL;
+    s->shapes.bbp = s->idx[OAC_BB_P_GAMMA] < 0 ? s->shape_buf + 2 * n : NULL;
+
+    return s;
+
+fail:
+    saber_schema_destroy(s);
+    return NULL;
+}
+
+void saber_schema_destroy(saber_schema* s)
+{
+    if (!s) return;
+    free(s->class_idx);
+    free(s->shape_buf);
+    free(s);
+}
+
+size_t saber_schema_n_param(const saber_schema* s) { return s ? s->n_param : 0; }
+size_t saber_schema_n_class(const saber_schema* s) { return s ? s->n_class : 0; }
+
+/* 0 if `s` was prepared on `ctx` and its grid is the current one */
+static int schema_check(const saber_ctx* ctx, const saber_schema* s)
+{
+    if (!ctx || !s) return 1;
+    if (s->ctx != ctx || s->grid_token != ctx->grid.token) return 2;
+    return 0;
+}
+
+/**
+ * iop_from_oac() on the context grid with pre-resolved names:
+ * param_values[j] is the value of the schema's j-th parameter name.
+ * a_out / bb_out hold saber_ctx_get_n_wl(ctx) bands.
+ *
+ * @return 0 on success, 1 null pointer, 2 schema not prepared on this
+ *         context / its grid is no longer current
+ */
+int saber_ctx_iop_from_oac_prepared(
+        const saber_ctx* ctx, const saber_schema* s,
+        const double* param_values,
+        double* a_out, double* bb_out
+) {
+    int rc = schema_check(ctx, s);
+    if (rc) return rc;
+    if ((s->n_param && !param_values) || !a_out || !bb_out) return 1;
+
+    STAT_CLOCK_BEGIN(ctx);
+    oac_params p;
+    oac_gather(s->idx, param_values, 1, &p);
+    oac_iop_spectrum(vm_select(ctx->accuracy), &ctx->grid, ctx->grid.wl, ctx->grid.n_wl,
+                     &p, &s->shapes, a_out, bb_out, 1);
+    STAT_STAGE_END(ctx, SABER_STAGE_IOP, 1);
+    return 0;
+}
+
+/**
+ * compute_r_rs_b_lmm() with pre-resolved classes: class_fractions[j]
+ * weights the schema's j-th class name.
+ *
+ * @return 0 on success, 1 null pointer, 2 stale schema
+ */
+int saber_ctx_compute_r_rs_b_lmm_prepared(
+        const saber_ctx* ctx, const saber_schema* s,
+        const double* class_fractions,
+        double* out_r_rs_b
+) {
+    int rc = schema_check(ctx, s);
+    if (rc) return rc;
+    if ((s->n_class && !class_fractions) || !out_r_rs_b) return 1;
+
+    STAT_CLOCK_BEGIN(ctx);
+    size_t n_wl = ctx->grid.n_wl;
+    const double* r_rs_b = ctx->grid.r_rs_b;
+
+    for (size_t i = 0; i < n_wl; i++) out_r_rs_b[i] = 0.0;
+
+    for (size_t j = 0; j < s->n_class; j++) {
+        double weight = class_fractions[j];
+        const double* col = r_rs_b + s->class_idx[j] * n_wl;
+        for (size_t i = 0; i < n_wl; i++)
+            out_r_rs_b[i] += weight * col[i];
+    }
+
+    STAT_STAGE_END(ctx, SABER_STAGE_MIXING, 1);
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef SABER_LIB_SCHEMA_H
+#define SABER_LIB_SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "saber.h"
+#include "iop_from_oac.h"
+
+/* Parameter and class names resolved once against one built context */
+struct saber_schema {
+    const saber_ctx* ctx;
+    uint64_t grid_token;        /* ctx->grid.token at prepare time */
+
+    size_t n_param;
+    int    idx[OAC_N];          /* OAC slot -> position in values, -1 absent */
+
+    size_t  n_class;
+    size_t* class_idx;          /* position in fractions -> library column */
+
+    /* spectral shapes whose slopes are not part of the schema */
+    double*    shape_buf;
+    oac_shapes shapes;
+};
+
+#endif //SABER_LIB_SCHEMA_H
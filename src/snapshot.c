@@ -0,0 +1,469 @@
+#include "data_cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Binary table files, in host byte order:
+ *
+ *   bin_header
+ *   one 64-byte aligned section per entry of the file kind's section
+ *   enum, in enum order
+ *
+ * Two kinds share the container: snapshots of a built grid and spectral
+ * libraries (the source tables the loaders take). Both end with NAME_OFF,
+ * n_class uint64 offsets into NAMES, a blob of NUL-terminated class
+ * names. The checksum covers every byte after the header, padding
+ * included, so its length is a multiple of 8.
+ */
+#define SNAP_MAGIC      "SABERSNP"
+#define LIB_MAGIC       "SABERLIB"
+#define BIN_FORMAT      1
+#define BIN_BYTE_ORDER  0x01020304u
+#define BIN_ALIGN       64
+#define BIN_MAX_SEC     16
+
+typedef enum snap_section {
+    SNAP_WL = 0,
+    SNAP_A_W,
+    SNAP_BB_W,
+    SNAP_A0,
+    SNAP_A1,
+    SNAP_R_RS_B,
+    SNAP_WL_F,
+    SNAP_A_W_F,
+    SNAP_BB_W_F,
+    SNAP_A0_F,
+    SNAP_A1_F,
+    SNAP_R_RS_B_F,
+    SNAP_NAME_OFF,
+    SNAP_NAMES,
+    SNAP_N
+} snap_section;
+
+typedef enum lib_section {
+    LIB_A_W_WL = 0,
+    LIB_A_W,
+    LIB_A0A1_WL,
+    LIB_A0,
+    LIB_A1,
+    LIB_R_RS_B_WL,
+    LIB_R_RS_B,             /* r_rs_b_wl_n x n_class, one class per column */
+    LIB_NAME_OFF,
+    LIB_NAMES,
+    LIB_N
+} lib_section;
+
+typedef struct bin_header {
+    char     magic[8];
+    uint32_t format;
+    uint32_t byte_order;
+    char     lib_version[32];   /* writer's saber_version(), informative */
+    uint64_t file_size;
+    uint64_t checksum;
+    uint64_t n_class;
+    uint64_t n_sec;
+    uint64_t off[BIN_MAX_SEC];
+    uint64_t len[BIN_MAX_SEC];  /* bytes */
+} bin_header;
+
+#define bin_align_const(v) (((v) + BIN_ALIGN - 1) / BIN_ALIGN * BIN_ALIGN)
+#define BIN_DATA           bin_align_const(sizeof(bin_header))
+
+static uint64_t bin_align(uint64_t v)
+{
+    return bin_align_const(v);
+}
+
+#define BIN_CHECKSUM_SEED 0xcbf29ce484222325ull
+
+/* FNV-1a over 64-bit words; len is a multiple of 8 */
+static uint64_t bin_checksum(uint64_t h, const void* p, size_t len)
+{
+    const unsigned char* b = p;
+    for (size_t k = 0; k + 8 <= len; k += 8) {
+        uint64_t w;
+        memcpy(&w, b + k, 8);
+        h = (h ^ w) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+/* Append one section: its bytes and the zero padding up to the next
+ * boundary, both folded into the checksum */
+static int bin_put(FILE* f, uint64_t* sum, const void* p, size_t len)
+{
+    static const unsigned char zeros[BIN_ALIGN];
+    size_t body = len - len % 8;
+    size_t pad  = bin_align(len) - len;
+    if (!len) return 0;
+    if (fwrite(p, 1, len, f) != len) return 3;
+    if (pad && fwrite(zeros, 1, pad, f) != pad) return 3;
+
+    unsigned char tail[BIN_ALIGN] = {0};        /* last partial word + padding */
+    memcpy(tail, (const unsigned char*)p + body, len - body);
+    *sum = bin_checksum(*sum, p, body);
+    *sum = bin_checksum(*sum, tail, len - body + pad);
+    return 0;
+}
+
+/* Write n_sec sections under a temporary name and rename the file into
+ * place, so processes mapping an earlier file at the same path keep a
+ * consistent view. 0, or 3 on I/O or allocation failure. */
+static int bin_write(const char* path, const char* magic, uint64_t n_class,
+                     const void* const* src, const uint64_t* len, int n_sec)
+{
+    bin_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic, 8);
+    h.format     = BIN_FORMAT;
+    h.byte_order = BIN_BYTE_ORDER;
+    strncpy(h.lib_version, saber_version(), sizeof(h.lib_version) - 1);
+    h.n_class = n_class;
+    h.n_sec   = (uint64_t)n_sec;
+
+    uint64_t pos = BIN_DATA;
+    for (int s = 0; s < n_sec; s++) {
+        h.off[s] = pos;
+        h.len[s] = len[s];
+        pos = bin_align(pos + len[s]);
+    }
+    h.file_size = pos;
+
+    size_t tmp_len = strlen(path) + 16;
+    char* tmp = malloc(tmp_len);
+    if (!tmp) return 3;
+    snprintf(tmp, tmp_len, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    FILE* f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!f) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return 3;
+    }
+
+    /* header placeholder, the sections, then the header with its checksum */
+    static const unsigned char zeros[BIN_DATA];
+    uint64_t sum = BIN_CHECKSUM_SEED;
+    int rc = 3;
+    if (fwrite(zeros, 1, sizeof(zeros), f) != sizeof(zeros)) goto out;
+    for (int s = 0; s < n_sec; s++)
+        if (bin_put(f, &sum, src[s], len[s])) goto out;
+    h.checksum = sum;
+    if (fseek(f, 0, SEEK_SET) || fwrite(&h, 1, sizeof(h), f) != sizeof(h)) goto out;
+    rc = 0;
+out:
+    if (fclose(f)) rc = 3;
+    if (!rc && (chmod(tmp, 0644) || rename(tmp, path))) rc = 3;
+    if (rc) unlink(tmp);
+    free(tmp);
+    return rc;
+}
+
+/* Map a file of the given kind read-only and check its header, layout
+ * and checksum; section lengths are left to the caller. 0, 2 wrong kind,
+ * format or byte order, truncated or corrupt, 3 I/O failure. */
+static int bin_map(const char* path, const char* magic, int n_sec,
+                   const uint8_t** map_out, size_t* len_out)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "'%s': %s\n", path, strerror(errno));
+        return 3;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return 3;
+    }
+    if (st.st_size < (off_t)BIN_DATA) {
+        close(fd);
+        return 2;
+    }
+    size_t len = (size_t)st.st_size;
+    uint8_t* map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 3;
+
+    const bin_header* h = (const bin_header*)map;
+    int rc = 0;
+    if (memcmp(h->magic, magic, 8) || h->format != BIN_FORMAT || h->byte_order != BIN_BYTE_ORDER ||
+        h->file_size != len || h->n_sec != (uint64_t)n_sec || h->n_class > len)
+        rc = 2;
+
+    uint64_t end = BIN_DATA;
+    for (int s = 0; s < n_sec && !rc; s++) {
+        if (h->off[s] != end || h->len[s] > len - end) rc = 2;
+        else end = bin_align(h->off[s] + h->len[s]);
+        if (end > len) rc = 2;
+    }
+    if (!rc && end != len) rc = 2;
+    if (!rc && bin_checksum(BIN_CHECKSUM_SEED, map + BIN_DATA, len - BIN_DATA) != h->checksum) rc = 2;
+
+    if (rc) {
+        munmap(map, len);
+        return rc;
+    }
+    *map_out = map;
+    *len_out = len;
+    return 0;
+}
+
+/* NAME_OFF and NAMES sections of a class list; 3 on allocation failure */
+static int names_pack(char* const* names, size_t k, uint64_t** off_out, char** blob_out, uint64_t* blob_len)
+{
+    size_t total = 0;
+    for (size_t j = 0; j < k; j++) total += strlen(names[j]) + 1;
+    uint64_t* off = malloc(sizeof(uint64_t) * (k ? k : 1));
+    char* blob = malloc(total ? total : 1);
+    if (!off || !blob) {
+        free(off);
+        free(blob);
+        return 3;
+    }
+    for (size_t j = 0, at = 0; j < k; j++) {
+        size_t len = strlen(names[j]) + 1;
+        off[j] = at;
+        memcpy(blob + at, names[j], len);
+        at += len;
+    }
+    *off_out  = off;
+    *blob_out = blob;
+    *blob_len = total;
+    return 0;
+}
+
+/* Class name pointers into a mapped NAMES section. NULL with *rc = 2 if
+ * a name runs off the blob, *rc = 3 on allocation failure. */
+static char** names_view(const uint8_t* map, int sec_off, int sec_names, int* rc)
+{
+    const bin_header* h = (const bin_header*)map;
+    size_t k = h->n_class;
+    const uint64_t* off = (const uint64_t*)(map + h->off[sec_off]);
+    const char* blob = (const char*)(map + h->off[sec_names]);
+    uint64_t blob_len = h->len[sec_names];
+    for (size_t j = 0; j < k; j++)
+        if (off[j] >= blob_len || !memchr(blob + off[j], 0, blob_len - off[j])) {
+            *rc = 2;
+            return NULL;
+        }
+
+    char** names = malloc(sizeof(char*) * (k ? k : 1));
+    if (!names) {
+        *rc = 3;
+        return NULL;
+    }
+    for (size_t j = 0; j < k; j++) names[j] = (char*)blob + off[j];
+    return names;
+}
+
+// ---------- Grid snapshots ----------
+
+/**
+ * Write the context's current grid (every resampled table, double and
+ * float, with the bottom class names) to `path`, replacing an earlier
+ * file atomically.
+ *
+ * @return 0 on success, 1 null pointer / cache not built, 3 I/O or
+ *         allocation failure
+ */
+int saber_ctx_save_snapshot(const saber_ctx* ctx, const char* path)
+{
+    if (!ctx || !path || !ctx->grid.wl) return 1;
+    const saber_grid* g = &ctx->grid;
+    size_t n = g->n_wl, k = ctx->r_rs_b_class_n;
+
+    uint64_t* name_off;
+    char* names;
+    uint64_t len[SNAP_N];
+    if (names_pack(ctx->r_rs_b_class_names, k, &name_off, &names, &len[SNAP_NAMES])) return 3;
+
+    const void* src[SNAP_N] = {
+        g->wl, g->a_w, g->bb_w, g->a0, g->a1, g->r_rs_b,
+        g->wl_f, g->a_w_f, g->bb_w_f, g->a0_f, g->a1_f, g->r_rs_b_f,
+        name_off, names
+    };
+    for (int s = SNAP_WL; s <= SNAP_A1; s++)     len[s] = sizeof(double) * n;
+    for (int s = SNAP_WL_F; s <= SNAP_A1_F; s++) len[s] = sizeof(float) * n;
+    len[SNAP_R_RS_B]   = sizeof(double) * n * k;
+    len[SNAP_R_RS_B_F] = sizeof(float) * n * k;
+    len[SNAP_NAME_OFF] = sizeof(uint64_t) * k;
+
+    int rc = bin_write(path, SNAP_MAGIC, k, src, len, SNAP_N);
+    free(name_off);
+    free(names);
+    return rc;
+}
+
+/**
+ * Replace everything the context holds with the grid of a snapshot file,
+ * mapped read-only: the tables are used in place from the page cache, so
+ * every process loading the same file shares one copy and loading costs
+ * a map plus one checksum pass, independent of how the grid was built.
+ *
+ * The context ends up as after a build of that grid, minus the source
+ * tables: kernels, schemas and every other prepared object work as usual;
+ * building another grid needs the loaders again. The mapping lives until
+ * the context is destroyed or reloaded. Kernel settings are kept.
+ *
+ * @return 0 on success, 1 null pointer, 2 not a snapshot of this format
+ *         and byte order, truncated or corrupt, 3 I/O or allocation failure
+ */
+int saber_ctx_load_snapshot(saber_ctx* ctx, const char* path)
+{
+    if (!ctx || !path) return 1;
+
+    const uint8_t* map;
+    size_t len;
+    int rc = bin_map(path, SNAP_MAGIC, SNAP_N, &map, &len);
+    if (rc) return rc;
+
+    const bin_header* h = (const bin_header*)map;
+    uint64_t n = h->len[SNAP_WL] / sizeof(double), k = h->n_class;
+    if (n == 0 || (k && n > len / sizeof(double) / k)) rc = 2;
+    for (int s = SNAP_WL; s <= SNAP_A1 && !rc; s++)     if (h->len[s] != sizeof(double) * n) rc = 2;
+    for (int s = SNAP_WL_F; s <= SNAP_A1_F && !rc; s++) if (h->len[s] != sizeof(float) * n) rc = 2;
+    if (!rc && (h->len[SNAP_R_RS_B] != sizeof(double) * n * k ||
+                h->len[SNAP_R_RS_B_F] != sizeof(float) * n * k ||
+                h->len[SNAP_NAME_OFF] != sizeof(uint64_t) * k))
+        rc = 2;
+    char** class_names = rc ? NULL : names_view(map, SNAP_NAME_OFF, SNAP_NAMES, &rc);
+    if (rc) {
+        munmap((void*)map, len);
+        return rc;
+    }
+
+    saber_grid g;
+    memset(&g, 0, sizeof(g));
+    g.n_wl     = n;
+    g.wl       = (double*)(map + h->off[SNAP_WL]);
+    g.a_w      = (double*)(map + h->off[SNAP_A_W]);
+    g.bb_w     = (double*)(map + h->off[SNAP_BB_W]);
+    g.a0       = (double*)(map + h->off[SNAP_A0]);
+    g.a1       = (double*)(map + h->off[SNAP_A1]);
+    g.r_rs_b   = (double*)(map + h->off[SNAP_R_RS_B]);
+    g.wl_f     = (float*)(map + h->off[SNAP_WL_F]);
+    g.a_w_f    = (float*)(map + h->off[SNAP_A_W_F]);
+    g.bb_w_f   = (float*)(map + h->off[SNAP_BB_W_F]);
+    g.a0_f     = (float*)(map + h->off[SNAP_A0_F]);
+    g.a1_f     = (float*)(map + h->off[SNAP_A1_F]);
+    g.r_rs_b_f = (float*)(map + h->off[SNAP_R_RS_B_F]);
+    g.borrowed = 1;
+
+    ctx_release(ctx);
+    ctx->snap_map  = (void*)map;
+    ctx->snap_len  = len;
+    ctx->r_rs_b_class_names    = class_names;
+    ctx->r_rs_b_class_n        = k;
+    ctx->r_rs_b_names_borrowed = 1;
+
+    g.token     = ++ctx->grid_epoch;
+    g.last_used = ++ctx->use_clock;
+    ctx_install_grid(ctx, &g);
+    return 0;
+}
+
+// ---------- Spectral libraries ----------
+
+/**
+ * Write the context's source tables (pure water, a0/a1 and the bottom
+ * reflectance library with its class names, loaded or borrowed) to a
+ * library file for saber_ctx_map_library(), replacing an earlier file
+ * atomically.
+ *
+ * @return 0 on success, 1 null pointer / a table not loaded, 3 I/O or
+ *         allocation failure
+ */
+int saber_ctx_save_library(const saber_ctx* ctx, const char* path)
+{
+    if (!ctx || !path || !ctx->a_w_wl || !ctx->a0a1_wl || !ctx->r_rs_b_wl) return 1;
+    size_t k = ctx->r_rs_b_class_n;
+
+    uint64_t* name_off;
+    char* names;
+    uint64_t len[LIB_N];
+    if (names_pack(ctx->r_rs_b_class_names, k, &name_off, &names, &len[LIB_NAMES])) return 3;
+
+    const void* src[LIB_N] = {
+        ctx->a_w_wl, ctx->a_w_val,
+        ctx->a0a1_wl, ctx->a0_val, ctx->a1_val,
+        ctx->r_rs_b_wl, ctx->r_rs_b_matrix,
+        name_off, names
+    };
+    len[LIB_A_W_WL]    = len[LIB_A_W] = sizeof(double) * ctx->a_w_wl_n;
+    len[LIB_A0A1_WL]   = len[LIB_A0] = len[LIB_A1] = sizeof(double) * ctx->a0a1_wl_n;
+    len[LIB_R_RS_B_WL] = sizeof(double) * ctx->r_rs_b_wl_n;
+    len[LIB_R_RS_B]    = sizeof(double) * ctx->r_rs_b_wl_n * k;
+    len[LIB_NAME_OFF]  = sizeof(uint64_t) * k;
+
+    int rc = bin_write(path, LIB_MAGIC, k, src, len, LIB_N);
+    free(name_off);
+    free(names);
+    return rc;
+}
+
+/**
+ * Borrow all three source tables from a library file mapped read-only,
+ * as the saber_ctx_borrow_*() loaders do from memory: nothing is copied
+ * and every process mapping the same file shares one page-cache copy.
+ * A library mapped earlier is released; cached grids are dropped as by
+ * any loader, and the next build resamples the new tables.
+ *
+ * @return 0 on success, 1 null pointer, 2 not a library file of this
+ *         format and byte order, truncated or corrupt, 3 I/O or
+ *         allocation failure
+ */
+int saber_ctx_map_library(saber_ctx* ctx, const char* path)
+{
+    if (!ctx || !path) return 1;
+
+    const uint8_t* map;
+    size_t len;
+    int rc = bin_map(path, LIB_MAGIC, LIB_N, &map, &len);
+    if (rc) return rc;
+
+    const bin_header* h = (const bin_header*)map;
+    uint64_t n_aw = h->len[LIB_A_W_WL] / sizeof(double);
+    uint64_t n_a0 = h->len[LIB_A0A1_WL] / sizeof(double);
+    uint64_t n_rb = h->len[LIB_R_RS_B_WL] / sizeof(double);
+    uint64_t k    = h->n_class;
+    if (!n_aw || !n_a0 || !n_rb || (k && n_rb > len / sizeof(double) / k)) rc = 2;
+    if (!rc && (h->len[LIB_A_W_WL] != sizeof(double) * n_aw || h->len[LIB_A_W] != sizeof(double) * n_aw ||
+                h->len[LIB_A0A1_WL] != sizeof(double) * n_a0 ||
+                h->len[LIB_A0] != sizeof(double) * n_a0 || h->len[LIB_A1] != sizeof(double) * n_a0 ||
+                h->len[LIB_R_RS_B_WL] != sizeof(double) * n_rb ||
+                h->len[LIB_R_RS_B] != sizeof(double) * n_rb * k ||
+                h->len[LIB_NAME_OFF] != sizeof(uint64_t) * k))
+        rc = 2;
+    char** class_names = rc ? NULL : names_view(map, LIB_NAME_OFF, LIB_NAMES, &rc);
+    if (rc) {
+        munmap((void*)map, len);
+        return rc;
+    }
+
+#define LIB_SEC(s) ((const double*)(map + h->off[s]))
+    rc = saber_ctx_borrow_r_rs_b(ctx, LIB_SEC(LIB_R_RS_B_WL), (const char**)class_names,
+                                 LIB_SEC(LIB_R_RS_B), n_rb, k);
+    free(class_names);
+    if (rc) {
+        munmap((void*)map, len);
+        return 3;
+    }
+    saber_ctx_borrow_pure_water(ctx, LIB_SEC(LIB_A_W_WL), LIB_SEC(LIB_A_W), n_aw);
+    saber_ctx_borrow_a0_a1(ctx, LIB_SEC(LIB_A0A1_WL), LIB_SEC(LIB_A0), LIB_SEC(LIB_A1), n_a0);
+#undef LIB_SEC
+
+    /* nothing points into the previous library any more */
+    if (ctx->lib_map) munmap(ctx->lib_map, ctx->lib_len);
+    ctx->lib_map = (void*)map;
+    ctx->lib_len = len;
+    return 0;
+}
@@ -1,20 +1,24 @@
 #include "snell_law.h"
+#include "stats.h"
 #include <math.h>
 
-// Cached last-used input/output
-static double cached_theta_view = -9999;
-static double cached_theta_sun  = -9999;
-static double cached_view_w     = 0;
-static double cached_sun_w      = 0;
+// Cached last-used input/output, one entry per thread so concurrent
+// callers with different geometries never see each other's angles
+static _Thread_local double cached_theta_view = -9999;
+static _Thread_local double cached_theta_sun  = -9999;
+static _Thread_local double cached_view_w     = 0;
+static _Thread_local double cached_sun_w      = 0;
 
 void snell_law(double theta_view_deg, double theta_sun_deg,
                      double* view_w, double* sun_w) {
     if (theta_view_deg == cached_theta_view && theta_sun_deg == cached_theta_sun) {
+        STAT_LOCAL(STAT_SNELL_HITS);
         *view_w = cached_view_w;
         *sun_w  = cached_sun_w;
         return;
     }
 
+    STAT_LOCAL(STAT_SNELL_MISSES);
     double theta_view_rad = theta_view_deg * M_PI / 180.0;
     double theta_sun_rad  = theta_sun_deg  * M_PI / 180.0;
 
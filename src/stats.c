@@ -0,0 +1,246 @@
+#include "stats.h"
+#include "data_cache.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if SABER_STATS
+
+_Thread_local stat_block stat_local STAT_TLS_MODEL;
+
+/* Generations of the live contexts, ascending (they are handed out in
+ * order). A block is only published into an earlier owner found here,
+ * under the lock, so saber_ctx_destroy() cannot free it meanwhile. */
+static pthread_mutex_t stat_live_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t* stat_live;
+static size_t    stat_live_n, stat_live_cap;
+static uint64_t  stat_next_gen;
+
+static pthread_once_t stat_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  stat_key;
+
+uint64_t stat_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Add the calling thread's block to c and clear it */
+static void stat_publish(saber_stat_counters* c)
+{
+    stat_block* b = &stat_local;
+    for (int id = 0; id < STAT_N; id++) {
+        if (!b->event[id]) continue;
+        atomic_fetch_add_explicit(&c->event[id], b->event[id], memory_order_relaxed);
+        b->event[id] = 0;
+    }
+    for (int s = 0; s < SABER_STAGE_N; s++) {
+        if (!b->calls[s]) continue;
+        atomic_fetch_add_explicit(&c->calls[s], b->calls[s], memory_order_relaxed);
+        atomic_fetch_add_explicit(&c->pixels[s], b->pixels[s], memory_order_relaxed);
+        if (b->ns[s]) atomic_fetch_add_explicit(&c->ns[s], b->ns[s], memory_order_relaxed);
+        b->calls[s] = b->pixels[s] = b->ns[s] = 0;
+    }
+    b->pending = 0;
+}
+
+static void stat_drop(void);
+
+/* Index of gen in stat_live, or stat_live_n; caller holds the lock */
+static size_t stat_live_find(uint64_t gen)
+{
+    size_t lo = 0, hi = stat_live_n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (stat_live[mid] < gen) lo = mid + 1;
+        else                      hi = mid;
+    }
+    return lo < stat_live_n && stat_live[lo] == gen ? lo : stat_live_n;
+}
+
+/* Publish the block into its owner if that context is still alive,
+ * drop it otherwise; the default context (gen 0) never goes away */
+static void stat_publish_owner(void)
+{
+    stat_block* b = &stat_local;
+    if (!b->gen) {
+        stat_publish(b->owner);
+        return;
+    }
+    pthread_mutex_lock(&stat_live_lock);
+    if (stat_live_find(b->gen) < stat_live_n) stat_publish(b->owner);
+    else                                      stat_drop();
+    pthread_mutex_unlock(&stat_live_lock);
+}
+
+static void stat_drop(void)
+{
+    stat_block* b = &stat_local;
+    memset(b->event, 0, sizeof(b->event));
+    memset(b->calls, 0, sizeof(b->calls));
+    memset(b->pixels, 0, sizeof(b->pixels));
+    memset(b->ns, 0, sizeof(b->ns));
+    b->pending = 0;
+}
+
+/* Publish what an exiting thread still holds */
+static void stat_thread_exit(void* unused)
+{
+    (void)unused;
+    stat_block* b = &stat_local;
+    if (b->owner) stat_publish_owner();
+    b->owner = NULL;
+}
+
+static void stat_key_init(void)
+{
+    pthread_key_create(&stat_key, stat_thread_exit);
+}
+
+/* Give a new context its generation; 3 on allocation failure */
+int stat_register(saber_stat_counters* c)
+{
+    int rc = 0;
+    pthread_mutex_lock(&stat_live_lock);
+    if (stat_live_n == stat_live_cap) {
+        size_t cap = stat_live_cap ? 2 * stat_live_cap : 16;
+        uint64_t* live = realloc(stat_live, sizeof(uint64_t) * cap);
+        if (live) {
+            stat_live     = live;
+            stat_live_cap = cap;
+        }
+    }
+    if (stat_live_n < stat_live_cap) {
+        c->gen = ++stat_next_gen;
+        stat_live[stat_live_n++] = c->gen;
+    } else {
+        rc = 3;
+    }
+    pthread_mutex_unlock(&stat_live_lock);
+    return rc;
+}
+
+/* Slow path of stat_enter(): hand the block of the previous owner over
+ * (dropped if that context is gone, even when c now sits at its address)
+ * and count against c */
+void stat_adopt(saber_stat_counters* c)
+{
+    stat_block* b = &stat_local;
+    if (b->owner) stat_publish_owner();
+    b->owner = c;
+    b->gen   = c->gen;
+
+    if (!b->hooked) {
+        pthread_once(&stat_key_once, stat_key_init);
+        pthread_setspecific(stat_key, b);
+        b->hooked = 1;
+    }
+}
+
+void stat_flush_to(saber_stat_counters* c)
+{
+    if (stat_local.owner != c || stat_local.gen != c->gen) stat_adopt(c);
+    stat_publish(c);
+}
+
+/* c is about to be freed: drop this thread's block if it counts c and
+ * retire its generation, after which no other thread publishes into it
+ * (one doing so right now finishes first) */
+void stat_forget(saber_stat_counters* c)
+{
+    if (stat_local.owner == c && stat_local.gen == c->gen) {
+        stat_drop();
+        stat_local.owner = NULL;
+    }
+    if (!c->gen) return;
+    pthread_mutex_lock(&stat_live_lock);
+    size_t k = stat_live_find(c->gen);
+    if (k < stat_live_n) {
+        memmove(stat_live + k, stat_live + k + 1, sizeof(uint64_t) * (stat_live_n - k - 1));
+        stat_live_n--;
+    }
+    pthread_mutex_unlock(&stat_live_lock);
+}
+
+#endif
+
+int saber_stats_enabled(void)
+{
+    return SABER_STATS;
+}
+
+/**
+ * Snapshot of the context's counters, including the calling thread's
+ * unpublished block. Other threads publish theirs every
+ * STAT_FLUSH_CALLS calls, after batches and scene tiles and on exit, so
+ * their last few single-spectrum calls may not show yet; and counters are
+ * read one by one while kernels may still be adding to them, so totals
+ * from a busy context can be a few events apart from each other.
+ *
+ * @return 0 on success, 1 on null pointer
+ */
+int saber_ctx_get_stats(const saber_ctx* ctx, saber_stats* out)
+{
+    if (!ctx || !out) return 1;
+    memset(out, 0, sizeof(*out));
+#if SABER_STATS
+    saber_stat_counters* c = STAT_COUNTERS(ctx);
+    if (stat_local.owner == c && stat_local.gen == c->gen) stat_flush_to(c);
+    uint64_t e[STAT_N];
+    for (int id = 0; id < STAT_N; id++)
+        e[id] = atomic_load_explicit(&c->event[id], memory_order_relaxed);
+
+    out->cache_builds         = e[STAT_CACHE_BUILDS];
+    out->cache_hits           = e[STAT_CACHE_HITS];
+    out->cache_spare_hits     = e[STAT_CACHE_SPARE_HITS];
+    out->cache_evictions      = e[STAT_CACHE_EVICTIONS];
+    out->grid_rejects         = e[STAT_GRID_REJECTS];
+    out->build_ns             = e[STAT_BUILD_NS];
+    out->snell_hits           = e[STAT_SNELL_HITS];
+    out->snell_misses         = e[STAT_SNELL_MISSES];
+    out->retrieve_ext_guard   = e[STAT_RETRIEVE_EXT_GUARD];
+    out->retrieve_denom_guard = e[STAT_RETRIEVE_DENOM_GUARD];
+    for (int s = 0; s < SABER_STAGE_N; s++) {
+        out->stage_calls[s]  = atomic_load_explicit(&c->calls[s], memory_order_relaxed);
+        out->stage_pixels[s] = atomic_load_explicit(&c->pixels[s], memory_order_relaxed);
+        out->stage_ns[s]     = atomic_load_explicit(&c->ns[s], memory_order_relaxed);
+    }
+#endif
+    return 0;
+}
+
+/* Zero every counter and the calling thread's block; safe while kernels
+ * run, whose events then land on either side of the reset. Counters are
+ * otherwise kept for the context's lifetime, across snapshot loads. */
+void saber_ctx_reset_stats(saber_ctx* ctx)
+{
+#if SABER_STATS
+    if (!ctx) return;
+    saber_stat_counters* c = &ctx->stats;
+    if (stat_local.owner == c && stat_local.gen == c->gen) stat_drop();
+    for (int id = 0; id < STAT_N; id++)
+        atomic_store_explicit(&c->event[id], 0, memory_order_relaxed);
+    for (int s = 0; s < SABER_STAGE_N; s++) {
+        atomic_store_explicit(&c->calls[s], 0, memory_order_relaxed);
+        atomic_store_explicit(&c->pixels[s], 0, memory_order_relaxed);
+        atomic_store_explicit(&c->ns[s], 0, memory_order_relaxed);
+    }
+#else
+    (void)ctx;
+#endif
+}
+
+/**
+ * Switch the per-stage and build wall-clock timers on or off (off by
+ * default). Like set_accuracy(), must not race with kernels on the context.
+ *
+ * @return 0 on success, 1 on null pointer
+ */
+int saber_ctx_set_timing(saber_ctx* ctx, int enabled)
+{
+    if (!ctx) return 1;
+    ctx->timing = enabled != 0;
+    return 0;
+}
@@ -0,0 +1,135 @@
+#ifndef SABER_LIB_STATS_H
+#define SABER_LIB_STATS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "saber.h"
+
+/* Runtime counters; -DSABER_STATS=0 compiles every hook below to nothing */
+#ifndef SABER_STATS
+#define SABER_STATS 1
+#endif
+
+typedef enum stat_id {
+    STAT_CACHE_BUILDS = 0,
+    STAT_CACHE_HITS,
+    STAT_CACHE_SPARE_HITS,
+    STAT_CACHE_EVICTIONS,
+    STAT_GRID_REJECTS,
+    STAT_BUILD_NS,
+    STAT_SNELL_HITS,
+    STAT_SNELL_MISSES,
+    STAT_RETRIEVE_EXT_GUARD,
+    STAT_RETRIEVE_DENOM_GUARD,
+    STAT_N
+} stat_id;
+
+/* Per-context counters, all updated with relaxed atomics. gen identifies
+ * the context for the thread blocks: set once at create, never reused,
+ * 0 only for the default context. */
+typedef struct saber_stat_counters {
+    uint64_t         gen;
+    _Atomic uint64_t event[STAT_N];
+    _Atomic uint64_t calls[SABER_STAGE_N];
+    _Atomic uint64_t pixels[SABER_STAGE_N];
+    _Atomic uint64_t ns[SABER_STAGE_N];
+} saber_stat_counters;
+
+#if SABER_STATS
+
+#if defined(__GNUC__)
+#define STAT_TLS_MODEL __attribute__((tls_model("initial-exec")))
+#else
+#define STAT_TLS_MODEL
+#endif
+
+/* A thread's block is published once it holds this many stage calls, or
+ * after any call over this many pixels */
+#define STAT_FLUSH_CALLS   64
+#define STAT_FLUSH_PIXELS  64
+
+/* What a thread counted since its last flush, with plain adds. Entry
+ * points adopt their context on the way in (stat_enter), so events of
+ * helpers without a context at hand (snell_law(), the AM03 cores) and
+ * stage counts both land on the context whose call caused them. The
+ * block reaches the context's atomics every STAT_FLUSH_CALLS calls, after
+ * batches, at the end of scene tiles, when the thread moves to another
+ * context, reads the stats or exits. Blocks are keyed on (owner, gen):
+ * one left over from a destroyed context is dropped, not published, even
+ * when a new context has taken its address. */
+typedef struct stat_block {
+    saber_stat_counters* owner;     /* context being counted, or NULL   */
+    uint64_t gen;                   /* owner->gen when it was taken     */
+    uint32_t pending;               /* stage calls since the last flush */
+    int      hooked;                /* thread-exit flush registered     */
+    uint64_t event[STAT_N];
+    uint64_t calls[SABER_STAGE_N];
+    uint64_t pixels[SABER_STAGE_N];
+    uint64_t ns[SABER_STAGE_N];
+} stat_block;
+
+extern _Thread_local stat_block stat_local STAT_TLS_MODEL;
+
+uint64_t stat_now_ns(void);
+int  stat_register(saber_stat_counters* c);
+void stat_adopt(saber_stat_counters* c);
+void stat_flush_to(saber_stat_counters* c);
+void stat_forget(saber_stat_counters* c);
+
+static inline void stat_add_to(saber_stat_counters* c, stat_id id, uint64_t v)
+{
+    atomic_fetch_add_explicit(&c->event[id], v, memory_order_relaxed);
+}
+
+static inline void stat_elapsed_to(saber_stat_counters* c, stat_id id, uint64_t t0)
+{
+    if (t0) stat_add_to(c, id, stat_now_ns() - t0);
+}
+
+/* Count the calling thread's events against c from here on; returns the
+ * stage clock (0 with timing off) */
+static inline uint64_t stat_enter(saber_stat_counters* c, int timing)
+{
+    if (stat_local.owner != c || stat_local.gen != c->gen) stat_adopt(c);
+    return timing ? stat_now_ns() : 0;
+}
+
+static inline void stat_stage_to(saber_stat_counters* c, saber_stage stage, size_t n_pix, uint64_t t0)
+{
+    stat_local.calls[stage]++;
+    stat_local.pixels[stage] += n_pix;
+    if (t0) stat_local.ns[stage] += stat_now_ns() - t0;
+    if (++stat_local.pending >= STAT_FLUSH_CALLS || n_pix >= STAT_FLUSH_PIXELS)
+        stat_flush_to(c);
+}
+
+/* Kernels only hold a const context; the counters are the one part of it
+ * they may write, and only through the atomics above (the thread block
+ * merely points at them). The macros need struct saber_ctx, i.e.
+ * data_cache.h. */
+#define STAT_COUNTERS(ctx)                  ((saber_stat_counters*)&(ctx)->stats)
+
+#define STAT_LOCAL(id)                      (stat_local.event[id]++)
+#define STAT_ADD(ctx, id, v)                stat_add_to(STAT_COUNTERS(ctx), (id), (v))
+#define STAT_CLOCK_BEGIN(ctx)               uint64_t stat_t0_ = stat_enter(STAT_COUNTERS(ctx), (ctx)->timing)
+#define STAT_CLOCK_END(ctx, id)             stat_elapsed_to(STAT_COUNTERS(ctx), (id), stat_t0_)
+#define STAT_STAGE_END(ctx, stage, n_pix)   stat_stage_to(STAT_COUNTERS(ctx), (stage), (n_pix), stat_t0_)
+#define STAT_FLUSH(ctx)                     stat_flush_to(STAT_COUNTERS(ctx))
+#define STAT_REGISTER(ctx)                  stat_register(STAT_COUNTERS(ctx))
+#define STAT_FORGET(ctx)                    stat_forget(STAT_COUNTERS(ctx))
+
+#else
+
+#define STAT_LOCAL(id)                      ((void)0)
+#define STAT_ADD(ctx, id, v)                ((void)0)
+#define STAT_CLOCK_BEGIN(ctx)               ((void)0)
+#define STAT_CLOCK_END(ctx, id)             ((void)0)
+#define STAT_STAGE_END(ctx, stage, n_pix)   ((void)0)
+#define STAT_FLUSH(ctx)                     ((void)0)
+#define STAT_REGISTER(ctx)                  0
+#define STAT_FORGET(ctx)                    ((void)0)
+
+#endif
+
+#endif //SABER_LIB_STATS_H
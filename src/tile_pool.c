@@ -0,0 +1,168 @@
+#include "tile_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct tile_worker {
+    pthread_mutex_t lock;
+    size_t lo, hi;              /* remaining tiles [lo, hi) */
+
+    struct tile_pool* pool;
+    size_t id;
+    int rc;
+    tile_worker_stats st;
+} tile_worker;
+
+typedef struct tile_pool {
+    tile_worker* w;
+    size_t n;
+    tile_fn fn;
+    void* user;
+    void** states;
+} tile_pool;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/* Own range first, from the front */
+static int take_own(tile_worker* w, size_t* tile)
+{
+    int ok = 0;
+    pthread_mutex_lock(&w->lock);
+    if (w->lo < w->hi) {
+        *tile = w->lo++;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return ok;
+}
+
+/* Move the back half of the fullest other range into our own */
+static int steal(tile_worker* self)
+{
+    tile_pool* pool = self->pool;
+
+    for (;;) {
+        size_t best = pool->n, best_left = 0;
+        for (size_t k = 1; k < pool->n; k++) {
+            size_t v = (self->id + k) % pool->n;
+            tile_worker* w = &pool->w[v];
+            pthread_mutex_lock(&w->lock);
+            size_t left = w->hi - w->lo;
+            pthread_mutex_unlock(&w->lock);
+            if (left > best_left) { best_left = left; best = v; }
+        }
+        if (best == pool->n) return 0;     /* nothing left anywhere */
+
+        tile_worker* v = &pool->w[best];
+        size_t lo = 0, hi = 0;
+        pthread_mutex_lock(&v->lock);
+        size_t left = v->hi - v->lo;
+        if (left > 0) {
+            size_t k = (left + 1) / 2;
+            hi = v->hi;
+            lo = hi - k;
+            v->hi = lo;
+        }
+        pthread_mutex_unlock(&v->lock);
+
+        if (hi > lo) {
+            pthread_mutex_lock(&self->lock);
+            self->lo = lo;
+            self->hi = hi;
+            pthread_mutex_unlock(&self->lock);
+            self->st.steals++;
+            return 1;
+        }
+        /* victim drained meanwhile: rescan */
+    }
+}
+
+static void* worker_main(void* arg)
+{
+    tile_worker* w = arg;
+    tile_pool* pool = w->pool;
+    void* state = pool->states ? pool->states[w->id] : NULL;
+    double t_start = now_s();
+
+    for (;;) {
+        size_t tile;
+        if (!take_own(w, &tile)) {
+            if (!steal(w)) break;
+            continue;
+        }
+        double t0 = now_s();
+        int rc = pool->fn(pool->user, state, tile);
+        w->st.busy_s += now_s() - t0;
+        w->st.tiles++;
+        if (rc > w->rc) w->rc = rc;
+    }
+
+    w->st.wall_s = now_s() - t_start;
+    return NULL;
+}
+
+/**
+ * Run fn over every tile with n_workers workers (worker 0 is the caller).
+ * If a thread cannot be started its share is picked up by the others.
+ *
+ * @return largest tile_fn return, or -1 on allocation failure
+ */
+int tile_pool_run(
+        size_t n_tiles,
+        size_t n_workers,
+        tile_fn fn,
+        void* user,
+        void** states,
+        tile_worker_stats* stats
+) {
+    if (n_workers == 0) n_workers = 1;
+
+    tile_pool pool = { NULL, n_workers, fn, user, states };
+    pool.w = calloc(n_workers, sizeof(tile_worker));
+    pthread_t* th = calloc(n_workers, sizeof(pthread_t));
+    int* started = calloc(n_workers, sizeof(int));
+    if (!pool.w || !th || !started) {
+        free(pool.w); free(th); free(started);
+        return -1;
+    }
+
+    for (size_t k = 0; k < n_workers; k++) {
+        tile_worker* w = &pool.w[k];
+        pthread_mutex_init(&w->lock, NULL);
+        w->lo   = n_tiles * k / n_workers;
+        w->hi   = n_tiles * (k + 1) / n_workers;
+        w->pool = &pool;
+        w->id   = k;
+    }
+
+    for (size_t k = 1; k < n_workers; k++)
+        started[k] = pthread_create(&th[k], NULL, worker_main, &pool.w[k]) == 0;
+
+    worker_main(&pool.w[0]);
+
+    int rc = 0;
+    for (size_t k = 0; k < n_workers; k++) {
+        if (k > 0 && started[k]) pthread_join(th[k], NULL);
+        if (pool.w[k].rc > rc) rc = pool.w[k].rc;
+        if (stats) stats[k] = pool.w[k].st;
+        pthread_mutex_destroy(&pool.w[k].lock);
+    }
+
+    free(pool.w);
+    free(th);
+    free(started);
+    return rc;
+}
+
+size_t tile_pool_hardware_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+}
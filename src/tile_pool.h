@@ -0,0 +1,34 @@
+#ifndef SABER_LIB_TILE_POOL_H
+#define SABER_LIB_TILE_POOL_H
+
+#include <stddef.h>
+
+/* Work-stealing pool over tiles [0, n_tiles).
+ *
+ * Each worker starts with a contiguous share of the tiles and takes them
+ * from the front; a worker that runs dry steals the back half of another
+ * worker's remaining range. Worker 0 runs on the calling thread. */
+
+typedef struct tile_worker_stats {
+    double busy_s;          /* time spent inside tile_fn            */
+    double wall_s;          /* time from start to the worker's exit */
+    size_t tiles;
+    size_t steals;
+} tile_worker_stats;
+
+/* Process one tile; a nonzero return is kept (largest wins) but does not
+ * stop the pool. `state` is the worker's entry of `states`. */
+typedef int (*tile_fn)(void* user, void* state, size_t tile);
+
+int tile_pool_run(
+        size_t n_tiles,
+        size_t n_workers,
+        tile_fn fn,
+        void* user,
+        void** states,              /* [n_workers] or NULL   */
+        tile_worker_stats* stats    /* [n_workers] or NULL   */
+);
+
+size_t tile_pool_hardware_threads(void);
+
+#endif //SABER_LIB_TILE_POOL_H
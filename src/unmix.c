@@ -0,0 +1,502 @@
+#include "unmix.h"
+#include "data_cache.h"
+#include "linalg.h"
+#include "r_rs_b_lmm.h"
+#include "schema.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Pixels per R^T y product: the block of sums stays in cache while its
+ * pixels are solved */
+#define UNMIX_BLOCK 64
+
+struct unmix_workspace {
+    size_t k;
+    size_t n_wl;
+    double* c;              /* UNMIX_BLOCK x k, R^T y of the block */
+    const double** rows;    /* operand rows of lmm_mix_dense() */
+    double* res;            /* [n_wl] residual */
+
+    /* active set: classes free to take a positive fraction */
+    size_t* set;            /* class positions, in order of entry */
+    size_t  n_set;
+    unsigned char* in_set;
+    unsigned char* blocked; /* refused for this step: collinear or no descent */
+
+    double* L;              /* k x k, factor of gram[set, set] over set[0 .. n_fac) */
+    size_t  n_fac;
+    double* v;              /* gram[set, set]^-1 1, for sum-to-one */
+    int     v_ok;
+    double* row;            /* bordered row for la_cholesky_append() */
+
+    double* f;              /* [k] iterate, 0 outside the set */
+    double* z;              /* [k] solution on the set, by set position */
+    double* gf;             /* [k] gram f */
+};
+
+unmix_workspace* unmix_workspace_create(const saber_unmixer* u)
+{
+    unmix_workspace* ws = calloc(1, sizeof(*ws));
+    if (!ws) return NULL;
+
+    size_t k = u->n_class, n_wl = u->n_wl;
+    ws->k     = k;
+    ws->n_wl  = n_wl;
+    ws->c     = malloc(sizeof(double) * UNMIX_BLOCK * k);
+    ws->rows  = malloc(sizeof(double*) * 2 * n_wl);
+    ws->res   = malloc(sizeof(double) * n_wl);
+    ws->set   = malloc(sizeof(size_t) * k);
+    ws->in_set  = calloc(k, 1);
+    ws->blocked = calloc(k, 1);
+    ws->L     = malloc(sizeof(double) * k * k);
+    ws->v     = malloc(sizeof(double) * k);
+    ws->row   = malloc(sizeof(double) * k);
+    ws->f     = calloc(k, sizeof(double));
+    ws->z     = malloc(sizeof(double) * k);
+    ws->gf    = malloc(sizeof(double) * k);
+    if (!ws->c || !ws->rows || !ws->res || !ws->set || !ws->in_set || !ws->blocked || !ws->L ||
+        !ws->v || !ws->row || !ws->f || !ws->z || !ws->gf) {
+        unmix_workspace_destroy(ws);
+        return NULL;
+    }
+    return ws;
+}
+
+void unmix_workspace_destroy(unmix_workspace* ws)
+{
+    if (!ws) return;
+    free(ws->c);
+    free(ws->rows);
+    free(ws->res);
+    free(ws->set);
+    free(ws->in_set);
+    free(ws->blocked);
+    free(ws->L);
+    free(ws->v);
+    free(ws->row);
+    free(ws->f);
+    free(ws->z);
+    free(ws->gf);
+    free(ws);
+}
+
+// ---------- Active set ----------
+
+/* Drop set members whose val (by set position) is not positive, keeping
+ * the order of the rest; the factor stays valid up to the first drop */
+static void set_drop_nonpositive(unmix_workspace* ws, double* val)
+{
+    size_t w = 0;
+    for (size_t q = 0; q < ws->n_set; q++) {
+        size_t j = ws->set[q];
+        if (val[q] > 0.0) {
+            ws->set[w] = j;
+            val[w++] = val[q];
+        } else {
+            ws->in_set[j] = 0;
+            ws->f[j] = 0.0;
+            if (ws->n_fac > w) ws->n_fac = w;
+        }
+    }
+    if (w != ws->n_set) ws->v_ok = 0;
+    ws->n_set = w;
+}
+
+static void set_add(unmix_workspace* ws, size_t j)
+{
+    ws->set[ws->n_set++] = j;
+    ws->in_set[j] = 1;
+    ws->v_ok = 0;
+}
+
+static void set_pop(unmix_workspace* ws)
+{
+    size_t j = ws->set[--ws->n_set];
+    ws->in_set[j] = 0;
+    ws->f[j] = 0.0;
+    if (ws->n_fac > ws->n_set) ws->n_fac = ws->n_set;
+    ws->v_ok = 0;
+}
+
+/* Least squares on the set, z = gram[set, set]^-1 c[set], moved onto
+ * sum(z) = 1 along gram^-1 1 when sum-to-one (mu is that multiplier).
+ * Extends the factor over members added since the last call; a member
+ * found collinear with the ones before it is dropped and blocked, and 1
+ * returned. */
+static int set_solve(const saber_unmixer* u, unmix_workspace* ws, const double* c, double* mu)
+{
+    size_t k = ws->k;
+    int dropped = 0;
+
+    while (ws->n_fac < ws->n_set) {
+        size_t p = ws->n_fac, j = ws->set[p];
+        for (size_t q = 0; q <= p; q++) ws->row[q] = u->gram[j * k + ws->set[q]];
+        if (!la_cholesky_append(ws->L, k, p, ws->row, u->min_pivot * u->gram[j * k + j])) {
+            ws->n_fac++;
+            continue;
+        }
+        for (size_t q = p + 1; q < ws->n_set; q++) ws->set[q - 1] = ws->set[q];
+        ws->n_set--;
+        ws->in_set[j] = 0;
+        ws->f[j] = 0.0;
+        ws->blocked[j] = 1;
+        ws->v_ok = 0;
+        dropped = 1;
+    }
+
+    size_t n = ws->n_set;
+    for (size_t q = 0; q < n; q++) ws->z[q] = c[ws->set[q]];
+    la_cholesky_solve_ld(ws->L, k, ws->z, n);
+
+    *mu = 0.0;
+    if (u->sum_to_one && n) {
+        if (!ws->v_ok) {
+            for (size_t q = 0; q < n; q++) ws->v[q] = 1.0;
+            la_cholesky_solve_ld(ws->L, k, ws->v, n);
+            ws->v_ok = 1;
+        }
+        double sz = 0.0, sv = 0.0;
+        for (size_t q = 0; q < n; q++) {
+            sz += ws->z[q];
+            sv += ws->v[q];
+        }
+        double m = (sz - 1.0) / sv;
+        for (size_t q = 0; q < n; q++) ws->z[q] -= m * ws->v[q];
+        *mu = m;
+    }
+    return dropped;
+}
+
+/* Class outside the set with the largest positive dual c - gram f - mu
+ * above tol, or k if the iterate is optimal */
+static size_t best_entering(const saber_unmixer* u, unmix_workspace* ws, const double* c, double mu)
+{
+    size_t k = ws->k;
+    double* gf = ws->gf;
+
+    for (size_t j = 0; j < k; j++) gf[j] = 0.0;
+    for (size_t q = 0; q < ws->n_set; q++) {
+        size_t s = ws->set[q];
+        double fs = ws->f[s];
+        const double* g = u->gram + s * k;
+        for (size_t j = 0; j < k; j++) gf[j] += fs * g[j];
+    }
+
+    size_t best = k;
+    double w_best = u->tol;
+    for (size_t j = 0; j < k; j++) {
+        if (ws->in_set[j] || ws->blocked[j]) continue;
+        double w = c[j] - gf[j] - mu;
+        if (w > w_best) {
+            w_best = w;
+            best = j;
+        }
+    }
+    return best;
+}
+
+static void set_clear(unmix_workspace* ws)
+{
+    for (size_t q = 0; q < ws->n_set; q++) {
+        ws->in_set[ws->set[q]] = 0;
+        ws->f[ws->set[q]] = 0.0;
+    }
+    ws->n_set = ws->n_fac = 0;
+    ws->v_ok = 0;
+}
+
+/* Empty the set; with sum-to-one, start instead from the single class
+ * nearest to y, the best vertex of the simplex */
+static void set_cold(const saber_unmixer* u, unmix_workspace* ws, const double* c, double* mu)
+{
+    size_t k = ws->k;
+    set_clear(ws);
+    *mu = 0.0;
+    if (!u->sum_to_one) return;
+
+    size_t best = 0;
+    double s_best = -INFINITY;
+    for (size_t j = 0; j < k; j++) {
+        double s = 2.0 * c[j] - u->gram[j * k + j];
+        if (s > s_best) {
+            s_best = s;
+            best = j;
+        }
+    }
+    set_add(ws, best);
+    if (!set_solve(u, ws, c, mu)) ws->f[best] = 1.0;
+}
+
+/* Lawson-Hanson inner loop: from an f feasible and positive on the set,
+ * step towards the set solution until it is positive, dropping the
+ * members that reach zero on the way, and take it. Returns 1 if the set
+ * must be rebuilt (a member turned out collinear), 4 out of budget. */
+static int set_settle(const saber_unmixer* u, unmix_workspace* ws, const double* c,
+                      double* mu, size_t* budget)
+{
+    for (;;) {
+        if (set_solve(u, ws, c, mu)) return 1;
+
+        double alpha = 1.0;
+        size_t q_min = ws->n_set;
+        for (size_t q = 0; q < ws->n_set; q++) {
+            if (ws->z[q] > 0.0) continue;
+            double fq = ws->f[ws->set[q]];
+            double a = fq / (fq - ws->z[q]);
+            if (a < alpha) {
+                alpha = a;
+                q_min = q;
+            }
+        }
+        if (q_min == ws->n_set) break;
+
+        for (size_t q = 0; q < ws->n_set; q++) {
+            size_t s = ws->set[q];
+            ws->f[s] += alpha * (ws->z[q] - ws->f[s]);
+            ws->z[q] = ws->f[s];
+        }
+        ws->z[q_min] = 0.0;
+        set_drop_nonpositive(ws, ws->z);
+
+        if (u->sum_to_one && !ws->n_set) return 1;
+        if (!*budget) return 4;
+        (*budget)--;
+    }
+    for (size_t q = 0; q < ws->n_set; q++) ws->f[ws->set[q]] = ws->z[q];
+    return 0;
+}
+
+/* Lawson-Hanson on the normal equations, min |R f - y|^2 subject to
+ * f >= 0 (and sum(f) = 1), from c = R^T y. The constraints do not depend
+ * on y, so the previous pixel's fractions left in the workspace are a
+ * feasible start: a similar pixel only settles on the same set, often
+ * without refactoring. Leaves the solution in ws->f; returns 4 if the
+ * iteration budget ran out. */
+static int solve_pixel(const saber_unmixer* u, unmix_workspace* ws, const double* c)
+{
+    size_t k = ws->k;
+    size_t budget = 3 * k + 30;
+    double mu = 0.0;
+
+    /* masked (non-finite) spectra get no fractions */
+    for (size_t j = 0; j < k; j++)
+        if (!isfinite(c[j])) {
+            set_clear(ws);
+            return 0;
+        }
+    memset(ws->blocked, 0, k);
+
+    int rc = ws->n_set ? set_settle(u, ws, c, &mu, &budget) : 1;
+    for (;;) {
+        if (rc == 4) return 4;
+        if (rc) {
+            if (!budget) return 4;
+            budget--;
+            set_cold(u, ws, c, &mu);
+        }
+
+        size_t j = best_entering(u, ws, c, mu);
+        if (j == k) return 0;
+        if (!budget) return 4;
+        budget--;
+
+        double mu_prev = mu;
+        set_add(ws, j);
+        if (set_solve(u, ws, c, &mu)) {
+            /* j was collinear with the set: z and mu are back on the old
+             * set, unless something else went too */
+            rc = ws->in_set[j];
+            continue;
+        }
+        if (!(ws->z[ws->n_set - 1] > 0.0)) {
+            /* no descent along j in floating point */
+            set_pop(ws);
+            ws->blocked[j] = 1;
+            mu = mu_prev;
+            rc = 0;
+            continue;
+        }
+        memset(ws->blocked, 0, k);
+        rc = set_settle(u, ws, c, &mu, &budget);
+    }
+}
+
+void unmix_tune(saber_unmixer* u)
+{
+    size_t k = u->n_class;
+    double trace = 0.0;
+    for (size_t j = 0; j < k; j++) trace += u->gram[j * k + j];
+    u->tol       = 1e-12 * trace / (double)k;
+    u->min_pivot = 1e-10;
+}
+
+void unmix_gram_changed(unmix_workspace* ws)
+{
+    ws->n_fac = 0;
+    ws->v_ok  = 0;
+}
+
+int unmix_solve(const saber_unmixer* u, unmix_workspace* ws, const double* rhs, double* f)
+{
+    int rc = solve_pixel(u, ws, rhs);
+    memcpy(f, ws->f, sizeof(double) * ws->k);
+    return rc;
+}
+
+int unmix_pixels(const saber_unmixer* u, unmix_workspace* ws,
+                 const double* r_b, size_t n_pix, int band_major, size_t px0, size_t px1,
+                 double* fractions, double* rmse)
+{
+    size_t k = u->n_class, n_wl = u->n_wl;
+    size_t stride = band_major ? n_pix : 1;
+    const double* lib = u->ctx->grid.r_rs_b;
+    int status = 0;
+
+    const double** a = ws->rows;
+    const double** b = ws->rows + n_wl;
+    for (size_t i = 0; i < n_wl; i++) b[i] = u->lib_t + i * k;
+
+    for (size_t b0 = px0; b0 < px1; b0 += UNMIX_BLOCK) {
+        size_t m = px1 - b0 < UNMIX_BLOCK ? px1 - b0 : UNMIX_BLOCK;
+
+        /* c = R^T y for the whole block in one product */
+        for (size_t i = 0; i < n_wl; i++)
+            a[i] = band_major ? r_b + i * n_pix + b0 : r_b + b0 * n_wl + i;
+        lmm_mix_dense(m, k, n_wl, a, band_major ? 1 : n_wl, b, ws->c, k);
+
+        for (size_t r = 0; r < m; r++) {
+            size_t px = b0 + r;
+            if (solve_pixel(u, ws, ws->c + r * k)) status = 4;
+
+            for (size_t j = 0; j < k; j++)
+                fractions[band_major ? j * n_pix + px : px * k + j] = ws->f[j];
+
+            if (rmse) {
+                const double* y = r_b + (band_major ? px : px * n_wl);
+                double* res = ws->res;
+                for (size_t i = 0; i < n_wl; i++) res[i] = y[i * stride];
+                for (size_t q = 0; q < ws->n_set; q++) {
+                    size_t s = ws->set[q];
+                    double fs = ws->f[s];
+                    const double* col = lib + u->class_idx[s] * n_wl;
+                    for (size_t i = 0; i < n_wl; i++) res[i] -= fs * col[i];
+                }
+                double ss = 0.0;
+                for (size_t i = 0; i < n_wl; i++) ss += res[i] * res[i];
+                rmse[px] = sqrt(ss / (double)n_wl);
+            }
+        }
+    }
+    return status;
+}
+
+// ---------- Public API ----------
+
+/**
+ * Prepare constrained unmixing against the classes of a schema (all
+ * library classes when s is NULL) on the context's current grid: the
+ * library Gram matrix R^T R and a band-major copy of R are computed once
+ * here and shared by every later call, from any thread.
+ *
+ * Fractions are non-negative; with sum_to_one they also add up to 1
+ * (fully constrained unmixing). Like a schema, the unmixer is tied to the
+ * grid it was created on.
+ *
+ * @return new unmixer, or NULL on bad arguments / stale schema / no
+ *         library / no memory
+ */
+saber_unmixer* saber_unmixer_create(const saber_ctx* ctx, const saber_schema* s, int sum_to_one)
+{
+    if (!ctx || !ctx->grid.wl || !ctx->grid.r_rs_b || ctx->r_rs_b_class_n == 0) return NULL;
+    if (s && (s->ctx != ctx || s->grid_token != ctx->grid.token)) return NULL;
+
+    size_t k = s ? s->n_class : ctx->r_rs_b_class_n;
+    size_t n_wl = ctx->grid.n_wl;
+    if (k == 0) return NULL;
+
+    saber_unmixer* u = calloc(1, sizeof(*u));
+    if (!u) return NULL;
+    u->ctx        = ctx;
+    u->grid_token = ctx->grid.token;
+    u->sum_to_one = sum_to_one != 0;
+    u->n_wl       = n_wl;
+    u->n_class    = k;
+    u->class_idx  = malloc(sizeof(size_t) * k);
+    u->gram       = malloc(sizeof(double) * k * k);
+    u->lib_t      = malloc(sizeof(double) * n_wl * k);
+    const double** rows = malloc(sizeof(double*) * 2 * n_wl);
+    if (!u->class_idx || !u->gram || !u->lib_t || !rows) {
+        free(rows);
+        saber_unmixer_destroy(u);
+        return NULL;
+    }
+
+    for (size_t j = 0; j < k; j++) {
+        u->class_idx[j] = s ? s->class_idx[j] : j;
+        const double* col = ctx->grid.r_rs_b + u->class_idx[j] * n_wl;
+        for (size_t i = 0; i < n_wl; i++) u->lib_t[i * k + j] = col[i];
+    }
+
+    /* R^T R, summed over bands in order, hence exactly symmetric */
+    for (size_t i = 0; i < n_wl; i++) rows[i] = rows[n_wl + i] = u->lib_t + i * k;
+    lmm_mix_dense(k, k, n_wl, rows, 1, rows + n_wl, u->gram, k);
+    free(rows);
+
+    unmix_tune(u);
+    return u;
+}
+
+void saber_unmixer_destroy(saber_unmixer* u)
+{
+    if (!u) return;
+    free(u->class_idx);
+    free(u->gram);
+    free(u->lib_t);
+    free(u);
+}
+
+size_t saber_unmixer_n_class(const saber_unmixer* u) { return u ? u->n_class : 0; }
+
+/**
+ * Fractions of the unmixer's classes for n_pix bottom reflectance spectra
+ * on the context grid (e.g. from retrieve_r_rs_b_am03), minimising the
+ * band-wise squared misfit under the unmixer's constraints.
+ *
+ * Pixels go through in blocks: R^T y for a block is one matrix product
+ * against the cached library, then each pixel is solved on the Gram
+ * matrix alone with an active-set method warm-started from the previous
+ * pixel, so neighbouring pixels with the same classes present cost one
+ * small Cholesky solve each.
+ *
+ * Layout (r_rs_b and fractions_out alike):
+ *   SABER_LAYOUT_PIXEL_MAJOR  band i at [p * n_wl + i], class j at [p * n_class + j]
+ *   SABER_LAYOUT_BAND_MAJOR   band i at [i * n_pix + p], class j at [j * n_pix + p]
+ * rmse_out ([n_pix], optional) receives the root-mean-square residual.
+ * Spectra with non-finite bands (masked pixels) get zero fractions.
+ *
+ * @return 0 on success, 1 null pointer, 2 unmixer not created on this
+ *         context / its grid is no longer current, 3 unknown layout or
+ *         allocation failure, 4 some pixels hit the iteration limit (their
+ *         last feasible fractions are returned)
+ */
+int saber_ctx_unmix_r_rs_b_batch(
+        const saber_ctx* ctx, const saber_unmixer* u, size_t n_pix,
+        const double* r_rs_b, saber_layout layout,
+        double* fractions_out, double* rmse_out
+) {
+    if (!ctx || !u) return 1;
+    if (u->ctx != ctx || u->grid_token != ctx->grid.token) return 2;
+    if (!r_rs_b || !fractions_out) return 1;
+    if (layout != SABER_LAYOUT_PIXEL_MAJOR && layout != SABER_LAYOUT_BAND_MAJOR) return 3;
+
+    unmix_workspace* ws = unmix_workspace_create(u);
+    if (!ws) return 3;
+
+    STAT_CLOCK_BEGIN(ctx);
+    int rc = unmix_pixels(u, ws, r_rs_b, n_pix, layout == SABER_LAYOUT_BAND_MAJOR, 0, n_pix,
+                          fractions_out, rmse_out);
+    unmix_workspace_destroy(ws);
+    STAT_STAGE_END(ctx, SABER_STAGE_UNMIX, n_pix);
+    return rc;
+}
@@ -0,0 +1,54 @@
+#ifndef SABER_LIB_UNMIX_H
+#define SABER_LIB_UNMIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "saber.h"
+
+/* Library products for one class set on one grid, shared read-only by
+ * every thread that unmixes with it */
+struct saber_unmixer {
+    const saber_ctx* ctx;
+    uint64_t grid_token;        /* ctx->grid.token at create time */
+    int      sum_to_one;
+
+    size_t   n_wl;
+    size_t   n_class;
+    size_t*  class_idx;         /* position in fractions -> library column */
+    double*  gram;              /* n_class x n_class, R^T R */
+    double*  lib_t;             /* n_wl x n_class, band i of every class in row i */
+
+    double   tol;               /* dual threshold for entering the active set */
+    double   min_pivot;         /* relative, below it a class is collinear */
+};
+
+/* Per-thread solver state. The active set and its factor carry over from
+ * one pixel to the next, so runs of similar pixels start at (and often
+ * finish on) the previous solution. */
+typedef struct unmix_workspace unmix_workspace;
+
+unmix_workspace* unmix_workspace_create(const saber_unmixer* u);
+void unmix_workspace_destroy(unmix_workspace* ws);
+
+/* Derive the solver thresholds from u->gram; call whenever it is filled */
+void unmix_tune(saber_unmixer* u);
+
+/* The gram of the workspace's unmixer changed: drop the cached factor
+ * (the fractions, still feasible, stay as the next warm start) */
+void unmix_gram_changed(unmix_workspace* ws);
+
+/* One solve from rhs = R^T y on the unmixer's gram alone, fractions into
+ * f ([n_class]); 0, or 4 at the iteration limit. Only gram, n_class,
+ * sum_to_one and the thresholds of u are used, so callers may fill a
+ * saber_unmixer of their own for a design that changes between calls. */
+int unmix_solve(const saber_unmixer* u, unmix_workspace* ws, const double* rhs, double* f);
+
+/* Unmix pixels [px0, px1) of an n_pix-pixel r_b cube (n_wl bands) into
+ * fractions (n_pix x n_class) and optionally rmse ([n_pix]), both cubes
+ * in the layout of r_b. 0 on success, 4 if some pixel hit the iteration
+ * limit (its last feasible iterate is kept). */
+int unmix_pixels(const saber_unmixer* u, unmix_workspace* ws,
+                 const double* r_b, size_t n_pix, int band_major, size_t px0, size_t px1,
+                 double* fractions, double* rmse);
+
+#endif //SABER_LIB_UNMIX_H
@@ -0,0 +1,181 @@
+#include "vec_math.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define VM_LOG2E  1.4426950408889634074
+#define VM_LN2_HI 0x1.62e42fefa3800p-1     /* low 11 bits clear: k * hi is exact */
+#define VM_LN2_LO 0x1.ef35793c76730p-45
+#define VM_SQRT2  1.4142135623730950488
+
+#define VMF_LOG2E  1.44269504f
+#define VMF_LN2_HI 0x1.62e4p-1f             /* low 8 bits clear: k * hi is exact */
+#define VMF_LN2_LO 1.42860682e-6f
+#define VMF_SQRT2  1.41421356f
+
+#define VM_STR_(x) #x
+#define VM_STR(x)  VM_STR_(x)
+
+// ---------- Exact tier: libm ----------
+
+static void libm_exp(const double* x, double* y, size_t n)
+{
+    for (size_t i = 0; i < n; i++) y[i] = exp(x[i]);
+}
+
+static void libm_log(const double* x, double* y, size_t n)
+{
+    for (size_t i = 0; i < n; i++) y[i] = log(x[i]);
+}
+
+static void libm_pow(const double* x, double p, double* y, size_t n)
+{
+    for (size_t i = 0; i < n; i++) y[i] = pow(x[i], p);
+}
+
+static void libm_pow2(const double* x, double p1, double p2, double* y1, double* y2, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        y1[i] = pow(x[i], p1);
+        y2[i] = pow(x[i], p2);
+    }
+}
+
+static const vm_impl vm_libm = { "libm", libm_exp, libm_log, libm_pow, libm_pow2 };
+
+static void libmf_exp(const float* x, float* y, size_t n)
+{
+    for (size_t i = 0; i < n; i++) y[i] = expf(x[i]);
+}
+
+static void libmf_log(const float* x, float* y, size_t n)
+{
+    for (size_t i = 0; i < n; i++) y[i] = logf(x[i]);
+}
+
+static void libmf_pow(const float* x, float p, float* y, size_t n)
+{
+    for (size_t i = 0; i < n; i++) y[i] = powf(x[i], p);
+}
+
+static void libmf_pow2(const float* x, float p1, float p2, float* y1, float* y2, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        y1[i] = powf(x[i], p1);
+        y2[i] = powf(x[i], p2);
+    }
+}
+
+static const vmf_impl vmf_libm = { "libm", libmf_exp, libmf_log, libmf_pow, libmf_pow2 };
+
+// ---------- Fast tier: one instantiation per ISA ----------
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SABER_VM_X86 1
+
+#define VM_W      2
+#define VM_ISA    sse2
+#define VM_TARGET __attribute__((target("sse2")))
+#include "vec_math_impl.h"
+#undef VM_W
+#undef VM_ISA
+#undef VM_TARGET
+
+#define VM_W      4
+#define VM_ISA    avx2
+#define VM_TARGET __attribute__((target("avx2,fma")))
+#include "vec_math_impl.h"
+#undef VM_W
+#undef VM_ISA
+#undef VM_TARGET
+
+#define VM_W      8
+#define VM_ISA    avx512
+#define VM_TARGET __attribute__((target("avx512f")))
+#include "vec_math_impl.h"
+#undef VM_W
+#undef VM_ISA
+#undef VM_TARGET
+
+static const vm_impl*  vm_fast  = &vm_table_sse2;
+static const vmf_impl* vmf_fast = &vmf_table_sse2;
+
+__attribute__((constructor))
+static void vm_dispatch_init(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        vm_fast  = &vm_table_avx512;
+        vmf_fast = &vmf_table_avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        vm_fast  = &vm_table_avx2;
+        vmf_fast = &vmf_table_avx2;
+    } else {
+        vm_fast  = &vm_table_sse2;
+        vmf_fast = &vmf_table_sse2;
+    }
+}
+
+size_t vm_fast_tables(const vm_impl** out, const vmf_impl** out_f)
+{
+    size_t k = 0;
+    __builtin_cpu_init();
+    out[k] = &vm_table_sse2;  out_f[k++] = &vmf_table_sse2;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        out[k] = &vm_table_avx2;  out_f[k++] = &vmf_table_avx2;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        out[k] = &vm_table_avx512;  out_f[k++] = &vmf_table_avx512;
+    }
+    return k;
+}
+
+#elif defined(__GNUC__)
+
+/* Other targets: let the compiler map 2-lane vectors to whatever it has */
+#define VM_W      2
+#define VM_ISA    generic
+#define VM_TARGET
+#include "vec_math_impl.h"
+#undef VM_W
+#undef VM_ISA
+#undef VM_TARGET
+
+static const vm_impl*  vm_fast  = &vm_table_generic;
+static const vmf_impl* vmf_fast = &vmf_table_generic;
+
+size_t vm_fast_tables(const vm_impl** out, const vmf_impl** out_f)
+{
+    out[0] = vm_fast;
+    out_f[0] = vmf_fast;
+    return 1;
+}
+
+#else
+
+static const vm_impl*  vm_fast  = &vm_libm;
+static const vmf_impl* vmf_fast = &vmf_libm;
+
+size_t vm_fast_tables(const vm_impl** out, const vmf_impl** out_f)
+{
+    out[0] = vm_fast;
+    out_f[0] = vmf_fast;
+    return 1;
+}
+
+#endif
+
+const vm_impl* vm_select(saber_accuracy accuracy)
+{
+    return accuracy == SABER_ACCURACY_FAST ? vm_fast : &vm_libm;
+}
+
+const vmf_impl* vmf_select(saber_accuracy accuracy)
+{
+    return accuracy == SABER_ACCURACY_FAST ? vmf_fast : &vmf_libm;
+}
+
+const char* saber_simd_isa(void)
+{
+    return vm_fast->isa;
+}
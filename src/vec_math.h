@@ -0,0 +1,53 @@
+#ifndef SABER_LIB_VEC_MATH_H
+#define SABER_LIB_VEC_MATH_H
+
+#include <stddef.h>
+#include "saber.h"
+
+/*
+ * Array-wise transcendental functions used by the spectral kernels.
+ *
+ * SABER_ACCURACY_EXACT  scalar libm, results identical to the historical
+ *                       per-band code.
+ * SABER_ACCURACY_FAST   polynomial kernels over SSE2 / AVX2 / AVX-512 lanes,
+ *                       picked once at load time from the running CPU.
+ *                       exp, log: <= 1 ulp; pow(x, p) = exp(p log x):
+ *                       <= 3 + 2 |p ln x| ulp. exp flushes results below
+ *                       DBL_MIN (x < -708) to 0; log/pow expect x > 0.
+ */
+typedef struct vm_impl {
+    const char* isa;
+    void (*exp)(const double* x, double* y, size_t n);
+    void (*log)(const double* x, double* y, size_t n);
+    void (*pow)(const double* x, double p, double* y, size_t n);
+    void (*pow2)(const double* x, double p1, double p2, double* y1, double* y2, size_t n);
+} vm_impl;
+
+const vm_impl* vm_select(saber_accuracy accuracy);
+
+/*
+ * float counterparts for the *_f kernels: libmf (expf, logf, powf) when
+ * exact, and the same polynomial scheme at twice the lanes when fast.
+ * Fast exp flushes x < -87 to 0 and returns +inf above x > 88.
+ */
+typedef struct vmf_impl {
+    const char* isa;
+    void (*exp)(const float* x, float* y, size_t n);
+    void (*log)(const float* x, float* y, size_t n);
+    void (*pow)(const float* x, float p, float* y, size_t n);
+    void (*pow2)(const float* x, float p1, float p2, float* y1, float* y2, size_t n);
+} vmf_impl;
+
+const vmf_impl* vmf_select(saber_accuracy accuracy);
+
+/*
+ * Every fast-tier table this build carries that the running CPU can
+ * execute, narrowest first (tests walk them all, not just the one
+ * vm_select() picks). Writes up to 3 entries; returns how many.
+ */
+size_t vm_fast_tables(const vm_impl** out, const vmf_impl** out_f);
+
+/* Bands handled per stack block by the kernels built on top of vm_impl */
+#define VM_BLOCK 64
+
+#endif //SABER_LIB_VEC_MATH_H
@@ -0,0 +1,349 @@
+/*
+ * Fast-tier exp / log / pow kernels, written once over GCC vector
+ * extensions and instantiated by vec_math.c for each lane width, in
+ * double (VM_W lanes) and float (2 * VM_W lanes).
+ *
+ * The including file defines before every inclusion:
+ *   VM_W     lanes per vector (1, 2, 4 or 8)
+ *   VM_ISA   suffix appended to every symbol (sse2, avx2, ...)
+ *   VM_TARGET  function attribute selecting the ISA, e.g.
+ *              __attribute__((target("avx2,fma"))), or empty
+ * Per-function attributes rather than `#pragma GCC target` so GCC and
+ * Clang build the same set of tables.
+ *
+ * No include guard on purpose.
+ */
+
+#define VM_GLUE_(a, b) a##_##b
+#define VM_GLUE(a, b)  VM_GLUE_(a, b)
+#define VM_FN(name)    VM_GLUE(name, VM_ISA)
+
+#define VD VM_FN(vm_vd)
+#define VI VM_FN(vm_vi)
+#define VU VM_FN(vm_vu)
+
+typedef double   VD __attribute__((vector_size(VM_W * sizeof(double))));
+typedef int64_t  VI __attribute__((vector_size(VM_W * sizeof(int64_t))));
+typedef uint64_t VU __attribute__((vector_size(VM_W * sizeof(uint64_t))));
+
+/* lane-wise m ? a : b on bit masks produced by vector comparisons */
+#define VM_SEL(m, a, b) ((VD)(((VI)(a) & (m)) | ((VI)(b) & ~(m))))
+
+VM_TARGET
+static inline VD VM_FN(vm_exp_v)(VD x)
+{
+    const double shift = 0x1.8p52;
+    VI under = x < -708.0;
+    VI over  = x >  709.0;
+    VI nan   = x != x;
+    x = VM_SEL(under, x * 0.0 - 708.0, x);
+    x = VM_SEL(over,  x * 0.0 + 709.0, x);
+    x = VM_SEL(nan,   x * 0.0, x);
+
+    /* x = k ln2 + r, |r| <= ln2 / 2 */
+    VD kd = x * VM_LOG2E + shift;
+    VI ki = (VI)kd - (VI)(kd * 0.0 + shift);
+    kd = kd - shift;
+    VD r = x - kd * VM_LN2_HI;
+    r = r - kd * VM_LN2_LO;
+
+    /* Taylor to degree 13: truncation < 1e-18 on |r| <= 0.3466 */
+    VD p = r * (1.0 / 6227020800.0) + (1.0 / 479001600.0);
+    p = p * r + (1.0 / 39916800.0);
+    p = p * r + (1.0 / 3628800.0);
+    p = p * r + (1.0 / 362880.0);
+    p = p * r + (1.0 / 40320.0);
+    p = p * r + (1.0 / 5040.0);
+    p = p * r + (1.0 / 720.0);
+    p = p * r + (1.0 / 120.0);
+    p = p * r + (1.0 / 24.0);
+    p = p * r + (1.0 / 6.0);
+    p = p * r + 0.5;
+    p = p * (r * r) + r;
+    p = p + 1.0;
+
+    VD scale = (VD)((ki + 1023) << 52);
+    VD y = p * scale;
+
+    y = VM_SEL(under, y * 0.0, y);
+    y = VM_SEL(over,  y * 0.0 + HUGE_VAL, y);
+    y = VM_SEL(nan,   y * 0.0 + NAN, y);
+    return y;
+}
+
+/* Natural log for positive normal x */
+VM_TARGET
+static inline VD VM_FN(vm_log_v)(VD x)
+{
+    const double two52 = 0x1p52;
+    VU bits = (VU)x;
+
+    /* x = 2^e * m, m in [1, 2) */
+    VU e_biased = bits >> 52;
+    VD m = (VD)((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    VD e = (VD)(e_biased | 0x4330000000000000ULL) - two52 - 1023.0;
+
+    /* fold m into [sqrt(2)/2, sqrt(2)) */
+    VI big = m > VM_SQRT2;
+    m = VM_SEL(big, m * 0.5, m);
+    e = VM_SEL(big, e + 1.0, e);
+
+    /* log(m) = 2 atanh(s), s = (m - 1) / (m + 1), |s| <= 0.1716 */
+    VD f  = m - 1.0;
+    VD s  = f / (m + 1.0);
+    VD s2 = s * s;
+    VD q = s2 * (1.0 / 21.0) + (1.0 / 19.0);
+    q = q * s2 + (1.0 / 17.0);
+    q = q * s2 + (1.0 / 15.0);
+    q = q * s2 + (1.0 / 13.0);
+    q = q * s2 + (1.0 / 11.0);
+    q = q * s2 + (1.0 / 9.0);
+    q = q * s2 + (1.0 / 7.0);
+    q = q * s2 + (1.0 / 5.0);
+    q = q * s2 + (1.0 / 3.0);
+
+    /* fdlibm split: log(1 + f) = f - (f^2/2 - s (f^2/2 + 2 s2 q)), with
+     * e ln2_lo folded into the small terms before the exact f is added
+     * (summing log_m and e ln2 separately loses ~0.2 ulp near x = 0.7) */
+    VD hf = 0.5 * f * f;
+
+    return e * VM_LN2_HI - ((hf - (s * (hf + 2.0 * s2 * q) + e * VM_LN2_LO)) - f);
+}
+
+#define VM_LOAD(dst, src, k)  memcpy(&(dst), (src) + (k), sizeof(VD))
+#define VM_STORE(dst, src, k) memcpy((dst) + (k), &(src), sizeof(VD))
+
+/* Array drivers: full vectors, then one tail vector padded with `pad` */
+#define VM_DRIVER(pad, body)                                        \
+    size_t i = 0;                                                   \
+    for (; i + VM_W <= n; i += VM_W) {                              \
+        VD v; VM_LOAD(v, x, i);                                     \
+        body;                                                       \
+        VM_STORE(y, v, i);                                          \
+    }                                                               \
+    if (i < n) {                                                    \
+        double tx[VM_W], ty[VM_W];                                  \
+        for (size_t t = 0; t < VM_W; t++)                           \
+            tx[t] = (i + t < n) ? x[i + t] : (pad);                 \
+        VD v; memcpy(&v, tx, sizeof(VD));                           \
+        body;                                                       \
+        memcpy(ty, &v, sizeof(VD));                                 \
+        for (size_t t = 0; t < n - i; t++) y[i + t] = ty[t];        \
+    }
+
+VM_TARGET
+static void VM_FN(vm_exp)(const double* x, double* y, size_t n)
+{
+    VM_DRIVER(0.0, v = VM_FN(vm_exp_v)(v))
+}
+
+VM_TARGET
+static void VM_FN(vm_log)(const double* x, double* y, size_t n)
+{
+    VM_DRIVER(1.0, v = VM_FN(vm_log_v)(v))
+}
+
+VM_TARGET
+static void VM_FN(vm_pow)(const double* x, double p, double* y, size_t n)
+{
+    VM_DRIVER(1.0, v = VM_FN(vm_exp_v)(p * VM_FN(vm_log_v)(v)))
+}
+
+/* x^p1 and x^p2 sharing one log */
+VM_TARGET
+static void VM_FN(vm_pow2)(const double* x, double p1, double p2,
+                           double* y1, double* y2, size_t n)
+{
+    size_t i = 0;
+    for (; i + VM_W <= n; i += VM_W) {
+        VD v; VM_LOAD(v, x, i);
+        VD l = VM_FN(vm_log_v)(v);
+        VD r1 = VM_FN(vm_exp_v)(p1 * l);
+        VD r2 = VM_FN(vm_exp_v)(p2 * l);
+        VM_STORE(y1, r1, i);
+        VM_STORE(y2, r2, i);
+    }
+    if (i < n) {
+        double tx[VM_W], t1[VM_W], t2[VM_W];
+        for (size_t t = 0; t < VM_W; t++) tx[t] = (i + t < n) ? x[i + t] : 1.0;
+        VD v; memcpy(&v, tx, sizeof(VD));
+        VD l = VM_FN(vm_log_v)(v);
+        VD r1 = VM_FN(vm_exp_v)(p1 * l);
+        VD r2 = VM_FN(vm_exp_v)(p2 * l);
+        memcpy(t1, &r1, sizeof(VD));
+        memcpy(t2, &r2, sizeof(VD));
+        for (size_t t = 0; t < n - i; t++) { y1[i + t] = t1[t]; y2[i + t] = t2[t]; }
+    }
+}
+
+static const vm_impl VM_FN(vm_table) = {
+        VM_STR(VM_ISA),
+        VM_FN(vm_exp),
+        VM_FN(vm_log),
+        VM_FN(vm_pow),
+        VM_FN(vm_pow2)
+};
+
+/* ---------- float: twice the lanes in the same registers ---------- */
+
+#define VMF_W (2 * VM_W)
+#define VF  VM_FN(vmf_vf)
+#define VFI VM_FN(vmf_vi)
+#define VFU VM_FN(vmf_vu)
+
+typedef float    VF  __attribute__((vector_size(VMF_W * sizeof(float))));
+typedef int32_t  VFI __attribute__((vector_size(VMF_W * sizeof(int32_t))));
+typedef uint32_t VFU __attribute__((vector_size(VMF_W * sizeof(uint32_t))));
+
+#define VMF_SEL(m, a, b) ((VF)(((VFI)(a) & (m)) | ((VFI)(b) & ~(m))))
+
+VM_TARGET
+static inline VF VM_FN(vmf_exp_v)(VF x)
+{
+    const float shift = 0x1.8p23f;
+    VFI under = x < -87.0f;
+    VFI over  = x >  88.0f;
+    VFI nan   = x != x;
+    x = VMF_SEL(under, x * 0.0f - 87.0f, x);
+    x = VMF_SEL(over,  x * 0.0f + 88.0f, x);
+    x = VMF_SEL(nan,   x * 0.0f, x);
+
+    /* x = k ln2 + r, |r| <= ln2 / 2 */
+    VF kd = x * VMF_LOG2E + shift;
+    VFI ki = (VFI)kd - (VFI)(kd * 0.0f + shift);
+    kd = kd - shift;
+    VF r = x - kd * VMF_LN2_HI;
+    r = r - kd * VMF_LN2_LO;
+
+    /* Taylor to degree 7: truncation < 6e-9 on |r| <= 0.3466 */
+    VF p = r * (1.0f / 5040.0f) + (1.0f / 720.0f);
+    p = p * r + (1.0f / 120.0f);
+    p = p * r + (1.0f / 24.0f);
+    p = p * r + (1.0f / 6.0f);
+    p = p * r + 0.5f;
+    p = p * (r * r) + r;
+    p = p + 1.0f;
+
+    VF scale = (VF)((ki + 127) << 23);
+    VF y = p * scale;
+
+    y = VMF_SEL(under, y * 0.0f, y);
+    y = VMF_SEL(over,  y * 0.0f + HUGE_VALF, y);
+    y = VMF_SEL(nan,   y * 0.0f + NAN, y);
+    return y;
+}
+
+/* Natural log for positive normal x */
+VM_TARGET
+static inline VF VM_FN(vmf_log_v)(VF x)
+{
+    VFU bits = (VFU)x;
+
+    /* x = 2^e * m, m in [1, 2) */
+    VFI e_biased = (VFI)(bits >> 23);
+    VF m = (VF)((bits & 0x007fffffU) | 0x3f800000U);
+    VF e = __builtin_convertvector(e_biased, VF) - 127.0f;
+
+    /* fold m into [sqrt(2)/2, sqrt(2)) */
+    VFI big = m > VMF_SQRT2;
+    m = VMF_SEL(big, m * 0.5f, m);
+    e = VMF_SEL(big, e + 1.0f, e);
+
+    /* log(m) = 2 atanh(s), s = (m - 1) / (m + 1), |s| <= 0.1716 */
+    VF f  = m - 1.0f;
+    VF s  = f / (m + 1.0f);
+    VF s2 = s * s;
+    VF q = s2 * (1.0f / 9.0f) + (1.0f / 7.0f);
+    q = q * s2 + (1.0f / 5.0f);
+    q = q * s2 + (1.0f / 3.0f);
+
+    VF hf = 0.5f * f * f;
+
+    return e * VMF_LN2_HI - ((hf - (s * (hf + 2.0f * s2 * q) + e * VMF_LN2_LO)) - f);
+}
+
+#define VMF_DRIVER(pad, body)                                       \
+    size_t i = 0;                                                   \
+    for (; i + VMF_W <= n; i += VMF_W) {                            \
+        VF v; memcpy(&v, x + i, sizeof(VF));                        \
+        body;                                                       \
+        memcpy(y + i, &v, sizeof(VF));                              \
+    }                                                               \
+    if (i < n) {                                                    \
+        float tx[VMF_W], ty[VMF_W];                                 \
+        for (size_t t = 0; t < VMF_W; t++)                          \
+            tx[t] = (i + t < n) ? x[i + t] : (pad);                 \
+        VF v; memcpy(&v, tx, sizeof(VF));                           \
+        body;                                                       \
+        memcpy(ty, &v, sizeof(VF));                                 \
+        for (size_t t = 0; t < n - i; t++) y[i + t] = ty[t];        \
+    }
+
+VM_TARGET
+static void VM_FN(vmf_exp)(const float* x, float* y, size_t n)
+{
+    VMF_DRIVER(0.0f, v = VM_FN(vmf_exp_v)(v))
+}
+
+VM_TARGET
+static void VM_FN(vmf_log)(const float* x, float* y, size_t n)
+{
+    VMF_DRIVER(1.0f, v = VM_FN(vmf_log_v)(v))
+}
+
+VM_TARGET
+static void VM_FN(vmf_pow)(const float* x, float p, float* y, size_t n)
+{
+    VMF_DRIVER(1.0f, v = VM_FN(vmf_exp_v)(p * VM_FN(vmf_log_v)(v)))
+}
+
+VM_TARGET
+static void VM_FN(vmf_pow2)(const float* x, float p1, float p2,
+                            float* y1, float* y2, size_t n)
+{
+    size_t i = 0;
+    for (; i + VMF_W <= n; i += VMF_W) {
+        VF v; memcpy(&v, x + i, sizeof(VF));
+        VF l = VM_FN(vmf_log_v)(v);
+        VF r1 = VM_FN(vmf_exp_v)(p1 * l);
+        VF r2 = VM_FN(vmf_exp_v)(p2 * l);
+        memcpy(y1 + i, &r1, sizeof(VF));
+        memcpy(y2 + i, &r2, sizeof(VF));
+    }
+    if (i < n) {
+        float tx[VMF_W], t1[VMF_W], t2[VMF_W];
+        for (size_t t = 0; t < VMF_W; t++) tx[t] = (i + t < n) ? x[i + t] : 1.0f;
+        VF v; memcpy(&v, tx, sizeof(VF));
+        VF l = VM_FN(vmf_log_v)(v);
+        VF r1 = VM_FN(vmf_exp_v)(p1 * l);
+        VF r2 = VM_FN(vmf_exp_v)(p2 * l);
+        memcpy(t1, &r1, sizeof(VF));
+        memcpy(t2, &r2, sizeof(VF));
+        for (size_t t = 0; t < n - i; t++) { y1[i + t] = t1[t]; y2[i + t] = t2[t]; }
+    }
+}
+
+static const vmf_impl VM_FN(vmf_table) = {
+        VM_STR(VM_ISA),
+        VM_FN(vmf_exp),
+        VM_FN(vmf_log),
+        VM_FN(vmf_pow),
+        VM_FN(vmf_pow2)
+};
+
+#undef VM_LOAD
+#undef VM_STORE
+#undef VM_DRIVER
+#undef VM_SEL
+#undef VMF_DRIVER
+#undef VMF_SEL
+#undef VMF_W
+#undef VF
+#undef VFI
+#undef VFU
+#undef VD
+#undef VI
+#undef VU
+#undef VM_FN
+#undef VM_GLUE
+#undef VM_GLUE_
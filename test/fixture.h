@@ -0,0 +1,85 @@
+/*
+ * Synthetic spectral library shared by the tests: pure water, a0/a1 and
+ * bottom reflectance on a 350 nm + 2.5 nm source grid, and a context
+ * with it loaded and a cache built on wl[i] = 400 + step * i.
+ */
+#ifndef SABER_TEST_FIXTURE_H
+#define SABER_TEST_FIXTURE_H
+
+#include "saber.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define FIX_N_SRC 200
+
+/* Source wavelengths and the water / phytoplankton tables on them */
+static inline void fixture_tables(double* swl, double* aw, double* a0, double* a1)
+{
+    for (size_t i = 0; i < FIX_N_SRC; i++) {
+        swl[i] = 350 + 2.5 * i;
+        aw[i]  = 0.005 + 0.0001 * i * i / 40.0;
+        a0[i]  = 0.7 + 0.3 * sin(i * 0.05);
+        a1[i]  = 0.05 + 0.02 * cos(i * 0.03);
+    }
+}
+
+/* Bottom reflectance of class j at source node i: sand, algae, coral,
+ * seagrass, then further smooth spectra of their own */
+static inline double fixture_r_rs_b(size_t j, size_t i)
+{
+    switch (j) {
+    case 0:  return 0.02 + 0.0005 * i;
+    case 1:  return 0.05 - 0.0001 * i;
+    case 2:  return 0.01 + 0.01 * sin(i * 0.1);
+    case 3:  return 0.03 + 0.02 * cos(i * 0.04);
+    default: return 0.04 + 0.015 * cos(i * 0.01 * (double)j);
+    }
+}
+
+/* Load the fixture tables with bottom reflectance `rb` (FIX_N_SRC rows,
+ * one class per column) into `ctx`, or fixture_r_rs_b() when rb is NULL */
+static inline int fixture_load(saber_ctx* ctx, const char** classes, const double* rb, size_t n_cls)
+{
+    double swl[FIX_N_SRC], aw[FIX_N_SRC], a0[FIX_N_SRC], a1[FIX_N_SRC];
+    fixture_tables(swl, aw, a0, a1);
+
+    double* own = NULL;
+    if (!rb) {
+        own = malloc(sizeof(double) * FIX_N_SRC * (n_cls ? n_cls : 1));
+        if (!own) return 3;
+        for (size_t j = 0; j < n_cls; j++)
+            for (size_t i = 0; i < FIX_N_SRC; i++) own[j * FIX_N_SRC + i] = fixture_r_rs_b(j, i);
+        rb = own;
+    }
+
+    int rc = saber_ctx_load_pure_water(ctx, swl, aw, FIX_N_SRC) ||
+             saber_ctx_load_a0_a1(ctx, swl, a0, a1, FIX_N_SRC) ||
+             saber_ctx_load_r_rs_b(ctx, swl, classes, rb, FIX_N_SRC, n_cls);
+    free(own);
+    return rc;
+}
+
+/* New context with the library loaded (see fixture_load()) and a cache
+ * built on wl[i] = 400 + step * i, i < n_wl; NULL on failure */
+static inline saber_ctx* fixture_ctx_lib(double* wl, size_t n_wl, double step,
+                                         const char** classes, const double* rb, size_t n_cls)
+{
+    for (size_t i = 0; i < n_wl; i++) wl[i] = 400 + step * i;
+
+    saber_ctx* ctx = saber_ctx_create();
+    if (!ctx) return NULL;
+    if (fixture_load(ctx, classes, rb, n_cls) || saber_ctx_build_cache(ctx, wl, n_wl)) {
+        saber_ctx_destroy(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static inline saber_ctx* fixture_ctx(double* wl, size_t n_wl, double step,
+                                     const char** classes, size_t n_cls)
+{
+    return fixture_ctx_lib(wl, n_wl, step, classes, NULL, n_cls);
+}
+
+#endif /* SABER_TEST_FIXTURE_H */
@@ -0,0 +1,319 @@
+/*
+ * ENVI cubes round trip: for BSQ, BIL and BIP, every supported data type,
+ * in host and swapped byte order, tiles written through create and
+ * write_tile (both layouts, all bands and a reordered subset) must read
+ * back through open and read_tile, the file bytes must sit where the
+ * interleave and byte order put them, the header must give back the
+ * wavelengths and band names, and views must appear exactly where
+ * saber_cube_view() documents them. Integer types must saturate and
+ * truncate, and band names the header list cannot hold must be refused.
+ * Prints one line per case and exits non-zero when one fails.
+ */
+#include "saber.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define S       5
+#define L       4
+#define B       3
+#define N_ELEM  (S * L * B)
+#define N_TYPES 7
+
+static const char* path = "test_envi.img";
+static const char* hdr_path = "test_envi.img.hdr";
+
+static const int types[N_TYPES] = {1, 2, 3, 4, 5, 12, 13};
+static const char* il_names[3] = {"bsq", "bil", "bip"};
+static const char* band_names[B] = {"red edge", "nir_1", "B3 (865 nm)"};
+static const double wavelength[B] = {705.25, 783.5, 864.7000000000001};
+
+static int check(const char* what, int ok)
+{
+    printf("  %-44s %s\n", what, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static size_t type_size(int t)
+{
+    return t == 1 ? 1 : t == 2 || t == 12 ? 2 : t == 5 ? 8 : 4;
+}
+
+static int host_big_endian(void)
+{
+    const uint16_t one = 1;
+    return *(const uint8_t*)&one == 0;
+}
+
+/* Value of (line, sample, band), exact in every type: signed types get
+ * negatives, floats a fraction */
+static double value(int type, size_t l, size_t s, size_t b)
+{
+    double v = (double)((l * S + s) * B + b);
+    switch (type) {
+        case 2: case 3: return v - 30.0;
+        case 4: case 5: return 0.25 * v - 7.5;
+        default:        return v;
+    }
+}
+
+/* Element index of (line, sample, band) under an interleave */
+static size_t file_index(saber_interleave il, size_t l, size_t s, size_t b)
+{
+    switch (il) {
+        case SABER_INTERLEAVE_BSQ: return (b * L + l) * S + s;
+        case SABER_INTERLEAVE_BIL: return (l * B + b) * S + s;
+        default:                   return (l * S + s) * B + b;
+    }
+}
+
+/* Decode one element from raw file bytes in the given byte order */
+static double decode(const uint8_t* p, int type, int big_endian)
+{
+    size_t n = type_size(type);
+    uint64_t u = 0;
+    for (size_t i = 0; i < n; i++) u |= (uint64_t)p[big_endian ? i : n - 1 - i] << (8 * (n - 1 - i));
+    switch (type) {
+        case 1:  return (double)u;
+        case 2:  return (double)(int16_t)(uint16_t)u;
+        case 3:  return (double)(int32_t)(uint32_t)u;
+        case 12: return (double)(uint16_t)u;
+        case 13: return (double)(uint32_t)u;
+        case 4:  { uint32_t w = (uint32_t)u; float f;  memcpy(&f, &w, 4); return f; }
+        default: { double d; memcpy(&d, &u, 8); return d; }
+    }
+}
+
+/* Rewrite the header's byte order so the data reads as swapped */
+static int flip_byte_order(void)
+{
+    char text[1024], key[32];
+    FILE* f = fopen(hdr_path, "rb");
+    if (!f) return 1;
+    size_t n = fread(text, 1, sizeof(text) - 1, f);
+    fclose(f);
+    text[n] = '\0';
+
+    snprintf(key, sizeof(key), "byte order = %d", host_big_endian());
+    char* at = strstr(text, key);
+    if (!at) return 1;
+    at[strlen(key) - 1] = host_big_endian() ? '0' : '1';
+
+    f = fopen(hdr_path, "wb");
+    if (!f) return 1;
+    int rc = fwrite(text, 1, n, f) != n;
+    return fclose(f) || rc;
+}
+
+/* A cube of the given type and interleave, swapped or not, with every
+ * element written */
+static saber_cube* write_cube(saber_interleave il, int type, int swapped)
+{
+    saber_cube* c = saber_cube_create(path, S, L, B, il, type, wavelength, band_names);
+    if (c && swapped) {
+        saber_cube_close(c);
+        c = flip_byte_order() ? NULL : saber_cube_open(path, 1);
+    }
+    if (!c) return NULL;
+
+    /* lines 0-1 pixel-major with all bands, 2-3 band-major reordered */
+    double pm[2 * S * B], bm[2 * S * B];
+    const size_t rev[B] = {2, 1, 0};
+    for (size_t l = 0; l < 2; l++)
+        for (size_t s = 0; s < S; s++)
+            for (size_t k = 0; k < B; k++) {
+                pm[(l * S + s) * B + k] = value(type, l, s, k);
+                bm[k * 2 * S + l * S + s] = value(type, 2 + l, s, rev[k]);
+            }
+    if (saber_cube_write_tile(c, 0, 2, NULL, 0, SABER_LAYOUT_PIXEL_MAJOR, pm) ||
+        saber_cube_write_tile(c, 2, 2, rev, B, SABER_LAYOUT_BAND_MAJOR, bm)) {
+        saber_cube_close(c);
+        return NULL;
+    }
+    return c;
+}
+
+/* Header entries and tiles of a reopened cube */
+static int read_back(const saber_cube* c, saber_interleave il, int type)
+{
+    int ok = saber_cube_samples(c) == S && saber_cube_lines(c) == L && saber_cube_bands(c) == B &&
+             saber_cube_interleave(c) == il && saber_cube_data_type(c) == type;
+    const double* wl = saber_cube_wavelength(c);
+    const char* const* names = saber_cube_band_names(c);
+    ok &= wl && names;
+    for (size_t b = 0; b < B && ok; b++)
+        ok &= wl[b] == wavelength[b] && !strcmp(names[b], band_names[b]);
+
+    double pm[N_ELEM], bm[N_ELEM], sub[2 * S * 2];
+    const size_t pick[2] = {2, 0};
+    ok &= !saber_cube_read_tile(c, 0, L, NULL, 0, SABER_LAYOUT_PIXEL_MAJOR, pm) &&
+          !saber_cube_read_tile(c, 0, L, NULL, 0, SABER_LAYOUT_BAND_MAJOR, bm) &&
+          !saber_cube_read_tile(c, 1, 2, pick, 2, SABER_LAYOUT_PIXEL_MAJOR, sub);
+    for (size_t l = 0; l < L && ok; l++)
+        for (size_t s = 0; s < S; s++) {
+            size_t px = l * S + s;
+            for (size_t b = 0; b < B; b++)
+                ok &= pm[px * B + b] == value(type, l, s, b) && bm[b * S * L + px] == value(type, l, s, b);
+            if (l >= 1 && l < 3)
+                for (size_t k = 0; k < 2; k++)
+                    ok &= sub[((l - 1) * S + s) * 2 + k] == value(type, l, s, pick[k]);
+        }
+    return ok;
+}
+
+/* The data file itself, decoded in the byte order the header states */
+static int file_bytes(saber_interleave il, int type, int big_endian)
+{
+    size_t sz = type_size(type);
+    uint8_t raw[N_ELEM * 8];
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+    int ok = fread(raw, 1, N_ELEM * sz + 1, f) == N_ELEM * sz;
+    fclose(f);
+    for (size_t l = 0; l < L && ok; l++)
+        for (size_t s = 0; s < S; s++)
+            for (size_t b = 0; b < B; b++)
+                ok &= decode(raw + file_index(il, l, s, b) * sz, type, big_endian) == value(type, l, s, b);
+    return ok;
+}
+
+/* Views exist for native float64 only, and then just where documented */
+static int views(saber_cube* c, saber_interleave il, int type, int swapped)
+{
+    saber_layout lay = SABER_LAYOUT_PIXEL_MAJOR;
+    int native = type == 5 && !swapped;
+    const double* all = saber_cube_view(c, 0, L, &lay);
+    const double* line = saber_cube_view(c, 1, 1, &lay);
+    const double* lines = saber_cube_view(c, 1, 2, &lay);
+    if (!native) return !all && !line && !lines && !saber_cube_view_rw(c, 0, L, &lay);
+
+    int ok;
+    switch (il) {
+        case SABER_INTERLEAVE_BIP:
+            ok = all && line && lines;
+            ok = ok && saber_cube_view(c, 1, 2, &lay) == lines && lay == SABER_LAYOUT_PIXEL_MAJOR;
+            for (size_t px = 0; px < 2 * S && ok; px++)
+                for (size_t b = 0; b < B; b++)
+                    ok &= lines[px * B + b] == value(type, 1 + px / S, px % S, b);
+            break;
+        case SABER_INTERLEAVE_BIL:
+            ok = !all && line && !lines;
+            ok = ok && saber_cube_view(c, 1, 1, &lay) == line && lay == SABER_LAYOUT_BAND_MAJOR;
+            for (size_t b = 0; b < B && ok; b++)
+                for (size_t s = 0; s < S; s++)
+                    ok &= line[b * S + s] == value(type, 1, s, b);
+            break;
+        default:
+            ok = all && !line && !lines;
+            ok = ok && saber_cube_view(c, 0, L, &lay) == all && lay == SABER_LAYOUT_BAND_MAJOR;
+            for (size_t b = 0; b < B && ok; b++)
+                for (size_t px = 0; px < S * L; px++)
+                    ok &= all[b * S * L + px] == value(type, px / S, px % S, b);
+            break;
+    }
+
+    /* a write through the view reads back at (line0, 0, 0) */
+    size_t line0 = il == SABER_INTERLEAVE_BSQ ? 0 : 1, band0[1] = {0};
+    double* rw = ok ? saber_cube_view_rw(c, line0, il == SABER_INTERLEAVE_BSQ ? L : 1, &lay) : NULL;
+    double got[S];
+    if (!rw) return 0;
+    rw[0] += 1000.0;
+    ok = !saber_cube_read_tile(c, line0, 1, band0, 1, SABER_LAYOUT_PIXEL_MAJOR, got) &&
+         got[0] == value(type, line0, 0, 0) + 1000.0;
+    rw[0] -= 1000.0;
+    return ok;
+}
+
+static int test_round_trips(void)
+{
+    int fail = 0;
+    for (int il = 0; il < 3; il++)
+        for (int swapped = 0; swapped < 2; swapped++) {
+            int cube_ok = 1, read_ok = 1, bytes_ok = 1, view_ok = 1;
+            for (int t = 0; t < N_TYPES; t++) {
+                saber_cube* c = write_cube((saber_interleave)il, types[t], swapped);
+                if (!c) {
+                    cube_ok = 0;
+                    continue;
+                }
+                saber_cube_close(c);
+                c = saber_cube_open(path, 0);
+                if (!c) {
+                    cube_ok = 0;
+                    continue;
+                }
+                read_ok &= read_back(c, (saber_interleave)il, types[t]);
+                bytes_ok &= file_bytes((saber_interleave)il, types[t], host_big_endian() != swapped);
+                saber_cube_close(c);
+
+                c = saber_cube_open(path, 1);
+                view_ok &= c && views(c, (saber_interleave)il, types[t], swapped);
+                saber_cube_close(c);
+            }
+            printf("%s, %s byte order\n", il_names[il], swapped ? "swapped" : "host");
+            fail |= check("create, write_tile, close, open", cube_ok);
+            fail |= check("header entries and read_tile", read_ok);
+            fail |= check("file bytes in interleave and byte order", bytes_ok);
+            fail |= check("views only where documented", view_ok);
+        }
+    return fail;
+}
+
+/* Out-of-range and fractional values into every integer type */
+static int test_saturation(void)
+{
+    static const int ints[5] = {1, 2, 3, 12, 13};
+    static const double lo[5] = {0, INT16_MIN, INT32_MIN, 0, 0};
+    static const double hi[5] = {UINT8_MAX, INT16_MAX, INT32_MAX, UINT16_MAX, UINT32_MAX};
+    const double in[S] = {-1e12, 1e12, -2.7, 2.7, NAN};
+    int ok = 1;
+    for (int t = 0; t < 5 && ok; t++) {
+        saber_cube* c = saber_cube_create(path, S, 1, 1, SABER_INTERLEAVE_BSQ, ints[t], NULL, NULL);
+        double out[S];
+        ok = c && !saber_cube_write_tile(c, 0, 1, NULL, 0, SABER_LAYOUT_PIXEL_MAJOR, in) &&
+             !saber_cube_read_tile(c, 0, 1, NULL, 0, SABER_LAYOUT_PIXEL_MAJOR, out) &&
+             out[0] == lo[t] && out[1] == hi[t] && out[2] == (lo[t] < 0 ? -2.0 : 0.0) &&
+             out[3] == 2.0 && out[4] == 0.0;
+        ok = ok && !saber_cube_wavelength(c) && !saber_cube_band_names(c);
+        saber_cube_close(c);
+    }
+    return check("integers saturate, truncate, NaN -> 0", ok);
+}
+
+/* Names that would split or close the header list are refused before
+ * anything is written */
+static int test_band_names(void)
+{
+    static const char* bad[] = {"a,b", "x}", "{x", "", " pad", "two\nlines"};
+    int ok = 1;
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        const char* names[B] = {"ok", bad[i], "fine"};
+        saber_cube* c = saber_cube_create(path, S, L, B, SABER_INTERLEAVE_BIP, 4, wavelength, names);
+        ok &= !c && access(hdr_path, F_OK) != 0 && access(path, F_OK) != 0;
+        saber_cube_close(c);
+    }
+    int fail = check("unlistable band names refused", ok);
+
+    const char* names[B] = {"ok", NULL, "fine"};
+    fail |= check("missing band name refused",
+                  !saber_cube_create(path, S, L, B, SABER_INTERLEAVE_BIP, 4, NULL, names));
+    return fail;
+}
+
+int main(void)
+{
+    int fail = test_round_trips();
+    fail |= test_saturation();
+    remove(path);
+    remove(hdr_path);
+    fail |= test_band_names();
+    remove(path);
+    remove(hdr_path);
+
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}
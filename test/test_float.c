@@ -0,0 +1,151 @@
+/*
+ * Single- vs double-precision kernels: the *_f entry points must agree with
+ * the double ones to float rounding, in both accuracy tiers and both
+ * batch layouts. Prints the worst relative difference per kernel and exits
+ * non-zero when one exceeds its bound.
+ */
+#include "saber.h"
+#include "fixture.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N_WL    150
+#define N_PIX   64
+
+static double max_rel(const double* ref, const float* got, size_t n, double floor)
+{
+    double worst = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double scale = fabs(ref[i]) > floor ? fabs(ref[i]) : floor;
+        double e = fabs((double)got[i] - ref[i]) / scale;
+        if (e > worst) worst = e;
+    }
+    return worst;
+}
+
+static void to_float(const double* x, float* y, size_t n)
+{
+    for (size_t i = 0; i < n; i++) y[i] = (float)x[i];
+}
+
+static int check(const char* what, double err, double bound)
+{
+    int ok = err <= bound;
+    printf("  %-22s %.3e (bound %.0e) %s\n", what, err, bound, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static int run(saber_ctx* ctx, const double* wl, saber_accuracy acc, double bound)
+{
+    enum { NP = 6, NV = N_PIX * N_WL };
+    const char* pn[NP] = {"chl", "a_g_440", "bb_p_550", "a_nap_440", "a_g_s", "bb_p_gamma"};
+    const char* classes[] = {"sand", "algae", "coral"};
+    static double pv[N_PIX * NP], a[NV], bb[NV], rb[NV], rrs[NV], rb_out[NV], rrs_rt[NV], h_w[N_PIX];
+    static float  pv_f[N_PIX * NP], a_f[NV], bb_f[NV], rb_f[NV], rrs_f[NV], rb_out_f[NV];
+    static float  a_in[NV], bb_in[NV], rb_in[NV], rrs_in[NV];
+    int fail = 0;
+
+    saber_ctx_set_accuracy(ctx, acc);
+    printf("%s\n", acc == SABER_ACCURACY_EXACT ? "EXACT" : "FAST");
+
+    srand(3);
+    for (size_t p = 0; p < N_PIX; p++) {
+        double* v = pv + p * NP;
+        for (int k = 0; k < 4; k++) v[k] = pow(10, -2 + 2.0 * rand() / RAND_MAX);
+        v[4] = 0.01 + 0.01 * rand() / RAND_MAX;
+        v[5] = 1.0 * rand() / RAND_MAX;
+        h_w[p] = 0.5 + 2.5 * rand() / RAND_MAX;
+    }
+    to_float(pv, pv_f, N_PIX * NP);
+
+    /* IOPs: one pixel, then a batch */
+    if (saber_ctx_iop_from_oac(ctx, wl, N_WL, pn, pv, NP, a, bb) ||
+        saber_ctx_iop_from_oac_f(ctx, wl, N_WL, pn, pv_f, NP, a_f, bb_f))
+        return 1;
+    fail |= check("iop a", max_rel(a, a_f, N_WL, 0.0), bound);
+    fail |= check("iop bb", max_rel(bb, bb_f, N_WL, 0.0), bound);
+
+    if (saber_ctx_iop_from_oac_batch(ctx, wl, N_WL, N_PIX, pn, pv, NP,
+                                     SABER_LAYOUT_PIXEL_MAJOR, a, bb) ||
+        saber_ctx_iop_from_oac_batch_f(ctx, wl, N_WL, N_PIX, pn, pv_f, NP,
+                                       SABER_LAYOUT_PIXEL_MAJOR, a_f, bb_f))
+        return 1;
+    fail |= check("iop batch a", max_rel(a, a_f, NV, 0.0), bound);
+    fail |= check("iop batch bb", max_rel(bb, bb_f, NV, 0.0), bound);
+
+    /* Bottom mixtures */
+    for (size_t p = 0; p < N_PIX; p++) {
+        double fr[3] = {0.2 + 0.01 * (p % 7), 0.5, 0.3 - 0.01 * (p % 7)};
+        float  fr_f[3] = {(float)fr[0], (float)fr[1], (float)fr[2]};
+        if (saber_ctx_compute_r_rs_b_lmm(ctx, classes, fr, 3, rb + p * N_WL) ||
+            saber_ctx_compute_r_rs_b_lmm_f(ctx, classes, fr_f, 3, rb_f + p * N_WL))
+            return 1;
+    }
+    fail |= check("lmm", max_rel(rb, rb_f, NV, 0.0), bound);
+
+    /* AM03 on identical (float-representable) inputs, so only the kernel
+     * precision differs */
+    to_float(a, a_in, NV);
+    to_float(bb, bb_in, NV);
+    to_float(rb, rb_in, NV);
+    for (size_t i = 0; i < NV; i++) {
+        a[i] = a_in[i];
+        bb[i] = bb_in[i];
+        rb[i] = rb_in[i];
+    }
+
+    for (int wt = 1; wt <= 2; wt++) {
+        if (saber_ctx_forward_am03_batch(ctx, wl, a, bb, N_WL, N_PIX, wt, 30.0, 10.0, NULL, NULL,
+                                         1, h_w, rb, SABER_LAYOUT_BAND_MAJOR, rrs) ||
+            saber_ctx_forward_am03_batch_f(ctx, wl, a_in, bb_in, N_WL, N_PIX, wt, 30.0, 10.0, NULL, NULL,
+                                           1, h_w, rb_in, SABER_LAYOUT_BAND_MAJOR, rrs_f))
+            return 1;
+        fail |= check(wt == 1 ? "forward type 1" : "forward type 2", max_rel(rrs, rrs_f, NV, 0.0), bound);
+
+        /* The retrieval divides by exp(-Kd h_w), so r_b itself carries
+         * rounding amplified by the water column in either precision.
+         * Check instead that the float r_b reproduces the observation
+         * through the double forward model, band by band. */
+        to_float(rrs, rrs_in, NV);
+        for (size_t i = 0; i < NV; i++) rrs[i] = rrs_in[i];
+        int rc_f = saber_ctx_retrieve_r_rs_b_am03_batch_f(ctx, wl, a_in, bb_in, rrs_in, N_WL, N_PIX, wt,
+                                                          30.0, 10.0, NULL, NULL, h_w,
+                                                          SABER_LAYOUT_BAND_MAJOR, rb_out_f);
+        if (rc_f != 0 && rc_f != 4) return 1;
+
+        for (size_t i = 0; i < NV; i++) rb_out[i] = rb_out_f[i];
+        saber_ctx_forward_am03_batch(ctx, wl, a, bb, N_WL, N_PIX, wt, 30.0, 10.0, NULL, NULL,
+                                     1, h_w, rb_out, SABER_LAYOUT_BAND_MAJOR, rrs_rt);
+        double worst = 0.0;
+        size_t n_solved = 0;
+        for (size_t i = 0; i < NV; i++) {
+            if (rb_out_f[i] == 0.0f) continue;      /* pixel hit the guard */
+            double e = fabs(rrs_rt[i] - rrs[i]) / fabs(rrs[i]);
+            if (e > worst) worst = e;
+            n_solved++;
+        }
+        if (n_solved < NV / 2) return 1;
+        fail |= check(wt == 1 ? "retrieve type 1" : "retrieve type 2", worst, bound);
+    }
+
+    return fail;
+}
+
+int main(void)
+{
+    double wl[N_WL];
+    const char* classes[] = {"sand", "algae", "coral"};
+    saber_ctx* ctx = fixture_ctx(wl, N_WL, 2, classes, 3);
+    if (!ctx) {
+        fprintf(stderr, "context setup failed\n");
+        return 1;
+    }
+
+    int fail = run(ctx, wl, SABER_ACCURACY_EXACT, 1e-5);
+    fail |= run(ctx, wl, SABER_ACCURACY_FAST, 5e-5);
+
+    saber_ctx_destroy(ctx);
+    return fail;
+}
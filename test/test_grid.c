@@ -0,0 +1,155 @@
+/*
+ * Grids against new source tables: reloading the bottom library with a
+ * different class count must drop every cached grid, so the next ensure
+ * builds a new one (new token, all columns, equal bit for bit to a fresh
+ * context's) and everything prepared on the old grids returns 2: tokens,
+ * schemas, unmixers and inversion workspaces. Also after reloading a
+ * context that holds a snapshot. Prints one line per case and exits
+ * non-zero when one fails.
+ */
+#include "saber.h"
+#include "fixture.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define N_WL    60
+#define N_OLD   2
+#define N_NEW   5
+
+static const char* classes[N_NEW] = {"sand", "algae", "coral", "seagrass", "rubble"};
+
+static int check(const char* what, int ok)
+{
+    printf("  %-44s %s\n", what, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+/* Current grid of `got` equals that of `ref`, every table bit for bit */
+static int same_grid(const saber_ctx* ref, const saber_ctx* got)
+{
+    size_t n = saber_ctx_get_n_wl(ref), k = saber_ctx_get_n_class(ref);
+    return saber_ctx_get_n_wl(got) == n && saber_ctx_get_n_class(got) == k &&
+           !memcmp(saber_ctx_get_a_w(ref),    saber_ctx_get_a_w(got),    sizeof(double) * n) &&
+           !memcmp(saber_ctx_get_bb_w(ref),   saber_ctx_get_bb_w(got),   sizeof(double) * n) &&
+           !memcmp(saber_ctx_get_a0(ref),     saber_ctx_get_a0(got),     sizeof(double) * n) &&
+           !memcmp(saber_ctx_get_a1(ref),     saber_ctx_get_a1(got),     sizeof(double) * n) &&
+           !memcmp(saber_ctx_get_r_rs_b(ref), saber_ctx_get_r_rs_b(got), sizeof(double) * n * k);
+}
+
+static int test_reload(const saber_ctx* fresh)
+{
+    double wl[N_WL], wl_b[N_WL / 2];
+    int fail = 0;
+    printf("reload %d -> %d classes\n", N_OLD, N_NEW);
+
+    saber_ctx* ctx = fixture_ctx(wl, N_WL, 4, classes, N_OLD);
+    if (!ctx) return check("context setup", 0);
+
+    /* a spare grid besides the current one */
+    saber_grid_token tok_b = 0, tok_a = 0;
+    for (size_t i = 0; i < N_WL / 2; i++) wl_b[i] = 410 + 8 * i;
+    int rc = saber_ctx_ensure_grid(ctx, wl_b, N_WL / 2, &tok_b);
+    rc |= saber_ctx_ensure_grid(ctx, wl, N_WL, &tok_a);
+    fail |= check("two grids cached", rc == 0 && tok_a && tok_b && tok_a != tok_b);
+
+    saber_inv_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.water_type     = 1;
+    cfg.theta_sun_deg  = 35.0;
+    cfg.theta_view_deg = 12.0;
+    cfg.shallow        = 1;
+    cfg.class_names    = classes;
+    cfg.n_class        = N_OLD;
+
+    saber_schema* s = saber_schema_create(ctx, NULL, 0, classes, N_OLD);
+    saber_unmixer* u = saber_unmixer_create(ctx, NULL, 0);
+    saber_inv_workspace* ws = saber_inv_workspace_create(ctx, &cfg);
+    fail |= check("prepared on the old grid", s && u && ws && saber_unmixer_n_class(u) == N_OLD);
+
+    rc = fixture_load(ctx, classes, NULL, N_NEW);
+    fail |= check("reload", rc == 0 && saber_ctx_get_n_class(ctx) == N_NEW);
+    fail |= check("no grid current until the next build", saber_ctx_grid_token(ctx) == 0);
+
+    double f[N_NEW] = {0.2, 0.2, 0.2, 0.2, 0.2}, r[N_WL];
+    fail |= check("kernels refuse the dropped grid",
+                  saber_ctx_compute_r_rs_b_lmm(ctx, classes, f, N_NEW, r) != 0);
+    fail |= check("old tokens stale",
+                  saber_ctx_select_grid(ctx, tok_a) == 2 && saber_ctx_select_grid(ctx, tok_b) == 2);
+
+    saber_grid_token tok_new = 0;
+    rc = saber_ctx_ensure_grid(ctx, wl, N_WL, &tok_new);
+    fail |= check("ensure rebuilds with a new token",
+                  rc == 0 && tok_new && tok_new != tok_a && tok_new != tok_b);
+    fail |= check("new grid equals a fresh context's", same_grid(fresh, ctx));
+
+    if (s && u && ws) {
+        double x[SABER_INV_N_BASE + N_OLD], jac[(SABER_INV_N_BASE + N_OLD) * N_WL];
+        double y[N_WL], frac[N_OLD];
+        saber_inv_defaults(&cfg, x, NULL, NULL);
+        for (size_t i = 0; i < N_WL; i++) y[i] = r[i] = 0.03;
+        fail |= check("schema stale",
+                      saber_ctx_compute_r_rs_b_lmm_prepared(ctx, s, f, r) == 2);
+        fail |= check("unmixer stale",
+                      saber_ctx_unmix_r_rs_b_batch(ctx, u, 1, y, SABER_LAYOUT_PIXEL_MAJOR,
+                                                   frac, NULL) == 2);
+        fail |= check("workspace stale", saber_inv_model_jacobian(ws, x, r, jac) == 2);
+    }
+    saber_schema_destroy(s);
+    saber_unmixer_destroy(u);
+    saber_inv_workspace_destroy(ws);
+
+    u = saber_unmixer_create(ctx, NULL, 0);
+    fail |= check("new unmixer sees every class", u && saber_unmixer_n_class(u) == N_NEW);
+    saber_unmixer_destroy(u);
+
+    saber_ctx_destroy(ctx);
+    return fail;
+}
+
+/* Same on a context whose grid and class names live in a snapshot */
+static int test_reload_snapshot(const saber_ctx* fresh)
+{
+    static const char* path = "test_grid.snp";
+    double wl[N_WL];
+    int fail = 0;
+    printf("reload over a snapshot\n");
+
+    saber_ctx* src = fixture_ctx(wl, N_WL, 4, classes, N_OLD);
+    saber_ctx* ctx = saber_ctx_create();
+    int rc = src && ctx ? saber_ctx_save_snapshot(src, path) : 3;
+    if (!rc) rc = saber_ctx_load_snapshot(ctx, path);
+    saber_grid_token tok_old = saber_ctx_grid_token(ctx);
+    fail |= check("snapshot loaded", rc == 0 && tok_old);
+
+    if (!rc) {
+        saber_grid_token tok_new = 0;
+        rc = fixture_load(ctx, classes, NULL, N_NEW);
+        if (!rc) rc = saber_ctx_ensure_grid(ctx, wl, N_WL, &tok_new);
+        fail |= check("reload and rebuild", rc == 0 && tok_new != tok_old);
+        fail |= check("new grid equals a fresh context's", same_grid(fresh, ctx));
+        fail |= check("snapshot token stale", saber_ctx_select_grid(ctx, tok_old) == 2);
+    }
+
+    saber_ctx_destroy(src);
+    saber_ctx_destroy(ctx);
+    remove(path);
+    return fail;
+}
+
+int main(void)
+{
+    double wl[N_WL];
+    saber_ctx* fresh = fixture_ctx(wl, N_WL, 4, classes, N_NEW);
+    if (!fresh) {
+        printf("context setup failed\n");
+        return 1;
+    }
+
+    int fail = test_reload(fresh);
+    fail |= test_reload_snapshot(fresh);
+
+    saber_ctx_destroy(fresh);
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}
@@ -0,0 +1,290 @@
+/*
+ * Inversion drivers on synthetic pixels: the population kernel against
+ * saber_inv_evaluate() candidate by candidate; the local fit in deep
+ * water and in shallow water with and without variable projection, which
+ * must recover a noise-free pixel when the fractions are projected out;
+ * and the global drivers (differential evolution with and without
+ * polish, multi-start, and DE under variable projection) from a poor
+ * first guess on a spectrum modelled at known parameters, which the local
+ * fits must recover in deep water. Also the return codes: 3 for an
+ * invalid global config, 2 once another grid is current. Prints one line
+ * per case and exits non-zero when one fails.
+ */
+#include "saber.h"
+#include "fixture.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define N_WL    40
+#define N_CLS   3
+#define N_PAR   (SABER_INV_N_BASE + N_CLS)
+#define N_CAND  13          /* not a whole number of SIMD blocks */
+#define N_POP_PIX 2
+
+static const char* classes[N_CLS] = {"sand", "algae", "coral"};
+
+static int check(const char* what, int ok)
+{
+    printf("  %-44s %s\n", what, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static saber_inv_config make_cfg(int wt, int shallow)
+{
+    saber_inv_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.water_type     = wt;
+    cfg.theta_sun_deg  = 35.0;
+    cfg.theta_view_deg = 12.0;
+    cfg.shallow        = shallow;
+    cfg.class_names    = classes;
+    cfg.n_class        = N_CLS;
+    return cfg;
+}
+
+/* Parameters the synthetic pixels are modelled at */
+static void true_x(const saber_inv_config* cfg, double* x)
+{
+    saber_inv_defaults(cfg, x, NULL, NULL);
+    x[SABER_INV_CHL]       = 2.0;
+    x[SABER_INV_A_G_440]   = 0.05;
+    x[SABER_INV_A_NAP_440] = 0.02;
+    x[SABER_INV_BB_P_550]  = 0.008;
+    if (cfg->shallow) {
+        x[SABER_INV_H_W] = 3.0;
+        x[SABER_INV_N_BASE + 0] = 0.6;
+        x[SABER_INV_N_BASE + 1] = 0.3;
+        x[SABER_INV_N_BASE + 2] = 0.1;
+    }
+}
+
+static double cost_of(const double* model, const double* obs, const double* w)
+{
+    double c = 0.0;
+    for (size_t i = 0; i < N_WL; i++) {
+        double r = model[i] - obs[i];
+        c += (w ? w[i] : 1.0) * r * r;
+    }
+    return 0.5 * c;
+}
+
+/* Largest relative error of the parameters against the truth */
+static double x_err(const double* x, const double* xt, size_t n_par)
+{
+    double worst = 0.0;
+    for (size_t k = 0; k < n_par; k++)
+        worst = fmax(worst, fabs(x[k] - xt[k]) / fabs(xt[k]));
+    return worst;
+}
+
+/* saber_inv_eval_population() against saber_inv_evaluate() per candidate:
+ * costs and, optionally, the modelled spectra */
+static int test_population(const saber_ctx* ctx)
+{
+    saber_inv_config cfg = make_cfg(2, 1);
+    double lo[N_PAR], hi[N_PAR], xt[N_PAR], w[N_WL];
+    double x[N_POP_PIX * N_CAND * N_PAR], obs[N_POP_PIX * N_WL];
+    double cost[N_POP_PIX * N_CAND], rrs[N_POP_PIX * N_CAND * N_WL], model[N_WL];
+    double jac[N_PAR * N_WL];
+    size_t n_par = saber_inv_n_param(&cfg);
+    saber_inv_defaults(&cfg, xt, lo, hi);
+    true_x(&cfg, xt);
+    for (size_t i = 0; i < N_WL; i++) w[i] = 0.5 + (double)(i % 3);
+
+    saber_inv_workspace* ws = saber_inv_workspace_create(ctx, &cfg);
+    saber_inv_evaluator* ev = saber_inv_evaluator_create(ctx, &cfg);
+    int rc = ws && ev ? 0 : 3;
+    for (size_t p = 0; p < N_POP_PIX && !rc; p++) {
+        rc = saber_inv_model_jacobian(ws, xt, obs + p * N_WL, jac);
+        for (size_t i = 0; i < N_WL; i++) obs[p * N_WL + i] *= 1.0 + 0.02 * sin(0.5 * i + p);
+        /* candidates spread geometrically inside the bounds, fractions linearly */
+        for (size_t c = 0; c < N_CAND; c++)
+            for (size_t k = 0; k < n_par; k++) {
+                double t = fmod(0.37 * (double)(c + 1) * (double)(k + 2) + 0.11 * (double)p, 1.0);
+                x[(p * N_CAND + c) * n_par + k] = k < SABER_INV_N_BASE && lo[k] > 0
+                    ? lo[k] * pow(hi[k] / lo[k], t) : lo[k] + (hi[k] - lo[k]) * t;
+            }
+    }
+    if (!rc) rc = saber_inv_eval_population(ws, N_POP_PIX, N_CAND, x, obs, w, cost, rrs);
+
+    double worst_cost = 0.0, worst_rrs = 0.0;
+    for (size_t c = 0; c < N_POP_PIX * N_CAND && !rc; c++) {
+        rc = saber_inv_evaluate(ev, x + c * n_par, model);
+        double ref = cost_of(model, obs + (c / N_CAND) * N_WL, w);
+        worst_cost = fmax(worst_cost, fabs(cost[c] - ref) / ref);
+        for (size_t i = 0; i < N_WL; i++)
+            worst_rrs = fmax(worst_rrs, fabs(rrs[c * N_WL + i] - model[i]) / fabs(model[i]));
+    }
+
+    /* without rrs_out the costs are the same */
+    double cost2[N_POP_PIX * N_CAND];
+    if (!rc) rc = saber_inv_eval_population(ws, N_POP_PIX, N_CAND, x, obs, w, cost2, NULL);
+
+    printf("population: %d x %d candidates, cost %.1e, rrs %.1e\n", N_POP_PIX, N_CAND,
+           worst_cost, worst_rrs);
+    int fail = check("costs as saber_inv_evaluate()", !rc && worst_cost <= 1e-12);
+    fail |= check("spectra as saber_inv_evaluate()", !rc && worst_rrs <= 1e-12);
+    fail |= check("costs alike without spectra", !rc && !memcmp(cost, cost2, sizeof(cost)));
+    saber_inv_evaluator_destroy(ev);
+    saber_inv_workspace_destroy(ws);
+    return fail;
+}
+
+/* Cost of x_out recomputed, to hold the report to it */
+static double cost_at(saber_inv_workspace* ws, const double* x, const double* obs)
+{
+    double c = HUGE_VAL;
+    return saber_inv_eval_population(ws, 1, 1, x, obs, NULL, &c, NULL) ? HUGE_VAL : c;
+}
+
+/* saber_invert_pixel() from a first guess near the truth on a
+ * noise-free pixel */
+static int test_local(const saber_ctx* ctx, const char* name, const saber_inv_config* cfg_in)
+{
+    saber_inv_config cfg = *cfg_in;
+    double xt[N_PAR], x0[N_PAR], x[N_PAR], obs[N_WL], jac[N_PAR * N_WL];
+    size_t n_par = saber_inv_n_param(&cfg);
+    true_x(&cfg, xt);
+    saber_inv_defaults(&cfg, x0, NULL, NULL);
+    x0[SABER_INV_CHL]      = 1.0;
+    x0[SABER_INV_BB_P_550] = 0.005;
+    if (cfg.shallow) x0[SABER_INV_H_W] = 2.0;
+
+    saber_inv_report r;
+    saber_inv_workspace* ws = saber_inv_workspace_create(ctx, &cfg);
+    int rc = ws ? saber_inv_model_jacobian(ws, xt, obs, jac) : 3;
+    if (!rc) rc = saber_invert_pixel(ws, obs, NULL, x0, x, &r);
+
+    double err = rc ? HUGE_VAL : x_err(x, xt, n_par);
+    double c = rc ? HUGE_VAL : cost_at(ws, x, obs);
+    printf("%s: status %d, %d iterations, cost %.2e -> %.2e, chl %.4f, x %.1e\n",
+           name, r.status, r.iterations, r.cost_initial, r.cost_final, x[SABER_INV_CHL], err);
+    int fail = check("ran", !rc);
+    fail |= check("report cost is that of x_out", !rc && fabs(r.cost_final - c) <= 1e-12 * c + 1e-30);
+    if (cfg.shallow && cfg.varpro == SABER_INV_VARPRO_OFF)
+        /* depth and fractions trade off along a shallow valley the full
+         * fit crawls down: it may run out of iterations short of the
+         * truth (chl 2.07 here), so only the cost is held */
+        fail |= check("lowers the cost a millionfold",
+                      !rc && r.cost_final <= 1e-6 * r.cost_initial && r.status <= SABER_INV_MAX_ITER);
+    else
+        fail |= check("recovers the pixel",
+                      !rc && err <= 1e-8 && r.status <= SABER_INV_CONVERGED_GRAD);
+    saber_inv_workspace_destroy(ws);
+    return fail;
+}
+
+/* One global driver from a poor first guess on a noise-free pixel */
+static int test_global(const saber_ctx* ctx, const char* name, const saber_inv_config* cfg_in,
+                       int method, int polish)
+{
+    saber_inv_config cfg = *cfg_in;
+    double xt[N_PAR], x0[N_PAR], x[N_PAR], x2[N_PAR], obs[N_WL], jac[N_PAR * N_WL];
+    size_t n_par = saber_inv_n_param(&cfg);
+    true_x(&cfg, xt);
+    saber_inv_defaults(&cfg, x0, NULL, NULL);
+    x0[SABER_INV_CHL]      = 30.0;
+    x0[SABER_INV_BB_P_550] = 0.05;
+
+    saber_global_config g;
+    memset(&g, 0, sizeof(g));
+    g.method = method;
+    g.polish = polish;
+
+    saber_inv_report r, r2;
+    saber_inv_workspace* ws = saber_inv_workspace_create(ctx, &cfg);
+    int rc = ws ? saber_inv_model_jacobian(ws, xt, obs, jac) : 3;
+    double c0 = ws ? cost_at(ws, x0, obs) : HUGE_VAL;
+    if (!rc) rc = saber_invert_pixel_global(ws, obs, NULL, &g, x0, x, &r);
+    if (!rc) rc = saber_invert_pixel_global(ws, obs, NULL, &g, x0, x2, &r2);
+
+    double err = rc ? HUGE_VAL : x_err(x, xt, n_par);
+    double c = rc ? HUGE_VAL : cost_at(ws, x, obs);
+    printf("%s: status %d, %d iterations, %d evaluations, cost %.2e -> %.2e, x %.1e\n",
+           name, r.status, r.iterations, r.n_eval, r.cost_initial, r.cost_final, err);
+    int fail = check("ran", !rc);
+    /* x0 goes through the search coordinates and back: a rounding off */
+    fail |= check("x0 in the initial population", !rc && r.cost_initial <= c0 * (1.0 + 1e-9));
+    fail |= check("report cost is that of x_out", !rc && fabs(r.cost_final - c) <= 1e-12 * c + 1e-30);
+    if (method == SABER_GLOBAL_DE && !polish)
+        /* deep: 40 members (10 per free parameter), one population per generation */
+        fail |= check("lowers the cost, 40 per generation",
+                      !rc && r.cost_final < 0.1 * r.cost_initial && r.n_eval == 40 * (r.iterations + 1) &&
+                      (r.status == SABER_INV_CONVERGED_COST || r.status == SABER_INV_MAX_ITER));
+    else if (cfg.shallow)
+        /* a shallow bottom under dense water fits the fixture nearly as
+         * well as the truth: only the cost is held */
+        fail |= check("lowers the cost a hundredfold", !rc && r.cost_final < 0.01 * r.cost_initial);
+    else
+        fail |= check("recovers the pixel", !rc && err <= 1e-4 && r.status != SABER_INV_MAX_ITER);
+    fail |= check("same seed, same fit",
+                  !rc && !memcmp(x, x2, sizeof(double) * n_par) && r.n_eval == r2.n_eval);
+    saber_inv_workspace_destroy(ws);
+    return fail;
+}
+
+static int test_global_codes(saber_ctx* ctx)
+{
+    saber_inv_config cfg = make_cfg(2, 0);
+    double x0[N_PAR], x[N_PAR], obs[N_WL], jac[N_PAR * N_WL], wl_b[N_WL / 2];
+    saber_inv_defaults(&cfg, x0, NULL, NULL);
+
+    saber_global_config g;
+    memset(&g, 0, sizeof(g));
+    saber_inv_workspace* ws = saber_inv_workspace_create(ctx, &cfg);
+    int rc = ws ? saber_inv_model_jacobian(ws, x0, obs, jac) : 3;
+    printf("return codes\n");
+
+    g.method = 7;
+    int fail = check("unknown method: 3", !rc && saber_invert_pixel_global(ws, obs, NULL, &g, x0, x, NULL) == 3);
+    g.method = SABER_GLOBAL_DE;
+    g.population = 3;
+    fail |= check("DE population of 3: 3", !rc && saber_invert_pixel_global(ws, obs, NULL, &g, x0, x, NULL) == 3);
+    g.population = 0;
+
+    saber_grid_token tok = saber_ctx_grid_token(ctx), tok_b = 0;
+    for (size_t i = 0; i < N_WL / 2; i++) wl_b[i] = 410 + 8 * i;
+    if (!rc) rc = saber_ctx_ensure_grid(ctx, wl_b, N_WL / 2, &tok_b);
+    double cost;
+    fail |= check("another grid current: 2",
+                  !rc && saber_invert_pixel(ws, obs, NULL, x0, x, NULL) == 2 &&
+                  saber_invert_pixel_global(ws, obs, NULL, &g, x0, x, NULL) == 2 &&
+                  saber_inv_eval_population(ws, 1, 1, x0, obs, NULL, &cost, NULL) == 2);
+    rc = saber_ctx_select_grid(ctx, tok);
+    fail |= check("its own grid again: 0",
+                  !rc && saber_invert_pixel(ws, obs, NULL, x0, x, NULL) == 0 &&
+                  saber_inv_eval_population(ws, 1, 1, x0, obs, NULL, &cost, NULL) == 0);
+    saber_inv_workspace_destroy(ws);
+    return fail;
+}
+
+int main(void)
+{
+    double wl[N_WL];
+    saber_ctx* ctx = fixture_ctx(wl, N_WL, 8, classes, N_CLS);
+    if (!ctx) {
+        printf("context setup failed\n");
+        return 1;
+    }
+
+    int fail = test_population(ctx);
+    saber_inv_config deep = make_cfg(2, 0), shallow = make_cfg(2, 1), nnls = make_cfg(2, 1);
+    saber_inv_config varpro = make_cfg(2, 1);
+    nnls.varpro   = SABER_INV_VARPRO_NNLS;
+    varpro.varpro = SABER_INV_VARPRO_SUM_TO_ONE;
+    fail |= test_local(ctx, "LM", &deep);
+    fail |= test_local(ctx, "LM, shallow", &shallow);
+    fail |= test_local(ctx, "LM, shallow with NNLS varpro", &nnls);
+    fail |= test_local(ctx, "LM, shallow with varpro", &varpro);
+    fail |= test_global(ctx, "DE", &deep, SABER_GLOBAL_DE, 0);
+    fail |= test_global(ctx, "DE + polish", &deep, SABER_GLOBAL_DE, 1);
+    fail |= test_global(ctx, "multi-start", &deep, SABER_GLOBAL_MULTISTART, 0);
+    fail |= test_global(ctx, "DE + polish, shallow with varpro", &varpro, SABER_GLOBAL_DE, 1);
+    fail |= test_global_codes(ctx);
+
+    saber_ctx_destroy(ctx);
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}
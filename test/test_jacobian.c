@@ -0,0 +1,421 @@
+/*
+ * Analytic Jacobians against central differences of the value they come
+ * with: the *_jac entry points, saber_inv_model_jacobian() and the misfit
+ * gradients of every metric (plain, and weighted with bands masked out),
+ * in both accuracy tiers, both water types, deep and shallow. Prints the
+ * worst error per kernel, relative to the largest derivative of its row,
+ * and exits non-zero when one exceeds the bound. Batched misfits are also
+ * checked against the forward model and the residual formed here, and
+ * their gradients against the single-spectrum entry point, band-major.
+ */
+#include "saber.h"
+#include "fixture.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define N_WL    60
+#define N_CLS   3
+#define BOUND   1e-6
+#define N_PIX   7
+
+static const char* classes[N_CLS] = {"sand", "algae", "coral"};
+
+/* Step for parameter value v */
+static double step(double v)
+{
+    return 1e-6 * fmax(fabs(v), 1e-3);
+}
+
+/* Worst |fd - jac| of one row, scaled by the row's largest |jac| */
+static double row_err(const double* jac, const double* plus, const double* minus,
+                      double h, size_t n)
+{
+    double scale = 1e-300, worst = 0.0;
+    for (size_t i = 0; i < n; i++) scale = fmax(scale, fabs(jac[i]));
+    for (size_t i = 0; i < n; i++) {
+        double fd = (plus[i] - minus[i]) / (2.0 * h);
+        worst = fmax(worst, fabs(fd - jac[i]) / scale);
+    }
+    return worst;
+}
+
+/* Same for a gradient against its finite differences fd */
+static double grad_err(const double* g, const double* fd, size_t n)
+{
+    double scale = 1e-300, worst = 0.0;
+    for (size_t i = 0; i < n; i++) scale = fmax(scale, fabs(g[i]));
+    for (size_t i = 0; i < n; i++) worst = fmax(worst, fabs(fd[i] - g[i]) / scale);
+    return worst;
+}
+
+static int check_bound(const char* what, int rc, double err, double bound)
+{
+    int ok = rc == 0 && err <= bound;
+    if (rc) printf("  %-32s rc %d FAIL\n", what, rc);
+    else    printf("  %-32s %.3e (bound %.0e) %s\n", what, err, bound, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static int check(const char* what, int rc, double err)
+{
+    return check_bound(what, rc, err, BOUND);
+}
+
+static int test_iop(const saber_ctx* ctx, const double* wl)
+{
+    enum { NP = 7 };
+    const char* pn[NP] = {"chl", "a_g_440", "a_nap_440", "bb_p_550",
+                          "a_g_s", "a_nap_s", "bb_p_gamma"};
+    double pv[NP] = {2.5, 0.05, 0.02, 0.008, 0.015, 0.011, 0.6};
+    double a[N_WL], bb[N_WL], da[NP * N_WL], dbb[NP * N_WL];
+    double ap[N_WL], bbp[N_WL], am[N_WL], bbm[N_WL], scratch[2 * NP * N_WL];
+
+    int rc = saber_ctx_iop_from_oac_jac(ctx, wl, N_WL, pn, pv, NP, a, bb, da, dbb);
+    double worst = 0.0;
+    for (size_t k = 0; k < NP && !rc; k++) {
+        double v = pv[k], h = step(v);
+        pv[k] = v + h;
+        rc |= saber_ctx_iop_from_oac_jac(ctx, wl, N_WL, pn, pv, NP, ap, bbp,
+                                         scratch, scratch + NP * N_WL);
+        pv[k] = v - h;
+        rc |= saber_ctx_iop_from_oac_jac(ctx, wl, N_WL, pn, pv, NP, am, bbm,
+                                         scratch, scratch + NP * N_WL);
+        pv[k] = v;
+        worst = fmax(worst, row_err(da + k * N_WL, ap, am, h, N_WL));
+        worst = fmax(worst, row_err(dbb + k * N_WL, bbp, bbm, h, N_WL));
+    }
+    return check("iop_from_oac_jac", rc, worst);
+}
+
+static int test_mixing(const saber_ctx* ctx)
+{
+    double f[N_CLS] = {0.5, 0.3, 0.2};
+    double r[N_WL], d[N_CLS * N_WL], rp[N_WL], rm[N_WL], scratch[N_CLS * N_WL];
+
+    int rc = saber_ctx_compute_r_rs_b_lmm_jac(ctx, classes, f, N_CLS, r, d);
+    double worst = 0.0;
+    for (size_t k = 0; k < N_CLS && !rc; k++) {
+        double v = f[k], h = step(v);
+        f[k] = v + h;
+        rc |= saber_ctx_compute_r_rs_b_lmm_jac(ctx, classes, f, N_CLS, rp, scratch);
+        f[k] = v - h;
+        rc |= saber_ctx_compute_r_rs_b_lmm_jac(ctx, classes, f, N_CLS, rm, scratch);
+        f[k] = v;
+        worst = fmax(worst, row_err(d + k * N_WL, rp, rm, h, N_WL));
+    }
+    return check("compute_r_rs_b_lmm_jac", rc, worst);
+}
+
+/* Per-band derivatives are diagonal: shifting every band at once and
+ * reading band i back gives dRrs_i / dv_i */
+static int forward(const saber_ctx* ctx, const double* wl, const double* a, const double* bb,
+                   int wt, int shallow, double h_w, const double* r_b, double* rrs,
+                   double* d_da, double* d_dbb, double* d_dh_w, double* d_dr_b)
+{
+    return saber_ctx_forward_am03_jac(ctx, wl, a, bb, N_WL, wt, 35.0, 12.0, shallow, h_w, r_b,
+                                      rrs, d_da, d_dbb, d_dh_w, d_dr_b);
+}
+
+static int test_forward(const saber_ctx* ctx, const double* wl, int wt, int shallow)
+{
+    double a[N_WL], bb[N_WL], r_b[N_WL], h_w = 3.2;
+    double rrs[N_WL], d_da[N_WL], d_dbb[N_WL], d_dh_w[N_WL], d_dr_b[N_WL];
+    double rp[N_WL], rm[N_WL], v[N_WL];
+    for (size_t i = 0; i < N_WL; i++) {
+        a[i]   = 0.05 + 0.4 * i / N_WL;
+        bb[i]  = 0.01 - 0.004 * i / N_WL;
+        r_b[i] = 0.03 + 0.02 * sin(i * 0.2);
+    }
+
+    int rc = forward(ctx, wl, a, bb, wt, shallow, h_w, r_b, rrs, d_da, d_dbb,
+                     shallow ? d_dh_w : NULL, shallow ? d_dr_b : NULL);
+    double worst = 0.0;
+    double* vecs[3] = {a, bb, r_b};
+    double* jacs[3] = {d_da, d_dbb, d_dr_b};
+    for (int q = 0; q < (shallow ? 3 : 2) && !rc; q++) {
+        double* x = vecs[q];
+        memcpy(v, x, sizeof(v));
+        double h = step(0.01);
+        for (size_t i = 0; i < N_WL; i++) x[i] = v[i] + h;
+        rc |= forward(ctx, wl, a, bb, wt, shallow, h_w, r_b, rp, NULL, NULL, NULL, NULL);
+        for (size_t i = 0; i < N_WL; i++) x[i] = v[i] - h;
+        rc |= forward(ctx, wl, a, bb, wt, shallow, h_w, r_b, rm, NULL, NULL, NULL, NULL);
+        memcpy(x, v, sizeof(v));
+        worst = fmax(worst, row_err(jacs[q], rp, rm, h, N_WL));
+    }
+    if (shallow && !rc) {
+        double h = step(h_w);
+        rc |= forward(ctx, wl, a, bb, wt, shallow, h_w + h, r_b, rp, NULL, NULL, NULL, NULL);
+        rc |= forward(ctx, wl, a, bb, wt, shallow, h_w - h, r_b, rm, NULL, NULL, NULL, NULL);
+        worst = fmax(worst, row_err(d_dh_w, rp, rm, h, N_WL));
+    }
+
+    char what[64];
+    snprintf(what, sizeof(what), "forward_am03_jac wt %d %s", wt, shallow ? "shallow" : "deep");
+    return check(what, rc, worst);
+}
+
+static int test_inversion(const saber_ctx* ctx, int wt, int shallow)
+{
+    saber_inv_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.water_type     = wt;
+    cfg.theta_sun_deg  = 35.0;
+    cfg.theta_view_deg = 12.0;
+    cfg.shallow        = shallow;
+    cfg.class_names    = classes;
+    cfg.n_class        = N_CLS;
+
+    enum { NP_MAX = SABER_INV_N_BASE + N_CLS };
+    double x[NP_MAX], rrs[N_WL], jac[NP_MAX * N_WL];
+    double rp[N_WL], rm[N_WL], scratch[NP_MAX * N_WL];
+    size_t n_par = saber_inv_n_param(&cfg);
+    saber_inv_defaults(&cfg, x, NULL, NULL);
+    x[SABER_INV_CHL]       = 2.5;
+    x[SABER_INV_A_G_440]   = 0.05;
+    x[SABER_INV_A_NAP_440] = 0.02;
+    x[SABER_INV_BB_P_550]  = 0.008;
+    if (shallow) {
+        x[SABER_INV_H_W] = 3.2;
+        x[SABER_INV_N_BASE + 0] = 0.6;
+        x[SABER_INV_N_BASE + 1] = 0.3;
+        x[SABER_INV_N_BASE + 2] = 0.1;
+    }
+
+    saber_inv_workspace* ws = saber_inv_workspace_create(ctx, &cfg);
+    int rc = ws ? saber_inv_model_jacobian(ws, x, rrs, jac) : 3;
+    double worst = 0.0;
+    for (size_t k = 0; k < n_par && !rc; k++) {
+        if (!shallow && k == SABER_INV_H_W) continue;
+        double v = x[k], h = step(v);
+        x[k] = v + h;
+        rc |= saber_inv_model_jacobian(ws, x, rp, scratch);
+        x[k] = v - h;
+        rc |= saber_inv_model_jacobian(ws, x, rm, scratch);
+        x[k] = v;
+        worst = fmax(worst, row_err(jac + k * N_WL, rp, rm, h, N_WL));
+    }
+    saber_inv_workspace_destroy(ws);
+
+    char what[64];
+    snprintf(what, sizeof(what), "inv_model_jacobian wt %d %s", wt, shallow ? "shallow" : "deep");
+    return check(what, rc, worst);
+}
+
+static const char* metric_names[3] = {"SSE", "ANGLE", "LOG"};
+
+/* Step for a misfit, one value summed over every band: longer than
+ * step(), so that its differences stand above the rounding of the sum */
+static double misfit_step(double v)
+{
+    return 10.0 * step(v);
+}
+
+/* Water column, bottom and an observation the model does not fit, in
+ * level or in shape: modelled with a rippled a, 0.9 bb and a deeper
+ * bottom */
+static void misfit_inputs(size_t px, int wt, int shallow, double* a, double* bb, double* r_b,
+                          double* h_w, double* obs, const saber_ctx* ctx, const double* wl)
+{
+    double ao[N_WL], bbo[N_WL];
+    for (size_t i = 0; i < N_WL; i++) {
+        a[i]   = 0.05 + 0.4 * i / N_WL + 0.01 * px;
+        bb[i]  = 0.01 - 0.004 * i / N_WL + 0.0005 * px;
+        r_b[i] = 0.03 + 0.02 * sin(i * 0.2 + px);
+        ao[i]  = (1.15 + 0.2 * sin(i * 0.3)) * a[i];
+        bbo[i] = 0.9 * bb[i];
+    }
+    *h_w = 3.2 + 0.4 * px;
+    saber_ctx_forward_am03(ctx, wl, ao, bbo, N_WL, wt, 35.0 + px, 12.0, shallow, 1.1 * *h_w,
+                           r_b, obs);
+}
+
+/* Per-band weights, every seventh band masked out */
+static void misfit_weights(saber_misfit* mf, double* w, unsigned char* mask)
+{
+    for (size_t i = 0; i < N_WL; i++) {
+        w[i]    = 0.5 + (double)(i % 3);
+        mask[i] = i % 7 != 3;
+    }
+    mf->weights = w;
+    mf->mask    = mask;
+}
+
+/* The misfit of modelled r against obs, formed from its definition */
+static double misfit_ref(const saber_misfit* mf, const double* r, const double* obs, size_t n,
+                         size_t stride)
+{
+    double fl = mf->log_floor > 0 ? mf->log_floor : 1e-6;
+    double sse = 0.0, ro = 0.0, rr = 0.0, oo = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double w = mf->weights ? mf->weights[i] : 1.0;
+        if (mf->mask && !mf->mask[i]) w = 0.0;
+        double ri = r[i * stride], oi = obs[i * stride];
+        double d = mf->metric == SABER_MISFIT_LOG ? log(fmax(ri, fl)) - log(fmax(oi, fl)) : ri - oi;
+        sse += w * d * d;
+        ro += w * ri * oi;
+        rr += w * ri * ri;
+        oo += w * oi * oi;
+    }
+    return mf->metric == SABER_MISFIT_ANGLE ? acos(fmin(ro / sqrt(rr * oo), 1.0)) : 0.5 * sse;
+}
+
+/* Gradients of saber_ctx_misfit_am03_planned() against central
+ * differences of its cost, band by band, in a, bb, r_b and h_w */
+static int test_misfit(const saber_ctx* ctx, const double* wl, int metric, int shallow)
+{
+    double a[N_WL], bb[N_WL], r_b[N_WL], h_w, obs[N_WL], w[N_WL];
+    double g[3][N_WL], g_h_w, fd[N_WL], cp, cm;
+    unsigned char mask[N_WL];
+    double worst = 0.0;
+    int rc = 0;
+
+    for (int wt = 1; wt <= 2 && !rc; wt++)
+        for (int weighted = 0; weighted <= 1 && !rc; weighted++) {
+            saber_misfit mf;
+            memset(&mf, 0, sizeof(mf));
+            mf.metric = metric;
+            if (weighted) misfit_weights(&mf, w, mask);
+            misfit_inputs(0, wt, shallow, a, bb, r_b, &h_w, obs, ctx, wl);
+
+            saber_am03_plan* plan = saber_am03_plan_create(wt, shallow, 35.0, 12.0);
+            double cost;
+            rc = plan ? saber_ctx_misfit_am03_planned(ctx, plan, &mf, a, bb, N_WL, h_w, r_b, obs,
+                                                      &cost, g[0], g[1],
+                                                      shallow ? &g_h_w : NULL,
+                                                      shallow ? g[2] : NULL) : 3;
+            double* vecs[3] = {a, bb, r_b};
+            for (int q = 0; q < (shallow ? 3 : 2) && !rc; q++) {
+                double* x = vecs[q];
+                for (size_t i = 0; i < N_WL; i++) {
+                    double v = x[i], h = misfit_step(v);
+                    x[i] = v + h;
+                    rc |= saber_ctx_misfit_am03_planned(ctx, plan, &mf, a, bb, N_WL, h_w, r_b,
+                                                        obs, &cp, NULL, NULL, NULL, NULL);
+                    x[i] = v - h;
+                    rc |= saber_ctx_misfit_am03_planned(ctx, plan, &mf, a, bb, N_WL, h_w, r_b,
+                                                        obs, &cm, NULL, NULL, NULL, NULL);
+                    x[i] = v;
+                    fd[i] = (cp - cm) / (2.0 * h);
+                }
+                worst = fmax(worst, grad_err(g[q], fd, N_WL));
+            }
+            if (shallow && !rc) {
+                double h = misfit_step(h_w);
+                rc |= saber_ctx_misfit_am03_planned(ctx, plan, &mf, a, bb, N_WL, h_w + h, r_b,
+                                                    obs, &cp, NULL, NULL, NULL, NULL);
+                rc |= saber_ctx_misfit_am03_planned(ctx, plan, &mf, a, bb, N_WL, h_w - h, r_b,
+                                                    obs, &cm, NULL, NULL, NULL, NULL);
+                fd[0] = (cp - cm) / (2.0 * h);
+                worst = fmax(worst, grad_err(&g_h_w, fd, 1));
+            }
+            saber_am03_plan_destroy(plan);
+        }
+
+    char what[64];
+    snprintf(what, sizeof(what), "misfit_am03 %s %s", metric_names[metric],
+             shallow ? "shallow" : "deep");
+    return check(what, rc, worst);
+}
+
+/* saber_ctx_misfit_am03_batch(), band-major with per-pixel sun angles and
+ * bands masked out, against forward_am03_batch() and misfit_ref(), and its
+ * gradients against the planned entry point pixel by pixel */
+static int test_misfit_batch(const saber_ctx* ctx, const double* wl, int metric)
+{
+    enum { N = N_PIX * N_WL };
+    double a[N], bb[N], r_b[N], obs[N], rrs[N], h_w[N_PIX], sun[N_PIX];
+    double cost[N_PIX], g_a[N], g_bb[N], g_r_b[N], g_h_w[N_PIX];
+    double pa[N_WL], pbb[N_WL], pr_b[N_WL], pobs[N_WL], w[N_WL];
+    double c1, ga1[N_WL], gbb1[N_WL], gr_b1[N_WL], gh1;
+    unsigned char mask[N_WL];
+    double worst_cost = 0.0, worst_grad = 0.0;
+    int rc = 0;
+
+    saber_misfit mf;
+    memset(&mf, 0, sizeof(mf));
+    mf.metric = metric;
+    misfit_weights(&mf, w, mask);
+
+    for (int wt = 1; wt <= 2 && !rc; wt++) {
+        for (size_t p = 0; p < N_PIX; p++) {
+            misfit_inputs(p, wt, 1, pa, pbb, pr_b, &h_w[p], pobs, ctx, wl);
+            sun[p] = 35.0 + p;
+            for (size_t i = 0; i < N_WL; i++) {
+                a[i * N_PIX + p]   = pa[i];
+                bb[i * N_PIX + p]  = pbb[i];
+                r_b[i * N_PIX + p] = pr_b[i];
+                obs[i * N_PIX + p] = pobs[i];
+            }
+        }
+        rc = saber_ctx_misfit_am03_batch(ctx, &mf, wl, a, bb, N_WL, N_PIX, wt, 35.0, 12.0, sun,
+                                         NULL, 1, h_w, r_b, obs, SABER_LAYOUT_BAND_MAJOR, cost,
+                                         g_a, g_bb, g_h_w, g_r_b);
+        rc |= saber_ctx_forward_am03_batch(ctx, wl, a, bb, N_WL, N_PIX, wt, 35.0, 12.0, sun, NULL,
+                                           1, h_w, r_b, SABER_LAYOUT_BAND_MAJOR, rrs);
+
+        for (size_t p = 0; p < N_PIX && !rc; p++) {
+            double ref = misfit_ref(&mf, rrs + p, obs + p, N_WL, N_PIX);
+            worst_cost = fmax(worst_cost, fabs(cost[p] - ref) / fabs(ref));
+
+            for (size_t i = 0; i < N_WL; i++) {
+                pa[i]   = a[i * N_PIX + p];
+                pbb[i]  = bb[i * N_PIX + p];
+                pr_b[i] = r_b[i * N_PIX + p];
+                pobs[i] = obs[i * N_PIX + p];
+            }
+            saber_am03_plan* plan = saber_am03_plan_create(wt, 1, sun[p], 12.0);
+            rc = plan ? saber_ctx_misfit_am03_planned(ctx, plan, &mf, pa, pbb, N_WL, h_w[p], pr_b,
+                                                      pobs, &c1, ga1, gbb1, &gh1, gr_b1) : 3;
+            saber_am03_plan_destroy(plan);
+
+            double d = fabs(c1 - cost[p]) + fabs(gh1 - g_h_w[p]);
+            for (size_t i = 0; i < N_WL; i++)
+                d += fabs(ga1[i] - g_a[i * N_PIX + p]) + fabs(gbb1[i] - g_bb[i * N_PIX + p]) +
+                     fabs(gr_b1[i] - g_r_b[i * N_PIX + p]);
+            worst_grad = fmax(worst_grad, d);
+        }
+    }
+
+    char what[64];
+    snprintf(what, sizeof(what), "misfit_am03_batch %s", metric_names[metric]);
+    int fail = check_bound(what, rc, worst_cost, 1e-12);
+    snprintf(what, sizeof(what), "  vs planned, gradients");
+    return fail | check_bound(what, rc, worst_grad, 0.0);
+}
+
+int main(void)
+{
+    double wl[N_WL];
+    saber_ctx* ctx = fixture_ctx(wl, N_WL, 5, classes, N_CLS);
+    if (!ctx) {
+        printf("context setup failed\n");
+        return 1;
+    }
+
+    int fail = 0;
+    for (int t = 0; t < 2; t++) {
+        saber_accuracy acc = t ? SABER_ACCURACY_FAST : SABER_ACCURACY_EXACT;
+        saber_ctx_set_accuracy(ctx, acc);
+        printf("%s\n", acc == SABER_ACCURACY_EXACT ? "EXACT" : "FAST");
+
+        fail |= test_iop(ctx, wl);
+        fail |= test_mixing(ctx);
+        for (int wt = 1; wt <= 2; wt++)
+            for (int shallow = 0; shallow <= 1; shallow++) {
+                fail |= test_forward(ctx, wl, wt, shallow);
+                fail |= test_inversion(ctx, wt, shallow);
+            }
+        for (int m = SABER_MISFIT_SSE; m <= SABER_MISFIT_LOG; m++) {
+            fail |= test_misfit(ctx, wl, m, 0);
+            fail |= test_misfit(ctx, wl, m, 1);
+            fail |= test_misfit_batch(ctx, wl, m);
+        }
+    }
+
+    saber_ctx_destroy(ctx);
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}
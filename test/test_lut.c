@@ -0,0 +1,240 @@
+/*
+ * LUT searches against brute force: the k nearest entries of each pixel,
+ * scored in float and rescored in double, must have the k smallest
+ * weighted distances found by modelling every entry in double, up to the
+ * rounding of the stored float spectra, in both layouts, also on a table
+ * whose first axis holds entries closer together than float scores
+ * resolve. First guesses must be the best entry, and a table
+ * must return 2 once another grid is current. Prints one line per case
+ * and exits non-zero when one fails.
+ */
+#include "saber.h"
+#include "fixture.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_WL    40
+#define N_CLS   3
+#define N_PIX   37
+#define K_MAX   8
+#define N_AXES  3
+
+static const char* classes[N_CLS] = {"sand", "algae", "coral"};
+
+static int check(const char* what, int ok)
+{
+    printf("  %-44s %s\n", what, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+/* Largest difference between the distance to an entry's stored (float)
+ * spectrum and to its model in double, from pixel norm |o|^2 = onorm and
+ * distance d: 2 u |o - s| |s| + u^2 |s|^2 with |s| <= |o| + |o - s|, and
+ * the rounding of the double sums */
+static double float_tol(double onorm, double d)
+{
+    const double u = ldexp(1.0, -24);
+    double s = sqrt(onorm) + sqrt(d);
+    return 2.0 * u * sqrt(d) * s + u * u * s * s + 1e-14 * onorm;
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Weighted squared distance of every entry's model from every pixel, in
+ * double: d[p * n_entries + e] */
+static int brute_force(const saber_ctx* ctx, const saber_inv_config* cfg, const saber_lut* lut,
+                       const double* rrs, const double* w, double* d)
+{
+    size_t n_e = saber_lut_size(lut), n_par = saber_lut_n_param(lut);
+    double* x = malloc(sizeof(double) * n_par);
+    double* jac = malloc(sizeof(double) * n_par * N_WL);
+    saber_inv_workspace* ws = saber_inv_workspace_create(ctx, cfg);
+    int rc = x && jac && ws ? 0 : 3;
+
+    double model[N_WL];
+    for (size_t e = 0; e < n_e && !rc; e++) {
+        rc = saber_lut_entry(lut, e, x) || saber_inv_model_jacobian(ws, x, model, jac);
+        for (size_t p = 0; p < N_PIX && !rc; p++) {
+            double s = 0.0;
+            for (size_t i = 0; i < N_WL; i++) {
+                double r = rrs[p * N_WL + i] - model[i];
+                s += w[i] * r * r;
+            }
+            d[p * n_e + e] = s;
+        }
+    }
+    saber_inv_workspace_destroy(ws);
+    free(x);
+    free(jac);
+    return rc;
+}
+
+/* Pixels near entries of the table and between them, with some noise */
+static int make_pixels(const saber_ctx* ctx, const saber_inv_config* cfg, const saber_lut* lut,
+                       double* rrs)
+{
+    size_t n_e = saber_lut_size(lut), n_par = saber_lut_n_param(lut);
+    double x[SABER_INV_N_BASE + N_CLS], y[SABER_INV_N_BASE + N_CLS];
+    double jac[(SABER_INV_N_BASE + N_CLS) * N_WL];
+    saber_inv_workspace* ws = saber_inv_workspace_create(ctx, cfg);
+    int rc = ws ? 0 : 3;
+    for (size_t p = 0; p < N_PIX && !rc; p++) {
+        rc = saber_lut_entry(lut, (p * 7919) % n_e, x) ||
+             saber_lut_entry(lut, (p * 104729 + 13) % n_e, y);
+        double t = (double)(p % 4) / 4.0;
+        for (size_t c = 0; c < n_par; c++) x[c] += t * (y[c] - x[c]);
+        if (!rc) rc = saber_inv_model_jacobian(ws, x, rrs + p * N_WL, jac);
+        for (size_t i = 0; i < N_WL; i++)
+            rrs[p * N_WL + i] *= 1.0 + 0.01 * sin(0.7 * i + p);
+    }
+    saber_inv_workspace_destroy(ws);
+    return rc;
+}
+
+/* Search one table for k = 1 .. K_MAX in both layouts against d */
+static int test_search(const char* name, const saber_lut* lut, const double* rrs,
+                       const double* w, const double* d)
+{
+    size_t n_e = saber_lut_size(lut);
+    double rrs_t[N_PIX * N_WL], brute[N_PIX * K_MAX];
+    double dist[2][N_PIX * K_MAX];
+    size_t idx[2][N_PIX * K_MAX];
+    double* row = malloc(sizeof(double) * n_e);
+    if (!row) return check(name, 0);
+
+    for (size_t p = 0; p < N_PIX; p++) {
+        memcpy(row, d + p * n_e, sizeof(double) * n_e);
+        qsort(row, n_e, sizeof(double), cmp_double);
+        memcpy(brute + p * K_MAX, row, sizeof(double) * K_MAX);
+        for (size_t i = 0; i < N_WL; i++) rrs_t[i * N_PIX + p] = rrs[p * N_WL + i];
+    }
+    free(row);
+
+    /* distances may differ from brute force only by the float spectra,
+     * so no entry nearer than those found can have been passed over */
+    int rc = 0, ranks_ok = 1, own_ok = 1, layouts_ok = 1;
+    double worst = 0.0;
+    for (size_t k = 1; k <= K_MAX && !rc; k++) {
+        rc = saber_lut_search(lut, rrs, N_PIX, SABER_LAYOUT_PIXEL_MAJOR, k, idx[0], dist[0]) ||
+             saber_lut_search(lut, rrs_t, N_PIX, SABER_LAYOUT_BAND_MAJOR, k, idx[1], dist[1]);
+        for (size_t p = 0; p < N_PIX && !rc; p++) {
+            double onorm = 0.0;
+            for (size_t i = 0; i < N_WL; i++) onorm += w[i] * rrs[p * N_WL + i] * rrs[p * N_WL + i];
+            for (size_t r = 0; r < k; r++) {
+                size_t at = p * k + r;
+                double ref = brute[p * K_MAX + r];
+                double err = fabs(dist[0][at] - ref) / float_tol(onorm, fmax(ref, dist[0][at]));
+                worst = fmax(worst, err);
+                ranks_ok &= err <= 1.0 && (r == 0 || dist[0][at] >= dist[0][at - 1]);
+                own_ok &= idx[0][at] < n_e &&
+                          fabs(d[p * n_e + idx[0][at]] - dist[0][at]) <=
+                              float_tol(onorm, d[p * n_e + idx[0][at]]);
+                for (size_t q = 0; q < r; q++) own_ok &= idx[0][p * k + q] != idx[0][at];
+            }
+        }
+        layouts_ok &= !memcmp(idx[0], idx[1], sizeof(size_t) * N_PIX * k) &&
+                      !memcmp(dist[0], dist[1], sizeof(double) * N_PIX * k);
+    }
+
+    char what[96];
+    printf("%s: %zu entries, worst %.2f of the float rounding\n", name, n_e, worst);
+    snprintf(what, sizeof(what), "k = 1..%d, search", K_MAX);
+    int fail = check(what, !rc);
+    fail |= check("k smallest distances, ascending", !rc && ranks_ok);
+    fail |= check("distinct entries at their own distance", !rc && own_ok);
+    fail |= check("both layouts alike", !rc && layouts_ok);
+    return fail;
+}
+
+static int test_first_guess(const saber_lut* lut, const double* rrs)
+{
+    size_t n_par = saber_lut_n_param(lut);
+    double x[N_PIX * (SABER_INV_N_BASE + N_CLS)], e[SABER_INV_N_BASE + N_CLS], dist[N_PIX];
+    size_t idx[N_PIX];
+    int rc = saber_lut_first_guess(lut, rrs, N_PIX, SABER_LAYOUT_PIXEL_MAJOR, x) ||
+             saber_lut_search(lut, rrs, N_PIX, SABER_LAYOUT_PIXEL_MAJOR, 1, idx, dist);
+    int same = !rc;
+    for (size_t p = 0; p < N_PIX && same; p++)
+        same = !saber_lut_entry(lut, idx[p], e) && !memcmp(x + p * n_par, e, sizeof(double) * n_par);
+    return check("first guess is the best entry", same);
+}
+
+int main(void)
+{
+    double wl[N_WL], wl_b[N_WL / 2];
+    saber_ctx* ctx = fixture_ctx(wl, N_WL, 8, classes, N_CLS);
+    if (!ctx) {
+        printf("context setup failed\n");
+        return 1;
+    }
+
+    saber_inv_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.water_type     = 2;
+    cfg.theta_sun_deg  = 35.0;
+    cfg.theta_view_deg = 12.0;
+    cfg.shallow        = 1;
+    cfg.class_names    = classes;
+    cfg.n_class        = N_CLS;
+
+    double w[N_WL];
+    for (size_t i = 0; i < N_WL; i++) w[i] = 0.5 + (double)(i % 3);
+
+    /* a plain grid, then one whose first axis steps by 1e-7 m */
+    const saber_lut_axis spread[N_AXES] = {
+        {SABER_INV_H_W, 1.0, 8.0, 12, 1},
+        {SABER_INV_CHL, 0.2, 20.0, 9, 1},
+        {SABER_INV_BB_P_550, 0.002, 0.03, 5, 1},
+    };
+    const saber_lut_axis dup[N_AXES] = {
+        {SABER_INV_H_W, 3.0, 3.0 + 1.5e-6, 16, 0},
+        {SABER_INV_CHL, 0.5, 5.0, 6, 1},
+        {SABER_INV_N_BASE + 1, 0.0, 1.0, 5, 0},
+    };
+    const saber_lut_axis* tables[2] = {spread, dup};
+    const char* names[2] = {"spread", "near duplicates"};
+
+    int fail = 0;
+    double rrs[N_PIX * N_WL];
+    for (int t = 0; t < 2; t++) {
+        saber_lut* lut = saber_lut_build(ctx, &cfg, NULL, tables[t], N_AXES, w, 0);
+        double* d = lut ? malloc(sizeof(double) * N_PIX * saber_lut_size(lut)) : NULL;
+        if (!d || make_pixels(ctx, &cfg, lut, rrs) || brute_force(ctx, &cfg, lut, rrs, w, d)) {
+            fail |= check("table setup", 0);
+        } else {
+            fail |= test_search(names[t], lut, rrs, w, d);
+            fail |= test_first_guess(lut, rrs);
+        }
+        free(d);
+        saber_lut_destroy(lut);
+    }
+
+    /* stale once another grid is current, and again after a reload */
+    saber_lut* lut = saber_lut_build(ctx, &cfg, NULL, spread, N_AXES, NULL, 1);
+    size_t idx[N_PIX];
+    double x[N_PIX * (SABER_INV_N_BASE + N_CLS)];
+    for (size_t i = 0; i < N_WL / 2; i++) wl_b[i] = 410 + 8 * i;
+    saber_grid_token tok_a = saber_ctx_grid_token(ctx), tok_b = 0;
+    int rc = lut ? saber_ctx_ensure_grid(ctx, wl_b, N_WL / 2, &tok_b) : 3;
+    fail |= check("table stale on another grid",
+                  !rc && saber_lut_search(lut, rrs, 1, SABER_LAYOUT_PIXEL_MAJOR, 1, idx, NULL) == 2 &&
+                  saber_lut_first_guess(lut, rrs, 1, SABER_LAYOUT_PIXEL_MAJOR, x) == 2);
+    rc = lut ? saber_ctx_select_grid(ctx, tok_a) : 3;
+    fail |= check("and current again on its own",
+                  !rc && saber_lut_search(lut, rrs, 1, SABER_LAYOUT_PIXEL_MAJOR, 1, idx, NULL) == 0);
+    rc = lut ? fixture_load(ctx, classes, NULL, N_CLS) || saber_ctx_build_cache(ctx, wl, N_WL) : 3;
+    fail |= check("table stale after a reload",
+                  !rc && saber_lut_search(lut, rrs, 1, SABER_LAYOUT_PIXEL_MAJOR, 1, idx, NULL) == 2);
+    saber_lut_destroy(lut);
+
+    saber_ctx_destroy(ctx);
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}
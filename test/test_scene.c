@@ -0,0 +1,384 @@
+/*
+ * Scenes against the entry points they tile: every scene op, on 1 and
+ * several threads, with small tiles and in both layouts, must give the
+ * same results as the single-pixel entry points called pixel by pixel
+ * and as the batch entry points (UNMIX and DEPTH: the batch on one pixel
+ * and on all), bit for bit except for unmixing, and the per-thread stats
+ * must account for every tile exactly once. Prints one line per op and exits non-zero when a
+ * run differs.
+ */
+#include "saber.h"
+#include "fixture.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_WL    40
+#define N_CLS   3
+#define N_PIX   203
+#define N_IOP   4
+#define SUN     35.0
+#define VIEW    12.0
+
+static const char* classes[N_CLS] = {"sand", "algae", "coral"};
+static const char* params[N_IOP]  = {"chl", "a_g_440", "a_nap_440", "bb_p_550"};
+
+static const size_t threads[] = {1, 4};
+static const size_t tiles[]   = {3, 16};
+
+/* Inputs in both layouts: [0] pixel-major, [1] band-major */
+static double in_iop[2][N_PIX * N_IOP], in_frac[2][N_PIX * N_CLS];
+static double in_a[2][N_PIX * N_WL], in_bb[2][N_PIX * N_WL];
+static double in_rrs[2][N_PIX * N_WL], in_rrs_deep[2][N_PIX * N_WL], in_rrs_depth[2][N_PIX * N_WL];
+static double in_r_b[2][N_PIX * N_WL], in_mix[2][N_PIX * N_WL];
+static double h_w[N_PIX], sun[N_PIX];
+
+/* Depth solver's water column and bottom, shared by every pixel */
+static double col_a[N_WL], col_bb[N_WL], col_r_b[N_WL];
+
+/* Outputs and pixel-major references, up to two per op */
+static double out1[N_PIX * N_WL], out2[N_PIX * N_WL];
+static double single1[N_PIX * N_WL], single2[N_PIX * N_WL];
+static double batch1[N_PIX * N_WL], batch2[N_PIX * N_WL];
+
+typedef struct op_refs {
+    saber_scene_op op;
+    const char*    name;
+    size_t         len1;        /* per pixel, in the scene layout   */
+    size_t         len2;        /* per pixel; 0 none                */
+    int            len2_plain;  /* out2 is [n_pix] whatever layout  */
+    double         tol;         /* largest difference allowed       */
+} op_refs;
+
+/* Pixel-major `src` (n_pix x len) into `layout` */
+static void to_layout(const double* src, size_t len, int band_major, double* dst)
+{
+    for (size_t p = 0; p < N_PIX; p++)
+        for (size_t k = 0; k < len; k++)
+            dst[band_major ? k * N_PIX + p : p * len + k] = src[p * len + k];
+}
+
+static void from_layout(const double* src, size_t len, int band_major, double* dst)
+{
+    for (size_t p = 0; p < N_PIX; p++)
+        for (size_t k = 0; k < len; k++)
+            dst[p * len + k] = src[band_major ? k * N_PIX + p : p * len + k];
+}
+
+static void both_layouts(double (*v)[2][N_PIX * N_WL], size_t len)
+{
+    to_layout((*v)[0], len, 1, (*v)[1]);
+}
+
+static int check(const char* what, int ok)
+{
+    printf("  %-44s %s\n", what, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+/* Pixel inputs: a spread of water columns, depths and bottoms */
+static int make_inputs(const saber_ctx* ctx, const double* wl)
+{
+    const double f_col[N_CLS] = {0.5, 0.3, 0.2};
+    int rc = 0;
+    for (size_t p = 0; p < N_PIX; p++) {
+        double* v = in_iop[0] + p * N_IOP;
+        v[0] = 0.2 + 0.05 * (double)(p % 40);
+        v[1] = 0.01 + 0.002 * (double)(p % 17);
+        v[2] = 0.005 + 0.001 * (double)(p % 11);
+        v[3] = 0.002 + 0.0003 * (double)(p % 13);
+
+        double* f = in_frac[0] + p * N_CLS;
+        f[0] = (double)(p % 5) / 4.0;
+        f[1] = (double)(p % 7) / 6.0 * (1.0 - f[0]);
+        f[2] = 1.0 - f[0] - f[1];
+
+        h_w[p] = 0.5 + 0.08 * (double)(p % 50);
+        sun[p] = 20.0 + 0.15 * (double)p;
+
+        rc |= saber_ctx_iop_from_oac(ctx, wl, N_WL, params, v, N_IOP,
+                                     in_a[0] + p * N_WL, in_bb[0] + p * N_WL);
+        rc |= saber_ctx_compute_r_rs_b_lmm(ctx, classes, f, N_CLS, in_r_b[0] + p * N_WL);
+        rc |= saber_ctx_forward_am03(ctx, wl, in_a[0] + p * N_WL, in_bb[0] + p * N_WL, N_WL, 1,
+                                     sun[p], VIEW, 1, h_w[p], in_r_b[0] + p * N_WL,
+                                     in_rrs[0] + p * N_WL);
+        rc |= saber_ctx_forward_am03(ctx, wl, in_a[0] + p * N_WL, in_bb[0] + p * N_WL, N_WL, 1,
+                                     SUN, VIEW, 0, 0.0, NULL, in_rrs_deep[0] + p * N_WL);
+        for (size_t i = 0; i < N_WL; i++)
+            in_mix[0][p * N_WL + i] = in_r_b[0][p * N_WL + i] + 1e-3 * sin(0.9 * i + p);
+    }
+
+    rc |= saber_ctx_iop_from_oac(ctx, wl, N_WL, params, in_iop[0], N_IOP, col_a, col_bb);
+    rc |= saber_ctx_compute_r_rs_b_lmm(ctx, classes, f_col, N_CLS, col_r_b);
+    for (size_t p = 0; p < N_PIX; p++)
+        rc |= saber_ctx_forward_am03(ctx, wl, col_a, col_bb, N_WL, 1, SUN, VIEW, 1, h_w[p],
+                                     col_r_b, in_rrs_depth[0] + p * N_WL);
+
+    to_layout(in_iop[0], N_IOP, 1, in_iop[1]);
+    to_layout(in_frac[0], N_CLS, 1, in_frac[1]);
+    both_layouts(&in_a, N_WL);
+    both_layouts(&in_bb, N_WL);
+    both_layouts(&in_rrs, N_WL);
+    both_layouts(&in_rrs_deep, N_WL);
+    both_layouts(&in_rrs_depth, N_WL);
+    both_layouts(&in_r_b, N_WL);
+    both_layouts(&in_mix, N_WL);
+    return rc;
+}
+
+typedef struct prepared {
+    saber_schema*        s_iop;
+    saber_schema*        s_mix;
+    saber_unmixer*       unmixer;
+    saber_am03_plan*     plan;
+    saber_depth_solver*  depth;
+    saber_inv_config     inv;
+} prepared;
+
+/* References of one op, pixel by pixel and in one batch call */
+static int references(const saber_ctx* ctx, const double* wl, const prepared* pr,
+                      const op_refs* op)
+{
+    int rc = 0;
+    switch (op->op) {
+        case SABER_SCENE_IOP:
+            for (size_t p = 0; p < N_PIX && !rc; p++)
+                rc = saber_ctx_iop_from_oac_prepared(ctx, pr->s_iop, in_iop[0] + p * N_IOP,
+                                                     single1 + p * N_WL, single2 + p * N_WL);
+            if (!rc)
+                rc = saber_ctx_iop_from_oac_batch(ctx, wl, N_WL, N_PIX, params, in_iop[0], N_IOP,
+                                                  SABER_LAYOUT_PIXEL_MAJOR, batch1, batch2);
+            break;
+        case SABER_SCENE_MIXING:
+            for (size_t p = 0; p < N_PIX && !rc; p++)
+                rc = saber_ctx_compute_r_rs_b_lmm_prepared(ctx, pr->s_mix, in_frac[0] + p * N_CLS,
+                                                           single1 + p * N_WL);
+            if (!rc)
+                rc = saber_ctx_compute_r_rs_b_lmm_batch(ctx, N_PIX, classes, in_frac[0], N_CLS,
+                                                        SABER_LAYOUT_PIXEL_MAJOR, batch1);
+            break;
+        case SABER_SCENE_FORWARD:
+            for (size_t p = 0; p < N_PIX && !rc; p++)
+                rc = saber_ctx_forward_am03(ctx, wl, in_a[0] + p * N_WL, in_bb[0] + p * N_WL, N_WL,
+                                            1, sun[p], VIEW, 1, h_w[p], in_r_b[0] + p * N_WL,
+                                            single1 + p * N_WL);
+            if (!rc)
+                rc = saber_ctx_forward_am03_batch(ctx, wl, in_a[0], in_bb[0], N_WL, N_PIX, 1, SUN,
+                                                  VIEW, sun, NULL, 1, h_w, in_r_b[0],
+                                                  SABER_LAYOUT_PIXEL_MAJOR, batch1);
+            break;
+        case SABER_SCENE_RETRIEVE:
+            for (size_t p = 0; p < N_PIX && !rc; p++)
+                rc = saber_ctx_retrieve_r_rs_b_am03(ctx, wl, in_a[0] + p * N_WL, in_bb[0] + p * N_WL,
+                                                    in_rrs[0] + p * N_WL, N_WL, 1, sun[p], VIEW,
+                                                    h_w[p], single1 + p * N_WL);
+            if (!rc)
+                rc = saber_ctx_retrieve_r_rs_b_am03_batch(ctx, wl, in_a[0], in_bb[0], in_rrs[0],
+                                                          N_WL, N_PIX, 1, SUN, VIEW, sun, NULL,
+                                                          h_w, SABER_LAYOUT_PIXEL_MAJOR, batch1);
+            break;
+        case SABER_SCENE_INVERT: {
+            /* no batch entry point: both references are saber_invert_pixel() */
+            size_t n_par = op->len1;
+            double x0[SABER_INV_N_BASE];
+            saber_inv_workspace* ws = saber_inv_workspace_create(ctx, &pr->inv);
+            rc = ws ? saber_inv_defaults(&pr->inv, x0, NULL, NULL) : 3;
+            for (size_t p = 0; p < N_PIX && !rc; p++)
+                if (saber_invert_pixel(ws, in_rrs_deep[0] + p * N_WL, NULL, x0,
+                                       single1 + p * n_par, NULL))
+                    rc = 4;
+            saber_inv_workspace_destroy(ws);
+            memcpy(batch1, single1, sizeof(double) * N_PIX * n_par);
+            break;
+        }
+        case SABER_SCENE_UNMIX:
+            for (size_t p = 0; p < N_PIX && !rc; p++)
+                rc = saber_ctx_unmix_r_rs_b_batch(ctx, pr->unmixer, 1, in_mix[0] + p * N_WL,
+                                                  SABER_LAYOUT_PIXEL_MAJOR, single1 + p * N_CLS,
+                                                  single2 + p);
+            if (!rc)
+                rc = saber_ctx_unmix_r_rs_b_batch(ctx, pr->unmixer, N_PIX, in_mix[0],
+                                                  SABER_LAYOUT_PIXEL_MAJOR, batch1, batch2);
+            break;
+        case SABER_SCENE_DEPTH:
+            for (size_t p = 0; p < N_PIX && !rc; p++)
+                rc = saber_ctx_solve_depth_batch(ctx, pr->depth, 1, in_rrs_depth[0] + p * N_WL,
+                                                 SABER_LAYOUT_PIXEL_MAJOR, single1 + p, single2 + p);
+            if (!rc)
+                rc = saber_ctx_solve_depth_batch(ctx, pr->depth, N_PIX, in_rrs_depth[0],
+                                                 SABER_LAYOUT_PIXEL_MAJOR, batch1, batch2);
+            break;
+    }
+    return rc;
+}
+
+static saber_scene make_scene(const prepared* pr, saber_scene_op op, int bm)
+{
+    saber_scene sc;
+    memset(&sc, 0, sizeof(sc));
+    sc.op             = op;
+    sc.n_pix          = N_PIX;
+    sc.layout         = bm ? SABER_LAYOUT_BAND_MAJOR : SABER_LAYOUT_PIXEL_MAJOR;
+    sc.water_type     = 1;
+    sc.theta_sun_deg  = SUN;
+    sc.theta_view_deg = VIEW;
+
+    switch (op) {
+        case SABER_SCENE_IOP:
+            sc.schema = pr->s_iop;
+            sc.values = in_iop[bm];
+            sc.a_out  = out1;
+            sc.bb_out = out2;
+            break;
+        case SABER_SCENE_MIXING:
+            sc.schema  = pr->s_mix;
+            sc.values  = in_frac[bm];
+            sc.r_b_out = out1;
+            break;
+        case SABER_SCENE_FORWARD:
+            sc.a = in_a[bm];
+            sc.bb = in_bb[bm];
+            sc.shallow = 1;
+            sc.h_w = h_w;
+            sc.r_b = in_r_b[bm];
+            sc.theta_sun_pix = sun;
+            sc.rrs_out = out1;
+            break;
+        case SABER_SCENE_RETRIEVE:
+            sc.a = in_a[bm];
+            sc.bb = in_bb[bm];
+            sc.rrs = in_rrs[bm];
+            sc.h_w = h_w;
+            sc.theta_sun_pix = sun;
+            sc.r_b_out = out1;
+            break;
+        case SABER_SCENE_INVERT:
+            sc.inv   = &pr->inv;
+            sc.rrs   = in_rrs_deep[bm];
+            sc.x_out = out1;
+            break;
+        case SABER_SCENE_UNMIX:
+            sc.unmixer = pr->unmixer;
+            sc.r_b = in_mix[bm];
+            sc.fractions_out = out1;
+            sc.rmse_out = out2;
+            break;
+        case SABER_SCENE_DEPTH:
+            sc.depth = pr->depth;
+            sc.rrs = in_rrs_depth[bm];
+            sc.h_w_out = out1;
+            sc.rmse_out = out2;
+            break;
+    }
+    return sc;
+}
+
+/* Largest |a - b| over n values; any NaN counts as infinite */
+static double max_diff(const double* a, const double* b, size_t n)
+{
+    double worst = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double d = fabs(a[i] - b[i]);
+        if (!(d <= worst)) worst = isnan(d) ? INFINITY : d;
+    }
+    return worst;
+}
+
+static int run_op(const saber_ctx* ctx, const double* wl, const prepared* pr, const op_refs* op)
+{
+    static double got1[N_PIX * N_WL], got2[N_PIX * N_WL];
+    int rc = references(ctx, wl, pr, op);
+    double worst_single = max_diff(single1, batch1, N_PIX * op->len1);
+    if (op->len2) worst_single = fmax(worst_single, max_diff(single2, batch2, N_PIX * op->len2));
+    int fail = rc != 0 || worst_single > op->tol;
+
+    size_t runs = 0, bad_tiles = 0;
+    double worst = 0.0;
+    for (int bm = 0; bm <= 1 && !rc; bm++)
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+            for (size_t k = 0; k < sizeof(tiles) / sizeof(tiles[0]); k++) {
+                saber_scene sc = make_scene(pr, op->op, bm);
+                saber_scene_thread_stats st[4];
+                memset(out1, 0, sizeof(out1));
+                memset(out2, 0, sizeof(out2));
+                int src = saber_scene_run(ctx, &sc, threads[t], tiles[k], st);
+                runs++;
+                if (src) {
+                    fail = 1;
+                    continue;
+                }
+
+                size_t n_tiles = (N_PIX + tiles[k] - 1) / tiles[k], sum = 0;
+                for (size_t w = 0; w < threads[t]; w++) sum += st[w].tiles;
+                bad_tiles += sum != n_tiles;
+
+                from_layout(out1, op->len1, bm, got1);
+                worst = fmax(worst, max_diff(got1, single1, N_PIX * op->len1));
+                if (op->len2) {
+                    if (op->len2_plain) memcpy(got2, out2, sizeof(double) * N_PIX * op->len2);
+                    else                from_layout(out2, op->len2, bm, got2);
+                    worst = fmax(worst, max_diff(got2, single2, N_PIX * op->len2));
+                }
+            }
+    fail |= worst > op->tol || bad_tiles != 0;
+
+    char what[96];
+    snprintf(what, sizeof(what), "%-8s %zu runs  diff %.0e  batch %.0e%s",
+             op->name, runs, worst, worst_single, bad_tiles ? "  tiles off" : "");
+    return check(what, !fail);
+}
+
+int main(void)
+{
+    double wl[N_WL];
+    saber_ctx* ctx = fixture_ctx(wl, N_WL, 8, classes, N_CLS);
+    if (!ctx || make_inputs(ctx, wl)) {
+        printf("context setup failed\n");
+        saber_ctx_destroy(ctx);
+        return 1;
+    }
+
+    prepared pr;
+    memset(&pr, 0, sizeof(pr));
+    pr.inv.water_type     = 1;
+    pr.inv.theta_sun_deg  = SUN;
+    pr.inv.theta_view_deg = VIEW;
+    pr.inv.max_iter       = 20;
+    pr.s_iop   = saber_schema_create(ctx, params, N_IOP, NULL, 0);
+    pr.s_mix   = saber_schema_create(ctx, NULL, 0, classes, N_CLS);
+    pr.unmixer = saber_unmixer_create(ctx, NULL, 1);
+    pr.plan    = saber_am03_plan_create(1, 1, SUN, VIEW);
+    pr.depth   = pr.plan ? saber_depth_solver_create(ctx, pr.plan, col_a, col_bb, col_r_b, NULL,
+                                                     0.1, 10.0) : NULL;
+
+    int fail = 0;
+    if (!pr.s_iop || !pr.s_mix || !pr.unmixer || !pr.depth) {
+        printf("prepared objects failed\n");
+        fail = 1;
+    } else {
+        /* unmixing starts each pixel from the previous one's active set,
+         * so where a tile starts shows at the rounding level */
+        const op_refs ops[] = {
+            {SABER_SCENE_IOP,      "iop",      N_WL, N_WL, 0, 0.0},
+            {SABER_SCENE_MIXING,   "mixing",   N_WL, 0, 0, 0.0},
+            {SABER_SCENE_FORWARD,  "forward",  N_WL, 0, 0, 0.0},
+            {SABER_SCENE_RETRIEVE, "retrieve", N_WL, 0, 0, 0.0},
+            {SABER_SCENE_INVERT,   "invert",   saber_inv_n_param(&pr.inv), 0, 0, 0.0},
+            {SABER_SCENE_UNMIX,    "unmix",    N_CLS, 1, 1, 1e-12},
+            {SABER_SCENE_DEPTH,    "depth",    1, 1, 1, 0.0},
+        };
+        for (size_t k = 0; k < sizeof(ops) / sizeof(ops[0]); k++)
+            fail |= run_op(ctx, wl, &pr, &ops[k]);
+    }
+
+    saber_schema_destroy(pr.s_iop);
+    saber_schema_destroy(pr.s_mix);
+    saber_unmixer_destroy(pr.unmixer);
+    saber_depth_solver_destroy(pr.depth);
+    saber_am03_plan_destroy(pr.plan);
+    saber_ctx_destroy(ctx);
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}
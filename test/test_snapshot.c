@@ -0,0 +1,230 @@
+/*
+ * Grid snapshots and spectral library files through the file: a loaded
+ * snapshot, or a grid built on a mapped library, must reproduce the grid
+ * of the context that saved it bit for bit (tables, class names, kernel
+ * output in both accuracy tiers, and the file itself when saved again),
+ * and a damaged file must be refused with return code 2 and leave the
+ * context as it was: a flipped data byte, a wrong checksum, truncation
+ * and section lengths that disagree with each other. Prints one line per
+ * case and exits non-zero when one fails.
+ */
+#include "saber.h"
+#include "fixture.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_WL    80
+#define N_CLS   3
+
+/* Header fields the damage cases edit, as laid out in snapshot.c:
+ * magic[8], format, byte_order, lib_version[32], file_size, checksum,
+ * n_class, n_sec, off[16], len[16]; sections start at BIN_DATA */
+#define HDR_CHECKSUM    56
+#define HDR_N_CLASS     64
+#define HDR_LEN(s)      (208 + 8 * (s))
+#define BIN_DATA        384
+
+static const char* classes[N_CLS] = {"sand", "algae", "coral"};
+
+/* One file kind: its entry points, the files the test writes and a
+ * section whose length is a multiple of 64, so shortening it by one
+ * element passes the layout check. A library holds source tables: the
+ * grid is rebuilt after every load to compare it. */
+typedef struct file_kind {
+    const char* name;
+    const char* path;
+    const char* bad_path;
+    int (*save)(const saber_ctx* ctx, const char* path);
+    int (*load)(saber_ctx* ctx, const char* path);
+    int sec_table;
+    int sources;
+} file_kind;
+
+static const file_kind kinds[] = {
+    {"snapshot", "test_snapshot.snp", "test_snapshot_bad.snp",
+     saber_ctx_save_snapshot, saber_ctx_load_snapshot, 1 /* SNAP_A_W, N_WL doubles */, 0},
+    {"library", "test_library.lib", "test_library_bad.lib",
+     saber_ctx_save_library, saber_ctx_map_library, 1 /* LIB_A_W, FIX_N_SRC doubles */, 1},
+};
+
+static unsigned char* read_file(const char* path, size_t* len)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char* buf = n > 0 ? malloc((size_t)n) : NULL;
+    if (buf && fread(buf, 1, (size_t)n, f) != (size_t)n) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = buf ? (size_t)n : 0;
+    return buf;
+}
+
+static int write_file(const char* path, const unsigned char* buf, size_t len)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f) return 1;
+    int rc = fwrite(buf, 1, len, f) != len;
+    return fclose(f) || rc;
+}
+
+static void put_u64(unsigned char* buf, size_t at, uint64_t v)
+{
+    memcpy(buf + at, &v, 8);
+}
+
+static uint64_t get_u64(const unsigned char* buf, size_t at)
+{
+    uint64_t v;
+    memcpy(&v, buf + at, 8);
+    return v;
+}
+
+static int check(const char* what, int ok)
+{
+    printf("  %-44s %s\n", what, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+/* Tables, class names and kernel output of `got` equal those of `ref`
+ * bit for bit, in both accuracy tiers */
+static int same_grid(saber_ctx* ref, saber_ctx* got, const double* wl)
+{
+    size_t n = saber_ctx_get_n_wl(ref), k = saber_ctx_get_n_class(ref);
+    if (saber_ctx_get_n_wl(got) != n || saber_ctx_get_n_class(got) != k) return 0;
+    if (memcmp(saber_ctx_get_a_w(ref),    saber_ctx_get_a_w(got),    sizeof(double) * n) ||
+        memcmp(saber_ctx_get_bb_w(ref),   saber_ctx_get_bb_w(got),   sizeof(double) * n) ||
+        memcmp(saber_ctx_get_a0(ref),     saber_ctx_get_a0(got),     sizeof(double) * n) ||
+        memcmp(saber_ctx_get_a1(ref),     saber_ctx_get_a1(got),     sizeof(double) * n) ||
+        memcmp(saber_ctx_get_r_rs_b(ref), saber_ctx_get_r_rs_b(got), sizeof(double) * n * k))
+        return 0;
+    for (size_t j = 0; j < k; j++)
+        if (strcmp(saber_ctx_get_r_rs_b_class_names(ref)[j], saber_ctx_get_r_rs_b_class_names(got)[j]))
+            return 0;
+
+    enum { NP = 5 };
+    const char* pn[NP] = {"chl", "a_g_440", "a_nap_440", "bb_p_550", "bb_p_gamma"};
+    const double pv[NP] = {2.5, 0.05, 0.02, 0.008, 0.6};
+    const double f[N_CLS] = {0.5, 0.3, 0.2};
+    double a[2][N_WL], bb[2][N_WL], rb[2][N_WL];
+    int same = 1;
+    for (int t = 0; t < 2 && same; t++) {
+        saber_accuracy acc = t ? SABER_ACCURACY_FAST : SABER_ACCURACY_EXACT;
+        saber_ctx* c[2] = {ref, got};
+        for (int q = 0; q < 2; q++) {
+            saber_ctx_set_accuracy(c[q], acc);
+            if (saber_ctx_iop_from_oac(c[q], wl, N_WL, pn, pv, NP, a[q], bb[q]) ||
+                saber_ctx_compute_r_rs_b_lmm(c[q], classes, f, N_CLS, rb[q]))
+                same = 0;
+        }
+        same = same && !memcmp(a[0], a[1], sizeof(a[0])) && !memcmp(bb[0], bb[1], sizeof(bb[0])) &&
+               !memcmp(rb[0], rb[1], sizeof(rb[0]));
+        saber_ctx_set_accuracy(ref, SABER_ACCURACY_EXACT);
+        saber_ctx_set_accuracy(got, SABER_ACCURACY_EXACT);
+    }
+    return same;
+}
+
+/* Load a file of kind `k` into `ctx`, building the grid on a library */
+static int load(const file_kind* k, saber_ctx* ctx, const char* path, const double* wl)
+{
+    int rc = k->load(ctx, path);
+    if (!rc && k->sources) rc = saber_ctx_build_cache(ctx, wl, N_WL);
+    return rc;
+}
+
+/* Write a damaged copy to a file of its own (the context maps the good
+ * one), load it into `ctx` and expect 2 with the grid of `ref` kept */
+static int damaged(const file_kind* k, const char* what, saber_ctx* ref, saber_ctx* ctx,
+                   const double* wl, const unsigned char* buf, size_t len)
+{
+    if (write_file(k->bad_path, buf, len)) return check(what, 0);
+    int rc = k->load(ctx, k->bad_path);
+    int kept = !k->sources || !saber_ctx_build_cache(ctx, wl, N_WL);
+    char line[96];
+    snprintf(line, sizeof(line), "%s: rc %d", what, rc);
+    return check(line, rc == 2 && kept && same_grid(ref, ctx, wl));
+}
+
+static int test_file(const file_kind* k, saber_ctx* ref, const double* wl)
+{
+    int fail = 0;
+    size_t len = 0, len2 = 0;
+    unsigned char *good = NULL, *again = NULL, *bad = NULL;
+    saber_ctx* ctx = saber_ctx_create();
+    printf("%s\n", k->name);
+
+    int rc = ctx ? k->save(ref, k->path) : 3;
+    if (!rc) rc = load(k, ctx, k->path, wl);
+    fail |= check("save and load", rc == 0);
+    if (rc) goto out;
+    fail |= check("grid bit for bit", same_grid(ref, ctx, wl));
+
+    good = read_file(k->path, &len);
+    rc = k->save(ctx, k->path);
+    again = read_file(k->path, &len2);
+    fail |= check("saved again byte for byte",
+                  !rc && good && again && len == len2 && !memcmp(good, again, len));
+    bad = good ? malloc(len) : NULL;
+    if (!bad) {
+        fail |= check("read back", 0);
+        goto out;
+    }
+
+    memcpy(bad, good, len);
+    bad[BIN_DATA + (len - BIN_DATA) / 2] ^= 0x10;
+    fail |= damaged(k, "flipped data byte", ref, ctx, wl, bad, len);
+
+    memcpy(bad, good, len);
+    put_u64(bad, HDR_CHECKSUM, get_u64(bad, HDR_CHECKSUM) + 1);
+    fail |= damaged(k, "wrong checksum", ref, ctx, wl, bad, len);
+
+    memcpy(bad, good, len);
+    fail |= damaged(k, "truncated by one section", ref, ctx, wl, bad, len - 64);
+    fail |= damaged(k, "truncated inside the header", ref, ctx, wl, bad, BIN_DATA / 2);
+
+    /* the header is outside the checksum: these pass it and the layout
+     * check and must be caught by the length checks */
+    memcpy(bad, good, len);
+    put_u64(bad, HDR_LEN(k->sec_table), get_u64(bad, HDR_LEN(k->sec_table)) - 8);
+    fail |= damaged(k, "table shorter than its wavelengths", ref, ctx, wl, bad, len);
+
+    memcpy(bad, good, len);
+    put_u64(bad, HDR_N_CLASS, get_u64(bad, HDR_N_CLASS) + 1);
+    fail |= damaged(k, "class count off the sections", ref, ctx, wl, bad, len);
+
+out:
+    free(good);
+    free(again);
+    free(bad);
+    saber_ctx_destroy(ctx);
+    remove(k->path);
+    remove(k->bad_path);
+    return fail;
+}
+
+int main(void)
+{
+    double wl[N_WL];
+    saber_ctx* ctx = fixture_ctx(wl, N_WL, 4, classes, N_CLS);
+    if (!ctx) {
+        printf("context setup failed\n");
+        return 1;
+    }
+
+    int fail = 0;
+    for (size_t t = 0; t < sizeof(kinds) / sizeof(kinds[0]); t++)
+        fail |= test_file(&kinds[t], ctx, wl);
+
+    saber_ctx_destroy(ctx);
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}
@@ -0,0 +1,164 @@
+/*
+ * Per-thread stat blocks against context lifetimes: counts a thread has
+ * not published yet must reach their context when another, unrelated
+ * context is destroyed meanwhile, and counts left over from a destroyed
+ * context must never show up in a new one, even one created at the same
+ * address. Prints one line per case and exits non-zero when one fails.
+ */
+#include "saber.h"
+#include "fixture.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define N_WL    40
+#define N_CLS   3
+#define N_CALLS 10          /* below the publish threshold */
+
+static const char* classes[N_CLS] = {"sand", "algae", "coral"};
+
+static int check(const char* what, int ok)
+{
+    printf("  %-48s %s\n", what, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+/* n single-spectrum mixing calls, each counted as one MIXING call */
+static int mix_calls(const saber_ctx* ctx, int n)
+{
+    const double f[N_CLS] = {0.5, 0.3, 0.2};
+    double r[N_WL];
+    int rc = 0;
+    for (int k = 0; k < n; k++) rc |= saber_ctx_compute_r_rs_b_lmm(ctx, classes, f, N_CLS, r);
+    return rc;
+}
+
+static uint64_t mixing_calls(const saber_ctx* ctx)
+{
+    saber_stats st;
+    return saber_ctx_get_stats(ctx, &st) ? 0 : st.stage_calls[SABER_STAGE_MIXING];
+}
+
+/* A worker thread: N_CALLS calls on `first`, a pause while the main
+ * thread destroys or creates contexts, then one call on `then` (if set)
+ * and exit, which publishes its block */
+typedef struct worker {
+    const saber_ctx*   first;
+    const saber_ctx*   then;
+    pthread_barrier_t* counted;     /* calls on `first` done, unpublished */
+    pthread_barrier_t* resume;
+    int rc;
+} worker;
+
+static void* worker_main(void* arg)
+{
+    worker* w = arg;
+    w->rc = mix_calls(w->first, N_CALLS);
+    pthread_barrier_wait(w->counted);
+    pthread_barrier_wait(w->resume);
+    if (w->then) w->rc |= mix_calls(w->then, 1);
+    return NULL;
+}
+
+/* Run a worker and call `pause` between its two phases */
+static int run_worker(worker* w, void (*pause)(worker* w, void* arg), void* arg)
+{
+    pthread_barrier_t counted, resume;
+    pthread_barrier_init(&counted, NULL, 2);
+    pthread_barrier_init(&resume, NULL, 2);
+    w->counted = &counted;
+    w->resume  = &resume;
+    pthread_t t;
+    int rc = pthread_create(&t, NULL, worker_main, w);
+    if (!rc) {
+        pthread_barrier_wait(&counted);
+        pause(w, arg);
+        pthread_barrier_wait(&resume);
+        pthread_join(t, NULL);
+    }
+    pthread_barrier_destroy(&counted);
+    pthread_barrier_destroy(&resume);
+    return rc;
+}
+
+static void destroy_other(worker* w, void* arg)
+{
+    (void)w;
+    saber_ctx_destroy(arg);
+}
+
+/* The worker counts on `a` while the main thread destroys `b` */
+static int test_unrelated_destroy(void)
+{
+    double wl[N_WL];
+    saber_ctx* a = fixture_ctx(wl, N_WL, 5, classes, N_CLS);
+    saber_ctx* b = fixture_ctx(wl, N_WL, 5, classes, N_CLS);
+    if (!a || !b) {
+        saber_ctx_destroy(a);
+        saber_ctx_destroy(b);
+        return check("context setup", 0);
+    }
+
+    worker w = {a, NULL, NULL, NULL, 0};
+    int rc = run_worker(&w, destroy_other, b);
+    if (rc) saber_ctx_destroy(b);
+    int fail = check("worker counts survive another context's destroy",
+                     !rc && !w.rc && mixing_calls(a) == N_CALLS);
+    saber_ctx_destroy(a);
+    return fail;
+}
+
+typedef struct replace {
+    saber_ctx*  ctx;
+    int         same_address;
+} replace;
+
+static void destroy_and_create(worker* w, void* arg)
+{
+    replace* r = arg;
+    double wl[N_WL];
+    const void* old_address = w->first;
+    saber_ctx_destroy((saber_ctx*)w->first);
+    r->ctx = fixture_ctx(wl, N_WL, 5, classes, N_CLS);
+    r->same_address = (const void*)r->ctx == old_address;
+    w->then = r->ctx;
+}
+
+/* The worker counts on a context the main thread then destroys and
+ * replaces, then makes one call on the new one: only that call may
+ * show, wherever the new context landed */
+static int test_reused_address(void)
+{
+    double wl[N_WL];
+    int fail = 0, same_address = 0;
+    for (int round = 0; round < 4 && !fail; round++) {
+        saber_ctx* old = fixture_ctx(wl, N_WL, 5, classes, N_CLS);
+        if (!old) return check("context setup", 0);
+
+        worker w = {old, NULL, NULL, NULL, 0};
+        replace r = {NULL, 0};
+        if (run_worker(&w, destroy_and_create, &r)) {
+            saber_ctx_destroy(old);
+            return check("thread start", 0);
+        }
+        same_address |= r.same_address;
+        fail |= !r.ctx || w.rc || mixing_calls(r.ctx) != 1;
+        saber_ctx_destroy(r.ctx);
+    }
+    printf("  (a new context reused the old address: %s)\n", same_address ? "yes" : "no");
+    return check("new context starts from zero", !fail);
+}
+
+int main(void)
+{
+    if (!saber_stats_enabled()) {
+        printf("stats compiled out\npassed\n");
+        return 0;
+    }
+
+    int fail = test_unrelated_destroy();
+    fail |= test_reused_address();
+
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}
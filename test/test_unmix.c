@@ -0,0 +1,168 @@
+/*
+ * Constrained unmixing against the KKT conditions of its least-squares
+ * problem, min 0.5 |R f - y|^2 subject to f >= 0 (and sum f = 1), with
+ * g = R^T (R f - y):
+ *   f >= 0, and sum f = 1 when asked for;
+ *   NNLS:        g_j = 0 on classes in use, g_j >= 0 on the others;
+ *   sum to one:  g_j = -mu on classes in use, g_j >= -mu on the others.
+ * The library holds a duplicated and a collinear column, the pixels
+ * include spectra outside the library's cone and masked (NaN) spectra,
+ * which must come back as zero fractions. Both layouts. Prints the worst
+ * violation per case and exits non-zero when one exceeds its bound.
+ */
+#include "saber.h"
+#include "fixture.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_WL    80
+#define N_CLS   6
+#define N_PIX   300
+#define BOUND   1e-9
+
+static const char* classes[N_CLS] = {"sand", "algae", "coral", "sand_copy", "mix", "seagrass"};
+
+/* The fixture's sand, algae, coral and seagrass, plus a copy of sand and
+ * an even mix of algae and coral */
+static saber_ctx* make_ctx(double* wl)
+{
+    static double rb[N_CLS * FIX_N_SRC];
+    for (size_t i = 0; i < FIX_N_SRC; i++) {
+        for (size_t j = 0; j < 3; j++) rb[j * FIX_N_SRC + i] = fixture_r_rs_b(j, i);
+        rb[3 * FIX_N_SRC + i] = rb[i];                                              /* duplicate */
+        rb[4 * FIX_N_SRC + i] = 0.5 * rb[FIX_N_SRC + i] + 0.5 * rb[2 * FIX_N_SRC + i]; /* collinear */
+        rb[5 * FIX_N_SRC + i] = fixture_r_rs_b(3, i);
+    }
+    return fixture_ctx_lib(wl, N_WL, 4, classes, rb, N_CLS);
+}
+
+/* Library columns on the grid: lib[j * N_WL + i] */
+static int grid_library(const saber_ctx* ctx, double* lib)
+{
+    for (size_t j = 0; j < N_CLS; j++) {
+        double f[N_CLS] = {0};
+        f[j] = 1.0;
+        if (saber_ctx_compute_r_rs_b_lmm(ctx, classes, f, N_CLS, lib + j * N_WL)) return 1;
+    }
+    return 0;
+}
+
+/* Spectrum of pixel p: mixtures with noise, some with a negative weight
+ * or scaled beyond the cone so constraints bind, every 17th masked */
+static void make_pixel(size_t p, const double* lib, double* y)
+{
+    double w[N_CLS] = {0};
+    w[p % 3]       = 0.2 + 0.6 * ((p * 7) % 11) / 10.0;
+    w[5]           = 0.3 * ((p * 5) % 7) / 6.0;
+    w[(p + 1) % 3] = p % 4 == 0 ? -0.2 : 0.1;
+    double scale   = p % 5 == 0 ? 1.6 : 1.0;
+    for (size_t i = 0; i < N_WL; i++) {
+        double v = 0.0;
+        for (size_t j = 0; j < N_CLS; j++) v += w[j] * lib[j * N_WL + i];
+        y[i] = scale * v + 1e-3 * sin(0.7 * i + p);
+    }
+    if (p % 17 == 3) y[p % N_WL] = NAN;
+}
+
+static int run(const saber_ctx* ctx, const double* lib, int sum_to_one, saber_layout layout)
+{
+    static double y[N_PIX * N_WL], f[N_PIX * N_CLS], yp[N_WL];
+    int band_major = layout == SABER_LAYOUT_BAND_MAJOR;
+
+    for (size_t p = 0; p < N_PIX; p++) {
+        make_pixel(p, lib, yp);
+        for (size_t i = 0; i < N_WL; i++)
+            y[band_major ? i * N_PIX + p : p * N_WL + i] = yp[i];
+    }
+
+    saber_unmixer* u = saber_unmixer_create(ctx, NULL, sum_to_one);
+    int rc = u ? saber_ctx_unmix_r_rs_b_batch(ctx, u, N_PIX, y, layout, f, NULL) : 3;
+    saber_unmixer_destroy(u);
+
+    size_t n_bound = 0;
+    double worst_neg = 0.0, worst_sum = 0.0, worst_stat = 0.0, worst_dual = 0.0, worst_mask = 0.0;
+    for (size_t p = 0; p < N_PIX && !rc; p++) {
+        double fp[N_CLS], g[N_CLS], r[N_WL];
+        for (size_t j = 0; j < N_CLS; j++)
+            fp[j] = f[band_major ? j * N_PIX + p : p * N_CLS + j];
+
+        make_pixel(p, lib, yp);
+        int masked = 0;
+        for (size_t i = 0; i < N_WL; i++) masked |= !isfinite(yp[i]);
+        if (masked) {
+            for (size_t j = 0; j < N_CLS; j++) worst_mask = fmax(worst_mask, fabs(fp[j]));
+            continue;
+        }
+
+        double sum = 0.0, gy = 0.0;
+        for (size_t j = 0; j < N_CLS; j++) {
+            if (-fp[j] > worst_neg) worst_neg = -fp[j];
+            sum += fp[j];
+        }
+        if (sum_to_one) worst_sum = fmax(worst_sum, fabs(sum - 1.0));
+
+        for (size_t i = 0; i < N_WL; i++) {
+            double v = -yp[i];
+            for (size_t j = 0; j < N_CLS; j++) v += lib[j * N_WL + i] * fp[j];
+            r[i] = v;
+        }
+        for (size_t j = 0; j < N_CLS; j++) {
+            double gj = 0.0, yj = 0.0;
+            for (size_t i = 0; i < N_WL; i++) {
+                gj += lib[j * N_WL + i] * r[i];
+                yj += lib[j * N_WL + i] * yp[i];
+            }
+            g[j] = gj;
+            gy = fmax(gy, fabs(yj));
+        }
+
+        /* multiplier of the sum constraint: mean -g over classes in use */
+        double mu = 0.0;
+        size_t n_used = 0;
+        if (sum_to_one) {
+            for (size_t j = 0; j < N_CLS; j++)
+                if (fp[j] > 0.0) { mu -= g[j]; n_used++; }
+            if (n_used) mu /= (double)n_used;
+        }
+
+        /* violations relative to the size of R^T y */
+        double scale = fmax(gy, 1e-300);
+        for (size_t j = 0; j < N_CLS; j++) {
+            double gj = (g[j] + mu) / scale;
+            if (fp[j] > 0.0) worst_stat = fmax(worst_stat, fabs(gj));
+            else             { worst_dual = fmax(worst_dual, -gj); n_bound++; }
+        }
+    }
+
+    int fail = rc != 0 || worst_neg > 0.0 || worst_sum > BOUND || worst_stat > BOUND ||
+               worst_dual > BOUND || worst_mask > 0.0;
+    printf("  %-10s %-5s rc %d  f<0 %.1e  |sum-1| %.1e  stationarity %.1e  dual %.1e "
+           "(%zu at bound)  masked %.1e  %s\n",
+           sum_to_one ? "sum-to-one" : "nnls", band_major ? "band" : "pixel", rc,
+           worst_neg, worst_sum, worst_stat, worst_dual, n_bound, worst_mask, fail ? "FAIL" : "ok");
+    return fail;
+}
+
+int main(void)
+{
+    double wl[N_WL], lib[N_CLS * N_WL];
+    saber_ctx* ctx = make_ctx(wl);
+    if (!ctx || grid_library(ctx, lib)) {
+        printf("context setup failed\n");
+        saber_ctx_destroy(ctx);
+        return 1;
+    }
+
+    int fail = 0;
+    for (int s = 0; s <= 1; s++) {
+        fail |= run(ctx, lib, s, SABER_LAYOUT_PIXEL_MAJOR);
+        fail |= run(ctx, lib, s, SABER_LAYOUT_BAND_MAJOR);
+    }
+
+    saber_ctx_destroy(ctx);
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}
@@ -0,0 +1,111 @@
+/*
+ * Fast-tier exp / log / pow against long-double references, on every
+ * table the running CPU supports: exp and log within 1 ulp, pow (and
+ * pow2) within 3 + 2 |p ln x| ulp, as documented in vec_math.h. Prints
+ * the worst error per function and table and exits non-zero when one
+ * exceeds its bound.
+ */
+#include "vec_math.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define N_X 4096
+
+/* |got - ref| in units of the double spacing at ref */
+static double ulp_err(double got, long double ref)
+{
+    double r = (double)ref;
+    double ulp = nextafter(fabs(r), INFINITY) - fabs(r);
+    return (double)(fabsl((long double)got - ref) / ulp);
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static double uniform(double lo, double hi)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return lo + (hi - lo) * (double)(rng_state >> 11) * 0x1p-53;
+}
+
+static int check(const char* isa, const char* what, double err, double bound)
+{
+    int ok = err <= bound;
+    printf("  %-7s %-5s %.3f ulp (bound %.0f) %s\n", isa, what, err, bound, ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
+
+static int run(const vm_impl* vm)
+{
+    static double x[N_X], y[N_X], y2[N_X];
+    int fail = 0;
+
+    /* exp over the unflushed range, denser near 0 where the kernels run */
+    double worst = 0.0;
+    for (size_t i = 0; i < N_X; i++)
+        x[i] = i % 2 ? uniform(-708.0, 709.0) : uniform(-10.0, 10.0);
+    vm->exp(x, y, N_X);
+    for (size_t i = 0; i < N_X; i++) {
+        double e = ulp_err(y[i], expl((long double)x[i]));
+        if (e > worst) worst = e;
+    }
+    fail |= check(vm->isa, "exp", worst, 1.0);
+
+    /* log over positive normals, plus a band around 1 */
+    worst = 0.0;
+    for (size_t i = 0; i < N_X; i++)
+        x[i] = i % 2 ? exp(uniform(-700.0, 700.0)) : uniform(0.5, 2.0);
+    vm->log(x, y, N_X);
+    for (size_t i = 0; i < N_X; i++) {
+        double e = ulp_err(y[i], logl((long double)x[i]));
+        if (e > worst) worst = e;
+    }
+    fail |= check(vm->isa, "log", worst, 1.0);
+
+    /* pow / pow2 at the exponents the kernels use and a few beyond;
+     * worst ratio to the documented bound */
+    static const double ps[] = {0.65, 0.46, -0.46, 1.5, -2.3, 3.7};
+    const size_t n_p = sizeof(ps) / sizeof(ps[0]);
+    double worst_pow = 0.0, worst_pow2 = 0.0;
+    for (size_t i = 0; i < N_X; i++) x[i] = exp(uniform(-7.0, 7.0));
+    for (size_t k = 0; k < n_p; k++) {
+        double p1 = ps[k], p2 = ps[(k + 1) % n_p];
+        vm->pow(x, p1, y, N_X);
+        for (size_t i = 0; i < N_X; i++) {
+            double bound = 3.0 + 2.0 * fabs(p1 * log(x[i]));
+            double e = ulp_err(y[i], powl((long double)x[i], (long double)p1)) / bound;
+            if (e > worst_pow) worst_pow = e;
+        }
+        vm->pow2(x, p1, p2, y, y2, N_X);
+        for (size_t i = 0; i < N_X; i++) {
+            double b1 = 3.0 + 2.0 * fabs(p1 * log(x[i]));
+            double b2 = 3.0 + 2.0 * fabs(p2 * log(x[i]));
+            double e1 = ulp_err(y[i],  powl((long double)x[i], (long double)p1)) / b1;
+            double e2 = ulp_err(y2[i], powl((long double)x[i], (long double)p2)) / b2;
+            if (e1 > worst_pow2) worst_pow2 = e1;
+            if (e2 > worst_pow2) worst_pow2 = e2;
+        }
+    }
+    /* reported as a fraction of 3 + 2 |p ln x| */
+    fail |= check(vm->isa, "pow",  worst_pow,  1.0);
+    fail |= check(vm->isa, "pow2", worst_pow2, 1.0);
+
+    return fail;
+}
+
+int main(void)
+{
+    const vm_impl* tabs[3];
+    const vmf_impl* tabs_f[3];
+    size_t n = vm_fast_tables(tabs, tabs_f);
+    int fail = 0;
+
+    printf("FAST (active: %s)\n", saber_simd_isa());
+    for (size_t t = 0; t < n; t++) fail |= run(tabs[t]);
+
+    printf(fail ? "FAILED\n" : "passed\n");
+    return fail;
+}